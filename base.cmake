@@ -16,7 +16,8 @@ macro(rg_setup_compile_options)
     endif()
 
     if(RG_ENABLE_PROFILING)
-        # Still debating whether -fno-inline is necessary or not...
-        component_compile_options(-DRG_ENABLE_PROFILING -finstrument-functions)
+        # Use RG_PROFILE_ZONE in the code of interest. -finstrument-functions also works but it should
+        # be limited to the few files being studied, instrumenting everything skews the results too much.
+        component_compile_options(-DRG_ENABLE_PROFILING)
     endif()
 endmacro()
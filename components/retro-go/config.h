@@ -153,6 +153,14 @@
 #define RG_ZIP_SUPPORT 0
 #endif
 
+// Deflate save state chunks, needs RG_ZIP_SUPPORT and a few hundred KB of RAM while saving
+#ifndef RG_STATE_COMPRESSION
+#define RG_STATE_COMPRESSION 0
+#endif
+#if RG_STATE_COMPRESSION && !RG_ZIP_SUPPORT
+#error "RG_STATE_COMPRESSION requires RG_ZIP_SUPPORT"
+#endif
+
 #ifndef RG_SCREEN_PARTIAL_UPDATES
 #define RG_SCREEN_PARTIAL_UPDATES 1
 #endif
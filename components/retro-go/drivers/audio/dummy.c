@@ -16,10 +16,12 @@ static bool driver_deinit(void)
 
 static bool driver_submit(const rg_audio_frame_t *frames, size_t count)
 {
+#ifndef RG_ENABLE_BENCHMARK // Benchmarks run unthrottled
     // Wait until the previous submission is done "playing"
     if (busyUntil > rg_system_timer())
         rg_usleep(busyUntil - rg_system_timer());
     busyUntil = rg_system_timer() + (count * (1000000.f / rg_audio_get_sample_rate()));
+#endif
     return true;
 }
 
@@ -1,20 +1,24 @@
 #include "rg_system.h"
 #include "rg_audio.h"
 
+#include <stdlib.h>
+
 #if RG_AUDIO_USE_SDL2
 #include <SDL2/SDL.h>
 
 static SDL_AudioDeviceID audioDevice;
 static int sampleRate;
+static bool vsync; // See RG_SDL_VSYNC in drivers/display/sdl2.h
 
 static bool driver_init(int device, int _sampleRate)
 {
+    sampleRate = _sampleRate;
+    vsync = atoi(getenv("RG_SDL_VSYNC") ?: "0") != 0;
     SDL_AudioSpec desired = {
         .freq = sampleRate,
         .format = AUDIO_S16,
         .channels = 2,
     };
-    sampleRate = _sampleRate;
     audioDevice = SDL_OpenAudioDevice(NULL, 0, &desired, NULL, 0);
     return audioDevice != 0;
 }
@@ -27,14 +31,17 @@ static bool driver_deinit(void)
 
 static bool driver_submit(const rg_audio_frame_t *frames, size_t count)
 {
+    // Block like the I2S DMA would, ie until the device has consumed enough of its queue.
+    // This runs on the audio task, the emulator itself is paced by rg_audio_submit() on the system timer.
+    const Uint32 max_queued = (sampleRate / 20) * 4;
+    // When the display paces emulation, we never block. If the emulated and host refresh rates differ
+    // too much the queue grows, and we drop the extra samples rather than drift further behind.
+    if (vsync && SDL_GetQueuedAudioSize(audioDevice) > max_queued * 2)
+        return true;
+    while (!vsync && SDL_GetQueuedAudioSize(audioDevice) > max_queued)
+        rg_usleep(1000);
     SDL_QueueAudio(audioDevice, (void *)frames, count * 4);
     SDL_PauseAudioDevice(audioDevice, 0);
-    // This is ugly, but we must emulate how it works on the ESP32, where the audio does the pacing!
-    static int64_t frame_start = 0;
-    int64_t frame_end = frame_start + (uint32_t)(count * (1000000.f / sampleRate)) - 500;
-    if (frame_end > rg_system_timer())
-        rg_usleep((frame_end - rg_system_timer()));
-    frame_start = rg_system_timer();
     return true;
 }
 
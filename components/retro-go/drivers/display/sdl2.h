@@ -1,19 +1,42 @@
 #include <SDL2/SDL.h>
 
+// Host side options, read from the environment at init:
+//   RG_SDL_SCALE=n          Initial window size, in multiples of the screen (default: 1). The window is resizable.
+//   RG_SDL_INTEGER_SCALE=1  Only scale by whole multiples, letterboxing the rest.
+//   RG_SDL_VSYNC=1          Present on the host's vsync and let it pace emulation, instead of the audio queue.
 static SDL_Window *window;
-static SDL_Surface *surface, *canvas;
-static int win_left, win_top, win_width, win_height, cursor;
+static SDL_Renderer *renderer;
+static SDL_Texture *texture;
+static SDL_mutex *render_lock; // Protects canvas and the dirty band, which any task may draw to
+static bool vsync, integer_scale;
+static int win_left, win_top, win_right, win_bottom, cursor_x, cursor_y;
+static int dirty_top = RG_SCREEN_HEIGHT, dirty_bottom = -1;
+static uint16_t canvas[RG_SCREEN_HEIGHT][RG_SCREEN_WIDTH]; // Native endian RGB565, like the texture
 static uint16_t lcd_buffer[LCD_BUFFER_LENGTH];
 
 static void lcd_init(void)
 {
-    window = SDL_CreateWindow("Retro-Go", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, RG_SCREEN_WIDTH, RG_SCREEN_HEIGHT, 0);
-    surface = SDL_GetWindowSurface(window);
-    canvas = SDL_CreateRGBSurfaceWithFormat(0, RG_SCREEN_WIDTH, RG_SCREEN_HEIGHT, 16, SDL_PIXELFORMAT_RGB565);
+    int scale = RG_MAX(atoi(getenv("RG_SDL_SCALE") ?: "1"), 1);
+    vsync = atoi(getenv("RG_SDL_VSYNC") ?: "0") != 0;
+    display.screen.vsync = vsync;
+    integer_scale = atoi(getenv("RG_SDL_INTEGER_SCALE") ?: "0") != 0;
+    window = SDL_CreateWindow("Retro-Go", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                              RG_SCREEN_WIDTH * scale, RG_SCREEN_HEIGHT * scale, SDL_WINDOW_RESIZABLE);
+    render_lock = SDL_CreateMutex();
+    // The renderer is created on first use by the display task, the only one allowed to render and present.
+    // Most backends are bound to the thread that created them.
 }
 
 static void lcd_deinit(void)
 {
+    SDL_LockMutex(render_lock);
+    if (texture)
+        SDL_DestroyTexture(texture);
+    if (renderer)
+        SDL_DestroyRenderer(renderer);
+    texture = NULL;
+    renderer = NULL;
+    SDL_UnlockMutex(render_lock);
 }
 
 static void lcd_set_window(int left, int top, int width, int height)
@@ -24,9 +47,10 @@ static void lcd_set_window(int left, int top, int width, int height)
         RG_LOGW("Bad lcd window (x0=%d, y0=%d, x1=%d, y1=%d)\n", left, top, right, bottom);
     win_left = left;
     win_top = top;
-    win_width = width;
-    win_height = height;
-    cursor = 0;
+    win_right = left + width;
+    win_bottom = top + height;
+    cursor_x = left;
+    cursor_y = top;
 }
 
 static void lcd_set_backlight(float percent)
@@ -40,25 +64,84 @@ static inline uint16_t *lcd_get_buffer(size_t length)
 
 static inline void lcd_send_buffer(uint16_t *buffer, size_t length)
 {
-    int bpp = canvas->format->BytesPerPixel;
-    int pitch = canvas->pitch;
-    void *pixels = canvas->pixels;
-    for (size_t i = 0; i < length; ++i) {
-        int real_top = win_top + (cursor / win_width);
-        int real_left = win_left + (cursor % win_width);
-        if (real_top >= RG_SCREEN_HEIGHT || real_left >= RG_SCREEN_WIDTH)
-            return;
-        uint16_t *dst = (void*)pixels + (real_top * pitch) + (real_left * bpp);
-        uint16_t pixel = buffer[i];
-        *dst = ((pixel & 0xFF) << 8) | ((pixel & 0xFF00) >> 8);;
-        cursor++;
+    // The window is filled left to right then top to bottom, like the real LCD. We go one row segment
+    // at a time so that the byteswap is a tight loop the compiler can vectorize.
+    SDL_LockMutex(render_lock);
+    while (length > 0 && cursor_y < win_bottom)
+    {
+        size_t count = RG_MIN(length, (size_t)(win_right - cursor_x));
+        int x0 = RG_MAX(cursor_x, 0), x1 = RG_MIN(cursor_x + (int)count, RG_SCREEN_WIDTH);
+
+        if (cursor_y >= 0 && cursor_y < RG_SCREEN_HEIGHT && x1 > x0)
+        {
+            const uint16_t *src = buffer + (x0 - cursor_x);
+            uint16_t *dst = &canvas[cursor_y][x0];
+            for (int i = 0; i < x1 - x0; ++i)
+                dst[i] = (src[i] << 8) | (src[i] >> 8);
+            dirty_top = RG_MIN(dirty_top, cursor_y);
+            dirty_bottom = RG_MAX(dirty_bottom, cursor_y);
+        }
+
+        buffer += count;
+        length -= count;
+        cursor_x += count;
+        if (cursor_x >= win_right)
+        {
+            cursor_x = win_left;
+            cursor_y++;
+        }
     }
+    SDL_UnlockMutex(render_lock);
 }
 
 static void lcd_sync(void)
 {
-    SDL_BlitSurface(canvas, NULL, surface, NULL);
-    SDL_UpdateWindowSurface(window);
+    // Other tasks (menus, overlays) only drew to the canvas, the display task will upload and present it.
+    // If a message is already waiting, the display task will sync after handling it anyway.
+    if (rg_task_current() != display_task_queue)
+    {
+        if (display_task_queue && rg_task_messages_waiting(display_task_queue) == 0)
+            rg_task_send(display_task_queue, &(rg_task_msg_t){.type = DISPLAY_MSG_SYNC});
+        return;
+    }
+
+    SDL_LockMutex(render_lock);
+
+    if (!renderer && window)
+    {
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+        if (!renderer) // No GPU (CI, remote sessions), still better than nothing
+            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+        if (renderer)
+        {
+            SDL_RenderSetLogicalSize(renderer, RG_SCREEN_WIDTH, RG_SCREEN_HEIGHT);
+            SDL_RenderSetIntegerScale(renderer, integer_scale);
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB565, SDL_TEXTUREACCESS_STREAMING,
+                                        RG_SCREEN_WIDTH, RG_SCREEN_HEIGHT);
+            dirty_top = 0, dirty_bottom = RG_SCREEN_HEIGHT - 1;
+        }
+        if (!texture)
+            RG_LOGE("SDL renderer init failed: %s\n", SDL_GetError());
+        else
+            RG_LOGI("SDL renderer ready, vsync=%d integer_scale=%d\n", vsync, integer_scale);
+    }
+
+    if (texture)
+    {
+        // Only the rows touched since the last sync are uploaded
+        if (dirty_bottom >= dirty_top)
+        {
+            SDL_Rect rect = {0, dirty_top, RG_SCREEN_WIDTH, dirty_bottom - dirty_top + 1};
+            SDL_UpdateTexture(texture, &rect, canvas[dirty_top], sizeof(canvas[0]));
+            dirty_top = RG_SCREEN_HEIGHT, dirty_bottom = -1;
+        }
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderPresent(renderer);
+    }
+
+    SDL_UnlockMutex(render_lock);
 }
 
 const rg_display_driver_t rg_display_driver_sdl2 = {
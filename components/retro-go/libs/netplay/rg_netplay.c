@@ -1,351 +1,539 @@
 #ifdef RG_ENABLE_NETPLAY
 
-#include <freertos/FreeRTOS.h>
-#include <lwip/ip_addr.h>
+#include "rg_system.h"
+#include "rg_netplay.h"
+
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <esp_system.h>
-#include <esp_event.h>
-#include <esp_wifi.h>
-#include <esp_log.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <assert.h>
-#include <netdb.h>
-
-#include "rg_system.h"
-#include "rg_netplay.h"
+#include <fcntl.h>
 
-#define NETPLAY_VERSION 0x01
-#define MAX_PLAYERS 8
+#define NETPLAY_VERSION 0x02
+#define NETPLAY_PORT 1234
 
-#define BROADCAST (inet_addr(WIFI_BROADCAST_ADDR))
-
-// The SSID should be randomized to avoid conflicts
+// On the device the host starts an access point and the guest joins it
 #define WIFI_SSID "RETRO-GO"
 #define WIFI_CHANNEL 12
-#define WIFI_BROADCAST_ADDR "192.168.4.255"
-#define WIFI_NETPLAY_PORT 1234
+#define WIFI_HOST_ADDR "192.168.4.1"
+
+#define HISTORY_FRAMES     64       // Must cover the rollback window plus the acknowledgement lag
+#define MAX_ROLLBACK       8        // How many frames we can run ahead of the last confirmed remote input
+#define CHECK_INTERVAL     60       // Frames between desync checks
+#define TIMESYNC_INTERVAL  30       // Frames between frame advantage corrections
+#define HANDSHAKE_INTERVAL 500000   // us
+#define RESEND_INTERVAL    20000    // us
+#define TIMEOUT            10000000 // us
+#define DELAY_QUEUE_SIZE   64
+
+static struct
+{
+    netplay_status_t status;
+    netplay_mode_t mode;
+    netplay_callback_t callback;
+    netplay_player_t players[NETPLAY_MAX_PLAYERS];
+    netplay_player_t *local_player;
+    netplay_player_t *remote_player;
+    struct sockaddr_in peer_addr;
+    bool peer_known;
+    int sock;
+    int64_t last_send;
+    // Simulated network conditions, to test on loopback (RG_NETPLAY_DELAY in ms, RG_NETPLAY_LOSS in %)
+    int delay, loss;
+    struct {
+        int64_t due;
+        size_t len;
+        netplay_packet_t packet;
+    } queue[DELAY_QUEUE_SIZE];
+    size_t queue_count;
+} netplay = {.sock = -1};
+
+static struct
+{
+    uint32_t frame;          // Frame about to be emulated
+    uint32_t remote_frames;  // Number of contiguous remote inputs received
+    uint32_t remote_ack;     // Number of our inputs the remote has received
+    uint32_t remote_frame;   // Last frame reported by the remote
+    int32_t remote_advantage;
+    uint32_t rollback_from;  // Earliest mispredicted frame, UINT32_MAX if none
+    uint32_t local_inputs[HISTORY_FRAMES];
+    uint32_t remote_inputs[HISTORY_FRAMES]; // Confirmed below remote_frames, predicted above
+    void *states[MAX_ROLLBACK + 1];         // Emulator state at the start of each frame in the window
+    size_t state_sizes[MAX_ROLLBACK + 1];
+    size_t state_capacity;
+    uint32_t check_frame, check_crc;
+    uint32_t remote_check_frame, remote_check_crc;
+    bool desynced;
+    // Statistics
+    uint32_t rollbacks, replayed, stalls;
+} session;
 
-// Test to skip the network task and semaphores
-#define NETPLAY_SYNCHRONOUS_TEST
 
-static netplay_status_t netplay_status = NETPLAY_STATUS_NOT_INIT;
-static netplay_mode_t netplay_mode = NETPLAY_MODE_NONE;
-static netplay_callback_t netplay_callback = NULL;
-static SemaphoreHandle_t netplay_sync;
-// static bool netplay_available = false;
+static void dummy_netplay_callback(netplay_event_t event, void *arg)
+{
+    RG_LOGI("...\n");
+}
 
-static netplay_player_t players[MAX_PLAYERS];
-static netplay_player_t *local_player;
-static netplay_player_t *remote_player; // This only works in 2 player mode
 
-static tcpip_adapter_ip_info_t local_if;
-static wifi_config_t wifi_config;
+static void set_status(netplay_status_t status)
+{
+    bool changed = status != netplay.status;
 
-static int rx_sock, tx_sock;
+    netplay.status = status;
 
+    if (changed)
+    {
+        (*netplay.callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay.status);
+    }
+}
 
-static void dummy_netplay_callback(netplay_event_t event, void *arg)
+
+static void network_cleanup(void)
 {
-    RG_LOGI("...\n");
+    if (netplay.sock >= 0)
+        close(netplay.sock);
+
+    netplay.sock = -1;
+    netplay.peer_known = false;
+    netplay.queue_count = 0;
 }
 
 
-static void network_cleanup()
+static bool network_setup(int port)
 {
-    if (rx_sock) close(rx_sock);
-    if (tx_sock) close(tx_sock);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(port),
+    };
+
+    network_cleanup();
+
+    netplay.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (netplay.sock < 0)
+    {
+        RG_LOGE("netplay: socket() failed\n");
+        return false;
+    }
+
+    if (bind(netplay.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        RG_LOGE("netplay: bind() on port %d failed\n", port);
+        network_cleanup();
+        return false;
+    }
+
+    // Everything is polled from the emulation loop, we never want to block on recv
+    fcntl(netplay.sock, F_SETFL, fcntl(netplay.sock, F_GETFL, 0) | O_NONBLOCK);
 
-    rx_sock = tx_sock = 0;
-    memset(&local_if, 0, sizeof(local_if));
+    RG_LOGI("netplay: Listening on port %d, local player ID: %d\n", port, netplay.local_player->id);
+    return true;
 }
 
 
-static void network_setup(tcpip_adapter_if_t tcpip_if)
+static void send_raw(const netplay_packet_t *packet, size_t len)
 {
-    tcpip_adapter_get_ip_info(tcpip_if, &local_if);
+    if (sendto(netplay.sock, packet, len, 0, (struct sockaddr *)&netplay.peer_addr, sizeof(netplay.peer_addr)) <= 0)
+    {
+        RG_LOGE("netplay: sendto() failed\n");
+    }
+}
 
-    int player_id = ((local_if.ip.addr >> 24) & 0xF) - 1;
-    struct sockaddr_in rx_addr;
-    int bc_val = 1;
 
-    local_player = &players[player_id];
-    local_player->id = player_id;
-    local_player->version = NETPLAY_VERSION;
-    local_player->game_id = rg_system_get_app()->romCRC32;
-    local_player->ip_addr = local_if.ip.addr;
+static void send_packet(uint8_t cmd, const void *data, uint8_t data_len)
+{
+    netplay_packet_t packet = {netplay.local_player->id, cmd, 0, data_len, {0}};
+    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
 
-    RG_LOGI("netplay: Local player ID: %d\n", local_player->id);
+    if (netplay.sock < 0 || !netplay.peer_known)
+        return;
 
-    rx_addr.sin_family = AF_INET;
-    rx_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    rx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
+    if (data_len > 0)
+    {
+        memcpy(&packet.data, data, data_len);
+    }
 
-    rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    assert(rx_sock > 0 && tx_sock > 0);
+    netplay.last_send = rg_system_timer();
 
-    setsockopt(rx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
-    setsockopt(tx_sock, SOL_SOCKET, SO_BROADCAST, &bc_val, sizeof bc_val);
+    if (netplay.loss > 0 && rand() % 100 < netplay.loss)
+        return;
 
-    if (bind(rx_sock, (struct sockaddr *)&rx_addr, sizeof rx_addr) < 0)
+    if (netplay.delay > 0 && netplay.queue_count < DELAY_QUEUE_SIZE)
     {
-        RG_PANIC("netplay: bind() failed");
+        netplay.queue[netplay.queue_count].due = netplay.last_send + netplay.delay * 1000;
+        netplay.queue[netplay.queue_count].len = len;
+        netplay.queue[netplay.queue_count].packet = packet;
+        netplay.queue_count++;
+        return;
     }
+
+    send_raw(&packet, len);
 }
 
 
-static void set_status(netplay_status_t status)
+static void flush_queue(void)
 {
-    bool changed = status != netplay_status;
+    int64_t now = rg_system_timer();
+    size_t sent = 0;
 
-    netplay_status = status;
+    // Packets are queued with a constant delay so they're already in order
+    while (sent < netplay.queue_count && netplay.queue[sent].due <= now)
+    {
+        send_raw(&netplay.queue[sent].packet, netplay.queue[sent].len);
+        sent++;
+    }
 
-    if (changed)
+    if (sent > 0)
     {
-        (*netplay_callback)(RG_EVENT_TYPE_NETPLAY|NETPLAY_EVENT_STATUS_CHANGED, &netplay_status);
+        netplay.queue_count -= sent;
+        memmove(&netplay.queue[0], &netplay.queue[sent], netplay.queue_count * sizeof(netplay.queue[0]));
     }
 }
 
 
-static inline bool receive_packet(netplay_packet_t *packet, int timeout)
+static bool receive_packet(netplay_packet_t *packet, struct sockaddr_in *from)
 {
-    fd_set read_fd_set;
+    socklen_t from_len = sizeof(*from);
+    int len = recvfrom(netplay.sock, packet, sizeof(*packet), 0, (struct sockaddr *)from, &from_len);
 
-    FD_ZERO(&read_fd_set);
-    FD_SET(rx_sock, &read_fd_set);
+    if (len <= 0)
+        return false;
 
-    int sel = select(FD_SETSIZE, &read_fd_set, NULL, NULL, NULL);
+    int expected_len = sizeof(*packet) - sizeof(packet->data) + packet->data_len;
 
-    if (sel > 0)
+    if (len < 4 || expected_len != len)
     {
-        return recv(rx_sock, &packet, sizeof packet, 0) >= 0;
+        RG_LOGE("netplay: Packet size mismatch. expected=%d received=%d\n", expected_len, len);
+        packet->player_id = 0xFF;
     }
-    else if (sel < 0)
+    else if (packet->player_id >= NETPLAY_MAX_PLAYERS || packet->player_id == netplay.local_player->id)
     {
-        RG_LOGE("netplay: select() failed\n");
+        RG_LOGE("netplay: Packet invalid player id: %d\n", packet->player_id);
+        packet->player_id = 0xFF;
     }
 
-    return false;
+    return true;
 }
 
 
-static inline void send_packet(uint32_t dest, uint8_t cmd, uint8_t arg, void *data, uint8_t data_len)
+static void session_reset(void)
 {
-    netplay_packet_t packet = {local_player->id, cmd, arg, data_len, {}};
-    size_t len = sizeof(packet) - sizeof(packet.data) + data_len;
-    struct sockaddr_in tx_addr;
+    void *states[MAX_ROLLBACK + 1];
+    size_t capacity = session.state_capacity;
+
+    memcpy(states, session.states, sizeof(states));
+    memset(&session, 0, sizeof(session));
+    memcpy(session.states, states, sizeof(states));
+    session.state_capacity = capacity;
+    session.rollback_from = UINT32_MAX;
+}
 
-    if (data_len > 0)
-    {
-        memcpy(&packet.data, data, data_len);
-    }
 
-    if (dest < MAX_PLAYERS)
+static bool session_alloc_states(void)
+{
+    rg_app_t *app = rg_system_get_app();
+
+    if (session.state_capacity)
+        return true;
+
+    if (!app->handlers.serialize || !app->handlers.unserialize)
+        return false;
+
+    // Measure the state once, it doesn't change much for a given game
+    for (size_t size = 0x10000; size <= 0x400000 && !session.state_capacity; size *= 2)
     {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = players[dest].ip_addr;
+        void *buffer = malloc(size);
+        if (!buffer)
+            break;
+        size_t used = app->handlers.serialize(buffer, size);
+        if (used > 0 && used < size)
+            session.state_capacity = used + used / 4;
+        free(buffer);
+        if (used == 0)
+            break;
     }
-    else
+
+    for (size_t i = 0; i < MAX_ROLLBACK + 1 && session.state_capacity; i++)
     {
-        tx_addr.sin_family = AF_INET;
-        tx_addr.sin_port = htons(WIFI_NETPLAY_PORT);
-        tx_addr.sin_addr.s_addr = dest;
+        if (!(session.states[i] = rg_alloc(session.state_capacity, MEM_SLOW)))
+        {
+            while (i > 0)
+                free(session.states[--i]);
+            session.state_capacity = 0;
+        }
     }
 
-    if (sendto(tx_sock, &packet, len, 0, (struct sockaddr*)&tx_addr, sizeof tx_addr) <= 0)
+    if (!session.state_capacity)
     {
-        RG_LOGE("netplay: sendto() failed\n");
-        // stop network
+        RG_LOGW("netplay: Unable to allocate save states, falling back to lockstep\n");
+        return false;
     }
+
+    RG_LOGI("netplay: Rollback enabled, %d states of %d bytes\n", MAX_ROLLBACK + 1, (int)session.state_capacity);
+    return true;
 }
 
-static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+
+static bool session_save_state(uint32_t frame)
 {
-    if (event_base == WIFI_EVENT)
+    size_t slot = frame % (MAX_ROLLBACK + 1);
+    size_t size = rg_system_get_app()->handlers.serialize(session.states[slot], session.state_capacity);
+
+    session.state_sizes[slot] = size;
+
+    if (size == 0 || size >= session.state_capacity)
     {
-        if (event_id == WIFI_EVENT_AP_START)
-        {
-            network_setup(TCPIP_ADAPTER_IF_AP);
-            set_status(NETPLAY_STATUS_LISTENING);
-        }
-        else if (event_id == WIFI_EVENT_AP_STOP || event_id == WIFI_EVENT_STA_STOP)
-        {
-            set_status(NETPLAY_STATUS_STOPPED);
-        }
-        else if (event_id == WIFI_EVENT_STA_CONNECTED || event_id == WIFI_EVENT_AP_STACONNECTED)
-        {
-            set_status(NETPLAY_STATUS_CONNECTING);
-        }
-        else if (event_id == WIFI_EVENT_AP_STADISCONNECTED || event_id == WIFI_EVENT_STA_DISCONNECTED)
-        {
-            set_status(NETPLAY_STATUS_DISCONNECTED);
-        }
+        RG_LOGE("netplay: Failed to save state of frame %u!\n", (unsigned)frame);
+        return false;
     }
-    else if (event_base == IP_EVENT)
-    {
-        if (event_id == IP_EVENT_STA_GOT_IP)
-        {
-            network_setup(TCPIP_ADAPTER_IF_STA);
-            set_status(NETPLAY_STATUS_HANDSHAKE);
-        }
-        else if (event_id == IP_EVENT_AP_STAIPASSIGNED)
-        {
-            ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
+    return true;
+}
 
-            send_packet(event->ip_info.ip.addr, NETPLAY_PACKET_INFO,
-                                       0, (void*)local_player, sizeof(netplay_player_t));
-            set_status(NETPLAY_STATUS_HANDSHAKE);
-        }
-    }
+
+static bool session_load_state(uint32_t frame)
+{
+    size_t slot = frame % (MAX_ROLLBACK + 1);
+    return rg_system_get_app()->handlers.unserialize(session.states[slot], session.state_sizes[slot]);
 }
 
 
-static void netplay_task()
+static uint32_t session_remote_input(uint32_t frame)
 {
-    int len, expected_len;
-    netplay_packet_t packet;
+    if (frame < session.remote_frames)
+        return session.remote_inputs[frame % HISTORY_FRAMES];
 
-    RG_LOGI("netplay: Task started!\n");
+    // Predict that the remote player is still holding the same buttons
+    uint32_t input = session.remote_frames ? session.remote_inputs[(session.remote_frames - 1) % HISTORY_FRAMES] : 0;
+    session.remote_inputs[frame % HISTORY_FRAMES] = input;
+    return input;
+}
 
-    while (1)
+
+static void session_get_inputs(uint32_t frame, uint32_t *inputs)
+{
+    inputs[netplay.local_player->id] = session.local_inputs[frame % HISTORY_FRAMES];
+    inputs[netplay.remote_player->id] = session_remote_input(frame);
+}
+
+
+static void session_send_inputs(void)
+{
+    netplay_input_t data = {
+        .frame = session.frame,
+        .ack = session.remote_frames,
+        .advantage = (int32_t)(session.frame - session.remote_frame),
+        .check_frame = session.check_frame,
+        .check_crc = session.check_crc,
+        .start = session.remote_ack,
+        .count = RG_MIN(session.frame + 1 - session.remote_ack, NETPLAY_MAX_PACKET_INPUTS),
+    };
+
+    // Everything the remote hasn't acknowledged yet is resent, so lost packets don't need special handling
+    for (size_t i = 0; i < data.count; i++)
+        data.inputs[i] = session.local_inputs[(data.start + i) % HISTORY_FRAMES];
+
+    send_packet(NETPLAY_PACKET_INPUT, &data, offsetof(netplay_input_t, inputs) + data.count * sizeof(uint32_t));
+}
+
+
+static void session_receive_inputs(const netplay_input_t *data)
+{
+    if (data->frame > session.remote_frame)
     {
-        memset(&packet, 0, sizeof(netplay_packet_t));
+        session.remote_frame = data->frame;
+        session.remote_advantage = data->advantage;
+    }
 
-    #ifdef NETPLAY_SYNCHRONOUS_TEST
-        if (!rx_sock || netplay_status != NETPLAY_STATUS_HANDSHAKE)
-    #else
-        if (!rx_sock || netplay_status < NETPLAY_STATUS_HANDSHAKE)
-    #endif
-        {
-            rg_task_delay(100);
-            continue;
-        }
+    if (data->ack > session.remote_ack && data->ack <= session.frame + 1)
+        session.remote_ack = data->ack;
 
-        // if ((len = recv(client_sock, &packet, sizeof packet, 0)) <= 0)
-        if ((len = recvfrom(rx_sock, &packet, sizeof packet, 0, NULL, 0)) <= 0)
-        {
-            RG_LOGE("netplay: Socket disconnected! (recv() failed)\n");
-            rg_task_delay(100);
-            continue;
-        }
+    if (data->check_frame > session.remote_check_frame)
+    {
+        session.remote_check_frame = data->check_frame;
+        session.remote_check_crc = data->check_crc;
+    }
 
-        expected_len = sizeof(packet) - sizeof(packet.data) + packet.data_len;
+    for (size_t i = 0; i < data->count && i < NETPLAY_MAX_PACKET_INPUTS; i++)
+    {
+        uint32_t frame = data->start + i;
+        uint32_t *slot = &session.remote_inputs[frame % HISTORY_FRAMES];
 
-        if (expected_len != len)
-        {
-            RG_LOGE("netplay: Packet size mismatch. expected=%d received=%d\n", expected_len, len);
-            continue;
-        }
-        else if (packet.player_id >= MAX_PLAYERS)
-        {
-            RG_LOGE("netplay: Packet invalid player id: %d\n", packet.player_id);
-            continue;
-        }
-        else if (packet.player_id == local_player->id)
-        {
-            RG_LOGE("netplay: Received echo!\n");
+        // Duplicates are expected, gaps are filled by the next packet
+        if (frame != session.remote_frames)
             continue;
-        }
 
-        netplay_player_t *packet_from = &players[packet.player_id];
-        packet_from->last_contact = rg_system_timer();
+        if (frame < session.frame && *slot != data->inputs[i] && frame < session.rollback_from)
+            session.rollback_from = frame;
 
-        switch (packet.cmd)
-        {
-            case NETPLAY_PACKET_INFO: // HOST <-> GUEST
-                if (packet.data_len != sizeof(netplay_player_t))
-                {
-                    RG_LOGE("netplay: Player struct size mismatch. expected=%d received=%d\n",
-                            sizeof(netplay_player_t), packet.data_len);
-                    break;
-                }
+        *slot = data->inputs[i];
+        session.remote_frames++;
+    }
+}
 
-                memcpy(packet_from, packet.data, packet.data_len);
-                remote_player = packet_from;
 
-                RG_LOGI("netplay: Remote client info player_id=%d game_id=%08X version=%02X\n",
-                        packet_from->id, packet_from->game_id, packet_from->version);
+static void session_check(uint32_t frame)
+{
+    // The state at the start of a frame is final once we have all the remote inputs before it
+    uint32_t check = RG_MIN(frame, session.remote_frames) / CHECK_INTERVAL * CHECK_INTERVAL;
 
-                if (packet_from->version != NETPLAY_VERSION)
-                {
-                    RG_LOGE("netplay: Remote client protocol version mismatch.\n");
-                    break;
-                }
+    if (check > session.check_frame && frame - check <= MAX_ROLLBACK)
+    {
+        size_t slot = check % (MAX_ROLLBACK + 1);
+        session.check_crc = rg_crc32(0, session.states[slot], session.state_sizes[slot]);
+        session.check_frame = check;
+    }
 
-                if (netplay_mode == NETPLAY_MODE_HOST)
-                {
-                    // Check if all players are ready (at the moment only 1, no need to check) then send NETPLAY_PACKET_READY
-                    send_packet(packet_from->id, NETPLAY_PACKET_READY, 0, 0, 0);
-                    set_status(NETPLAY_STATUS_CONNECTED);
-                }
-                else
-                {
-                    send_packet(packet_from->id, NETPLAY_PACKET_INFO, 1, (void*)local_player, sizeof(netplay_player_t));
-                }
-                break;
+    if (session.check_frame && session.check_frame == session.remote_check_frame && !session.desynced)
+    {
+        // There's no way to recover yet (see forced synchronization), the emulators would only drift
+        // further apart. Stopping notifies the app through NETPLAY_EVENT_STATUS_CHANGED.
+        if (session.check_crc != session.remote_check_crc)
+        {
+            RG_LOGE("netplay: Desync detected at frame %u, stopping!\n", (unsigned)session.check_frame);
+            session.desynced = true;
+            rg_netplay_stop();
+        }
+    }
+}
 
-            case NETPLAY_PACKET_READY: // HOST -> GUEST
-                // if (packet.data_len != sizeof(players))
-                // {
-                //     RG_LOGE("netplay: Players array size mismatch. expected=%d received=%d\n",
-                //             sizeof(players), packet.data_len);
-                //     break;
-                // }
 
-                // memcpy(&players, packet.data, packet.data_len);
-                set_status(NETPLAY_STATUS_CONNECTED);
+static void handle_packet(const netplay_packet_t *packet, const struct sockaddr_in *from)
+{
+    if (packet->player_id >= NETPLAY_MAX_PLAYERS) // Already reported by receive_packet
+        return;
+
+    netplay_player_t *packet_from = &netplay.players[packet->player_id];
+
+    switch (packet->cmd)
+    {
+        case NETPLAY_PACKET_INFO: // GUEST -> HOST
+        case NETPLAY_PACKET_READY: // HOST -> GUEST
+            if (packet->data_len != sizeof(netplay_player_t))
+            {
+                RG_LOGE("netplay: Player struct size mismatch. expected=%d received=%d\n",
+                        (int)sizeof(netplay_player_t), packet->data_len);
                 break;
+            }
 
-            case NETPLAY_PACKET_SYNC_REQ: // HOST -> GUEST
-                memcpy(&packet_from->sync_data, packet.data, packet.data_len);
-                xSemaphoreGive(netplay_sync);
+            if (packet->cmd == NETPLAY_PACKET_INFO && netplay.mode != NETPLAY_MODE_HOST)
+                break;
+            if (packet->cmd == NETPLAY_PACKET_READY && netplay.mode != NETPLAY_MODE_GUEST)
                 break;
 
-            case NETPLAY_PACKET_SYNC_ACK: // GUEST -> HOST
-                memcpy(&packet_from->sync_data, packet.data, packet.data_len);
+            memcpy(packet_from, packet->data, packet->data_len);
 
-                // if received all players ACK then:
-                send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
-                xSemaphoreGive(netplay_sync);
+            if (packet_from->version != NETPLAY_VERSION || packet_from->id != packet->player_id)
+            {
+                RG_LOGE("netplay: Remote client protocol version mismatch.\n");
                 break;
+            }
 
-            case NETPLAY_PACKET_SYNC_DONE: // HOST -> GUEST
-                xSemaphoreGive(netplay_sync);
-                break;
+            if (netplay.status != NETPLAY_STATUS_CONNECTED)
+            {
+                RG_LOGI("netplay: Remote client info player_id=%d game_id=%08X version=%02X\n",
+                        packet_from->id, (unsigned)packet_from->game_id, packet_from->version);
+                netplay.remote_player = packet_from;
+                netplay.peer_addr = *from;
+                netplay.peer_known = true;
+                session_reset();
+                set_status(NETPLAY_STATUS_CONNECTED);
+            }
 
-            default:
-                RG_LOGE("netplay: Received unknown packet type 0x%02x\n", packet.cmd);
-        }
+            // The guest keeps sending INFO until one of our READY gets through
+            if (packet->cmd == NETPLAY_PACKET_INFO)
+                send_packet(NETPLAY_PACKET_READY, netplay.local_player, sizeof(netplay_player_t));
+            break;
+
+        case NETPLAY_PACKET_INPUT:
+            if (netplay.status == NETPLAY_STATUS_CONNECTED && packet->data_len >= offsetof(netplay_input_t, inputs))
+            {
+                netplay_input_t data = {0};
+                memcpy(&data, packet->data, RG_MIN(packet->data_len, sizeof(data)));
+                session_receive_inputs(&data);
+            }
+            break;
+
+        case NETPLAY_PACKET_QUIT:
+            if (netplay.status == NETPLAY_STATUS_CONNECTED)
+            {
+                RG_LOGI("netplay: Remote player left.\n");
+                set_status(NETPLAY_STATUS_DISCONNECTED);
+            }
+            break;
+
+        default:
+            RG_LOGE("netplay: Received unknown packet type 0x%02x\n", packet->cmd);
     }
+
+    packet_from->last_contact = rg_system_timer();
 }
 
 
-static void netplay_init()
+static void netplay_poll(int timeout_ms)
 {
-    RG_LOGI("%s called.\n", __func__);
+    netplay_packet_t packet;
+    struct sockaddr_in from;
+
+#ifndef RG_TARGET_SDL2
+    // Wait for the access point to be up (host) or joined (guest)
+    if (netplay.status == NETPLAY_STATUS_CONNECTING && rg_network_get_info().state == RG_NETWORK_CONNECTED)
+    {
+        if (!network_setup(netplay.mode == NETPLAY_MODE_HOST ? NETPLAY_PORT : 0))
+            set_status(NETPLAY_STATUS_STOPPED);
+        else if (netplay.mode == NETPLAY_MODE_HOST)
+            set_status(NETPLAY_STATUS_LISTENING);
+        else
+            set_status(NETPLAY_STATUS_HANDSHAKE);
+    }
+#endif
+
+    if (netplay.sock < 0)
+    {
+        if (timeout_ms > 0)
+            rg_task_delay(timeout_ms);
+        return;
+    }
+
+    if (timeout_ms > 0)
+    {
+        struct timeval timeout = {0, timeout_ms * 1000};
+        fd_set read_fd_set;
+        FD_ZERO(&read_fd_set);
+        FD_SET(netplay.sock, &read_fd_set);
+        select(netplay.sock + 1, &read_fd_set, NULL, NULL, &timeout);
+    }
+
+    while (receive_packet(&packet, &from))
+    {
+        handle_packet(&packet, &from);
+    }
 
-    if (netplay_status == NETPLAY_STATUS_NOT_INIT)
+    if (netplay.status == NETPLAY_STATUS_HANDSHAKE && rg_system_timer() - netplay.last_send > HANDSHAKE_INTERVAL)
     {
-        netplay_status = NETPLAY_STATUS_STOPPED;
-        netplay_callback = netplay_callback ?: dummy_netplay_callback;
-        netplay_mode = NETPLAY_MODE_NONE;
-        netplay_sync = xSemaphoreCreateMutex();
+        send_packet(NETPLAY_PACKET_INFO, netplay.local_player, sizeof(netplay_player_t));
+    }
 
-        tcpip_adapter_init();
+    flush_queue();
+}
 
-        esp_event_loop_create_default();
 
-        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-        ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-        ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL));
-        ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE)); // Improves latency a lot
-        ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+static void netplay_init()
+{
+    RG_LOGI("%s called.\n", __func__);
 
-        rg_task_create("rg_netplay", &netplay_task, NULL, 4096, RG_TASK_PRIORITY - 2, 1);
+    if (netplay.status == NETPLAY_STATUS_NOT_INIT)
+    {
+        netplay.status = NETPLAY_STATUS_STOPPED;
+        netplay.callback = netplay.callback ?: dummy_netplay_callback;
+        netplay.mode = NETPLAY_MODE_NONE;
+        netplay.sock = -1;
+        netplay.delay = atoi(getenv("RG_NETPLAY_DELAY") ?: "0");
+        netplay.loss = atoi(getenv("RG_NETPLAY_LOSS") ?: "0");
+        if (netplay.delay || netplay.loss)
+            RG_LOGW("netplay: Simulating %dms latency and %d%% packet loss\n", netplay.delay, netplay.loss);
     }
 }
 
@@ -354,7 +542,19 @@ void rg_netplay_init(netplay_callback_t callback)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    netplay_callback = callback;
+    netplay.callback = callback;
+}
+
+
+void rg_netplay_deinit(void)
+{
+    rg_netplay_stop();
+
+    for (size_t i = 0; i < MAX_ROLLBACK + 1; i++)
+        free(session.states[i]);
+    memset(&session, 0, sizeof(session));
+
+    netplay.status = NETPLAY_STATUS_NOT_INIT;
 }
 
 
@@ -362,7 +562,6 @@ bool rg_netplay_quick_start(void)
 {
     const char *status_msg = _("Initializing...");
     const char *screen_msg = NULL;
-    // int timeout = 100;
 
     rg_display_clear(0);
 
@@ -383,12 +582,18 @@ bool rg_netplay_quick_start(void)
 
     while (1)
     {
-        switch (netplay_status)
+        switch (netplay.status)
         {
             case NETPLAY_STATUS_CONNECTED:
-                return remote_player->game_id == local_player->game_id
-                    || rg_gui_confirm(_("Netplay"), _("ROMs not identical. Continue?"), 1);
-                break;
+                if (netplay.remote_player->game_id == netplay.local_player->game_id
+                    || rg_gui_confirm(_("Netplay"), _("ROMs not identical. Continue?"), 1))
+                {
+                    // Both players must start from the exact same state
+                    rg_emu_reset(true);
+                    return true;
+                }
+                rg_netplay_stop();
+                return false;
 
             case NETPLAY_STATUS_HANDSHAKE:
                 status_msg = _("Exchanging info...");
@@ -424,7 +629,7 @@ bool rg_netplay_quick_start(void)
         if (rg_input_key_is_pressed(RG_KEY_B))
             break;
 
-        rg_task_delay(10);
+        netplay_poll(10);
     }
 
     rg_netplay_stop();
@@ -437,52 +642,63 @@ bool rg_netplay_start(netplay_mode_t mode)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    esp_err_t ret = ESP_FAIL;
-
-    if (netplay_status == NETPLAY_STATUS_NOT_INIT)
+    if (netplay.status == NETPLAY_STATUS_NOT_INIT)
     {
         netplay_init();
     }
-    else if (netplay_mode != NETPLAY_MODE_NONE)
+    else if (netplay.mode != NETPLAY_MODE_NONE)
     {
         rg_netplay_stop();
     }
 
-    memset(&players, 0xFF, sizeof(players));
-    local_player = NULL;
-    remote_player = NULL;
-
-    if (mode == NETPLAY_MODE_GUEST)
+    if (mode != NETPLAY_MODE_HOST && mode != NETPLAY_MODE_GUEST)
     {
-        RG_LOGI("netplay: Starting in guest mode.\n");
-
-        strncpy((char*)wifi_config.sta.ssid, WIFI_SSID, 32);
-        wifi_config.sta.channel = WIFI_CHANNEL;
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
-        ESP_ERROR_CHECK(esp_wifi_start());
-        ret = esp_wifi_connect();
-        netplay_mode = NETPLAY_MODE_GUEST;
+        RG_PANIC("netplay: Error: Unknown mode!");
     }
-    else if (mode == NETPLAY_MODE_HOST)
-    {
-        RG_LOGI("netplay: Starting in host mode.\n");
 
-        strncpy((char*)wifi_config.ap.ssid, WIFI_SSID, 32);
-        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-        wifi_config.ap.channel = WIFI_CHANNEL;
-        wifi_config.ap.max_connection = MAX_PLAYERS - 1;
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-        ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
-        ret = esp_wifi_start();
-        netplay_mode = NETPLAY_MODE_HOST;
-    }
-    else
+    RG_LOGI("netplay: Starting in %s mode.\n", mode == NETPLAY_MODE_HOST ? "host" : "guest");
+
+    // The host is always player 1, there can only be one guest for now
+    memset(&netplay.players, 0xFF, sizeof(netplay.players));
+    netplay.local_player = &netplay.players[mode == NETPLAY_MODE_HOST ? 0 : 1];
+    netplay.local_player->id = mode == NETPLAY_MODE_HOST ? 0 : 1;
+    netplay.local_player->version = NETPLAY_VERSION;
+    // A proper ROM checksum would be nicer but the file name is good enough to catch mistakes
+    const char *rom_name = rg_basename(rg_system_get_app()->romPath ?: "");
+    netplay.local_player->game_id = rg_crc32(0, (const uint8_t *)rom_name, strlen(rom_name));
+    netplay.remote_player = &netplay.players[mode == NETPLAY_MODE_HOST ? 1 : 0];
+    netplay.mode = mode;
+
+    // The guest knows where to find the host, the host learns the guest's address from its INFO packet
+    const char *host = getenv("RG_NETPLAY_HOST");
+    int port = atoi(getenv("RG_NETPLAY_PORT") ?: "0") ?: NETPLAY_PORT;
+    memset(&netplay.peer_addr, 0, sizeof(netplay.peer_addr));
+    netplay.peer_addr.sin_family = AF_INET;
+    netplay.peer_addr.sin_port = htons(port);
+
+#ifdef RG_TARGET_SDL2
+    netplay.peer_addr.sin_addr.s_addr = inet_addr(host ?: "127.0.0.1");
+    if (!network_setup(mode == NETPLAY_MODE_HOST ? port : 0))
     {
-        RG_PANIC("netplay: Error: Unknown mode!");
+        set_status(NETPLAY_STATUS_STOPPED);
+        return false;
     }
+    netplay.peer_known = mode == NETPLAY_MODE_GUEST;
+    set_status(mode == NETPLAY_MODE_HOST ? NETPLAY_STATUS_LISTENING : NETPLAY_STATUS_HANDSHAKE);
+    return true;
+#else
+    netplay.peer_addr.sin_addr.s_addr = inet_addr(host ?: WIFI_HOST_ADDR);
+    netplay.peer_known = mode == NETPLAY_MODE_GUEST;
 
-    return ret == ESP_OK;
+    rg_wifi_config_t config = {.ssid = WIFI_SSID, .channel = WIFI_CHANNEL, .ap_mode = mode == NETPLAY_MODE_HOST};
+    if (!rg_network_init() || !rg_network_wifi_set_config(&config) || !rg_network_wifi_start())
+    {
+        set_status(NETPLAY_STATUS_STOPPED);
+        return false;
+    }
+    set_status(NETPLAY_STATUS_CONNECTING);
+    return true;
+#endif
 }
 
 
@@ -490,97 +706,128 @@ bool rg_netplay_stop(void)
 {
     RG_LOGI("%s called.\n", __func__);
 
-    esp_err_t ret = ESP_FAIL;
+    if (netplay.mode == NETPLAY_MODE_NONE)
+    {
+        return false;
+    }
 
-    if (netplay_mode != NETPLAY_MODE_NONE)
+    if (netplay.status == NETPLAY_STATUS_CONNECTED)
     {
-        network_cleanup();
-        ret = esp_wifi_stop();
-        netplay_status = NETPLAY_STATUS_STOPPED;
-        netplay_mode = NETPLAY_MODE_NONE;
-        xSemaphoreGive(netplay_sync);
+        // Bypass the simulated network, the socket is going away
+        netplay_packet_t packet = {netplay.local_player->id, NETPLAY_PACKET_QUIT, 0, 0, {0}};
+        send_raw(&packet, sizeof(packet) - sizeof(packet.data));
     }
 
-    return ret == ESP_OK;
+    network_cleanup();
+#ifndef RG_TARGET_SDL2
+    rg_network_wifi_stop();
+#endif
+    netplay.mode = NETPLAY_MODE_NONE;
+    set_status(NETPLAY_STATUS_STOPPED);
+
+    return true;
 }
 
 
-void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len)
+void rg_netplay_sync(uint32_t local_input, uint32_t *inputs, netplay_replay_t replay)
 {
-    static uint32_t sync_count = 0, sync_time = 0, start_time = 0;
-    static netplay_packet_t packet;
-
-    if (netplay_status != NETPLAY_STATUS_CONNECTED)
+    if (netplay.status != NETPLAY_STATUS_CONNECTED)
     {
+        inputs[0] = local_input;
+        inputs[1] = 0;
         return;
     }
 
-    start_time = rg_system_timer();
+    // Without rollback we must wait for the remote input of every frame (lockstep)
+    bool rollback = replay && session_alloc_states();
+    uint32_t window = rollback ? MAX_ROLLBACK : 0;
+    uint32_t frame = session.frame;
 
-    memcpy(&local_player->sync_data, data_in, data_len);
+    session.local_inputs[frame % HISTORY_FRAMES] = local_input;
+    session_send_inputs();
+    netplay_poll(0);
 
-    if (netplay_mode == NETPLAY_MODE_HOST)
+    if (frame >= session.remote_frames + window)
     {
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_REQ, 0, (void*)data_in, data_len);
-    }
+        int64_t start_time = rg_system_timer();
 
-#ifdef NETPLAY_SYNCHRONOUS_TEST
-    if (netplay_mode == NETPLAY_MODE_HOST)
-    {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // ACK
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_ACK);
-        // send_packet(remote_player->id, NETPLAY_PACKET_SYNC_DONE, packet.arg, 0, 0);
+        session.stalls++;
+
+        while (frame >= session.remote_frames + window)
+        {
+            if (netplay.status != NETPLAY_STATUS_CONNECTED || rg_system_timer() - start_time > TIMEOUT)
+            {
+                RG_LOGE("netplay: Lost sync...\n");
+                rg_netplay_stop();
+                inputs[0] = local_input;
+                inputs[1] = 0;
+                return;
+            }
+
+            if (rg_system_timer() - netplay.last_send > RESEND_INTERVAL)
+                session_send_inputs();
+
+            netplay_poll(2);
+        }
     }
-    else
+
+    // A prediction turned out wrong: go back to the last correct state and emulate up to now again
+    if (rollback && session.rollback_from < frame)
     {
-        do {
-            recv(rx_sock, &packet, sizeof packet, 0); // REQ
-        } while (packet.cmd != NETPLAY_PACKET_SYNC_REQ);
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0, (void*)data_in, data_len);
-        // recv(rx_sock, &packet, sizeof packet, 0); // DONE
+        uint32_t from = session.rollback_from;
+
+        session.rollbacks++;
+        session.replayed += frame - from;
+
+        if (!session_load_state(from))
+            RG_LOGE("netplay: Failed to load state of frame %u!\n", (unsigned)from);
+
+        for (uint32_t f = from; f < frame; f++)
+        {
+            if (f > from)
+                session_save_state(f);
+            session_get_inputs(f, inputs);
+            (*replay)(inputs);
+        }
     }
+    session.rollback_from = UINT32_MAX;
 
-    memcpy(&remote_player->sync_data, packet.data, packet.data_len);
-    memcpy(data_out, remote_player->sync_data, data_len);
-#else
-    // wait to receive/send NETPLAY_PACKET_SYNC_DONE
-    if (xSemaphoreTake(netplay_sync, 10000 / portTICK_PERIOD_MS) != pdPASS)
+    if (rollback)
     {
-        RG_LOGE("netplay: Lost sync...\n");
-        rg_netplay_stop();
-        return;
+        session_save_state(frame);
+        session_check(frame);
     }
 
-    memcpy(data_out, remote_player->sync_data, data_len);
+    session_get_inputs(frame, inputs);
+    session.frame++;
 
-    if (netplay_mode == NETPLAY_MODE_GUEST)
+    // Whoever runs ahead causes the other to roll back more, slow down a bit to even it out
+    if (frame % TIMESYNC_INTERVAL == 0)
     {
-        send_packet(remote_player->id, NETPLAY_PACKET_SYNC_ACK, 0,
-                    local_player->sync_data, sizeof(local_player->sync_data));
-        xSemaphoreTake(netplay_sync, 1000 / portTICK_PERIOD_MS);
+        int advantage = (int32_t)(frame - session.remote_frame) - session.remote_advantage;
+        int wait_frames = RG_MIN(advantage / 2, 3);
+        if (wait_frames > 0)
+            rg_task_delay(wait_frames * rg_system_get_app()->frameTime / 1000);
     }
-#endif
-
-    sync_time += rg_system_timer() - start_time;
 
-    if (++sync_count == 60)
+    if (frame % 600 == 0)
     {
-        RG_LOGI("netplay: Sync delay=%.4fms\n", (float)sync_time / sync_count / 1000);
-        sync_count = sync_time = 0;
+        RG_LOGI("netplay: frame=%u remote=%u rollbacks=%u replayed=%u stalls=%u\n", (unsigned)frame,
+                (unsigned)session.remote_frames, (unsigned)session.rollbacks, (unsigned)session.replayed,
+                (unsigned)session.stalls);
     }
 }
 
 
 netplay_mode_t rg_netplay_mode()
 {
-    return netplay_mode;
+    return netplay.mode;
 }
 
 
 netplay_status_t rg_netplay_status()
 {
-    return netplay_status;
+    return netplay.status;
 }
 
 #endif
@@ -3,6 +3,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define NETPLAY_MAX_PLAYERS 2
+#define NETPLAY_MAX_PACKET_INPUTS 24
+
 typedef enum {
     NETPLAY_MODE_NONE,
     NETPLAY_MODE_HOST,
@@ -26,22 +29,10 @@ typedef enum {
 } netplay_status_t;
 
 typedef enum {
-    NETPLAY_PACKET_INFO,       // Send protocol version and player struct
-    NETPLAY_PACKET_PING,       //
-    NETPLAY_PACKET_PONG,       //
-    NETPLAY_PACKET_READY,      // Sent by the host once all players are ready
-    // Synchronization packets
-    NETPLAY_PACKET_SYNC_REQ,   // Sent by the host to all players after reading input
-    NETPLAY_PACKET_SYNC_ACK,   // Sent by the guests after reading input and receiving SYNC_REQ
-    NETPLAY_PACKET_SYNC_DONE,  // Sent by the host when all guests have ACK, starts frame emulation
-    NETPLAY_PACKET_RESYNC,     // Sent when sync is lost, expects an exact frame number to resume at
-    // User interaction packets
-    NETPLAY_PACKET_GAME_START,  //
-    NETPLAY_PACKET_GAME_PAUSE,  //
-    NETPLAY_PACKET_GAME_RESET,  //
-    NETPLAY_PACKET_INPUT,       // Send gamepad data
-    NETPLAY_PACKET_SERIAL,      // Send serial data
-    NETPLAY_PACKET_RAW_DATA,    // Send raw data for the emulator to handle (serial, memory copy, etc)
+    NETPLAY_PACKET_INFO,       // Sent by the guest until the host answers, contains its player struct
+    NETPLAY_PACKET_READY,      // Sent by the host in reply to INFO, contains its player struct. Session starts at frame 0
+    NETPLAY_PACKET_INPUT,      // Sent by everyone every frame, contains a netplay_input_t
+    NETPLAY_PACKET_QUIT,       // Sent when a player leaves the session
 } netplay_packet_type_t;
 
 typedef struct __attribute__ ((packed)) {
@@ -56,21 +47,32 @@ typedef struct __attribute__ ((packed)) {
     uint8_t  version;
     uint8_t  id;
     uint32_t game_id;
-    uint16_t status;
-    uint32_t ip_addr;
     uint32_t last_contact;
-    uint8_t  sync_data[16];
 } netplay_player_t;
 
+typedef struct __attribute__ ((packed)) {
+    uint32_t frame;         // Frame the sender is about to emulate
+    uint32_t ack;           // Number of contiguous inputs the sender has received from us
+    int32_t  advantage;     // How many frames the sender thinks it is ahead of us
+    uint32_t check_frame;   // Frame of the last desync check, 0 if none yet
+    uint32_t check_crc;     // CRC32 of the emulator state at the start of check_frame
+    uint32_t start;         // Frame of inputs[0]
+    uint8_t  count;
+    uint32_t inputs[NETPLAY_MAX_PACKET_INPUTS];
+} netplay_input_t;
+
 typedef void (*netplay_callback_t)(netplay_event_t event, void *arg);
 typedef netplay_callback_t rg_netplay_handler_t;
 
+// Emulates one frame with the given inputs (indexed by player id) without any video or audio output
+typedef void (*netplay_replay_t)(const uint32_t *inputs);
+
 void rg_netplay_init(netplay_callback_t callback);
 void rg_netplay_deinit(void);
 bool rg_netplay_quick_start(void);
 bool rg_netplay_start(netplay_mode_t mode);
 bool rg_netplay_stop(void);
-void rg_netplay_sync(void *data_in, void *data_out, uint8_t data_len);
+void rg_netplay_sync(uint32_t local_input, uint32_t *inputs, netplay_replay_t replay);
 
 netplay_mode_t rg_netplay_mode();
 netplay_status_t rg_netplay_status();
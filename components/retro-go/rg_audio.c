@@ -39,15 +39,43 @@ static const rg_audio_sink_t sinks[] = {
     })
 #define RELEASE_DEVICE() rg_mutex_give(audio.lock)
 
+// Must be a power of two. ~32ms at 32KHz, the sink's own buffers come on top of that.
+#define RING_LENGTH 1024
+// Largest chunk handed to the driver at once, smaller chunks keep the ring draining smoothly
+#define RING_CHUNK_LENGTH 256
+// Dynamic rate control: the sample rate is nudged by up to DRC_MAX_PPM to keep the ring around DRC_TARGET_FILL
+#define DRC_MAX_PPM 5000
+#define DRC_TARGET_FILL (RING_LENGTH * 3 / 4)
+// The producer is paced by the system timer, if it falls further behind than this it doesn't try to catch up
+#define PACING_MAX_LAG_US 50000
+
+// Single producer (rg_audio_submit) and single consumer (audio_task), no lock needed.
+// The indices are free running, only the owner of each writes it.
+static struct
+{
+    rg_audio_frame_t buffer[RING_LENGTH];
+    uint32_t head; // Written by the consumer
+    uint32_t tail; // Written by the producer
+} ring;
+
+static struct
+{
+    rg_audio_frame_t last;
+    uint32_t pos;
+    int64_t clock; // When the last submitted frame is due, in rg_system_timer() time
+} resampler;
+
 static struct
 {
     const rg_audio_sink_t *sink;
     const rg_audio_driver_t *driver;
     rg_mutex_t *lock;
+    rg_task_t *task;
     int sampleRate;
     int filter;
     int volume;
     bool muted;
+    bool vsync; // The display paces emulation, see rg_audio_submit
 } audio;
 static rg_audio_counters_t counters;
 
@@ -63,6 +91,49 @@ static const char *get_last_driver_error(void)
     return "Unspecified Error";
 }
 
+static size_t ring_fill(void)
+{
+    return __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+}
+
+static void audio_task(void *arg)
+{
+    bool playing = false;
+
+    while (true)
+    {
+        uint32_t head = ring.head;
+        uint32_t tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail)
+        {
+            if (playing)
+                counters.underruns++;
+            playing = false;
+            // The producer sends a message whenever it adds samples and our slot is empty
+            rg_task_msg_t msg;
+            rg_task_receive(&msg);
+            if (msg.type == RG_TASK_MSG_STOP)
+                break;
+            continue;
+        }
+
+        size_t offset = head & (RING_LENGTH - 1);
+        size_t count = RG_MIN(RG_MIN(tail - head, RING_LENGTH - offset), RING_CHUNK_LENGTH);
+
+        // The driver can still be swapped by rg_audio_set_sink() and friends
+        if (ACQUIRE_DEVICE(1000))
+        {
+            if (audio.driver)
+                audio.driver->submit(&ring.buffer[offset], count);
+            RELEASE_DEVICE();
+        }
+
+        __atomic_store_n(&ring.head, head + count, __ATOMIC_RELEASE);
+        playing = true;
+    }
+}
+
 void rg_audio_init(int sampleRate)
 {
     RG_ASSERT(audio.sink == NULL, "Audio sink already initialized!");
@@ -74,6 +145,13 @@ void rg_audio_init(int sampleRate)
     }
     ACQUIRE_DEVICE(1000);
 
+    if (!audio.task)
+        audio.task = rg_task_create("rg_audio", &audio_task, NULL, 3 * 1024, RG_TASK_PRIORITY_6, -1);
+
+    // Don't resume from a stale position or interpolate against the previous app's last frame
+    memset(&resampler, 0, sizeof(resampler));
+    audio.vsync = rg_display_get_info()->screen.vsync;
+
     char *driver_name = rg_settings_get_string(NS_GLOBAL, SETTING_DRIVER, "DEFAULT");
     int device = rg_settings_get_number(NS_GLOBAL, SETTING_DEVICE, 0);
     for (size_t i = 0; i < RG_COUNT(sinks); ++i)
@@ -131,8 +209,51 @@ void rg_audio_deinit(void)
     RELEASE_DEVICE();
 }
 
+static bool ring_write(const rg_audio_frame_t *frames, size_t count)
+{
+    while (count > 0)
+    {
+        uint32_t tail = ring.tail;
+        uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        size_t room = RING_LENGTH - (tail - head);
+
+        // We never wait for the sink, rate control should keep us around the target fill. If it can't keep
+        // up (stuck sink, sink clock way off) the excess is dropped.
+        if (room == 0)
+        {
+            counters.overruns++;
+            return false;
+        }
+
+        size_t offset = tail & (RING_LENGTH - 1);
+        size_t chunk = RG_MIN(RG_MIN(room, RING_LENGTH - offset), count);
+        memcpy(&ring.buffer[offset], frames, chunk * sizeof(rg_audio_frame_t));
+        __atomic_store_n(&ring.tail, tail + chunk, __ATOMIC_RELEASE);
+        frames += chunk;
+        count -= chunk;
+
+        // Only we send to this task, so if its slot is empty this can't block
+        if (audio.task && rg_task_messages_waiting(audio.task) == 0)
+            rg_task_send(audio.task, &(rg_task_msg_t){0});
+    }
+
+    return true;
+}
+
+static uint32_t rate_control_step(void)
+{
+    // Stretch the audio a little when the ring drains and squeeze it when it fills up. The pitch change
+    // is inaudible but it absorbs the drift between the emulated refresh rate and the sink's clock.
+    int fill = ring_fill();
+    int adjust = DRC_MAX_PPM * (DRC_TARGET_FILL - fill) / DRC_TARGET_FILL;
+    adjust = RG_MIN(RG_MAX(adjust, -DRC_MAX_PPM), DRC_MAX_PPM);
+    counters.rateAdjust = adjust;
+    return (65536LL * 1000000) / (1000000 + adjust);
+}
+
 void rg_audio_submit(const rg_audio_frame_t *frames, size_t count)
 {
+    RG_PROFILE_ZONE("rg_audio:submit");
     const int64_t time_start = rg_system_timer();
 
     if (!audio.driver)
@@ -141,18 +262,72 @@ void rg_audio_submit(const rg_audio_frame_t *frames, size_t count)
     if (!frames || !count)
         return;
 
-    if (ACQUIRE_DEVICE(0))
+    // Keep the fixed point position below from overflowing
+    for (; count > 0x7FFF; frames += 0x7FFF, count -= 0x7FFF)
+        rg_audio_submit(frames, 0x7FFF);
+
+    counters.totalSamples += count;
+#ifdef RG_ENABLE_BENCHMARK
+    counters.streamHash = rg_crc32(counters.streamHash, (const uint8_t *)frames, count * sizeof(*frames));
+#endif
+
+    // Linear interpolation in 16.16 fixed point. The position is relative to resampler.last, which
+    // is the input frame preceding frames[0]. This means a step of 1.0 is a plain copy, one frame late.
+    rg_audio_frame_t buffer[RING_CHUNK_LENGTH];
+    rg_audio_frame_t prev = resampler.last;
+    uint32_t step = rate_control_step();
+    uint32_t pos = resampler.pos;
+    size_t pos_max = count << 16;
+    size_t length = 0;
+
+    while (pos < pos_max)
     {
-        audio.driver->submit(frames, count);
-        RELEASE_DEVICE();
+        size_t index = pos >> 16;
+        int frac = (pos & 0xFFFF) >> 1; // 15 bits, so the products below fit in 32 bits
+        const rg_audio_frame_t a = index ? frames[index - 1] : prev;
+        const rg_audio_frame_t b = frames[index];
+        buffer[length].left = a.left + (((b.left - a.left) * frac) >> 15);
+        buffer[length].right = a.right + (((b.right - a.right) * frac) >> 15);
+        pos += step;
+
+        if (++length == RG_COUNT(buffer))
+        {
+            if (!ring_write(buffer, length))
+                break;
+            length = 0;
+        }
     }
 
-    counters.totalSamples += count;
+    if (length > 0)
+        ring_write(buffer, length);
+
+    resampler.pos = pos > pos_max ? pos - pos_max : 0;
+    resampler.last = frames[count - 1];
+
     counters.busyTime += rg_system_timer() - time_start;
+
+#ifndef RG_ENABLE_BENCHMARK // Benchmarks run unthrottled
+    // The emulator runs off the system timer at the nominal sample rate, the sink's clock only steers the
+    // rate control above. When something else paces us (slow frames) we're late and don't wait.
+    int64_t now = rg_system_timer();
+    if (now - resampler.clock > PACING_MAX_LAG_US)
+        resampler.clock = now;
+    resampler.clock += count * 1000000LL / RG_MAX(audio.sampleRate, 1000);
+    // With vsync the display is the clock, a second one would fight it. We only step in when the screen
+    // refreshes much faster than the emulated system (120Hz monitor, 50Hz game) and we get too far ahead.
+    int64_t lead = resampler.clock - now - (audio.vsync ? PACING_MAX_LAG_US : 0);
+    // Sleep whole ticks only, spinning for the rest would burn the CPU the display task needs. Being up
+    // to one tick late is fine: the clock is absolute, so the next submit simply waits that much less.
+    int64_t wait_ticks = lead * RG_TICK_RATE / 1000000;
+    if (wait_ticks > 0)
+        rg_task_delay(wait_ticks * 1000 / RG_TICK_RATE);
+#endif
 }
 
 rg_audio_counters_t rg_audio_get_counters(void)
 {
+    counters.bufferFill = ring_fill();
+    counters.bufferSize = RING_LENGTH;
     return counters;
 }
 
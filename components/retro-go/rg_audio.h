@@ -34,6 +34,12 @@ typedef struct
 {
     int64_t totalSamples;
     int64_t busyTime;
+    int64_t underruns;  // The sink ran out of samples
+    int64_t overruns;   // Samples were dropped because the ring buffer was full
+    int32_t bufferFill; // Frames waiting in the ring buffer
+    int32_t bufferSize;
+    int32_t rateAdjust; // Current dynamic rate control correction, in ppm
+    uint32_t streamHash; // CRC32 of all submitted samples (benchmark builds only)
 } rg_audio_counters_t;
 
 void rg_audio_init(int sample_rate);
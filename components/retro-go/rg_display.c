@@ -17,7 +17,37 @@ static int16_t map_viewport_to_source_x[RG_SCREEN_WIDTH + 1];
 static int16_t map_viewport_to_source_y[RG_SCREEN_HEIGHT + 1];
 static uint32_t screen_line_checksum[RG_SCREEN_HEIGHT + 1];
 
+enum {FRAME_FREE = 0, FRAME_ACQUIRED, FRAME_QUEUED};
+static struct
+{
+    rg_display_frame_t frames[RG_DISPLAY_MAX_FRAMES];
+    uint8_t state[RG_DISPLAY_MAX_FRAMES]; // Shared with the display task, use frame_state()/set_frame_state()
+    rg_display_frame_t *last_presented;
+    const rg_surface_t *last_submitted; // Legacy rg_display_submit()
+    uint32_t sequence;
+    int count;
+} queue;
+
+// Frames from the queue are released from the task's message slot before being drawn
+#define DISPLAY_MSG_FRAME 1
+// Drivers that must present from a single thread ask the display task to call lcd_sync for them
+#define DISPLAY_MSG_SYNC 2
+
+// Frames change hands between the emulator and the display task, the release/acquire pair makes sure
+// that a frame's content is visible to the other side before its new state is.
+static inline int frame_state(int index)
+{
+    return __atomic_load_n(&queue.state[index], __ATOMIC_ACQUIRE);
+}
+
+static inline void set_frame_state(int index, int state)
+{
+    __atomic_store_n(&queue.state[index], state, __ATOMIC_RELEASE);
+}
+
 #define LINE_IS_REPEATED(Y) (map_viewport_to_source_y[(Y)] == map_viewport_to_source_y[(Y) - 1])
+// Checksum given to lines drawn from a surface with dirty_rows, 0 is reserved for invalidated lines
+#define LINE_CHECKSUM_TRACKED 1
 // This is to avoid flooring a number that is approximated to .9999999 and be explicit about it
 #define FLOAT_TO_INT(x) ((int)((x) + 0.1f))
 
@@ -65,11 +95,165 @@ static inline unsigned blend_pixels(unsigned a, unsigned b)
     // return (((a ^ b) & 0b1101111011110110U) >> 1) + (a & b);
 }
 
+static inline void blend_lines(uint16_t *dst, const uint16_t *lineA, const uint16_t *lineB, int width)
+{
+    for (int x = 0; x < width; ++x)
+        dst[x] = blend_pixels(lineA[x], lineB[x]);
+}
+
+/**
+ * Scaler kernels convert one source line to 565BE and scale it horizontally, applying the horizontal
+ * filter in the same pass. The fixed ratio kernels are only selected when map_viewport_to_source_x
+ * follows their pattern exactly, so their output is identical to the generic kernel's.
+ */
+typedef void (*scaler_func_t)(uint16_t *dst, const void *data, const uint16_t *palette, int width);
+
+typedef struct
+{
+    uint8_t src_step, dst_step; // Size of the repeating pattern, in pixels
+    uint8_t pattern[5];         // Source pixel of each destination pixel within the pattern
+    bool filter;
+    scaler_func_t func[3];      // Indexed by scaler_format()
+} scaler_t;
+
+#define SCALER_INLINE static inline __attribute__((always_inline))
+
+SCALER_INLINE int scaler_format(int format)
+{
+    if (format & RG_PIXEL_PALETTE)
+        return 0;
+    if (format == RG_PIXEL_565_LE)
+        return 1;
+    return 2;
+}
+
+SCALER_INLINE uint16_t read_pixel(const void *data, const uint16_t *palette, int x, int format)
+{
+    if (format & RG_PIXEL_PALETTE)
+        return palette[((const uint8_t *)data)[x]];
+    uint16_t pixel = ((const uint16_t *)data)[x];
+    if (format == RG_PIXEL_565_LE)
+        return (pixel << 8) | (pixel >> 8);
+    return pixel;
+}
+
+// Also used to finish the lines that aren't a multiple of a kernel's pattern
+SCALER_INLINE void scale_generic(uint16_t *dst, const void *data, const uint16_t *palette, int x, int width,
+                                 int format, bool filter)
+{
+    const int16_t *map = map_viewport_to_source_x;
+    for (; x < width; ++x)
+    {
+        if (filter && x > 0 && x < width - 1 && map[x] == map[x - 1])
+            dst[x] = blend_pixels(dst[x - 1], read_pixel(data, palette, map[x + 1], format));
+        else
+            dst[x] = read_pixel(data, palette, map[x], format);
+    }
+}
+
+SCALER_INLINE void scale_integer(uint16_t *dst, const void *data, const uint16_t *palette, int width, int format,
+                                 int factor)
+{
+    int x = 0;
+    if (factor == 1 && format == RG_PIXEL_565_BE)
+    {
+        memcpy(dst, data, width * 2);
+        return;
+    }
+    for (int i = 0; x + factor <= width; x += factor, ++i)
+    {
+        uint16_t pixel = read_pixel(data, palette, i, format);
+        for (int j = 0; j < factor; ++j)
+            dst[x + j] = pixel;
+    }
+    scale_generic(dst, data, palette, x, width, format, false);
+}
+
+// Pattern AAB: 2 source pixels become 3 (160 => 240, 320 => 480)
+SCALER_INLINE void scale_2to3(uint16_t *dst, const void *data, const uint16_t *palette, int width, int format,
+                              bool filter)
+{
+    int x = 0;
+    for (int i = 0; x + 3 <= width; x += 3, i += 2)
+    {
+        uint16_t a = read_pixel(data, palette, i + 0, format);
+        uint16_t b = read_pixel(data, palette, i + 1, format);
+        dst[x + 0] = a;
+        dst[x + 1] = filter ? blend_pixels(a, b) : a;
+        dst[x + 2] = b;
+    }
+    scale_generic(dst, data, palette, x, width, format, filter);
+}
+
+// Pattern AABCD: 4 source pixels become 5 (256 => 320, 192 => 240)
+SCALER_INLINE void scale_4to5(uint16_t *dst, const void *data, const uint16_t *palette, int width, int format,
+                              bool filter)
+{
+    int x = 0;
+    for (int i = 0; x + 5 <= width; x += 5, i += 4)
+    {
+        uint16_t a = read_pixel(data, palette, i + 0, format);
+        uint16_t b = read_pixel(data, palette, i + 1, format);
+        dst[x + 0] = a;
+        dst[x + 1] = filter ? blend_pixels(a, b) : a;
+        dst[x + 2] = b;
+        dst[x + 3] = read_pixel(data, palette, i + 2, format);
+        dst[x + 4] = read_pixel(data, palette, i + 3, format);
+    }
+    scale_generic(dst, data, palette, x, width, format, filter);
+}
+
+#define DEFINE_SCALER(name, call)                                                                         \
+    static void name##_pal(uint16_t *dst, const void *data, const uint16_t *palette, int width)           \
+    { const int format = RG_PIXEL_PALETTE; call; }                                                        \
+    static void name##_le(uint16_t *dst, const void *data, const uint16_t *palette, int width)            \
+    { const int format = RG_PIXEL_565_LE; call; }                                                         \
+    static void name##_be(uint16_t *dst, const void *data, const uint16_t *palette, int width)            \
+    { const int format = RG_PIXEL_565_BE; call; }
+#define SCALER_FUNCS(name) {name##_pal, name##_le, name##_be}
+
+DEFINE_SCALER(generic, scale_generic(dst, data, palette, 0, width, format, false))
+DEFINE_SCALER(generic_filter, scale_generic(dst, data, palette, 0, width, format, true))
+DEFINE_SCALER(copy_1x, scale_integer(dst, data, palette, width, format, 1))
+DEFINE_SCALER(scale_2x, scale_integer(dst, data, palette, width, format, 2))
+DEFINE_SCALER(scale_3x, scale_integer(dst, data, palette, width, format, 3))
+DEFINE_SCALER(scale_2to3, scale_2to3(dst, data, palette, width, format, false))
+DEFINE_SCALER(scale_2to3_filter, scale_2to3(dst, data, palette, width, format, true))
+DEFINE_SCALER(scale_4to5, scale_4to5(dst, data, palette, width, format, false))
+DEFINE_SCALER(scale_4to5_filter, scale_4to5(dst, data, palette, width, format, true))
+
+static const scaler_t scalers[] = {
+    {1, 1, {0},             false, SCALER_FUNCS(copy_1x)},
+    {1, 2, {0, 0},          false, SCALER_FUNCS(scale_2x)},
+    {1, 3, {0, 0, 0},       false, SCALER_FUNCS(scale_3x)},
+    {2, 3, {0, 0, 1},       false, SCALER_FUNCS(scale_2to3)},
+    {2, 3, {0, 0, 1},       true,  SCALER_FUNCS(scale_2to3_filter)},
+    {4, 5, {0, 0, 1, 2, 3}, false, SCALER_FUNCS(scale_4to5)},
+    {4, 5, {0, 0, 1, 2, 3}, true,  SCALER_FUNCS(scale_4to5_filter)},
+};
+static const scaler_t scaler_generic = {0, 0, {0}, false, SCALER_FUNCS(generic)};
+static const scaler_t scaler_generic_filter = {0, 0, {0}, true, SCALER_FUNCS(generic_filter)};
+static const scaler_t *scaler = &scaler_generic;
+
+static const scaler_t *select_scaler(int width, bool filter)
+{
+    for (size_t i = 0; i < RG_COUNT(scalers); ++i)
+    {
+        const scaler_t *s = &scalers[i];
+        bool match = s->filter == filter;
+        for (int x = 0; x < width && match; ++x)
+            match = map_viewport_to_source_x[x] == (x / s->dst_step) * s->src_step + s->pattern[x % s->dst_step];
+        if (match)
+            return s;
+    }
+    return filter ? &scaler_generic_filter : &scaler_generic;
+}
+
 static inline void write_update(const rg_surface_t *update)
 {
+    RG_PROFILE_ZONE("rg_display:write_update");
     const int64_t time_start = rg_system_timer();
 
-    bool filter_x = display.viewport.filter_x;
     bool filter_y = display.viewport.filter_y;
     int draw_left = display.viewport.left;
     int draw_top = display.viewport.top;
@@ -97,8 +281,10 @@ static inline void write_update(const rg_surface_t *update)
     const int stride = update->stride;
     const void *data = update->data + update->offset + (crop_top * stride) + (crop_left * RG_PIXEL_GET_SIZE(format));
     const uint16_t *palette = update->palette;
+    const scaler_func_t render_line = scaler->func[scaler_format(format)];
 
     const bool partial_update = RG_SCREEN_PARTIAL_UPDATES;
+    const uint8_t *dirty_rows = (partial_update && update->dirty_rows) ? update->dirty_rows + crop_top : NULL;
 
     int lines_per_buffer = LCD_BUFFER_LENGTH / draw_width;
     int lines_remaining = draw_height;
@@ -120,81 +306,68 @@ static inline void write_update(const rg_surface_t *update)
                 --lines_to_copy;
         }
 
+        // When the core tells us which rows changed we can skip unchanged blocks without rendering or hashing
+        // them, as long as the screen still holds the previous frame (write_rect and others reset the checksum)
+        if (dirty_rows)
+        {
+            bool need_update = false;
+            for (int i = 0; i < lines_to_copy && !need_update; ++i)
+            {
+                need_update = dirty_rows[map_viewport_to_source_y[y + i]] ||
+                              screen_line_checksum[draw_top + y + i] != LINE_CHECKSUM_TRACKED;
+            }
+            if (!need_update)
+            {
+                lines_remaining -= lines_to_copy;
+                y += lines_to_copy;
+                continue;
+            }
+        }
+
         uint16_t *line_buffer = lcd_get_buffer(LCD_BUFFER_LENGTH);
-        uint16_t *line_buffer_ptr = line_buffer;
 
-        uint32_t checksum = 0xFFFFFFFF;
-        bool need_update = !partial_update;
+        uint32_t checksum = dirty_rows ? LINE_CHECKSUM_TRACKED : 0xFFFFFFFF;
+        bool need_update = !partial_update || dirty_rows;
+        bool rendered_ahead = false;
 
-        for (int i = 0; i < lines_to_copy; ++i)
+        for (int i = 0; i < lines_to_copy; ++i, ++y)
         {
-            if (i > 0 && LINE_IS_REPEATED(y))
+            uint16_t *line = line_buffer + i * draw_width;
+
+            if (rendered_ahead)
             {
-                memcpy(line_buffer_ptr, line_buffer_ptr - draw_width, draw_width * 2);
-                line_buffer_ptr += draw_width;
+                // This line was already rendered to blend the previous one
+                rendered_ahead = false;
+                if (partial_update && !dirty_rows)
+                    checksum = rg_hash((void *)line, draw_width * 2);
             }
-            else
+            else if (i > 0 && LINE_IS_REPEATED(y))
             {
-                #define RENDER_LINE(PTR_TYPE, PIXEL) { \
-                    PTR_TYPE *buffer = (PTR_TYPE *)(data + map_viewport_to_source_y[y] * stride);\
-                    for (int xx = 0; xx < draw_width; ++xx) { \
-                        int x = map_viewport_to_source_x[xx]; \
-                        *line_buffer_ptr++ = (PIXEL); \
-                    } \
+                // When filtering, a repeated line is the blend of its neighbours. We render the next
+                // line early so we can produce it right away instead of copying then filtering it.
+                if (filter_y && i < lines_to_copy - 1 && !LINE_IS_REPEATED(y + 1))
+                {
+                    render_line(line + draw_width, data + map_viewport_to_source_y[y + 1] * stride, palette, draw_width);
+                    blend_lines(line, line - draw_width, line + draw_width, draw_width);
+                    rendered_ahead = true;
                 }
-                if (format & RG_PIXEL_PALETTE)
-                    RENDER_LINE(uint8_t, palette[buffer[x]])
-                else if (format == RG_PIXEL_565_LE)
-                    RENDER_LINE(uint16_t, (buffer[x] << 8) | (buffer[x] >> 8))
                 else
-                    RENDER_LINE(uint16_t, buffer[x])
-
-                if (partial_update)
                 {
-                    checksum = rg_hash((void*)(line_buffer_ptr - draw_width), draw_width * 2);
+                    memcpy(line, line - draw_width, draw_width * 2);
                 }
             }
+            else
+            {
+                render_line(line, data + map_viewport_to_source_y[y] * stride, palette, draw_width);
+                if (partial_update && !dirty_rows)
+                    checksum = rg_hash((void *)line, draw_width * 2);
+            }
 
             if (screen_line_checksum[draw_top + y] != checksum)
             {
                 screen_line_checksum[draw_top + y] = checksum;
                 need_update = true;
             }
-
-            ++y;
-        }
-
-        if (filter_x && need_update)
-        {
-            for (int i = 0; i < lines_to_copy; ++i)
-            {
-                uint16_t *buffer = line_buffer + i * draw_width;
-                for (int x = 1; x < draw_width - 1; ++x)
-                {
-                    if (map_viewport_to_source_x[x] == map_viewport_to_source_x[x - 1])
-                    {
-                        buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
-                    }
-                }
-            }
-        }
-
-        if (filter_y && need_update)
-        {
-            int top = y - lines_to_copy;
-            for (int i = 1; i < lines_to_copy - 1; ++i)
-            {
-                if (LINE_IS_REPEATED(top + i))
-                {
-                    uint16_t *lineA = line_buffer + (i - 1) * draw_width;
-                    uint16_t *lineB = line_buffer + (i + 0) * draw_width;
-                    uint16_t *lineC = line_buffer + (i + 1) * draw_width;
-                    for (size_t x = 0; x < draw_width; ++x)
-                    {
-                        lineB[x] = blend_pixels(lineA[x], lineC[x]);
-                    }
-                }
-            }
         }
 
         if (need_update)
@@ -282,9 +455,12 @@ static void update_viewport_scaling(void)
     for (int y = 0; y < screen_height; ++y)
         map_viewport_to_source_y[y] = FLOAT_TO_INT(y * display.viewport.step_y);
 
-    RG_LOGI("%dx%d@%.3f => %dx%d@%.3f left:%d top:%d step_x:%.2f step_y:%.2f", src_width, src_height,
-            (float)src_width / src_height, new_width, new_height, (float)new_width / new_height,
-            display.viewport.left, display.viewport.top, display.viewport.step_x, display.viewport.step_y);
+    scaler = select_scaler(RG_MIN(new_width, screen_width), display.viewport.filter_x);
+
+    RG_LOGI("%dx%d@%.3f => %dx%d@%.3f left:%d top:%d step_x:%.2f step_y:%.2f scaler:%d:%d%s", src_width,
+            src_height, (float)src_width / src_height, new_width, new_height, (float)new_width / new_height,
+            display.viewport.left, display.viewport.top, display.viewport.step_x, display.viewport.step_y,
+            scaler->src_step, scaler->dst_step, scaler->filter ? "+filter" : "");
 }
 
 static bool load_border_file(const char *filename)
@@ -321,6 +497,22 @@ static void display_task(void *arg)
         if (msg.type == RG_TASK_MSG_STOP)
             break;
 
+        if (msg.type == DISPLAY_MSG_SYNC)
+        {
+            rg_task_receive(&msg);
+            lcd_sync();
+            continue;
+        }
+
+        // Queued frames are owned by us until we release them, so the next frame can be queued while we draw.
+        // Other surfaces must remain in the queue until we're done with them, rg_display_sync() relies on it.
+        rg_display_frame_t *frame = NULL;
+        if (msg.type == DISPLAY_MSG_FRAME)
+        {
+            frame = (rg_display_frame_t *)msg.dataPtr;
+            rg_task_receive(&msg);
+        }
+
         if (display.changed)
         {
             update_viewport_scaling();
@@ -335,9 +527,17 @@ static void display_task(void *arg)
             display.changed = false;
         }
 
-        write_update(msg.dataPtr);
-
-        rg_task_receive(&msg);
+        if (frame)
+        {
+            write_update(frame->surface);
+            frame->display_time = rg_system_timer();
+            set_frame_state(frame - queue.frames, FRAME_FREE);
+        }
+        else
+        {
+            write_update(msg.dataPtr);
+            rg_task_receive(&msg);
+        }
 
         lcd_sync();
     }
@@ -358,7 +558,11 @@ const rg_display_t *rg_display_get_info(void)
 
 rg_display_counters_t rg_display_get_counters(void)
 {
-    return counters;
+    rg_display_counters_t copy = counters;
+    copy.queuedFrames = 0;
+    for (int i = 0; i < queue.count; ++i)
+        copy.queuedFrames += frame_state(i) == FRAME_QUEUED;
+    return copy;
 }
 
 int rg_display_get_width(void)
@@ -456,6 +660,17 @@ char *rg_display_get_border(void)
     return rg_settings_get_string(NS_APP, SETTING_BORDER, NULL);
 }
 
+static void update_source(const rg_surface_t *update)
+{
+    if (display.source.width != update->width || display.source.height != update->height)
+    {
+        rg_display_sync(true);
+        display.source.width = update->width;
+        display.source.height = update->height;
+        display.changed = true;
+    }
+}
+
 void rg_display_submit(const rg_surface_t *update, uint32_t flags)
 {
     const int64_t time_start = rg_system_timer();
@@ -464,25 +679,136 @@ void rg_display_submit(const rg_surface_t *update, uint32_t flags)
     if (!update || !update->data)
         return;
 
-    if (display.source.width != update->width || display.source.height != update->height)
+    update_source(update);
+    queue.last_submitted = update;
+
+    rg_task_send(display_task_queue, &(rg_task_msg_t){.dataPtr = update});
+
+    counters.blockTime += rg_system_timer() - time_start;
+    counters.totalFrames++;
+}
+
+static bool frames_in_flight(void)
+{
+    for (int i = 0; i < queue.count; ++i)
+        if (frame_state(i) == FRAME_QUEUED)
+            return true;
+    return false;
+}
+
+rg_display_frame_t *rg_display_create_frames(int count, int width, int height, int format, uint32_t alloc_flags)
+{
+    RG_ASSERT_ARG(count > 0 && count <= RG_DISPLAY_MAX_FRAMES);
+
+    rg_display_sync(true);
+
+    for (int i = 0; i < queue.count; ++i)
     {
-        rg_display_sync(true);
-        display.source.width = update->width;
-        display.source.height = update->height;
-        display.changed = true;
+        free(queue.frames[i].surface->dirty_rows);
+        rg_surface_free(queue.frames[i].surface);
     }
+    memset(&queue, 0, sizeof(queue));
 
-    rg_task_send(display_task_queue, &(rg_task_msg_t){.dataPtr = update});
+    for (int i = 0; i < count; ++i)
+    {
+        rg_surface_t *surface = rg_surface_create(width, height, format, alloc_flags);
+        RG_ASSERT(surface, "Frame allocation failed");
+        if (RG_SCREEN_PARTIAL_UPDATES)
+            surface->dirty_rows = calloc(height, 1);
+        queue.frames[i].surface = surface;
+    }
+    queue.count = count;
+
+    return queue.frames;
+}
+
+rg_display_frame_t *rg_display_acquire_frame(void)
+{
+    const int64_t time_start = rg_system_timer();
+    rg_display_frame_t *frame = NULL;
+
+    RG_ASSERT(queue.count > 0, "rg_display_create_frames() must be called first");
+
+    // The emulator only ever holds one frame, if it didn't present it we simply hand it back
+    for (int i = 0; i < queue.count && !frame; ++i)
+    {
+        if (frame_state(i) == FRAME_ACQUIRED)
+            frame = &queue.frames[i];
+    }
+
+    // The last presented frame must stay intact as long as possible: it's what's on screen, what the next
+    // frame is compared against, and what redraws and screenshots use. Hence we only block when it's the
+    // only frame left and the queue is full.
+    while (true)
+    {
+        for (int i = 0; i < queue.count && !frame; ++i)
+        {
+            if (frame_state(i) == FRAME_FREE && (&queue.frames[i] != queue.last_presented || queue.count == 1))
+                frame = &queue.frames[i];
+        }
+        if (frame)
+            break;
+        rg_task_yield(); // Let the display task finish what it's drawing
+    }
+
+    set_frame_state(frame - queue.frames, FRAME_ACQUIRED);
+    frame->number = ++queue.sequence;
+    frame->acquire_time = rg_system_timer();
+    frame->present_time = 0;
+    frame->display_time = 0;
+    frame->reference = (queue.last_presented && queue.last_presented != frame) ? queue.last_presented->surface : NULL;
+    frame->rows_marked = false;
+    if (frame->surface->dirty_rows)
+        memset(frame->surface->dirty_rows, 1, frame->surface->height);
+
+    counters.blockTime += frame->acquire_time - time_start;
+
+    return frame;
+}
+
+void rg_display_present_frame(rg_display_frame_t *frame, uint32_t flags)
+{
+    const int64_t time_start = rg_system_timer();
+
+    RG_ASSERT_ARG(frame && frame >= queue.frames && frame < queue.frames + queue.count);
+
+    rg_surface_t *surface = frame->surface;
+    rg_display_frame_t *previous = queue.last_presented;
+
+    // Frames are displayed in order so the screen will hold the previous frame when this one is drawn.
+    // If the emulator flagged the rows itself we trust it, otherwise we compare the whole frame.
+    if (surface->dirty_rows)
+    {
+        const rg_surface_t *reference = (previous && previous != frame) ? previous->surface : NULL;
+        bool rows_marked = frame->rows_marked && reference && reference == frame->reference;
+        rg_surface_update_dirty_rows(surface, reference, rows_marked);
+    }
+
+    update_source(surface);
+
+    frame->present_time = time_start;
+    set_frame_state(frame - queue.frames, FRAME_QUEUED);
+    queue.last_presented = frame;
+
+    // This only blocks if a frame is already waiting for the display task, ie the queue is full
+    rg_task_send(display_task_queue, &(rg_task_msg_t){.type = DISPLAY_MSG_FRAME, .dataPtr = frame});
 
     counters.blockTime += rg_system_timer() - time_start;
     counters.totalFrames++;
 }
 
+rg_surface_t *rg_display_get_last_frame(void)
+{
+    if (queue.last_presented)
+        return queue.last_presented->surface;
+    return (rg_surface_t *)queue.last_submitted;
+}
+
 bool rg_display_sync(bool block)
 {
-    while (block && rg_task_messages_waiting(display_task_queue))
+    while (block && (rg_task_messages_waiting(display_task_queue) || frames_in_flight()))
         continue; // We should probably yield?
-    return !rg_task_messages_waiting(display_task_queue);
+    return !rg_task_messages_waiting(display_task_queue) && !frames_in_flight();
 }
 
 void rg_display_write_rect(int left, int top, int width, int height, int stride, const uint16_t *buffer, uint32_t flags)
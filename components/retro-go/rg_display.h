@@ -42,6 +42,8 @@ enum
     RG_DISPLAY_WRITE_NOSWAP = (1 << 1),
 };
 
+#define RG_DISPLAY_MAX_FRAMES 3
+
 typedef struct
 {
     display_rotation_t rotation;
@@ -59,6 +61,7 @@ typedef struct
     int32_t partFrames;
     int64_t blockTime;
     int64_t busyTime;
+    int32_t queuedFrames; // Waiting to be drawn by the display task
 } rg_display_counters_t;
 
 typedef struct
@@ -82,6 +85,7 @@ typedef struct
         int width, height; // Visible resolution (minus margins)
         struct {int left, top, right, bottom;} margins;
         int format;
+        bool vsync; // Presents wait for the screen's refresh, which then paces emulation
     } screen;
     struct
     {
@@ -99,6 +103,20 @@ typedef struct
 
 #include "rg_surface.h"
 
+typedef struct
+{
+    rg_surface_t *surface;
+    uint32_t number;      // Sequence number, incremented every time a frame is acquired
+    int64_t acquire_time; // When the frame was handed to the emulator
+    int64_t present_time; // When the emulator queued it for display
+    int64_t display_time; // When the display task was done with it (0 while in flight)
+    // Frame that was on screen when this one was acquired. Emulators that draw line by line can compare each
+    // line against it while it's still in cache, flag surface->dirty_rows and set rows_marked. That spares
+    // rg_display_present_frame() a second pass over the whole frame. Rows left untouched are redrawn.
+    const rg_surface_t *reference;
+    bool rows_marked;
+} rg_display_frame_t;
+
 void rg_display_init(void);
 void rg_display_deinit(void);
 void rg_display_write_rect(int left, int top, int width, int height, int stride, const uint16_t *buffer, uint32_t flags);
@@ -109,6 +127,12 @@ bool rg_display_sync(bool block);
 void rg_display_force_redraw(void);
 void rg_display_submit(const rg_surface_t *update, uint32_t flags);
 
+// Frame queue: the display owns `count` surfaces, the emulator draws in one while the others are displayed
+rg_display_frame_t *rg_display_create_frames(int count, int width, int height, int format, uint32_t alloc_flags);
+rg_display_frame_t *rg_display_acquire_frame(void);
+void rg_display_present_frame(rg_display_frame_t *frame, uint32_t flags);
+rg_surface_t *rg_display_get_last_frame(void);
+
 rg_display_counters_t rg_display_get_counters(void);
 const rg_display_t *rg_display_get_info(void);
 int rg_display_get_width(void);
@@ -35,6 +35,13 @@ static struct
     int font_index;
     bool show_clock;
     bool initialized;
+    struct
+    {
+        rg_setting_t *language;
+        rg_setting_t *font;
+        rg_setting_t *theme;
+        rg_setting_t *clock;
+    } settings;
 } gui;
 
 #define SETTING_FONTTYPE    "FontType"
@@ -108,10 +115,14 @@ void rg_gui_init(void)
     //        because of how this is defined in config.h. It should be documented somewhere...
     gui.margins = (__typeof__(gui.margins))RG_SCREEN_SAFE_AREA;
     gui.draw_buffer = get_draw_buffer(gui.screen_width, 18, C_BLACK);
-    rg_gui_set_language_id(rg_settings_get_number(NS_GLOBAL, SETTING_LANGUAGE, RG_LANG_EN));
-    rg_gui_set_font(rg_settings_get_number(NS_GLOBAL, SETTING_FONTTYPE, RG_FONT_VERA_11));
-    rg_gui_set_theme(rg_settings_get_string(NS_GLOBAL, SETTING_THEME, NULL));
-    gui.show_clock = rg_settings_get_boolean(NS_GLOBAL, SETTING_CLOCK, false);
+    gui.settings.language = rg_settings_find(NS_GLOBAL, SETTING_LANGUAGE);
+    gui.settings.font = rg_settings_find(NS_GLOBAL, SETTING_FONTTYPE);
+    gui.settings.theme = rg_settings_find(NS_GLOBAL, SETTING_THEME);
+    gui.settings.clock = rg_settings_find(NS_GLOBAL, SETTING_CLOCK);
+    rg_gui_set_language_id(rg_setting_get_number(gui.settings.language, RG_LANG_EN));
+    rg_gui_set_font(rg_setting_get_number(gui.settings.font, RG_FONT_VERA_11));
+    rg_gui_set_theme(rg_setting_get_string(gui.settings.theme, NULL));
+    gui.show_clock = rg_setting_get_boolean(gui.settings.clock, false);
     gui.initialized = true;
 }
 
@@ -119,7 +130,7 @@ bool rg_gui_set_language_id(int index)
 {
     if (rg_localization_set_language_id(index))
     {
-        rg_settings_set_number(NS_GLOBAL, SETTING_LANGUAGE, index);
+        rg_setting_set_number(gui.settings.language, index);
         RG_LOGI("Language set to: %s (%d)", rg_localization_get_language_name(index), index);
         return true;
     }
@@ -155,7 +166,7 @@ bool rg_gui_set_theme(const char *theme_name)
 
     if (new_theme)
     {
-        rg_settings_set_string(NS_GLOBAL, SETTING_THEME, theme_name);
+        rg_setting_set_string(gui.settings.theme, theme_name);
         strcpy(gui.theme_name, theme_name);
         // FIXME: Keeping the theme around uses quite a lot of internal memory (about 3KB)...
         //        We should probably convert it to a regular array or hashmap.
@@ -164,7 +175,7 @@ bool rg_gui_set_theme(const char *theme_name)
     }
     else
     {
-        rg_settings_set_string(NS_GLOBAL, SETTING_THEME, NULL);
+        rg_setting_set_string(gui.settings.theme, NULL);
         strcpy(gui.theme_name, "");
         gui.theme_obj = NULL;
         RG_LOGI("Using built-in theme!\n");
@@ -227,7 +238,7 @@ bool rg_gui_set_font(int index)
     gui.style.font = font;
     gui.style.font_height = (index < 3) ? (8 + index * 4) : font->height;
 
-    rg_settings_set_number(NS_GLOBAL, SETTING_FONTTYPE, index);
+    rg_setting_set_number(gui.settings.font, index);
 
     RG_LOGI("Font set to: %s (height=%d, scaling=%.2f)\n",
         gui.style.font->name, gui.style.font_height, (float)gui.style.font_height / font->height);
@@ -268,18 +279,99 @@ void rg_gui_copy_buffer(int left, int top, int width, int height, int stride, co
     }
 }
 
-static size_t get_glyph(uint32_t *output, const rg_font_t *font, int points, int c)
+#define GLYPH_CACHE_SIZE   48
+#define GLYPH_CACHE_HEIGHT 32 // Taller glyphs (very big text) aren't cached
+
+typedef struct
 {
-    // Some glyphs are always zero width
-    if (!font || c == '\r' || c == '\n' || c == 0) // || c < 8 || c > 0xFFFF)
-        return 0;
+    uint16_t code;
+    uint32_t offset; // Of the glyph in the font's data
+} glyph_index_t;
 
-    if (points <= 0)
-        points = font->height;
+static struct
+{
+    struct
+    {
+        const rg_font_t *font;
+        glyph_index_t *entries;
+        size_t count;
+    } indexes[RG_FONT_MAX];
+    struct
+    {
+        const rg_font_t *font;
+        uint32_t last_use;
+        uint16_t code;
+        uint8_t points;
+        uint8_t width;
+        uint32_t rows[GLYPH_CACHE_HEIGHT];
+    } *entries;
+    uint32_t clock;
+} glyphs;
+
+static int glyph_index_cmp(const void *a, const void *b)
+{
+    return ((const glyph_index_t *)a)->code - ((const glyph_index_t *)b)->code;
+}
+
+static const glyph_index_t *build_glyph_index(const rg_font_t *font, size_t *count_out)
+{
+    // The font data is a stream of variable-length glyphs, walk it once and keep the offsets sorted by codepoint
+    size_t count = 0;
+    for (const uint8_t *ptr = font->data; ((rg_font_glyph_t *)ptr)->code; ++count)
+    {
+        const rg_font_glyph_t *glyph = (rg_font_glyph_t *)ptr;
+        if (glyph->width != 0)
+            ptr += (((glyph->width * glyph->height) - 1) / 8) + 1;
+        ptr += sizeof(rg_font_glyph_t);
+    }
+
+    glyph_index_t *entries = malloc(RG_MAX(count, 1) * sizeof(glyph_index_t));
+    if (!entries)
+        return NULL;
+
+    const uint8_t *ptr = font->data;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const rg_font_glyph_t *glyph = (rg_font_glyph_t *)ptr;
+        entries[i] = (glyph_index_t){glyph->code, ptr - font->data};
+        if (glyph->width != 0)
+            ptr += (((glyph->width * glyph->height) - 1) / 8) + 1;
+        ptr += sizeof(rg_font_glyph_t);
+    }
+    qsort(entries, count, sizeof(glyph_index_t), glyph_index_cmp);
+
+    RG_LOGD("Indexed font '%s': %d glyphs", font->name, (int)count);
+    *count_out = count;
+    return entries;
+}
+
+static const rg_font_glyph_t *find_glyph(const rg_font_t *font, int c)
+{
+    if (c > 0xFFFF) // Our fonts only cover the BMP
+        return NULL;
+
+    for (size_t i = 0; i < RG_COUNT(glyphs.indexes); ++i)
+    {
+        if (glyphs.indexes[i].font == NULL)
+        {
+            const glyph_index_t *entries = build_glyph_index(font, &glyphs.indexes[i].count);
+            if (!entries)
+                break;
+            glyphs.indexes[i].entries = (glyph_index_t *)entries;
+            glyphs.indexes[i].font = font;
+        }
+        if (glyphs.indexes[i].font == font)
+        {
+            const glyph_index_t key = {c, 0};
+            const glyph_index_t *found = bsearch(&key, glyphs.indexes[i].entries, glyphs.indexes[i].count,
+                                                 sizeof(glyph_index_t), glyph_index_cmp);
+            return found ? (rg_font_glyph_t *)(font->data + found->offset) : NULL;
+        }
+    }
 
+    // No index available, fall back to a linear search
     const uint8_t *ptr = font->data;
     const rg_font_glyph_t *glyph = (rg_font_glyph_t *)ptr;
-    // for (size_t i = 0; i < font->chars && glyph->code && glyph->code != c; ++i)
     while (glyph->code && glyph->code != c)
     {
         if (glyph->width != 0)
@@ -287,8 +379,14 @@ static size_t get_glyph(uint32_t *output, const rg_font_t *font, int points, int
         ptr += sizeof(rg_font_glyph_t);
         glyph = (rg_font_glyph_t *)ptr;
     }
+    return glyph->code ? glyph : NULL;
+}
+
+static size_t rasterize_glyph(uint32_t *output, const rg_font_t *font, int points, int c)
+{
+    const rg_font_glyph_t *glyph = find_glyph(font, c);
 
-    if (glyph && glyph->code == c) // Glyph found
+    if (glyph) // Glyph found
     {
         // Based on code by Boris Lovosevic (https://github.com/loboris)
         int yOffset = glyph->yOffset;
@@ -300,37 +398,26 @@ static size_t get_glyph(uint32_t *output, const rg_font_t *font, int points, int
         if (output)
         {
             memset(output, 0, points * 4);
-            int ch = 0, mask = 0x80;
-            for (int y = 0; y < height; y++)
+            // The bitmap is a continuous stream of bits, rows aren't byte-aligned
+            for (int y = 0, bit = 0; y < height; y++)
             {
                 uint32_t row = 0;
-                for (int x = 0; x < width; x++)
+                for (int x = 0; x < width; x++, bit++)
                 {
-                    if (((x + (y * width)) % 8) == 0)
-                    {
-                        mask = 0x80;
-                        ch = *data++;
-                    }
-                    if ((ch & mask) != 0)
+                    if (data[bit >> 3] & (0x80 >> (bit & 7)))
                         row |= (1 << (xOffset + x));
-                    mask >>= 1;
                 }
                 output[yOffset + y] = row;
             }
             // Vertical stretching
             if (points != font->height)
             {
-                float scale = (float)points / font->height;
                 for (int y = points - 1; y >= 0; y--)
-                    output[y] = output[(int)(y / scale)];
+                    output[y] = output[y * font->height / points];
             }
         }
         return RG_MAX(width, xDelta);
     }
-    // else if (font != &font_basic8x8) // Glyph not found, try fallback font
-    // {
-    //     return get_glyph(output, &font_basic8x8, points, c);
-    // }
     else // Glyph not found, no fallback
     {
         size_t box_width = font->width ?: 8;
@@ -344,6 +431,49 @@ static size_t get_glyph(uint32_t *output, const rg_font_t *font, int points, int
     }
 }
 
+static size_t get_glyph(uint32_t *output, const rg_font_t *font, int points, int c)
+{
+    // Some glyphs are always zero width
+    if (!font || c == '\r' || c == '\n' || c == 0) // || c < 8 || c > 0xFFFF)
+        return 0;
+
+    if (points <= 0)
+        points = font->height;
+
+    if (!output || c > 0xFFFF || points > GLYPH_CACHE_HEIGHT || font->height > GLYPH_CACHE_HEIGHT)
+        return rasterize_glyph(output, font, points, c);
+
+    // The cache is optional, we just rasterize every time if there's no memory for it
+    if (!glyphs.entries)
+        glyphs.entries = rg_alloc(GLYPH_CACHE_SIZE * sizeof(*glyphs.entries), MEM_ANY | MEM_NOPANIC);
+    if (!glyphs.entries)
+        return rasterize_glyph(output, font, points, c);
+
+    // Small LRU of rasterized glyphs, most text on screen uses the same few dozen characters
+    size_t victim = 0;
+    for (size_t i = 0; i < GLYPH_CACHE_SIZE; ++i)
+    {
+        if (glyphs.entries[i].font == font && glyphs.entries[i].code == c && glyphs.entries[i].points == points)
+        {
+            glyphs.entries[i].last_use = ++glyphs.clock;
+            memcpy(output, glyphs.entries[i].rows, points * 4);
+            return glyphs.entries[i].width;
+        }
+        if (glyphs.entries[i].last_use < glyphs.entries[victim].last_use)
+            victim = i;
+    }
+
+    uint32_t *rows = glyphs.entries[victim].rows;
+    size_t width = rasterize_glyph(rows, font, points, c);
+    glyphs.entries[victim].font = font;
+    glyphs.entries[victim].code = c;
+    glyphs.entries[victim].points = points;
+    glyphs.entries[victim].width = width;
+    glyphs.entries[victim].last_use = ++glyphs.clock;
+    memcpy(output, rows, points * 4);
+    return width;
+}
+
 rg_rect_t rg_gui_draw_text(int x_pos, int y_pos, int width, const char *text, // const rg_font_t *font,
                            rg_color_t color_fg, rg_color_t color_bg, uint32_t flags)
 {
@@ -1255,6 +1385,14 @@ static rg_gui_event_t speedup_update_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rewind_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+        rg_emu_set_rewind(!rg_emu_get_rewind());
+    strcpy(option->value, rg_emu_get_rewind() ? _("On") : _("Off"));
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t led_indicator_opt_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -1285,7 +1423,7 @@ static rg_gui_event_t show_clock_cb(rg_gui_option_t *option, rg_gui_event_t even
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
     {
         gui.show_clock = !gui.show_clock;
-        rg_settings_set_boolean(NS_GLOBAL, SETTING_CLOCK, gui.show_clock);
+        rg_setting_set_boolean(gui.settings.clock, gui.show_clock);
         return RG_DIALOG_REDRAW;
     }
     strcpy(option->value, gui.show_clock ? _("On") : _("Off"));
@@ -1556,6 +1694,7 @@ static rg_gui_event_t app_options_cb(rg_gui_option_t *option, rg_gui_event_t eve
 
 void rg_gui_options_menu(void)
 {
+    const rg_app_t *app = rg_system_get_app();
     rg_gui_option_t options[16] = {
         #if RG_SCREEN_BACKLIGHT
         {0, _("Brightness"),    "-", RG_DIALOG_FLAG_NORMAL, &brightness_update_cb},
@@ -1585,12 +1724,12 @@ void rg_gui_options_menu(void)
         {0, _("Filter"),        "-", RG_DIALOG_FLAG_NORMAL, &filter_update_cb},
         {0, _("Border"),        "-", RG_DIALOG_FLAG_NORMAL, &border_update_cb},
         {0, _("Speed"),         "-", RG_DIALOG_FLAG_NORMAL, &speedup_update_cb},
+        {0, _("Rewind"),        "-", app->handlers.serialize ? RG_DIALOG_FLAG_NORMAL : RG_DIALOG_FLAG_HIDDEN, &rewind_update_cb},
         // {0, _("Misc options"),  NULL, RG_DIALOG_FLAG_NORMAL, &misc_options_cb},
         {0, _("Emulator options"), NULL, RG_DIALOG_FLAG_NORMAL, &app_options_cb},
         RG_DIALOG_END,
     };
 
-    const rg_app_t *app = rg_system_get_app();
     if (app->isLauncher)
         memcpy(options + get_dialog_items_count(options), misc_options, sizeof(misc_options));
     else
@@ -1659,7 +1798,7 @@ void rg_gui_debug_menu(void)
     char screen_res[20], source_res[20], scaled_res[20];
     char stack_hwm[20], heap_free[20], block_free[20];
     char local_time[32], timezone[32], uptime[20];
-    char battery_info[25], frame_time[32];
+    char battery_info[25], frame_time[32], frame_pct[32];
     char app_name[32], network_str[64];
 
     const rg_gui_option_t options[] = {
@@ -1676,6 +1815,7 @@ void rg_gui_debug_menu(void)
         {0, "Uptime    ", uptime,       RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Battery   ", battery_info, RG_DIALOG_FLAG_NORMAL, NULL},
         {0, "Blit time ", frame_time,   RG_DIALOG_FLAG_NORMAL, NULL},
+        {0, "Frame p50/95/99", frame_pct, RG_DIALOG_FLAG_NORMAL, NULL},
         RG_DIALOG_SEPARATOR,
         {0, "Overclock", "-", RG_DIALOG_FLAG_NORMAL, &overclock_update_cb},
         {1, "Reboot to firmware", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
@@ -1685,6 +1825,11 @@ void rg_gui_debug_menu(void)
         {5, "Cheats    ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {6, "Crash     ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
         {7, "Log=debug ", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        {10, rg_system_get_telemetry() ? "Save telemetry " : "Start telemetry", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        #ifdef RG_ENABLE_PROFILING
+        {8, "Save profile", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        {9, rg_profile_trace_active() ? "Stop trace " : "Start trace", NULL, RG_DIALOG_FLAG_NORMAL, NULL},
+        #endif
         RG_DIALOG_END
     };
 
@@ -1706,6 +1851,8 @@ void rg_gui_debug_menu(void)
     }
     else
         snprintf(frame_time, 20, "N/A");
+    snprintf(frame_pct, 32, "%d/%d/%dms", (int)stats.frameTime.p50 / 1000, (int)stats.frameTime.p95 / 1000,
+             (int)stats.frameTime.p99 / 1000);
     snprintf(stack_hwm, 20, "%d", stats.freeStackMain);
     snprintf(heap_free, 20, "%d+%d", stats.freeMemoryInt, stats.freeMemoryExt);
     snprintf(block_free, 20, "%d+%d", stats.freeBlockInt, stats.freeBlockExt);
@@ -1753,6 +1900,24 @@ void rg_gui_debug_menu(void)
     case 7:
         rg_system_set_log_level(RG_LOG_DEBUG);
         break;
+    case 10:
+        if (rg_system_get_telemetry())
+        {
+            rg_system_save_telemetry(RG_STORAGE_ROOT "/telemetry.csv");
+            rg_system_set_telemetry(false);
+        }
+        else
+            rg_system_set_telemetry(true);
+        break;
+    #ifdef RG_ENABLE_PROFILING
+    case 8:
+        rg_profile_save_folded(RG_STORAGE_ROOT "/profile.folded");
+        break;
+    case 9:
+        if (!rg_profile_trace_stop())
+            rg_profile_trace_start(RG_STORAGE_ROOT "/profile.json");
+        break;
+    #endif
     }
 }
 
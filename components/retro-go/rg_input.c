@@ -43,6 +43,14 @@ static uint32_t gamepad_state = -1; // _Atomic
 static uint32_t gamepad_mapped = 0;
 static rg_battery_t battery_state = {0};
 
+// Input recording, one little-endian uint32 gamepad state per frame
+static struct
+{
+    FILE *fp;
+    bool recording;
+    uint32_t state;
+} movie;
+
 #define UPDATE_GLOBAL_MAP(keymap)                 \
     for (size_t i = 0; i < RG_COUNT(keymap); ++i) \
         gamepad_mapped |= keymap[i].key;          \
@@ -377,9 +385,55 @@ uint32_t rg_input_read_gamepad(void)
 #ifdef RG_TARGET_SDL2
     SDL_PumpEvents();
 #endif
+    if (movie.fp && !movie.recording)
+        return movie.state;
+    if (movie.fp)
+        movie.state = gamepad_state & ~(RG_KEY_MENU | RG_KEY_OPTION); // Menus can't be replayed
     return gamepad_state;
 }
 
+bool rg_input_movie_open(const char *filename, bool record)
+{
+    rg_input_movie_close();
+
+    if (!(movie.fp = fopen(filename, record ? "wb" : "rb")))
+    {
+        RG_LOGE("Failed to open input movie '%s'\n", filename);
+        return false;
+    }
+
+    movie.recording = record;
+    movie.state = 0;
+    if (!record)
+        rg_input_movie_step(); // Load the first frame
+
+    RG_LOGI("Input movie '%s' opened for %s.\n", filename, record ? "recording" : "playback");
+    return true;
+}
+
+void rg_input_movie_close(void)
+{
+    if (movie.fp)
+        fclose(movie.fp);
+    movie.fp = NULL;
+}
+
+void rg_input_movie_step(void)
+{
+    if (!movie.fp)
+        return;
+
+    if (movie.recording)
+    {
+        fwrite(&movie.state, sizeof(movie.state), 1, movie.fp);
+    }
+    else if (fread(&movie.state, sizeof(movie.state), 1, movie.fp) != 1)
+    {
+        // Past the end of the recording nothing is pressed
+        movie.state = 0;
+    }
+}
+
 bool rg_input_key_is_pressed(rg_key_t mask)
 {
     return (bool)(rg_input_read_gamepad() & mask);
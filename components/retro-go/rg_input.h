@@ -106,3 +106,8 @@ rg_battery_t rg_input_read_battery(void);
 bool rg_input_read_gamepad_raw(uint32_t *out);
 bool rg_input_read_keyboard_raw(int *out);
 bool rg_input_read_battery_raw(rg_battery_t *out);
+
+// Input movies hold the gamepad state of each frame (ie each rg_system_tick) for deterministic replays
+bool rg_input_movie_open(const char *filename, bool record);
+void rg_input_movie_close(void);
+void rg_input_movie_step(void);
@@ -5,13 +5,339 @@
 #include <string.h>
 #include <cJSON.h>
 
-static cJSON *config_root = NULL;
+// The JSON files in RG_BASE_PATH_CONFIG remain the reference (users edit them), the shadow is a
+// pre-parsed copy that is only trusted if the JSON file's size and mtime haven't changed since.
+#define SHADOW_MAGIC 0x21112226
+#define SHADOW_PATH  RG_BASE_PATH_CACHE "/settings_%s.bin"
+#define COMMIT_DELAY 250000 // us, to coalesce the bursts of changes made by menus
+
+typedef enum
+{
+    SETTING_NONE = 0, // Deleted or never set, the handle stays valid
+    SETTING_NULL,
+    SETTING_BOOL,
+    SETTING_NUMBER,
+    SETTING_STRING,
+    SETTING_JSON, // Arrays and objects we don't interpret, kept as JSON text
+} setting_type_t;
+
+typedef struct settings_ns_s settings_ns_t;
+
+struct rg_setting_s
+{
+    char *key;
+    uint32_t hash;
+    uint8_t type;
+    union
+    {
+        bool boolean;
+        double number;
+        char *string;
+    };
+    settings_ns_t *ns;
+};
+
+struct settings_ns_s
+{
+    char *name;
+    rg_setting_t **entries; // In insertion order, so that the files don't get shuffled around
+    size_t count, capacity;
+    rg_setting_t **table;   // Open addressing, table_size is a power of two
+    size_t table_size;
+    bool dirty;             // JSON file needs to be written
+    bool shadow_dirty;      // Shadow needs to be (re)written
+    settings_ns_t *next;
+};
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t json_size;
+    int64_t json_mtime;
+    uint32_t count;
+    // Followed by count records of: type (u8), key_len (u8), value_len (u16), key, value
+} shadow_header_t;
+
+static struct
+{
+    settings_ns_t *namespaces;
+    settings_ns_t *special[5]; // NS_GLOBAL..NS_BOOT
+    const char *special_name[5];
+    rg_mutex_t *lock;
+    rg_mutex_t *write_lock;
+    rg_task_t *task;
+    int64_t commit_time;
+    bool commit_pending;
+    bool initialized;
+} settings;
 static bool safe_mode = false;
 
 
-static cJSON *json_root(const char *name, bool set_dirty)
+static uint32_t hash_key(const char *key)
 {
-    if (!config_root)
+    uint32_t hash = 2166136261u; // FNV-1a
+    while (*key)
+        hash = (hash ^ (uint8_t)*key++) * 16777619u;
+    return hash;
+}
+
+static void clear_value(rg_setting_t *entry)
+{
+    if (entry->type == SETTING_STRING || entry->type == SETTING_JSON)
+        free(entry->string);
+    entry->type = SETTING_NONE;
+    entry->string = NULL;
+}
+
+static rg_setting_t *find_entry(settings_ns_t *ns, const char *key, bool create)
+{
+    uint32_t hash = hash_key(key);
+
+    for (size_t i = hash & (ns->table_size - 1);; i = (i + 1) & (ns->table_size - 1))
+    {
+        rg_setting_t *entry = ns->table[i];
+        if (!entry)
+            break;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            return entry;
+    }
+
+    if (!create)
+        return NULL;
+
+    // Grow at 75% load, entries are allocated individually so handles never move
+    if ((ns->count + 1) * 4 > ns->table_size * 3)
+    {
+        size_t table_size = ns->table_size * 2;
+        rg_setting_t **table = calloc(table_size, sizeof(rg_setting_t *));
+        RG_ASSERT(table, "Out of memory");
+        for (size_t i = 0; i < ns->count; i++)
+        {
+            size_t j = ns->entries[i]->hash & (table_size - 1);
+            while (table[j])
+                j = (j + 1) & (table_size - 1);
+            table[j] = ns->entries[i];
+        }
+        free(ns->table);
+        ns->table = table;
+        ns->table_size = table_size;
+    }
+
+    if (ns->count == ns->capacity)
+    {
+        ns->capacity = ns->capacity ? ns->capacity * 2 : 16;
+        ns->entries = realloc(ns->entries, ns->capacity * sizeof(rg_setting_t *));
+        RG_ASSERT(ns->entries, "Out of memory");
+    }
+
+    rg_setting_t *entry = calloc(1, sizeof(rg_setting_t));
+    RG_ASSERT(entry, "Out of memory");
+    entry->key = strdup(key);
+    entry->hash = hash;
+    entry->ns = ns;
+
+    size_t i = hash & (ns->table_size - 1);
+    while (ns->table[i])
+        i = (i + 1) & (ns->table_size - 1);
+    ns->table[i] = entry;
+    ns->entries[ns->count++] = entry;
+
+    return entry;
+}
+
+static void import_json(settings_ns_t *ns, cJSON *values)
+{
+    for (cJSON *item = values->child; item; item = item->next)
+    {
+        if (!item->string)
+            continue;
+        rg_setting_t *entry = find_entry(ns, item->string, true);
+        clear_value(entry);
+        if (cJSON_IsBool(item))
+            entry->type = SETTING_BOOL, entry->boolean = cJSON_IsTrue(item);
+        else if (cJSON_IsNumber(item))
+            entry->type = SETTING_NUMBER, entry->number = item->valuedouble;
+        else if (cJSON_IsString(item))
+            entry->type = SETTING_STRING, entry->string = strdup(item->valuestring);
+        else if (cJSON_IsNull(item))
+            entry->type = SETTING_NULL;
+        else if ((entry->string = cJSON_PrintUnformatted(item)))
+            entry->type = SETTING_JSON;
+    }
+}
+
+static char *export_json(settings_ns_t *ns)
+{
+    cJSON *values = cJSON_CreateObject();
+
+    for (size_t i = 0; i < ns->count; i++)
+    {
+        rg_setting_t *entry = ns->entries[i];
+        cJSON *item = NULL;
+        if (entry->type == SETTING_BOOL)
+            item = cJSON_CreateBool(entry->boolean);
+        else if (entry->type == SETTING_NUMBER)
+            item = cJSON_CreateNumber(entry->number);
+        else if (entry->type == SETTING_STRING)
+            item = cJSON_CreateString(entry->string);
+        else if (entry->type == SETTING_NULL)
+            item = cJSON_CreateNull();
+        else if (entry->type == SETTING_JSON)
+            item = cJSON_Parse(entry->string) ?: cJSON_CreateNull();
+        if (item)
+            cJSON_AddItemToObject(values, entry->key, item);
+    }
+
+    char *buffer = cJSON_Print(values);
+    cJSON_Delete(values);
+    return buffer;
+}
+
+static bool import_shadow(settings_ns_t *ns, const uint8_t *data, size_t data_len, const rg_stat_t *json)
+{
+    const shadow_header_t *header = (const shadow_header_t *)data;
+
+    if (data_len < sizeof(shadow_header_t) || header->magic != SHADOW_MAGIC
+        || header->json_size != json->size || header->json_mtime != (int64_t)json->mtime)
+        return false;
+
+    const uint8_t *ptr = data + sizeof(shadow_header_t), *end = data + data_len;
+    char key[256];
+
+    for (size_t i = 0; i < header->count; i++)
+    {
+        if (end - ptr < 4)
+            return false;
+        uint8_t type = ptr[0], key_len = ptr[1];
+        uint16_t value_len = ptr[2] | (ptr[3] << 8);
+        ptr += 4;
+        if (end - ptr < key_len + value_len)
+            return false;
+        memcpy(key, ptr, key_len);
+        key[key_len] = 0;
+        ptr += key_len;
+
+        rg_setting_t *entry = find_entry(ns, key, true);
+        clear_value(entry);
+        if (type == SETTING_BOOL && value_len == 1)
+            entry->boolean = ptr[0];
+        else if (type == SETTING_NUMBER && value_len == sizeof(double))
+            memcpy(&entry->number, ptr, sizeof(double));
+        else if ((type == SETTING_STRING || type == SETTING_JSON) && value_len > 0 && !ptr[value_len - 1])
+            entry->string = strdup((const char *)ptr);
+        else if (type != SETTING_NULL || value_len != 0)
+            return false;
+        entry->type = type;
+        ptr += value_len;
+    }
+
+    return true;
+}
+
+static void *export_shadow(settings_ns_t *ns, size_t *out_len)
+{
+    size_t size = sizeof(shadow_header_t), count = 0;
+
+    for (size_t i = 0; i < ns->count; i++)
+    {
+        rg_setting_t *entry = ns->entries[i];
+        if (entry->type == SETTING_NONE)
+            continue;
+        if (strlen(entry->key) > 255)
+            return NULL;
+        size += 4 + strlen(entry->key) + sizeof(double);
+        if (entry->type == SETTING_STRING || entry->type == SETTING_JSON)
+            size += strlen(entry->string) + 1;
+    }
+
+    uint8_t *data = malloc(size), *ptr = data + sizeof(shadow_header_t);
+    if (!data)
+        return NULL;
+
+    for (size_t i = 0; i < ns->count; i++)
+    {
+        rg_setting_t *entry = ns->entries[i];
+        size_t key_len = strlen(entry->key), value_len = 0;
+        const void *value = NULL;
+
+        if (entry->type == SETTING_NONE)
+            continue;
+        else if (entry->type == SETTING_BOOL)
+            value = &entry->boolean, value_len = 1;
+        else if (entry->type == SETTING_NUMBER)
+            value = &entry->number, value_len = sizeof(double);
+        else if (entry->type == SETTING_STRING || entry->type == SETTING_JSON)
+            value = entry->string, value_len = strlen(entry->string) + 1;
+
+        if (value_len > 0xFFFF)
+        {
+            free(data);
+            return NULL;
+        }
+
+        ptr[0] = entry->type;
+        ptr[1] = key_len;
+        ptr[2] = value_len & 0xFF;
+        ptr[3] = value_len >> 8;
+        memcpy(ptr + 4, entry->key, key_len);
+        if (value_len)
+            memcpy(ptr + 4 + key_len, value, value_len);
+        ptr += 4 + key_len + value_len;
+        count++;
+    }
+
+    *(shadow_header_t *)data = (shadow_header_t){SHADOW_MAGIC, 0, 0, count};
+    *out_len = ptr - data;
+    return data;
+}
+
+static void load_namespace(settings_ns_t *ns)
+{
+    char json_path[RG_PATH_MAX], shadow_path[RG_PATH_MAX];
+    snprintf(json_path, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, ns->name);
+    snprintf(shadow_path, RG_PATH_MAX, SHADOW_PATH, ns->name);
+
+    rg_stat_t json = rg_storage_stat(json_path);
+    if (!json.exists)
+        return;
+
+    char *data; size_t data_len;
+    if (rg_storage_read_file(shadow_path, (void **)&data, &data_len, 0))
+    {
+        bool success = import_shadow(ns, (uint8_t *)data, data_len, &json);
+        free(data);
+        if (success)
+        {
+            RG_LOGI("Config shadow loaded: '%s'", shadow_path);
+            return;
+        }
+        // A partial import is fine, the JSON file will overwrite every value
+    }
+
+    if (rg_storage_read_file(json_path, (void **)&data, &data_len, 0))
+    {
+        cJSON *values = cJSON_Parse(data);
+        if (!values) // Parse failure, clean the markup and try again
+            values = cJSON_Parse(rg_json_fixup(data));
+        if (cJSON_IsObject(values))
+        {
+            RG_LOGI("Config file loaded: '%s'", json_path);
+            import_json(ns, values);
+            ns->shadow_dirty = true;
+        }
+        else
+            RG_LOGE("Config file parsing failed: '%s'", json_path);
+        cJSON_Delete(values);
+        free(data);
+    }
+}
+
+static settings_ns_t *get_namespace(const char *name)
+{
+    const char *special = name;
+    size_t index = (uintptr_t)name;
+
+    if (!settings.initialized)
         return NULL;
 
     if (name == NS_GLOBAL)
@@ -25,156 +351,319 @@ static cJSON *json_root(const char *name, bool set_dirty)
     else if (name == NS_BOOT)
         name = "boot";
 
-    cJSON *branch = cJSON_GetObjectItem(config_root, name);
-    if (!branch)
+    // Special namespaces are cached, as long as what they point to doesn't change (NS_APP/NS_FILE)
+    if (special != name && settings.special[index] && settings.special_name[index] == name)
+        return settings.special[index];
+
+    settings_ns_t *ns = settings.namespaces;
+    while (ns && strcmp(ns->name, name) != 0)
+        ns = ns->next;
+
+    if (!ns)
     {
-        branch = cJSON_AddObjectToObject(config_root, name);
-        cJSON_AddStringToObject(branch, "namespace", name);
-        cJSON_AddNumberToObject(branch, "changed", 0);
+        ns = calloc(1, sizeof(settings_ns_t));
+        RG_ASSERT(ns, "Out of memory");
+        ns->name = strdup(name);
+        ns->table_size = 32;
+        ns->table = calloc(ns->table_size, sizeof(rg_setting_t *));
+        ns->next = settings.namespaces;
+        settings.namespaces = ns;
         if (!safe_mode)
-        {
-            char *data; size_t data_len;
-            char pathbuf[RG_PATH_MAX];
-            snprintf(pathbuf, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, name);
-            if (rg_storage_read_file(pathbuf, (void **)&data, &data_len, 0))
-            {
-                cJSON *values = cJSON_Parse(data);
-                if (!values) // Parse failure, clean the markup and try again
-                    values = cJSON_Parse(rg_json_fixup(data));
-                if (values)
-                {
-                    RG_LOGI("Config file loaded: '%s'", pathbuf);
-                    cJSON_AddItemToObject(branch, "values", values);
-                }
-                else
-                    RG_LOGE("Config file parsing failed: '%s'", pathbuf);
-                free(data);
-            }
-        }
+            load_namespace(ns);
     }
 
-    cJSON *root = cJSON_GetObjectItem(branch, "values");
-    if (!cJSON_IsObject(root))
+    if (special != name)
     {
-        cJSON_DeleteItemFromObject(branch, "values");
-        root = cJSON_AddObjectToObject(branch, "values");
+        settings.special[index] = ns;
+        settings.special_name[index] = name;
     }
 
-    if (set_dirty)
+    return ns;
+}
+
+static bool write_file(const char *path, const void *data, size_t data_len)
+{
+    return rg_storage_write_file(path, data, data_len, RG_FILE_ATOMIC_WRITE) ||
+           (rg_storage_mkdir(rg_dirname(path)) && rg_storage_write_file(path, data, data_len, RG_FILE_ATOMIC_WRITE));
+}
+
+static void write_namespaces(void)
+{
+    bool written = false;
+
+    rg_mutex_take(settings.write_lock, -1);
+
+    for (settings_ns_t *ns = settings.namespaces; ns; ns = ns->next)
     {
-        cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 1);
+        char json_path[RG_PATH_MAX], shadow_path[RG_PATH_MAX];
+        size_t shadow_len = 0;
+
+        // Serialize under the lock but do the slow SD card access without it
+        rg_mutex_take(settings.lock, -1);
+        bool write_json = ns->dirty, write_shadow = ns->dirty || ns->shadow_dirty;
+        char *json = write_json ? export_json(ns) : NULL;
+        void *shadow = write_shadow ? export_shadow(ns, &shadow_len) : NULL;
+        ns->dirty = ns->shadow_dirty = false;
+        rg_mutex_give(settings.lock);
+
+        if (!write_json && !write_shadow)
+            continue;
+
+        snprintf(json_path, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, ns->name);
+        snprintf(shadow_path, RG_PATH_MAX, SHADOW_PATH, ns->name);
+
+        if (write_json && !(json && write_file(json_path, json, strlen(json) + 1)))
+        {
+            RG_LOGE("Failed to save config file: '%s'", json_path);
+            rg_mutex_take(settings.lock, -1);
+            ns->dirty = true;
+            rg_mutex_give(settings.lock);
+        }
+        else if (shadow)
+        {
+            rg_stat_t info = rg_storage_stat(json_path);
+            ((shadow_header_t *)shadow)->json_size = info.size;
+            ((shadow_header_t *)shadow)->json_mtime = info.mtime;
+            if (!info.exists || !write_file(shadow_path, shadow, shadow_len))
+                rg_storage_delete(shadow_path);
+        }
+        else
+        {
+            rg_storage_delete(shadow_path);
+        }
+
+        cJSON_free(json);
+        free(shadow);
+        written = true;
     }
 
-    return root;
+    if (written)
+        rg_storage_commit();
+
+    rg_mutex_give(settings.write_lock);
+}
+
+static void settings_task(void *arg)
+{
+    rg_task_msg_t msg;
+
+    // Sleeps until rg_settings_commit wakes us, then waits for the burst of changes to settle
+    while (rg_task_receive(&msg) && msg.type != RG_TASK_MSG_STOP)
+    {
+        while (true)
+        {
+            rg_mutex_take(settings.lock, -1);
+            bool pending = settings.commit_pending;
+            int64_t wait = settings.commit_time + COMMIT_DELAY - rg_system_timer();
+            if (pending && wait <= 0)
+                settings.commit_pending = false;
+            rg_mutex_give(settings.lock);
+
+            if (!pending)
+                break;
+            if (wait <= 0)
+            {
+                write_namespaces();
+                break;
+            }
+            rg_task_delay(wait / 1000 + 1);
+        }
+    }
 }
 
-static void update_value(const char *section, const char *key, cJSON *new_value)
+static void set_value(rg_setting_t *entry, setting_type_t type, bool boolean, double number, const char *string)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (obj == NULL)
-        cJSON_AddItemToObject(json_root(section, 1), key, new_value);
-    else if (!cJSON_Compare(obj, new_value, true))
-        cJSON_ReplaceItemInObject(json_root(section, 1), key, new_value);
-    else
-        cJSON_Delete(new_value);
+    if (!entry)
+        return;
+
+    rg_mutex_take(settings.lock, -1);
+    bool changed = entry->type != type
+        || (type == SETTING_BOOL && entry->boolean != boolean)
+        || (type == SETTING_NUMBER && entry->number != number)
+        || (type == SETTING_STRING && strcmp(entry->string, string) != 0);
+    if (changed)
+    {
+        clear_value(entry);
+        entry->type = type;
+        if (type == SETTING_BOOL)
+            entry->boolean = boolean;
+        else if (type == SETTING_NUMBER)
+            entry->number = number;
+        else if (type == SETTING_STRING)
+            entry->string = strdup(string);
+        entry->ns->dirty = true;
+    }
+    rg_mutex_give(settings.lock);
 }
 
 void rg_settings_init(bool _safe_mode)
 {
-    config_root = cJSON_CreateObject();
     safe_mode = _safe_mode;
-    json_root(NS_GLOBAL, 0);
-    json_root(NS_BOOT, 0);
+    settings.lock = rg_mutex_create();
+    settings.write_lock = rg_mutex_create();
+    settings.initialized = true;
+    get_namespace(NS_GLOBAL);
+    get_namespace(NS_BOOT);
+    if (!safe_mode)
+        settings.task = rg_task_create("rg_settings", &settings_task, NULL, 4 * 1024, RG_TASK_PRIORITY_1, -1);
 }
 
 void rg_settings_commit(void)
 {
-    if (!config_root || safe_mode)
+    if (!settings.initialized || safe_mode)
         return;
 
-    for (cJSON *branch = config_root->child; branch; branch = branch->next)
-    {
-        char *name = cJSON_GetStringValue(cJSON_GetObjectItem(branch, "namespace"));
-        int changed = cJSON_GetNumberValue(cJSON_GetObjectItem(branch, "changed"));
-
-        if (!changed)
-            continue;
-
-        char *buffer = cJSON_Print(cJSON_GetObjectItem(branch, "values"));
-        if (!buffer)
-            continue;
+    rg_mutex_take(settings.lock, -1);
+    settings.commit_pending = true;
+    settings.commit_time = rg_system_timer();
+    rg_mutex_give(settings.lock);
 
-        size_t buffer_len = strlen(buffer) + 1;
+    // If a wake up is already waiting the task will see our change too, no need to block on its slot
+    if (settings.task && rg_task_messages_waiting(settings.task) == 0)
+        rg_task_send(settings.task, &(rg_task_msg_t){0});
+}
 
-        char pathbuf[RG_PATH_MAX];
-        snprintf(pathbuf, RG_PATH_MAX, "%s/%s.json", RG_BASE_PATH_CONFIG, name);
-        if (rg_storage_write_file(pathbuf, buffer, buffer_len, 0) ||
-            (rg_storage_mkdir(rg_dirname(pathbuf)) && rg_storage_write_file(pathbuf, buffer, buffer_len, 0)))
-        {
-            cJSON_SetNumberHelper(cJSON_GetObjectItem(branch, "changed"), 0);
-        }
+void rg_settings_flush(void)
+{
+    if (!settings.initialized || safe_mode)
+        return;
 
-        cJSON_free(buffer);
-    }
+    rg_mutex_take(settings.lock, -1);
+    settings.commit_pending = false;
+    rg_mutex_give(settings.lock);
 
-    rg_storage_commit();
+    write_namespaces();
 }
 
 void rg_settings_reset(void)
 {
     RG_LOGI("Clearing settings...\n");
+
+    rg_mutex_take(settings.write_lock, -1);
     rg_storage_delete(RG_BASE_PATH_CONFIG);
     rg_storage_mkdir(RG_BASE_PATH_CONFIG);
-    if (config_root)
+    rg_mutex_take(settings.lock, -1);
+    for (settings_ns_t *ns = settings.namespaces; ns; ns = ns->next)
     {
-        cJSON_Delete(config_root);
-        config_root = cJSON_CreateObject();
+        for (size_t i = 0; i < ns->count; i++)
+            clear_value(ns->entries[i]);
+        ns->dirty = ns->shadow_dirty = false;
     }
+    settings.commit_pending = false;
+    rg_mutex_give(settings.lock);
+    rg_mutex_give(settings.write_lock);
+}
+
+rg_setting_t *rg_settings_find(const char *section, const char *key)
+{
+    if (!settings.initialized)
+        return NULL;
+
+    rg_mutex_take(settings.lock, -1);
+    settings_ns_t *ns = get_namespace(section);
+    rg_setting_t *entry = ns ? find_entry(ns, key, true) : NULL;
+    rg_mutex_give(settings.lock);
+    return entry;
+}
+
+bool rg_setting_get_boolean(const rg_setting_t *setting, bool default_value)
+{
+    if (setting && setting->type == SETTING_NUMBER) // Backwards compatible with plain numbers
+        return setting->number != 0;
+    return (setting && setting->type == SETTING_BOOL) ? setting->boolean : default_value;
+}
+
+void rg_setting_set_boolean(rg_setting_t *setting, bool value)
+{
+    set_value(setting, SETTING_BOOL, value, 0, NULL);
+}
+
+double rg_setting_get_number(const rg_setting_t *setting, double default_value)
+{
+    return (setting && setting->type == SETTING_NUMBER) ? setting->number : default_value;
+}
+
+void rg_setting_set_number(rg_setting_t *setting, double value)
+{
+    set_value(setting, SETTING_NUMBER, false, value, NULL);
+}
+
+char *rg_setting_get_string(const rg_setting_t *setting, const char *default_value)
+{
+    char *value = NULL;
+    if (setting)
+    {
+        rg_mutex_take(settings.lock, -1);
+        if (setting->type == SETTING_STRING)
+            value = strdup(setting->string);
+        rg_mutex_give(settings.lock);
+    }
+    if (!value && default_value)
+        value = strdup(default_value);
+    return value;
+}
+
+void rg_setting_set_string(rg_setting_t *setting, const char *value)
+{
+    set_value(setting, value ? SETTING_STRING : SETTING_NULL, false, 0, value);
+}
+
+static rg_setting_t *lookup(const char *section, const char *key)
+{
+    if (!settings.initialized)
+        return NULL;
+
+    rg_mutex_take(settings.lock, -1);
+    settings_ns_t *ns = get_namespace(section);
+    rg_setting_t *entry = ns ? find_entry(ns, key, false) : NULL;
+    rg_mutex_give(settings.lock);
+    return entry;
 }
 
 bool rg_settings_get_boolean(const char *section, const char *key, bool default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (cJSON_IsNumber(obj)) // Backwards compatible with plain numbers
-        return obj->valueint != 0;
-    return cJSON_IsBool(obj) ? cJSON_IsTrue(obj) : default_value;
+    return rg_setting_get_boolean(lookup(section, key), default_value);
 }
 
 void rg_settings_set_boolean(const char *section, const char *key, bool value)
 {
-    update_value(section, key, cJSON_CreateBool(value));
+    rg_setting_set_boolean(rg_settings_find(section, key), value);
 }
 
 double rg_settings_get_number(const char *section, const char *key, double default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    return cJSON_IsNumber(obj) ? obj->valuedouble : default_value;
+    return rg_setting_get_number(lookup(section, key), default_value);
 }
 
 void rg_settings_set_number(const char *section, const char *key, double value)
 {
-    update_value(section, key, cJSON_CreateNumber(value));
+    rg_setting_set_number(rg_settings_find(section, key), value);
 }
 
 char *rg_settings_get_string(const char *section, const char *key, const char *default_value)
 {
-    cJSON *obj = cJSON_GetObjectItem(json_root(section, 0), key);
-    if (cJSON_IsString(obj))
-        return strdup(obj->valuestring);
-    return default_value ? strdup(default_value) : NULL;
+    return rg_setting_get_string(lookup(section, key), default_value);
 }
 
 void rg_settings_set_string(const char *section, const char *key, const char *value)
 {
-    update_value(section, key, value ? cJSON_CreateString(value) : cJSON_CreateNull());
+    rg_setting_set_string(rg_settings_find(section, key), value);
 }
 
 void rg_settings_delete(const char *section, const char *key)
 {
-    cJSON_DeleteItemFromObject(json_root(section, 1), key);
+    rg_setting_t *entry = lookup(section, key);
+    if (entry && entry->type != SETTING_NONE)
+    {
+        rg_mutex_take(settings.lock, -1);
+        clear_value(entry);
+        entry->ns->dirty = true;
+        rg_mutex_give(settings.lock);
+    }
 }
 
 bool rg_settings_exists(const char *section, const char *key)
 {
-    return cJSON_GetObjectItem(json_root(section, 0), key) != NULL;
+    rg_setting_t *entry = lookup(section, key);
+    return entry && entry->type != SETTING_NONE;
 }
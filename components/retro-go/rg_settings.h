@@ -10,9 +10,13 @@
 #define NS_WIFI   ((char *)3)
 #define NS_BOOT   ((char *)4)
 
+typedef struct rg_setting_s rg_setting_t;
+
 // Safe mode means no loading/saving config files
 void rg_settings_init(bool safe_mode);
+// Schedules a write of the modified namespaces in the background, rg_settings_flush writes them now
 void rg_settings_commit(void);
+void rg_settings_flush(void);
 void rg_settings_reset(void);
 bool rg_settings_get_boolean(const char *section, const char *key, bool default_value);
 void rg_settings_set_boolean(const char *section, const char *key, bool value);
@@ -22,3 +26,12 @@ char *rg_settings_get_string(const char *section, const char *key, const char *d
 void rg_settings_set_string(const char *section, const char *key, const char *value);
 void rg_settings_delete(const char *section, const char *key);
 bool rg_settings_exists(const char *section, const char *key);
+
+// Handles resolve the key once and stay valid until reboot (even through reset/delete)
+rg_setting_t *rg_settings_find(const char *section, const char *key);
+bool rg_setting_get_boolean(const rg_setting_t *setting, bool default_value);
+void rg_setting_set_boolean(rg_setting_t *setting, bool value);
+double rg_setting_get_number(const rg_setting_t *setting, double default_value);
+void rg_setting_set_number(rg_setting_t *setting, double value);
+char *rg_setting_get_string(const rg_setting_t *setting, const char *default_value);
+void rg_setting_set_string(rg_setting_t *setting, const char *value);
@@ -510,8 +510,9 @@ bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_l
 
 /**
  * This is a minimal UNZIP implementation that utilizes only the miniz primitives found in ESP32's ROM.
- * I think that we should use miniz' ZIP API instead and bundle miniz with retro-go. But first I need
- * to do some testing to determine if the increased executable size is acceptable...
+ * It locates the entry through the central directory. rg_storage_unzip_file inflates it straight into
+ * the output buffer, rg_storage_zip_read streams it through a 32KB wrapping window instead so that
+ * callers can inflate it piece by piece to its final destination.
  */
 #if RG_ZIP_SUPPORT
 
@@ -521,134 +522,368 @@ bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_l
 #include <miniz.h>
 #endif
 
-#define ZIP_MAGIC 0x04034b50
-typedef struct __attribute__((packed))
+#define ZIP_LOCAL_MAGIC   0x04034b50
+#define ZIP_CENTRAL_MAGIC 0x02014b50
+#define ZIP_EOCD_MAGIC    0x06054b50
+#define ZIP_EOCD_SIZE     22
+#define ZIP_READ_BUFFER   0x4000
+
+// Only allocated by the first rg_storage_zip_read of a deflated entry
+typedef struct
 {
-    uint32_t magic;
-    uint16_t version;
-    uint16_t flags;
-    uint16_t compression;
-    uint16_t modified_time;
-    uint16_t modified_date;
-    uint32_t checksum;
-    uint32_t compressed_size;
-    uint32_t uncompressed_size;
-    uint16_t filename_size;
-    uint16_t extra_field_size;
-    uint8_t filename[226];
-    // uint8_t extra_field[];
-    // uint8_t compressed_data[];
-} zip_header_t;
+    tinfl_decompressor decomp;
+    tinfl_status status;
+    size_t in_pos, in_avail;
+    size_t dict_pos, dict_avail;
+    uint8_t in_buffer[ZIP_READ_BUFFER];
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+} zip_stream_t;
 
-bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+struct rg_zip_s
+{
+    FILE *fp;
+    char name[RG_PATH_MAX + 1];
+    int compression;
+    size_t uncompressed_size;
+    size_t compressed_remaining;
+    size_t remaining;
+    zip_stream_t *stream;
+};
+
+#define READ_LE16(p) ((p)[0] | ((p)[1] << 8))
+#define READ_LE32(p) ((uint32_t)READ_LE16(p) | ((uint32_t)READ_LE16((p) + 2) << 16))
+
+static bool zip_filter_match(const char *name, const char *filter)
+{
+    if (!filter || !*filter)
+        return true;
+    return strcasecmp(rg_basename(name), filter) == 0 || rg_extension_match(name, filter);
+}
+
+static long zip_find_central_directory(FILE *fp, size_t *entries)
+{
+    uint8_t buffer[1024];
+
+    if (fseek(fp, 0, SEEK_END) != 0)
+        return -1;
+
+    long file_size = ftell(fp);
+    long search_end = file_size;
+    long search_limit = RG_MAX(0, file_size - 0xFFFF - ZIP_EOCD_SIZE);
+
+    // The end of central directory record is at the end, followed only by an optional comment
+    while (search_end > search_limit)
+    {
+        long start = RG_MAX(search_limit, search_end - (long)sizeof(buffer));
+        size_t length = search_end - start;
+        if (fseek(fp, start, SEEK_SET) != 0 || fread(buffer, length, 1, fp) != 1)
+            return -1;
+        for (int i = (int)length - ZIP_EOCD_SIZE; i >= 0; --i)
+        {
+            if (READ_LE32(buffer + i) == ZIP_EOCD_MAGIC)
+            {
+                *entries = READ_LE16(buffer + i + 10);
+                return READ_LE32(buffer + i + 16);
+            }
+        }
+        // Records may straddle two blocks
+        search_end = start + ZIP_EOCD_SIZE - 1;
+        if (start == search_limit)
+            break;
+    }
+
+    return -1;
+}
+
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter, size_t *size_out)
 {
-    RG_ASSERT_ARG(data_out && data_len);
     CHECK_PATH(zip_path);
 
-    zip_header_t header = {0};
-    int header_pos = 0;
+    rg_zip_t *zip = calloc(1, sizeof(rg_zip_t));
+    if (!zip)
+    {
+        RG_LOGE("Memory allocation failed: '%s'", zip_path);
+        return NULL;
+    }
 
-    FILE *fp = fopen(zip_path, "rb");
-    if (!fp)
+    if (!(zip->fp = fopen(zip_path, "rb")))
     {
         RG_LOGE("Fopen failed (%d): '%s'", errno, zip_path);
-        return false;
+        free(zip);
+        return NULL;
     }
 
-    // Very inefficient, we should read a block at a time and search it for a header. But I'm lazy.
-    // Thankfully the header is usually found on the very first read :)
-    for (header_pos = 0; !feof(fp) && header_pos < 0x10000; ++header_pos)
+    size_t entries = 0;
+    long offset = zip_find_central_directory(zip->fp, &entries);
+    long local_offset = -1;
+    uint8_t header[46];
+
+    if (offset < 0 || fseek(zip->fp, offset, SEEK_SET) != 0)
     {
-        fseek(fp, header_pos, SEEK_SET);
-        fread(&header, sizeof(header), 1, fp);
-        if (header.magic == ZIP_MAGIC)
+        RG_LOGE("No central directory found: '%s'", zip_path);
+        goto _fail;
+    }
+
+    for (size_t i = 0; i < entries; ++i)
+    {
+        if (fread(header, sizeof(header), 1, zip->fp) != 1 || READ_LE32(header) != ZIP_CENTRAL_MAGIC)
+            break;
+
+        size_t name_size = READ_LE16(header + 28);
+        size_t skip_size = READ_LE16(header + 30) + READ_LE16(header + 32);
+        char *name = zip->name;
+
+        if (fread(name, RG_MIN(name_size, RG_PATH_MAX), 1, zip->fp) != 1)
+            break;
+        name[RG_MIN(name_size, RG_PATH_MAX)] = 0;
+        skip_size += name_size - RG_MIN(name_size, RG_PATH_MAX);
+
+        // Skip directories, encrypted entries and non-matching files
+        if (name[0] && name[strlen(name) - 1] != '/' && !(READ_LE16(header + 8) & 1) && zip_filter_match(name, filter))
+        {
+            zip->compression = READ_LE16(header + 10);
+            zip->compressed_remaining = READ_LE32(header + 20);
+            zip->uncompressed_size = READ_LE32(header + 24);
+            local_offset = READ_LE32(header + 42);
+            break;
+        }
+
+        if (fseek(zip->fp, skip_size, SEEK_CUR) != 0)
             break;
     }
 
-    if (header.magic != ZIP_MAGIC)
+    if (local_offset < 0)
     {
-        RG_LOGE("No valid header found: '%s'", zip_path);
-        fclose(fp);
-        return false;
+        RG_LOGE("No matching file found: '%s' (filter: '%s')", zip_path, filter ?: "");
+        goto _fail;
+    }
+
+    if (zip->compression != 0 && zip->compression != 8)
+    {
+        RG_LOGE("Unsupported compression method %d: '%s'", zip->compression, zip_path);
+        goto _fail;
     }
 
-    // Zero terminate or truncate filename just in case
-    header.filename[RG_MIN(header.filename_size, 225)] = 0;
+    // The local header's extra field may differ from the central directory's
+    if (fseek(zip->fp, local_offset, SEEK_SET) != 0 || fread(header, 30, 1, zip->fp) != 1
+        || READ_LE32(header) != ZIP_LOCAL_MAGIC
+        || fseek(zip->fp, READ_LE16(header + 26) + READ_LE16(header + 28), SEEK_CUR) != 0)
+    {
+        RG_LOGE("Invalid local header at %ld: '%s'", local_offset, zip_path);
+        goto _fail;
+    }
 
-    RG_LOGI("Found file at %d, name: '%s', size: %d", header_pos, header.filename, (int)header.uncompressed_size);
+    RG_LOGI("Found file at %ld, name: '%s', size: %d", local_offset, zip->name, (int)zip->uncompressed_size);
 
-    size_t stream_offset = header_pos + 30 + header.filename_size + header.extra_field_size;
-    size_t stream_remaining = header.compressed_size;
-    size_t output_buffer_align = RG_MAX(0x1000, (flags & 0xF) * 0x2000);
-    size_t output_buffer_size;
-    size_t output_buffer_pos = 0;
-    uint8_t *output_buffer = NULL;
+    zip->remaining = zip->uncompressed_size;
 
-    if (flags & RG_FILE_USER_BUFFER)
+    if (size_out)
+        *size_out = zip->uncompressed_size;
+    return zip;
+
+_fail:
+    fclose(zip->fp);
+    free(zip);
+    return NULL;
+}
+
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t length)
+{
+    RG_ASSERT_ARG(zip && buffer);
+
+    length = RG_MIN(length, zip->remaining);
+
+    if (zip->compression == 0)
     {
-        output_buffer_size = RG_MIN(*data_len, header.uncompressed_size);
-        output_buffer = *data_out;
+        length = fread(buffer, 1, length, zip->fp);
+        zip->remaining -= length;
+        return length;
     }
-    else
+
+    zip_stream_t *stream = zip->stream;
+    size_t total = 0;
+
+    if (!stream)
     {
-        output_buffer_size = header.uncompressed_size;
-        output_buffer = malloc((output_buffer_size + (output_buffer_align - 1)) & ~(output_buffer_align - 1));
+        if (!(stream = zip->stream = malloc(sizeof(zip_stream_t))))
+        {
+            RG_LOGE("Memory allocation failed");
+            return 0;
+        }
+        tinfl_init(&stream->decomp);
+        stream->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+        stream->in_pos = stream->in_avail = 0;
+        stream->dict_pos = stream->dict_avail = 0;
+    }
+
+    while (total < length)
+    {
+        // Drain what was already inflated into the dictionary
+        if (stream->dict_avail > 0)
+        {
+            size_t chunk = RG_MIN(stream->dict_avail, length - total);
+            memcpy(buffer + total, stream->dict + stream->dict_pos, chunk);
+            stream->dict_pos = (stream->dict_pos + chunk) & (TINFL_LZ_DICT_SIZE - 1);
+            stream->dict_avail -= chunk;
+            total += chunk;
+            continue;
+        }
+
+        if (stream->status <= TINFL_STATUS_DONE)
+            break;
+
+        if (stream->in_avail == 0 && zip->compressed_remaining > 0)
+        {
+            size_t chunk = RG_MIN(zip->compressed_remaining, sizeof(stream->in_buffer));
+            if (fread(stream->in_buffer, chunk, 1, zip->fp) != 1)
+            {
+                RG_LOGE("Read error (%d)", errno);
+                break;
+            }
+            zip->compressed_remaining -= chunk;
+            stream->in_avail = chunk;
+            stream->in_pos = 0;
+        }
+
+        // The dictionary doubles as our output buffer, it wraps so tinfl only ever needs the last 32KB
+        size_t out_pos = (stream->dict_pos + stream->dict_avail) & (TINFL_LZ_DICT_SIZE - 1);
+        size_t in_size = stream->in_avail;
+        size_t out_size = TINFL_LZ_DICT_SIZE - out_pos;
+        stream->status = tinfl_decompress(&stream->decomp, stream->in_buffer + stream->in_pos, &in_size,
+                                          stream->dict, stream->dict + out_pos, &out_size,
+                                          zip->compressed_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+        stream->in_pos += in_size;
+        stream->in_avail -= in_size;
+        stream->dict_pos = out_pos;
+        stream->dict_avail = out_size;
+
+        if (stream->status < TINFL_STATUS_DONE)
+        {
+            RG_LOGE("Decompression failed (%d)", (int)stream->status);
+            break;
+        }
     }
 
+    zip->remaining -= total;
+    return total;
+}
+
+void rg_storage_zip_close(rg_zip_t *zip)
+{
+    if (!zip)
+        return;
+    fclose(zip->fp);
+    free(zip->stream);
+    free(zip);
+}
+
+// When the whole output is available tinfl can use it as its dictionary, no window or extra copy needed
+static bool zip_inflate_all(rg_zip_t *zip, uint8_t *output_buffer, size_t output_buffer_size)
+{
+    if (zip->compression == 0)
+        return rg_storage_zip_read(zip, output_buffer, output_buffer_size) == output_buffer_size;
+
     size_t read_buffer_size = 0x8000;
     uint8_t *read_buffer = malloc(read_buffer_size);
     tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
+    size_t output_buffer_pos = 0;
+    tinfl_status status = TINFL_STATUS_FAILED;
 
-    if (!read_buffer || !output_buffer || !decomp)
+    if (!read_buffer || !decomp)
     {
-        RG_LOGE("Memory allocation failed: '%s'", zip_path);
-        goto _fail;
+        RG_LOGE("Memory allocation failed");
+        goto _done;
     }
 
-    tinfl_status status;
     tinfl_init(decomp);
 
     do
     {
-        size_t input_size = RG_MIN(read_buffer_size, stream_remaining);
+        size_t input_size = RG_MIN(read_buffer_size, zip->compressed_remaining);
         size_t output_size = output_buffer_size - output_buffer_pos;
-        if (fseek(fp, stream_offset, SEEK_SET) != 0 || fread(read_buffer, input_size, 1, fp) != 1)
+        if (fread(read_buffer, input_size, 1, zip->fp) != 1)
         {
-            RG_LOGE("Read error (%d): '%s'", errno, zip_path);
-            goto _fail;
+            RG_LOGE("Read error (%d)", errno);
+            status = TINFL_STATUS_FAILED;
+            break;
         }
-        stream_offset += input_size;
-        stream_remaining -= input_size;
+        zip->compressed_remaining -= input_size;
         status = tinfl_decompress(
             decomp, read_buffer, &input_size, output_buffer, output_buffer + output_buffer_pos, &output_size,
-            TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (stream_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+            TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (zip->compressed_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0));
         output_buffer_pos += output_size;
     } while (status == TINFL_STATUS_NEEDS_MORE_INPUT);
 
+_done:
+    free(read_buffer);
+    free(decomp);
     // With user-provided buffer we might not reach TINFL_STATUS_DONE, but it doesn't mean we've failed
-    if (status < TINFL_STATUS_DONE || output_buffer_pos != output_buffer_size) // (status != TINFL_STATUS_DONE)
+    return status >= TINFL_STATUS_DONE && output_buffer_pos == output_buffer_size;
+}
+
+bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
+{
+    RG_ASSERT_ARG(data_out && data_len);
+    CHECK_PATH(zip_path);
+
+    size_t uncompressed_size;
+    rg_zip_t *zip = rg_storage_zip_open(zip_path, filter, &uncompressed_size);
+    if (!zip)
+        return false;
+
+    size_t output_buffer_align = RG_MAX(0x1000, (flags & 0xF) * 0x2000);
+    size_t output_buffer_size;
+    uint8_t *output_buffer = NULL;
+
+    if (flags & RG_FILE_USER_BUFFER)
     {
-        RG_LOGE("Decompression failed (%d): %s", (int)status, zip_path);
-        goto _fail;
+        output_buffer_size = RG_MIN(*data_len, uncompressed_size);
+        output_buffer = *data_out;
+    }
+    else
+    {
+        output_buffer_size = uncompressed_size;
+        output_buffer = malloc((output_buffer_size + (output_buffer_align - 1)) & ~(output_buffer_align - 1));
     }
 
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
+    if (!output_buffer)
+    {
+        RG_LOGE("Memory allocation failed: '%s'", zip_path);
+        rg_storage_zip_close(zip);
+        return false;
+    }
+
+    if (!zip_inflate_all(zip, output_buffer, output_buffer_size))
+    {
+        RG_LOGE("Decompression failed: '%s'", zip_path);
+        if (!(flags & RG_FILE_USER_BUFFER))
+            free(output_buffer);
+        rg_storage_zip_close(zip);
+        return false;
+    }
+
+    rg_storage_zip_close(zip);
 
     *data_out = output_buffer;
     *data_len = output_buffer_size;
     return true;
-
-_fail:
-    if (!(flags & RG_FILE_USER_BUFFER))
-        free(output_buffer);
-    free(read_buffer);
-    free(decomp);
-    fclose(fp);
-    return false;
 }
 #else
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter, size_t *size_out)
+{
+    RG_LOGE("ZIP support hasn't been enabled!");
+    return NULL;
+}
+
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t length)
+{
+    return 0;
+}
+
+void rg_storage_zip_close(rg_zip_t *zip)
+{
+}
+
 bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags)
 {
     RG_LOGE("ZIP support hasn't been enabled!");
@@ -77,4 +77,11 @@ enum
 };
 bool rg_storage_read_file(const char *path, void **data_out, size_t *data_len, uint32_t flags);
 bool rg_storage_write_file(const char *path, const void *data_ptr, size_t data_len, uint32_t flags);
+// `filter` selects the first entry whose name or extension(s) match, NULL means the first file
 bool rg_storage_unzip_file(const char *zip_path, const char *filter, void **data_out, size_t *data_len, uint32_t flags);
+
+// Streaming access to a zip entry, to inflate straight into its destination
+typedef struct rg_zip_s rg_zip_t;
+rg_zip_t *rg_storage_zip_open(const char *zip_path, const char *filter, size_t *size_out);
+size_t rg_storage_zip_read(rg_zip_t *zip, void *buffer, size_t length);
+void rg_storage_zip_close(rg_zip_t *zip);
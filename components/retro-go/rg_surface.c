@@ -36,6 +36,7 @@ static bool create_window(const rg_surface_t *parent, const rg_rect_t *rect, rg_
     out->data += (rect->top * out->stride) + (rect->left * RG_PIXEL_GET_SIZE(out->format));
     out->width = RG_MIN(rect->width, out->width - rect->left);
     out->height = RG_MIN(rect->height, out->height - rect->top);
+    out->dirty_rows = NULL;
     out->free_data = false;
     out->free_palette = false;
     return true;
@@ -317,6 +318,51 @@ rg_surface_t *rg_surface_load_image_file(const char *filename, uint32_t flags)
     return NULL;
 }
 
+// Flags the rows of `surface` that differ from `reference` (usually the previously submitted frame),
+// rg_display_submit() will then skip the rows that didn't change. When `rows_marked` is set the emulator
+// already flagged the rows as it drew them, they're then only invalidated by a geometry or palette change.
+// Returns the number of dirty rows.
+int rg_surface_update_dirty_rows(rg_surface_t *surface, const rg_surface_t *reference, bool rows_marked)
+{
+    CHECK_SURFACE(surface, -1);
+
+    if (!surface->dirty_rows)
+        return -1;
+
+    // Any change in geometry or palette means that every row must be redrawn
+    bool all_dirty = !reference || !reference->data || reference->width != surface->width ||
+                     reference->height != surface->height || reference->format != surface->format ||
+                     reference->offset != surface->offset || reference->stride != surface->stride;
+    if (!all_dirty && (surface->format & RG_PIXEL_PALETTE))
+    {
+        size_t palette_size = 256 * (surface->format == RG_PIXEL_PAL888 ? 3 : 2);
+        all_dirty = surface->palette != reference->palette &&
+                    (!reference->palette || memcmp(surface->palette, reference->palette, palette_size) != 0);
+    }
+
+    if (rows_marked && !all_dirty)
+    {
+        int dirty_count = 0;
+        for (int y = 0; y < surface->height; ++y)
+            dirty_count += surface->dirty_rows[y];
+        return dirty_count;
+    }
+
+    const size_t line_size = surface->width * RG_PIXEL_GET_SIZE(surface->format);
+    const uint8_t *src = surface->data + surface->offset;
+    const uint8_t *ref = all_dirty ? NULL : reference->data + reference->offset;
+    int dirty_count = 0;
+
+    for (int y = 0; y < surface->height; ++y)
+    {
+        bool dirty = all_dirty || memcmp(src + y * surface->stride, ref + y * surface->stride, line_size) != 0;
+        surface->dirty_rows[y] = dirty;
+        dirty_count += dirty;
+    }
+
+    return dirty_count;
+}
+
 bool rg_surface_save_image_file(const rg_surface_t *source, const char *filename, int width, int height)
 {
     CHECK_SURFACE(source, false);
@@ -37,6 +37,7 @@ typedef struct
     int format;
     uint16_t *palette;
     void *data;
+    uint8_t *dirty_rows; // Optional, one flag per row, see rg_surface_update_dirty_rows()
     bool free_data;
     bool free_palette;
 } rg_surface_t;
@@ -56,4 +57,5 @@ bool rg_surface_copy(const rg_surface_t *source, const rg_rect_t *source_rect, r
 bool rg_surface_fill(rg_surface_t *dest, const rg_rect_t *rect, rg_color_t color);
 rg_surface_t *rg_surface_convert(const rg_surface_t *source, int new_width, int new_height, int new_format);
 #define rg_surface_resize(source, new_width, new_height) rg_surface_convert(source, new_width, new_height, RG_PIXEL_565_LE)
+int rg_surface_update_dirty_rows(rg_surface_t *surface, const rg_surface_t *reference, bool rows_marked);
 bool rg_surface_save_image_file(const rg_surface_t *source, const char *filename, int width, int height);
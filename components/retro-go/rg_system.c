@@ -7,6 +7,13 @@
 #include <string.h>
 #include <math.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#define fsync(fd) _commit(fd)
+#else
+#include <unistd.h>
+#endif
+
 #ifdef ESP_PLATFORM
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
@@ -24,6 +31,14 @@
 #include <SDL2/SDL_mutex.h>
 #endif
 
+#if RG_ZIP_SUPPORT
+#if defined(ESP_PLATFORM) && ESP_IDF_VERSION_MAJOR < 5
+#include <rom/miniz.h>
+#else
+#include <miniz.h>
+#endif
+#endif
+
 #define RG_STRUCT_MAGIC 0x12345678
 #define RG_LOGBUF_SIZE 2048
 typedef struct
@@ -65,20 +80,65 @@ struct rg_task_s
 };
 
 #ifdef RG_ENABLE_PROFILING
+#define PROFILE_MAX_THREADS 16
+#define PROFILE_RING_SIZE   4096 // Events per thread, must be a power of two
+#define PROFILE_MAX_DEPTH   32
+#define PROFILE_MAX_NODES   2048 // Must be a power of two
+#define PROFILE_NO_NODE     0xFFFF
+
+enum {PROFILE_EVENT_END, PROFILE_EVENT_ZONE, PROFILE_EVENT_FUNC, PROFILE_EVENT_THREAD};
+
 typedef struct
 {
-    void *func_ptr, *caller_ptr;
-    int32_t num_calls, run_time;
-    int64_t enter_time;
-} profile_frame_t;
+    const void *id; // Zone name or function address, unused for PROFILE_EVENT_END
+    uint32_t time;  // Microseconds, wraps around but durations remain correct
+    uint32_t type;
+} profile_event_t;
+
+// Each thread owns one ring, it is the only writer of head and the collector is the only writer of tail.
+// This is what keeps the hot path free of locks.
+typedef struct
+{
+    uint32_t head;
+    uint32_t open;    // Zones begun but not ended, their end events are guaranteed to fit in the ring
+    uint32_t skipped; // Zones that didn't fit in the ring, their end events must be skipped too
+    uint32_t dropped;
+    uint32_t tail;
+    int depth;
+    struct
+    {
+        uint16_t node;
+        uint32_t start;
+    } stack[PROFILE_MAX_DEPTH];
+    uint16_t root;
+    char name[16];
+    profile_event_t ring[PROFILE_RING_SIZE];
+} profile_thread_t;
+
+// Aggregated call tree, one node per unique stack
+typedef struct
+{
+    const void *id;
+    uint16_t parent;
+    uint16_t type;
+    uint32_t calls;
+    uint64_t total_time;
+    uint64_t child_time;
+} profile_node_t;
 
 static struct
 {
+    profile_thread_t *threads[PROFILE_MAX_THREADS];
+    uint32_t threads_count;
+    profile_node_t nodes[PROFILE_MAX_NODES];
+    uint32_t nodes_count;
+    rg_mutex_t *lock; // Serializes the collector, it's never taken on the hot path
     int64_t time_started;
-    int32_t total_frames;
-    rg_mutex_t *lock;
-    profile_frame_t frames[512];
+    FILE *trace;
+    size_t trace_events;
 } *profile;
+static __thread profile_thread_t *profile_thread;
+static void profile_task(void *arg);
 #endif
 
 // The trace will survive a software reset
@@ -93,11 +153,82 @@ static rg_stats_t statistics;
 static rg_app_t app;
 static rg_task_t tasks[8];
 
+#define REWIND_BUFFER_SIZE      (1024 * 1024)
+#define REWIND_MAX_SNAPSHOTS    256
+#define REWIND_INTERVAL         10 // Frames between snapshots
+#define REWIND_STEP_INTERVAL    4  // Frames between steps while the hotkey is held
+#define REWIND_HOTKEY           (RG_KEY_SELECT | RG_KEY_LEFT) // All held, every target has those
+
+static struct
+{
+    bool enabled;
+    uint8_t *ring;
+    size_t ring_head, ring_used;
+    struct {uint32_t length, prev_size;} records[REWIND_MAX_SNAPSHOTS];
+    size_t first, count;
+    uint32_t *state;   // Last captured state, zero past state_size
+    uint32_t *current; // Serialization target
+    uint32_t *encoded;
+    size_t state_size, capacity;
+    int counter;
+} history;
+
+static void rewind_tick(void);
+
+#define TELEMETRY_FRAMES        512 // Ticks kept in the timeline (~8s at 60Hz)
+
+// Per-tick timeline, the percentiles in statistics are derived from it
+typedef struct
+{
+    int64_t timestamp;
+    int32_t frameTime;
+    int32_t emulateTime;
+    int32_t blockTime;
+    int32_t displayTime;
+    int32_t audioTime;
+    int16_t audioFill;
+    int8_t displayQueue;
+    int8_t drawn;
+} telemetry_frame_t;
+
+static struct
+{
+    telemetry_frame_t *frames; // Ring of TELEMETRY_FRAMES entries, allocated the first time it's enabled
+    uint32_t count;
+    bool enabled;
+    rg_display_counters_t display;
+    rg_audio_counters_t audio;
+} telemetry;
+
+static void telemetry_tick(int busyTime);
+
+#ifdef RG_ENABLE_BENCHMARK
+static struct
+{
+    int frames;
+    int64_t startTime;
+    int64_t busyTime;
+    rg_display_counters_t display;
+    rg_audio_counters_t audio;
+} benchmark;
+
+static void benchmark_tick(void);
+#endif
+
 static const char *SETTING_BOOT_NAME = "BootName";
 static const char *SETTING_BOOT_ARGS = "BootArgs";
 static const char *SETTING_BOOT_FLAGS = "BootFlags";
 static const char *SETTING_TIMEZONE = "Timezone";
 static const char *SETTING_INDICATOR_MASK = "Indicators";
+static const char *SETTING_REWIND = "Rewind";
+
+// Resolved once the app's namespace is known, the menus write them on every change
+static struct
+{
+    rg_setting_t *timezone;
+    rg_setting_t *indicators;
+    rg_setting_t *rewind;
+} handles;
 
 #define logbuf_putc(buf, c) (buf)->console[(buf)->cursor++] = c, (buf)->cursor %= RG_LOGBUF_SIZE;
 #define logbuf_puts(buf, str) for (const char *ptr = str; *ptr; ptr++) logbuf_putc(buf, *ptr);
@@ -130,7 +261,8 @@ static bool update_boot_config(const char *partition, const char *name, const ch
         rg_settings_set_string(NS_BOOT, SETTING_BOOT_NAME, name);
         rg_settings_set_string(NS_BOOT, SETTING_BOOT_ARGS, args);
         rg_settings_set_number(NS_BOOT, SETTING_BOOT_FLAGS, flags);
-        rg_settings_commit();
+        // Not deferred: the device may lose power right after a save state and must still resume from it
+        rg_settings_flush();
     }
     else
     {
@@ -174,6 +306,42 @@ static void update_memory_statistics(void)
 #endif
 }
 
+static int compare_int32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static rg_percentiles_t get_percentiles(size_t field_offset, int32_t *values, size_t count)
+{
+    if (count == 0)
+        return (rg_percentiles_t){0};
+    for (size_t i = 0; i < count; ++i)
+        values[i] = *(int32_t *)((uint8_t *)&telemetry.frames[i] + field_offset);
+    qsort(values, count, sizeof(int32_t), compare_int32);
+    return (rg_percentiles_t){values[count * 50 / 100], values[count * 95 / 100], values[count * 99 / 100]};
+}
+
+static void update_telemetry_statistics(void)
+{
+    if (!telemetry.enabled)
+        return;
+
+    // The main task keeps writing while we read, a torn entry now and then doesn't matter here
+    size_t count = RG_MIN(telemetry.count, TELEMETRY_FRAMES);
+    int32_t *values = malloc(count * sizeof(int32_t) + 1);
+    if (!values)
+        return;
+
+    statistics.frameTime = get_percentiles(offsetof(telemetry_frame_t, frameTime), values, count);
+    statistics.emulateTime = get_percentiles(offsetof(telemetry_frame_t, emulateTime), values, count);
+    statistics.blockTime = get_percentiles(offsetof(telemetry_frame_t, blockTime), values, count);
+    statistics.displayTime = get_percentiles(offsetof(telemetry_frame_t, displayTime), values, count);
+    statistics.audioTime = get_percentiles(offsetof(telemetry_frame_t, audioTime), values, count);
+
+    free(values);
+}
+
 static void update_statistics(void)
 {
     static counters_t counters = {0};
@@ -215,6 +383,7 @@ static void update_statistics(void)
     }
     statistics.uptime = rg_system_timer() / 1000000;
 
+    update_telemetry_statistics();
     update_memory_statistics();
 }
 
@@ -276,7 +445,8 @@ static void system_monitor_task(void *arg)
             (int)roundf(statistics.fullFPS),
             (int)roundf((battery.volts * 1000) ?: battery.level));
 
-        // Auto frameskip
+        // Auto frameskip (benchmarks must be reproducible)
+    #ifndef RG_ENABLE_BENCHMARK
         if (statistics.ticks > app.tickRate * 2)
         {
             float speed = ((float)statistics.totalFPS / app.tickRate) * 100.f / app.speed;
@@ -293,6 +463,7 @@ static void system_monitor_task(void *arg)
                 RG_LOGI("Raised frameskip to %d", app.frameskip);
             }
         }
+    #endif
 
         if (statistics.lastTick < rg_system_timer() - app.tickTimeout)
         {
@@ -365,10 +536,15 @@ static void platform_init(void)
         gpio_set_level(RG_GPIO_LED, 0);
     #endif
 #elif defined(RG_TARGET_SDL2)
+#ifdef RG_ENABLE_BENCHMARK
+    const int subsystems = SDL_INIT_TIMER; // Headless, and the report goes to the console
+#else
+    const int subsystems = SDL_INIT_VIDEO|SDL_INIT_AUDIO;
     freopen("stdout.txt", "w", stdout);
     freopen("stderr.txt", "w", stderr);
+#endif
     SDL_SetMainReady();
-    if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) < 0)
+    if (SDL_Init(subsystems) < 0)
         RG_PANIC("SDL Init failed!");
 #endif
 
@@ -464,6 +640,19 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     app.configNs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_NAME, app.configNs);
     app.bootArgs = rg_settings_get_string(NS_BOOT, SETTING_BOOT_ARGS, app.bootArgs);
     app.bootFlags = rg_settings_get_number(NS_BOOT, SETTING_BOOT_FLAGS, app.bootFlags);
+#ifdef RG_ENABLE_BENCHMARK
+    // Benchmarks bypass the launcher and never resume a saved state, see tools/build_bench.sh
+    app.configNs = getenv("RG_BENCH_APP") ?: app.configNs;
+    app.bootArgs = getenv("RG_BENCH_ROM") ?: app.bootArgs;
+    app.bootFlags = 0;
+    benchmark.frames = atoi(getenv("RG_BENCH_FRAMES") ?: "3600");
+    const char *movie = getenv("RG_BENCH_INPUT");
+    if (movie && *movie)
+        rg_input_movie_open(movie, false);
+#elif defined(RG_TARGET_SDL2)
+    if (getenv("RG_INPUT_RECORD"))
+        rg_input_movie_open(getenv("RG_INPUT_RECORD"), true);
+#endif
     rg_display_init();
     rg_gui_init();
 
@@ -493,14 +682,18 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     update_memory_statistics();
     app.lowMemoryMode = statistics.totalMemoryExt == 0;
 
-    app.indicatorsMask = rg_settings_get_number(NS_GLOBAL, SETTING_INDICATOR_MASK, app.indicatorsMask);
+    handles.timezone = rg_settings_find(NS_GLOBAL, SETTING_TIMEZONE);
+    handles.indicators = rg_settings_find(NS_GLOBAL, SETTING_INDICATOR_MASK);
+    handles.rewind = rg_settings_find(NS_APP, SETTING_REWIND);
+    app.indicatorsMask = rg_setting_get_number(handles.indicators, app.indicatorsMask);
+    history.enabled = rg_setting_get_number(handles.rewind, 0);
     app.saveSlot = (app.bootFlags & RG_BOOT_SLOT_MASK) >> 4;
     app.romPath = app.bootArgs ?: ""; // For whatever reason some of our code isn't NULL-aware, sigh..
 
     rg_gui_draw_hourglass();
     rg_audio_init(sampleRate);
 
-    rg_system_set_timezone(rg_settings_get_string(NS_GLOBAL, SETTING_TIMEZONE, "EST+5"));
+    rg_system_set_timezone(rg_setting_get_string(handles.timezone, "EST+5"));
     rg_system_load_time();
 
     // Do these last to not interfere with panic handling above
@@ -511,6 +704,8 @@ rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_u
     RG_LOGI("Profiling has been enabled at compile time!\n");
     profile = rg_alloc(sizeof(*profile), MEM_SLOW);
     profile->lock = rg_mutex_create();
+    profile->time_started = rg_system_timer();
+    rg_task_create("rg_profiler", &profile_task, NULL, 3 * 1024, RG_TASK_PRIORITY_2, -1);
 #endif
 
     if (app.lowMemoryMode)
@@ -768,6 +963,9 @@ void rg_system_load_time(void)
 
 void rg_system_save_time(void)
 {
+    // The time is saved when the device may be about to lose power, the deferred settings mustn't be lost either
+    rg_settings_flush();
+
     time_t time_sec = time(NULL);
     // We always save to storage in case the RTC disappears.
     if (rg_storage_write_file(RG_BASE_PATH_CACHE "/clock.bin", (void *)&time_sec, sizeof(time_sec), 0))
@@ -784,7 +982,7 @@ void rg_system_save_time(void)
 
 void rg_system_set_timezone(const char *TZ)
 {
-    rg_settings_set_string(NS_GLOBAL, SETTING_TIMEZONE, TZ);
+    rg_setting_set_string(handles.timezone, TZ);
 #ifdef ESP_PLATFORM
     setenv("TZ", TZ, 1);
     tzset();
@@ -793,7 +991,7 @@ void rg_system_set_timezone(const char *TZ)
 
 char *rg_system_get_timezone(void)
 {
-    return rg_settings_get_string(NS_GLOBAL, SETTING_TIMEZONE, NULL);
+    return rg_setting_get_string(handles.timezone, NULL);
     // return strdup(getenv("TZ"));
 }
 
@@ -807,6 +1005,78 @@ rg_stats_t rg_system_get_counters(void)
     return statistics;
 }
 
+static void telemetry_tick(int busyTime)
+{
+    rg_display_counters_t display = rg_display_get_counters();
+    rg_audio_counters_t audio = rg_audio_get_counters();
+    int64_t now = rg_system_timer();
+
+    // Audio is usually submitted after the tick, so audioTime is really the previous frame's
+    telemetry.frames[telemetry.count++ % TELEMETRY_FRAMES] = (telemetry_frame_t){
+        .timestamp = now,
+        .frameTime = statistics.lastTick ? now - statistics.lastTick : 0,
+        .emulateTime = busyTime,
+        .blockTime = display.blockTime - telemetry.display.blockTime,
+        .displayTime = display.busyTime - telemetry.display.busyTime,
+        .audioTime = audio.busyTime - telemetry.audio.busyTime,
+        .audioFill = RG_MIN(audio.bufferFill, INT16_MAX),
+        .displayQueue = display.queuedFrames,
+        .drawn = display.totalFrames != telemetry.display.totalFrames,
+    };
+    telemetry.display = display;
+    telemetry.audio = audio;
+}
+
+// The timeline costs two counters snapshots per tick and some memory, it's only recorded on demand
+bool rg_system_set_telemetry(bool enable)
+{
+    if (enable && !telemetry.enabled)
+    {
+        // The ring is never freed because the system task may be reading it
+        if (!telemetry.frames)
+            telemetry.frames = rg_alloc(TELEMETRY_FRAMES * sizeof(telemetry_frame_t), MEM_SLOW);
+        if (!telemetry.frames)
+            return false;
+        telemetry.count = 0;
+        telemetry.display = rg_display_get_counters();
+        telemetry.audio = rg_audio_get_counters();
+    }
+    telemetry.enabled = enable;
+    return true;
+}
+
+bool rg_system_get_telemetry(void)
+{
+    return telemetry.enabled;
+}
+
+bool rg_system_save_telemetry(const char *filename)
+{
+    RG_ASSERT_ARG(filename);
+
+    if (!telemetry.frames)
+        return false;
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        return false;
+
+    uint32_t end = telemetry.count;
+    uint32_t start = end > TELEMETRY_FRAMES ? end - TELEMETRY_FRAMES : 0;
+
+    fprintf(fp, "timestamp_us,frame_us,emulate_us,block_us,display_us,audio_us,audio_fill,display_queue,drawn\n");
+    for (uint32_t i = start; i < end; ++i)
+    {
+        const telemetry_frame_t *frame = &telemetry.frames[i % TELEMETRY_FRAMES];
+        fprintf(fp, "%lld,%d,%d,%d,%d,%d,%d,%d,%d\n", (long long)frame->timestamp, (int)frame->frameTime,
+                (int)frame->emulateTime, (int)frame->blockTime, (int)frame->displayTime, (int)frame->audioTime,
+                (int)frame->audioFill, (int)frame->displayQueue, (int)frame->drawn);
+    }
+
+    RG_LOGI("Saved %d frames of telemetry to '%s'", (int)(end - start), filename);
+    return fclose(fp) == 0;
+}
+
 void rg_system_set_tick_rate(int tickRate)
 {
     app.tickRate = tickRate;
@@ -820,13 +1090,21 @@ int rg_system_get_tick_rate(void)
 
 void rg_system_tick(int busyTime)
 {
+    if (telemetry.enabled)
+        telemetry_tick(busyTime);
     statistics.lastTick = rg_system_timer();
     statistics.busyTime += busyTime;
     statistics.ticks++;
     // WDT_RELOAD(WDT_TIMEOUT);
+    if (history.enabled)
+        rewind_tick();
+    rg_input_movie_step();
+#ifdef RG_ENABLE_BENCHMARK
+    benchmark_tick();
+#endif
 }
 
-IRAM_ATTR int64_t rg_system_timer(void)
+NO_PROFILE IRAM_ATTR int64_t rg_system_timer(void)
 {
 #if defined(ESP_PLATFORM)
     return esp_timer_get_time();
@@ -849,6 +1127,7 @@ static void shutdown_cleanup(void)
     rg_gui_draw_hourglass();                  // ...
     rg_system_event(RG_EVENT_SHUTDOWN, NULL); // Allow apps to save their state if they want
     rg_audio_deinit();                        // Disable sound ASAP to avoid audio garbage
+    rg_settings_flush();                      // Write the settings still waiting for the background commit
     // rg_system_save_time();                    // RTC might save to storage, do it before
     rg_storage_deinit();                      // Unmount storage
     rg_input_wait_for_key(RG_KEY_ALL, 0, -1); // Wait for all keys to be released (boot is sensitive to GPIO0,32,33)
@@ -1050,7 +1329,7 @@ void rg_system_set_indicator_mask(rg_indicator_t indicator, bool on)
 {
     app.indicatorsMask &= ~(1 << indicator);
     app.indicatorsMask |= (on << indicator);
-    rg_settings_set_number(NS_GLOBAL, SETTING_INDICATOR_MASK, app.indicatorsMask);
+    rg_setting_set_number(handles.indicators, app.indicatorsMask);
 }
 
 bool rg_system_get_indicator_mask(rg_indicator_t indicator)
@@ -1231,9 +1510,389 @@ static void emu_update_save_slot(uint8_t slot)
     rg_storage_commit();
 }
 
+size_t rg_stream_read(void *ptr, size_t size, size_t count, rg_stream_t *stream)
+{
+    RG_ASSERT_ARG(stream);
+    if (stream->fp)
+    {
+        size_t done = fread(ptr, size, count, stream->fp);
+        stream->error |= done < count;
+        return done;
+    }
+    size_t done = size ? RG_MIN(count, (stream->size - stream->pos) / size) : count;
+    memcpy(ptr, stream->data + stream->pos, done * size);
+    stream->pos += done * size;
+    stream->used = RG_MAX(stream->used, stream->pos);
+    stream->error |= done < count;
+    return done;
+}
+
+size_t rg_stream_write(const void *ptr, size_t size, size_t count, rg_stream_t *stream)
+{
+    RG_ASSERT_ARG(stream);
+    if (stream->fp)
+    {
+        size_t done = fwrite(ptr, size, count, stream->fp);
+        stream->error |= done < count;
+        return done;
+    }
+    size_t done = size ? RG_MIN(count, (stream->size - stream->pos) / size) : count;
+    memcpy(stream->data + stream->pos, ptr, done * size);
+    stream->pos += done * size;
+    stream->used = RG_MAX(stream->used, stream->pos);
+    stream->error |= done < count;
+    return done;
+}
+
+int rg_stream_seek(rg_stream_t *stream, long offset, int whence)
+{
+    RG_ASSERT_ARG(stream);
+    if (stream->fp)
+        return fseek(stream->fp, offset, whence);
+    long base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (long)stream->pos : (long)stream->used;
+    if (base + offset < 0 || base + offset > (long)stream->size)
+        return -1;
+    stream->pos = base + offset;
+    return 0;
+}
+
+long rg_stream_tell(rg_stream_t *stream)
+{
+    RG_ASSERT_ARG(stream);
+    if (stream->fp)
+        return ftell(stream->fp);
+    return stream->pos;
+}
+
+/**
+ * Save state container, used when the emulator provides the serialize/unserialize handlers.
+ * The state is split in fixed-size chunks, each with a CRC32 and two reserved areas in the file.
+ * The file also holds two headers and chunk tables, the valid one with the highest generation wins.
+ * Saving again to the same slot writes the changed chunks to their inactive area, then the other
+ * table with the next generation. An interrupted save leaves the previous table and data intact.
+ */
+#define STATE_MAGIC             "RGST"
+#define STATE_VERSION           2
+#define STATE_CHUNK_SIZE        0x1000
+#define STATE_CHUNK_DEFLATED    (1 << 0)
+#define STATE_TABLE_OFFSET(count, table) \
+    (2 * sizeof(state_header_t) + (table) * (count) * sizeof(state_chunk_t))
+#define STATE_CHUNK_OFFSET(count, index, slot) \
+    (STATE_TABLE_OFFSET(count, 2) + ((slot) * (count) + (index)) * STATE_CHUNK_SIZE)
+
+typedef struct __attribute__((packed))
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint32_t data_size;
+    uint32_t generation;
+    uint32_t crc;   // Of this header (with crc = 0) and its chunk table
+} state_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t crc;   // Of the uncompressed data
+    uint16_t size;  // Stored size
+    uint8_t flags;
+    uint8_t slot;   // Which of the chunk's two areas holds it
+} state_chunk_t;
+
+static void *emu_serialize(size_t *size_out)
+{
+    // The handler returns the full buffer size when the state might not have fit
+    for (size_t size = 0x10000; size <= 0x400000; size *= 2)
+    {
+        void *buffer = malloc(size);
+        if (!buffer)
+            break;
+        size_t used = app.handlers.serialize(buffer, size);
+        if (used > 0 && used < size)
+        {
+            *size_out = used;
+            return buffer;
+        }
+        free(buffer);
+        if (used == 0)
+            break;
+    }
+    return NULL;
+}
+
+static bool state_is_container(const char *filename)
+{
+    state_header_t headers[2] = {0};
+    FILE *fp = fopen(filename, "rb");
+    if (fp)
+    {
+        fread(headers, sizeof(state_header_t), 2, fp);
+        fclose(fp);
+    }
+    // Either header can be the one an interrupted save was rewriting
+    return memcmp(headers[0].magic, STATE_MAGIC, 4) == 0 || memcmp(headers[1].magic, STATE_MAGIC, 4) == 0;
+}
+
+static uint32_t state_table_crc(const state_header_t *header, const state_chunk_t *chunks)
+{
+    state_header_t temp = *header;
+    temp.crc = 0;
+    uint32_t crc = rg_crc32(0, (const uint8_t *)&temp, sizeof(temp));
+    return rg_crc32(crc, (const uint8_t *)chunks, temp.chunk_count * sizeof(state_chunk_t));
+}
+
+static bool state_sync(FILE *fp)
+{
+    return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+// Returns the index of the newest valid table and loads it, or -1 if there's none
+static int state_read_table(FILE *fp, state_header_t *header_out, state_chunk_t **chunks_out)
+{
+    state_header_t headers[2] = {0};
+    state_chunk_t *tables[2] = {NULL, NULL};
+    int active = -1;
+
+    if (fseek(fp, 0, SEEK_SET) != 0 || fread(headers, sizeof(state_header_t), 2, fp) != 2)
+        return -1;
+
+    for (int t = 0; t < 2; ++t)
+    {
+        const state_header_t *header = &headers[t];
+        size_t count = header->chunk_count;
+
+        if (memcmp(header->magic, STATE_MAGIC, 4) != 0 || header->version != STATE_VERSION
+            || header->chunk_size != STATE_CHUNK_SIZE || header->data_size == 0
+            || count != (header->data_size + STATE_CHUNK_SIZE - 1) / STATE_CHUNK_SIZE)
+            continue;
+
+        if (!(tables[t] = malloc(count * sizeof(state_chunk_t)))
+            || fseek(fp, STATE_TABLE_OFFSET(count, t), SEEK_SET) != 0
+            || fread(tables[t], sizeof(state_chunk_t), count, fp) != count
+            || state_table_crc(header, tables[t]) != header->crc)
+        {
+            free(tables[t]);
+            tables[t] = NULL;
+            continue;
+        }
+
+        if (active < 0 || (int32_t)(header->generation - headers[active].generation) > 0)
+            active = t;
+    }
+
+    if (active >= 0)
+    {
+        *header_out = headers[active];
+        *chunks_out = tables[active];
+        tables[active] = NULL;
+    }
+    free(tables[0]);
+    free(tables[1]);
+    return active;
+}
+
+static bool state_write(const char *filename, const uint8_t *data, size_t size)
+{
+    size_t count = (size + STATE_CHUNK_SIZE - 1) / STATE_CHUNK_SIZE;
+    state_header_t header = {0};
+    state_chunk_t *chunks = NULL;
+    char tempname[RG_PATH_MAX + 8] = {0};
+    size_t written = 0;
+    bool success = false;
+    int active = -1;
+    FILE *fp = NULL;
+
+#if RG_STATE_COMPRESSION
+    tdefl_compressor *compressor = malloc(sizeof(tdefl_compressor));
+    uint8_t *buffer = malloc(STATE_CHUNK_SIZE);
+#endif
+
+    // Chunks that changed go to the area the active table doesn't use, so the slot is updated in place
+    if ((fp = fopen(filename, "r+b")))
+    {
+        active = state_read_table(fp, &header, &chunks);
+        if (active >= 0 && header.chunk_count != count)
+        {
+            free(chunks);
+            chunks = NULL;
+            active = -1;
+        }
+        if (active < 0)
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+
+    // Otherwise the state goes to a new file that replaces the slot once complete
+    if (active < 0)
+    {
+        header = (state_header_t){STATE_MAGIC, STATE_VERSION, 0, STATE_CHUNK_SIZE, count, 0, 0, 0};
+        chunks = calloc(count, sizeof(state_chunk_t));
+        if (!chunks || !(fp = fopen(strcat(strcpy(tempname, filename), ".new"), "w+b")))
+            goto _cleanup;
+        // The fresh table goes to index 0, and its chunks to area 0, while table 1 stays invalid
+        for (size_t i = 0; i < count; ++i)
+            chunks[i].slot = 1;
+        active = 1;
+        state_header_t empty = {0};
+        if (fseek(fp, sizeof(header), SEEK_SET) != 0 || fwrite(&empty, sizeof(empty), 1, fp) != 1)
+            goto _cleanup;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *chunk = data + i * STATE_CHUNK_SIZE;
+        size_t length = RG_MIN(size - i * STATE_CHUNK_SIZE, STATE_CHUNK_SIZE);
+        uint32_t crc = rg_crc32(0, chunk, length);
+        const void *stored = chunk;
+
+        // The last chunk's length is implied by data_size
+        if (!tempname[0] && chunks[i].crc == crc && (i < count - 1 || header.data_size == size))
+            continue;
+
+        state_chunk_t entry = {crc, length, 0, !chunks[i].slot};
+    #if RG_STATE_COMPRESSION
+        size_t in_size = length, out_size = length - 1;
+        if (compressor && buffer && tdefl_init(compressor, NULL, NULL, TDEFL_GREEDY_PARSING_FLAG | 16) == TDEFL_STATUS_OKAY
+            && tdefl_compress(compressor, chunk, &in_size, buffer, &out_size, TDEFL_FINISH) == TDEFL_STATUS_DONE)
+        {
+            entry.size = out_size;
+            entry.flags = STATE_CHUNK_DEFLATED;
+            stored = buffer;
+        }
+    #endif
+
+        if (fseek(fp, STATE_CHUNK_OFFSET(count, i, entry.slot), SEEK_SET) != 0
+            || fwrite(stored, entry.size, 1, fp) != 1)
+            goto _cleanup;
+        chunks[i] = entry;
+        written++;
+    }
+
+    if (!tempname[0] && written == 0 && header.data_size == size)
+    {
+        RG_LOGI("State unchanged, nothing written.\n");
+        success = true;
+        goto _cleanup;
+    }
+
+    // The data must be on disk before the table that references it, the table is the commit point
+    header.data_size = size;
+    header.generation++;
+    header.crc = state_table_crc(&header, chunks);
+    if (!state_sync(fp) || fseek(fp, STATE_TABLE_OFFSET(count, !active), SEEK_SET) != 0
+        || fwrite(chunks, sizeof(state_chunk_t), count, fp) != count
+        || fseek(fp, !active * sizeof(header), SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, fp) != 1
+        || !state_sync(fp))
+        goto _cleanup;
+
+    success = true;
+    RG_LOGI("State written: %d bytes, %d of %d chunks changed.\n", (int)size, (int)written, (int)count);
+
+_cleanup:
+    if (fp && fclose(fp) != 0)
+        success = false;
+    if (fp && tempname[0] && success)
+    {
+        char backup[RG_PATH_MAX + 8];
+        rename(filename, strcat(strcpy(backup, filename), ".bak"));
+        if ((success = rename(tempname, filename) == 0))
+            remove(backup);
+        else
+            rename(backup, filename);
+    }
+    if (fp && tempname[0] && !success)
+    {
+        remove(tempname);
+    }
+#if RG_STATE_COMPRESSION
+    free(compressor);
+    free(buffer);
+#endif
+    free(chunks);
+    return success;
+}
+
+static void *state_read(const char *filename, size_t *size_out)
+{
+    state_header_t header = {0};
+    state_chunk_t *chunks = NULL;
+    uint8_t *buffer = malloc(STATE_CHUNK_SIZE);
+    uint8_t *data = NULL;
+    FILE *fp = fopen(filename, "rb");
+
+#if RG_ZIP_SUPPORT
+    tinfl_decompressor *decomp = malloc(sizeof(tinfl_decompressor));
+#endif
+
+    if (!fp || !buffer || state_read_table(fp, &header, &chunks) < 0)
+    {
+        RG_LOGE("Invalid state header: '%s'\n", filename);
+        goto _fail;
+    }
+
+    if (!(data = malloc(header.data_size)))
+        goto _fail;
+
+    for (size_t i = 0; i < header.chunk_count; ++i)
+    {
+        uint8_t *chunk = data + i * STATE_CHUNK_SIZE;
+        size_t length = RG_MIN(header.data_size - i * STATE_CHUNK_SIZE, STATE_CHUNK_SIZE);
+        size_t stored = chunks[i].size;
+
+        if (stored > STATE_CHUNK_SIZE || chunks[i].slot > 1
+            || fseek(fp, STATE_CHUNK_OFFSET(header.chunk_count, i, chunks[i].slot), SEEK_SET) != 0
+            || fread(buffer, stored, 1, fp) != 1)
+            goto _fail;
+
+        if (chunks[i].flags & STATE_CHUNK_DEFLATED)
+        {
+        #if RG_ZIP_SUPPORT
+            size_t in_size = stored, out_size = length;
+            tinfl_init(decomp);
+            if (tinfl_decompress(decomp, buffer, &in_size, chunk, chunk, &out_size,
+                                 TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) != TINFL_STATUS_DONE
+                || out_size != length)
+                goto _fail;
+        #else
+            RG_LOGE("Compressed states aren't supported in this build!\n");
+            goto _fail;
+        #endif
+        }
+        else if (stored == length)
+            memcpy(chunk, buffer, length);
+        else
+            goto _fail;
+
+        if (rg_crc32(0, chunk, length) != chunks[i].crc)
+        {
+            RG_LOGE("Chunk %d is corrupted: '%s'\n", (int)i, filename);
+            goto _fail;
+        }
+    }
+
+    *size_out = header.data_size;
+    goto _cleanup;
+
+_fail:
+    free(data);
+    data = NULL;
+_cleanup:
+#if RG_ZIP_SUPPORT
+    free(decomp);
+#endif
+    if (fp)
+        fclose(fp);
+    free(chunks);
+    free(buffer);
+    return data;
+}
+
 bool rg_emu_load_state(uint8_t slot)
 {
-    if (!app.romPath || !app.handlers.loadState)
+    if (!app.romPath || !(app.handlers.loadState || app.handlers.unserialize))
     {
         RG_LOGE("No rom or handler defined...\n");
         return false;
@@ -1246,7 +1905,20 @@ bool rg_emu_load_state(uint8_t slot)
 
     rg_gui_draw_hourglass();
 
-    if (!(success = (*app.handlers.loadState)(filename)))
+    // Older saves or emulators without the in-memory handlers go through the file handler
+    if (app.handlers.unserialize && (!app.handlers.loadState || state_is_container(filename)))
+    {
+        size_t size;
+        void *data = state_read(filename, &size);
+        success = data && (*app.handlers.unserialize)(data, size);
+        free(data);
+    }
+    else if (app.handlers.loadState)
+    {
+        success = (*app.handlers.loadState)(filename);
+    }
+
+    if (!success)
     {
         RG_LOGE("Load failed!\n");
     }
@@ -1262,7 +1934,7 @@ bool rg_emu_load_state(uint8_t slot)
 
 bool rg_emu_save_state(uint8_t slot)
 {
-    if (!app.romPath || !app.handlers.saveState)
+    if (!app.romPath || !(app.handlers.saveState || app.handlers.serialize))
     {
         RG_LOGE("No rom or handler defined...\n");
         return false;
@@ -1284,7 +1956,14 @@ bool rg_emu_save_state(uint8_t slot)
 
     #define tempname(ext) strcat(strcpy(tempname, filename), ext)
 
-    if ((*app.handlers.saveState)(tempname(".new")))
+    if (app.handlers.serialize)
+    {
+        size_t size;
+        void *data = emu_serialize(&size);
+        success = data && state_write(filename, data, size);
+        free(data);
+    }
+    else if ((*app.handlers.saveState)(tempname(".new")))
     {
         rename(filename, tempname(".bak"));
 
@@ -1419,89 +2098,589 @@ float rg_emu_get_speed(void)
     return app.speed;
 }
 
+/**
+ * Rewind keeps the last captured state plus a history of XOR deltas going back in time. The deltas
+ * are mostly zeroes so they're run-length encoded (in 32bit words) into a fixed-size ring buffer.
+ * Stepping back is applying the newest delta to the last state and loading the result.
+ */
+static size_t rewind_encode(uint32_t *out, const uint32_t *a, const uint32_t *b, size_t words)
+{
+    uint32_t *ptr = out;
+
+    for (size_t i = 0; i < words;)
+    {
+        size_t zeroes = 0, literals = 0;
+        while (i < words && zeroes < 0xFFFF && a[i] == b[i])
+            zeroes++, i++;
+        // A lone identical word doesn't end a literal run, the header would cost as much
+        uint32_t *header = ptr++;
+        while (i < words && literals < 0xFFFF && (a[i] != b[i] || (i + 1 < words && a[i + 1] != b[i + 1])))
+            *ptr++ = a[i] ^ b[i], literals++, i++;
+        *header = zeroes | (literals << 16);
+    }
+
+    return (ptr - out) * 4;
+}
+
+static void rewind_decode(uint32_t *dst, const uint32_t *in, size_t length)
+{
+    const uint32_t *end = in + length / 4;
+    size_t i = 0;
+
+    while (in < end)
+    {
+        uint32_t header = *in++;
+        i += header & 0xFFFF;
+        for (size_t literals = header >> 16; literals > 0; literals--)
+            dst[i++] ^= *in++;
+    }
+}
+
+static void rewind_free(void)
+{
+    free(history.ring);
+    free(history.state);
+    free(history.current);
+    free(history.encoded);
+    bool enabled = history.enabled;
+    memset(&history, 0, sizeof(history));
+    history.enabled = enabled;
+}
+
+static bool rewind_setup(void)
+{
+    if (!app.handlers.serialize || !app.handlers.unserialize || app.lowMemoryMode)
+        return false;
+
+    size_t size;
+    void *state = emu_serialize(&size);
+    if (!state)
+        return false;
+
+    // Leave some room for the state to grow (nofrendo adds blocks when VRAM/SRAM get used, for example)
+    history.capacity = (size + size / 4 + 0xFFF) & ~0xFFF;
+    history.ring = rg_alloc(REWIND_BUFFER_SIZE, MEM_SLOW);
+    history.state = rg_alloc(history.capacity, MEM_SLOW);
+    history.current = rg_alloc(history.capacity, MEM_SLOW);
+    history.encoded = rg_alloc(history.capacity + 256, MEM_SLOW);
+
+    if (!history.ring || !history.state || !history.current || !history.encoded)
+    {
+        rewind_free();
+        free(state);
+        return false;
+    }
+
+    memcpy(history.state, state, size);
+    history.state_size = size;
+    free(state);
+
+    RG_LOGI("Rewind ready: state size: %d, history: %dKB\n", (int)size, REWIND_BUFFER_SIZE / 1024);
+    return true;
+}
+
+static void rewind_push(const void *data, size_t length, size_t prev_size)
+{
+    if (length > REWIND_BUFFER_SIZE)
+    {
+        // The chain of deltas is broken, start over
+        history.ring_used = history.count = 0;
+        return;
+    }
+
+    // Drop the oldest snapshots until there's room
+    while (history.count == REWIND_MAX_SNAPSHOTS || REWIND_BUFFER_SIZE - history.ring_used < length)
+    {
+        size_t oldest = history.records[history.first].length;
+        history.ring_head = (history.ring_head + oldest) % REWIND_BUFFER_SIZE;
+        history.ring_used -= oldest;
+        history.first = (history.first + 1) % REWIND_MAX_SNAPSHOTS;
+        history.count--;
+    }
+
+    size_t tail = (history.ring_head + history.ring_used) % REWIND_BUFFER_SIZE;
+    size_t part = RG_MIN(length, REWIND_BUFFER_SIZE - tail);
+    memcpy(history.ring + tail, data, part);
+    memcpy(history.ring, data + part, length - part);
+
+    size_t index = (history.first + history.count) % REWIND_MAX_SNAPSHOTS;
+    history.records[index].length = length;
+    history.records[index].prev_size = prev_size;
+    history.ring_used += length;
+    history.count++;
+}
+
+static void rewind_capture(void)
+{
+    size_t size = app.handlers.serialize(history.current, history.capacity);
+    if (size == 0 || size >= history.capacity)
+    {
+        RG_LOGW("State doesn't fit anymore, resetting rewind history.\n");
+        rewind_free();
+        return;
+    }
+
+    memset((void *)history.current + size, 0, history.capacity - size);
+    size_t words = (RG_MAX(size, history.state_size) + 3) / 4;
+    size_t length = rewind_encode(history.encoded, history.current, history.state, words);
+    rewind_push(history.encoded, length, history.state_size);
+
+    uint32_t *temp = history.state;
+    history.state = history.current;
+    history.current = temp;
+    history.state_size = size;
+}
+
+bool rg_emu_rewind(void)
+{
+    if (!history.count)
+        return false;
+
+    size_t index = (history.first + history.count - 1) % REWIND_MAX_SNAPSHOTS;
+    size_t length = history.records[index].length;
+    size_t start = (history.ring_head + history.ring_used - length) % REWIND_BUFFER_SIZE;
+    size_t part = RG_MIN(length, REWIND_BUFFER_SIZE - start);
+    memcpy(history.encoded, history.ring + start, part);
+    memcpy((void *)history.encoded + part, history.ring, length - part);
+
+    rewind_decode(history.state, history.encoded, length);
+    history.state_size = history.records[index].prev_size;
+    history.ring_used -= length;
+    history.count--;
+
+    return app.handlers.unserialize(history.state, history.state_size);
+}
+
+static void rewind_tick(void)
+{
+    if (!history.state && !rewind_setup())
+    {
+        RG_LOGW("Rewind isn't available, disabling it.\n");
+        history.enabled = false;
+        return;
+    }
+
+    if ((rg_input_read_gamepad() & REWIND_HOTKEY) == REWIND_HOTKEY)
+    {
+        if (++history.counter >= REWIND_STEP_INTERVAL)
+        {
+            history.counter = 0;
+            rg_emu_rewind();
+        }
+    }
+    else if (++history.counter >= REWIND_INTERVAL)
+    {
+        history.counter = 0;
+        rewind_capture();
+    }
+}
+
+void rg_emu_set_rewind(bool enable)
+{
+    if (!enable)
+        rewind_free();
+    history.enabled = enable;
+    rg_setting_set_number(handles.rewind, enable);
+}
+
+bool rg_emu_get_rewind(void)
+{
+    return history.enabled;
+}
+
+#ifdef RG_ENABLE_BENCHMARK
+/**
+ * Benchmark builds run the app headless and unthrottled for a fixed number of frames, optionally
+ * replaying an input movie, then print the speed and hashes of the final frame, the audio stream
+ * and the emulation state. The hashes tell whether a change affected the output. The frame hash is
+ * only comparable when the same number of frames were drawn, because most cores skip frames when late.
+ */
+static void benchmark_tick(void)
+{
+    if (statistics.ticks == 1) // Measure from the first frame, not including boot and ROM loading
+    {
+        benchmark.startTime = rg_system_timer();
+        benchmark.busyTime = statistics.busyTime;
+        benchmark.display = rg_display_get_counters();
+        benchmark.audio = rg_audio_get_counters();
+        return;
+    }
+
+    if (statistics.ticks <= benchmark.frames)
+        return;
+
+    int64_t elapsed = rg_system_timer() - benchmark.startTime;
+    int frames = statistics.ticks - 1;
+    rg_display_sync(true);
+
+    rg_display_counters_t display = rg_display_get_counters();
+    rg_audio_counters_t audio = rg_audio_get_counters();
+    uint32_t frame_crc = 0, state_crc = 0;
+
+    rg_surface_t *surface = rg_display_get_last_frame();
+    if (surface)
+    {
+        size_t row_size = surface->width * RG_PIXEL_GET_SIZE(surface->format);
+        for (int y = 0; y < surface->height; ++y)
+            frame_crc = rg_crc32(frame_crc, surface->data + surface->offset + y * surface->stride, row_size);
+    }
+
+    size_t state_size;
+    void *state = app.handlers.serialize ? emu_serialize(&state_size) : NULL;
+    if (state)
+        state_crc = rg_crc32(0, state, state_size);
+    free(state);
+
+    printf("BENCHMARK app=%s frames=%d drawn=%d time=%.3fs fps=%.1f core=%dus display=%dus audio=%dus "
+           "frame_crc=%08X audio_crc=%08X state_crc=%08X\n",
+           app.configNs, frames, (int)(display.totalFrames - benchmark.display.totalFrames),
+           elapsed / 1000000.f, frames * 1000000.f / elapsed,
+           (int)((statistics.busyTime - benchmark.busyTime) / frames),
+           (int)((display.busyTime - benchmark.display.busyTime) / frames),
+           (int)((audio.busyTime - benchmark.audio.busyTime) / frames),
+           (unsigned)frame_crc, (unsigned)audio.streamHash, (unsigned)state_crc);
+    fflush(stdout);
+    exit(0);
+}
+#endif
+
 #ifdef RG_ENABLE_PROFILING
-// Note this profiler might be inaccurate because of:
-// https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
+// Zones are recorded in per-thread rings without any locking. The rg_profiler task drains them
+// regularly into a call tree, so the cost on the profiled code is one timer read and a store.
+// The __cyg_profile hooks feed the same rings, but -finstrument-functions should be used sparingly
+// (on a single file or component) because instrumenting everything still skews the results.
+
+NO_PROFILE static inline uint32_t profile_time(void)
+{
+#if defined(ESP_PLATFORM)
+    return esp_timer_get_time();
+#else
+    static uint64_t divider;
+    if (!divider)
+        divider = RG_MAX(SDL_GetPerformanceFrequency() / 1000000, 1);
+    return SDL_GetPerformanceCounter() / divider;
+#endif
+}
 
-// We also need to add multi-core support. Currently it's not an issue
-// because all our profiled code runs on the same core.
+NO_PROFILE static profile_thread_t *profile_register_thread(void)
+{
+    static __thread bool registered;
+    profile_thread_t *thread = NULL;
 
-#define LOCK_PROFILE()   rg_mutex_take(profile->lock, 10000)
-#define UNLOCK_PROFILE() rg_mutex_give(lock)
+    // Also protects against recursion when the functions below are instrumented
+    if (registered)
+        return NULL;
+    registered = true;
 
-NO_PROFILE static inline profile_frame_t *find_frame(void *this_fn, void *call_site)
+    uint32_t index = __atomic_fetch_add(&profile->threads_count, 1, __ATOMIC_ACQ_REL);
+    if (index < PROFILE_MAX_THREADS && (thread = rg_alloc(sizeof(profile_thread_t), MEM_SLOW)))
+    {
+        rg_task_t *task = rg_task_current();
+        snprintf(thread->name, sizeof(thread->name), "%s", task ? task->name : "main");
+        thread->root = PROFILE_NO_NODE;
+        __atomic_store_n(&profile->threads[index], thread, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        RG_LOGW("Profiler: Can't track more threads!");
+    }
+
+    return (profile_thread = thread);
+}
+
+NO_PROFILE static inline void profile_push(const void *id, uint32_t type)
 {
-    for (int i = 0; i < 512; ++i)
+    profile_thread_t *thread = profile_thread;
+
+    if (!thread && (!profile || !(thread = profile_register_thread())))
+        return;
+
+    if (type == PROFILE_EVENT_END)
     {
-        profile_frame_t *frame = &profile->frames[i];
-        if (frame->func_ptr == 0)
+        if (thread->skipped > 0)
         {
-            profile->total_frames = RG_MAX(profile->total_frames, i + 1);
-            frame->func_ptr = this_fn;
+            thread->skipped--;
+            return;
         }
-        if (frame->func_ptr == this_fn) // && frame->caller_ptr == call_site)
-            return frame;
+        if (thread->open == 0)
+            return;
+        thread->open--;
     }
+    else
+    {
+        // A zone is only recorded if there's also room left for its end and the ends of all open zones.
+        // Zones nested in a skipped one are skipped too, otherwise the ENDs would pair with the wrong BEGINs.
+        uint32_t used = thread->head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE);
+        if (thread->skipped > 0 || used + thread->open + 2 > PROFILE_RING_SIZE)
+        {
+            thread->skipped++;
+            thread->dropped++;
+            return;
+        }
+        thread->open++;
+    }
+
+    profile_event_t *event = &thread->ring[thread->head & (PROFILE_RING_SIZE - 1)];
+    event->id = id;
+    event->type = type;
+    event->time = profile_time();
+    __atomic_store_n(&thread->head, thread->head + 1, __ATOMIC_RELEASE);
+}
 
-    RG_PANIC("Profile memory exhausted!");
+NO_PROFILE static uint16_t profile_find_node(uint16_t parent, const void *id, uint16_t type)
+{
+    uint32_t hash = ((uintptr_t)id >> 2) * 2654435761u ^ (parent * 40503u);
+    for (size_t i = 0; i < PROFILE_MAX_NODES; ++i)
+    {
+        uint16_t index = (hash + i) & (PROFILE_MAX_NODES - 1);
+        profile_node_t *node = &profile->nodes[index];
+        if (node->id == id && node->parent == parent && node->type == type)
+            return index;
+        if (node->id == NULL)
+        {
+            // Keep a few slots free so that lookups always terminate quickly
+            if (profile->nodes_count >= PROFILE_MAX_NODES * 7 / 8)
+                return PROFILE_NO_NODE;
+            *node = (profile_node_t){id, parent, type, 0, 0, 0};
+            profile->nodes_count++;
+            return index;
+        }
+    }
+    return PROFILE_NO_NODE;
+}
+
+NO_PROFILE static const char *profile_node_name(const profile_node_t *node, char *buffer)
+{
+    if (node->type == PROFILE_EVENT_FUNC)
+        return sprintf(buffer, "%p", node->id), buffer;
+    return (const char *)node->id;
+}
+
+NO_PROFILE static void profile_collect(void)
+{
+    for (size_t t = 0; t < PROFILE_MAX_THREADS; ++t)
+    {
+        profile_thread_t *thread = __atomic_load_n(&profile->threads[t], __ATOMIC_ACQUIRE);
+        if (!thread)
+            continue;
+
+        if (thread->root == PROFILE_NO_NODE)
+            thread->root = profile_find_node(PROFILE_NO_NODE, thread->name, PROFILE_EVENT_THREAD);
+
+        uint32_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+        for (uint32_t pos = thread->tail; pos != head; ++pos)
+        {
+            const profile_event_t *event = &thread->ring[pos & (PROFILE_RING_SIZE - 1)];
+
+            if (event->type != PROFILE_EVENT_END)
+            {
+                uint16_t parent = thread->depth > 0 ? thread->stack[RG_MIN(thread->depth, PROFILE_MAX_DEPTH) - 1].node : thread->root;
+                if (thread->depth < PROFILE_MAX_DEPTH)
+                {
+                    thread->stack[thread->depth].node = parent == PROFILE_NO_NODE ? PROFILE_NO_NODE : profile_find_node(parent, event->id, event->type);
+                    thread->stack[thread->depth].start = event->time;
+                }
+                thread->depth++;
+                continue;
+            }
+
+            // Ends without a begin happen when the profile was reset while zones were open
+            if (thread->depth == 0)
+                continue;
+            if (--thread->depth >= PROFILE_MAX_DEPTH)
+                continue;
+
+            uint16_t index = thread->stack[thread->depth].node;
+            uint32_t start = thread->stack[thread->depth].start;
+            uint32_t elapsed = event->time - start;
+            if (index == PROFILE_NO_NODE)
+                continue;
+
+            profile_node_t *node = &profile->nodes[index];
+            node->calls++;
+            node->total_time += elapsed;
+            if (node->parent != PROFILE_NO_NODE)
+                profile->nodes[node->parent].child_time += elapsed;
+
+            if (profile->trace)
+            {
+                char buffer[20];
+                fprintf(profile->trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%u,\"dur\":%u}\n",
+                        profile->trace_events++ ? "," : "", profile_node_name(node, buffer), (int)t,
+                        (unsigned)start, (unsigned)elapsed);
+            }
+        }
+        __atomic_store_n(&thread->tail, head, __ATOMIC_RELEASE);
+    }
+}
+
+NO_PROFILE static void profile_task(void *arg)
+{
+    while (!exitCalled)
+    {
+        rg_mutex_take(profile->lock, -1);
+        profile_collect();
+        rg_mutex_give(profile->lock);
+        rg_task_delay(20);
+    }
+}
+
+NO_PROFILE void rg_profile_begin(const char *zone)
+{
+    profile_push(zone, PROFILE_EVENT_ZONE);
+}
+
+NO_PROFILE void rg_profile_end(void)
+{
+    profile_push(NULL, PROFILE_EVENT_END);
+}
+
+NO_PROFILE void rg_profile_end_scope(const char **zone)
+{
+    profile_push(NULL, PROFILE_EVENT_END);
+}
+
+NO_PROFILE bool rg_profile_save_folded(const char *filename)
+{
+    RG_ASSERT_ARG(filename);
+
+    if (!profile)
+        return false;
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        return false;
+
+    rg_mutex_take(profile->lock, -1);
+    profile_collect();
+    for (size_t i = 0; i < PROFILE_MAX_NODES; ++i)
+    {
+        const profile_node_t *node = &profile->nodes[i];
+        if (!node->id || node->type == PROFILE_EVENT_THREAD || node->total_time <= node->child_time)
+            continue;
+
+        // Format: thread;outer;inner self_time
+        uint16_t stack[PROFILE_MAX_DEPTH + 1];
+        int depth = 0;
+        for (uint16_t index = i; index != PROFILE_NO_NODE && depth < RG_COUNT(stack); index = profile->nodes[index].parent)
+            stack[depth++] = index;
+        while (depth-- > 0)
+        {
+            char buffer[20];
+            fprintf(fp, "%s%c", profile_node_name(&profile->nodes[stack[depth]], buffer), depth ? ';' : ' ');
+        }
+        fprintf(fp, "%llu\n", (unsigned long long)(node->total_time - node->child_time));
+    }
+    rg_mutex_give(profile->lock);
+
+    fclose(fp);
+    return true;
+}
+
+NO_PROFILE bool rg_profile_trace_start(const char *filename)
+{
+    RG_ASSERT_ARG(filename);
+
+    if (!profile || profile->trace)
+        return false;
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        return false;
+
+    // Chrome's trace event format, it can be opened in chrome://tracing or https://ui.perfetto.dev
+    fprintf(fp, "[\n");
+    rg_mutex_take(profile->lock, -1);
+    profile_collect(); // Discard what happened before the trace started
+    profile->trace = fp;
+    profile->trace_events = 0;
+    rg_mutex_give(profile->lock);
+    return true;
+}
+
+NO_PROFILE bool rg_profile_trace_stop(void)
+{
+    if (!profile || !profile->trace)
+        return false;
+
+    rg_mutex_take(profile->lock, -1);
+    profile_collect();
+    FILE *fp = profile->trace;
+    for (size_t t = 0; t < PROFILE_MAX_THREADS; ++t)
+    {
+        if (profile->threads[t])
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}\n",
+                    profile->trace_events++ ? "," : "", (int)t, profile->threads[t]->name);
+    }
+    fprintf(fp, "]\n");
+    profile->trace = NULL;
+    rg_mutex_give(profile->lock);
+
+    RG_LOGI("Trace complete, %d events.", (int)profile->trace_events);
+    return fclose(fp) == 0;
+}
+
+NO_PROFILE bool rg_profile_trace_active(void)
+{
+    return profile && profile->trace;
 }
 
 NO_PROFILE void rg_system_dump_profile(void)
 {
-    LOCK_PROFILE();
+    if (!profile)
+        return;
+
+    rg_mutex_take(profile->lock, -1);
+    profile_collect();
 
-    printf("RGD:PROF:BEGIN %d %d\n", profile->total_frames, (int)(rg_system_timer() - profile->time_started));
+    printf("RGD:PROF:BEGIN %d %d\n", (int)profile->nodes_count, (int)(rg_system_timer() - profile->time_started));
 
-    for (int i = 0; i < profile->total_frames; ++i)
+    for (size_t i = 0; i < PROFILE_MAX_NODES; ++i)
     {
-        profile_frame_t *frame = &profile->frames[i];
+        const profile_node_t *node = &profile->nodes[i];
+        if (!node->id || node->type == PROFILE_EVENT_THREAD)
+            continue;
 
+        char buffer[2][20];
         printf(
-            "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
-            frame->caller_ptr,
-            frame->func_ptr,
-            frame->num_calls,
-            frame->run_time
+            "RGD:PROF:DATA %s\t%s\t%u\t%u\t%u\n",
+            profile_node_name(&profile->nodes[node->parent], buffer[0]),
+            profile_node_name(node, buffer[1]),
+            (unsigned)node->calls,
+            (unsigned)node->total_time,
+            (unsigned)(node->total_time - node->child_time)
         );
     }
 
+    for (size_t t = 0; t < PROFILE_MAX_THREADS; ++t)
+    {
+        profile_thread_t *thread = profile->threads[t];
+        if (thread && thread->dropped)
+            printf("RGD:PROF:DROPPED %s\t%u\n", thread->name, (unsigned)thread->dropped);
+    }
+
     printf("RGD:PROF:END\n");
 
-    memset(profile->frames, 0, sizeof(profile->frames));
+    // The open zones can't be matched anymore, their ends will be ignored
+    memset(profile->nodes, 0, sizeof(profile->nodes));
+    profile->nodes_count = 0;
+    for (size_t t = 0; t < PROFILE_MAX_THREADS; ++t)
+    {
+        if (profile->threads[t])
+            profile->threads[t]->root = PROFILE_NO_NODE, profile->threads[t]->depth = 0;
+    }
     profile->time_started = rg_system_timer();
-    profile->total_frames = 0;
 
-    UNLOCK_PROFILE();
+    rg_mutex_give(profile->lock);
 }
 
 NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
 {
-    if (!profile)
-        return;
-
-    int64_t now = rg_system_timer();
-    LOCK_PROFILE();
-    profile_frame_t *fn = find_frame(this_fn, call_site);
-    // Recursion will need a real stack, this is absurd
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
-    fn->enter_time = rg_system_timer(); // not now, because we delayed execution
-    fn->num_calls++;
-    UNLOCK_PROFILE();
+    profile_push(this_fn, PROFILE_EVENT_FUNC);
 }
 
 NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
 {
-    if (!profile)
-        return;
-
-    int64_t now = rg_system_timer();
-    LOCK_PROFILE();
-    profile_frame_t *fn = find_frame(this_fn, call_site);
-    // Ignore if profiler was disabled when function entered
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
-    fn->enter_time = 0;
-    UNLOCK_PROFILE();
+    profile_push(NULL, PROFILE_EVENT_END);
 }
 #endif
@@ -130,6 +130,8 @@ typedef struct
 {
     bool (*loadState)(const char *filename);                         // rg_emu_load_state() handler
     bool (*saveState)(const char *filename);                         // rg_emu_save_state() handler
+    size_t (*serialize)(void *buffer, size_t size);                  // In-memory saveState, returns the size used, or `size` if it didn't fit, 0 on error
+    bool (*unserialize)(const void *buffer, size_t size);            // In-memory loadState
     bool (*reset)(bool hard);                                        // rg_emu_reset() handler
     bool (*screenshot)(const char *filename, int width, int height); // rg_emu_screenshot() handler
     void (*event)(int event, void *data);                            // listen to retro-go system events
@@ -189,6 +191,11 @@ typedef struct
     bool initialized;
 } rg_app_t;
 
+typedef struct
+{
+    int32_t p50, p95, p99;
+} rg_percentiles_t;
+
 typedef struct
 {
     float skippedFPS;
@@ -207,6 +214,12 @@ typedef struct
     int freeBlockInt;
     int freeBlockExt;
     int freeStackMain;
+    // Per-frame timings in microseconds over the last few seconds, only while rg_system_set_telemetry() is on
+    rg_percentiles_t frameTime;   // Between two ticks
+    rg_percentiles_t emulateTime; // As reported to rg_system_tick
+    rg_percentiles_t blockTime;   // Waiting on the display (rg_display_sync and friends)
+    rg_percentiles_t displayTime; // Display task busy time
+    rg_percentiles_t audioTime;   // rg_audio_submit
 } rg_stats_t;
 
 rg_app_t *rg_system_init(int sampleRate, const rg_handlers_t *handlers, void *_unused);
@@ -236,6 +249,9 @@ void rg_system_event(int event, void *data);
 int64_t rg_system_timer(void);
 rg_app_t *rg_system_get_app(void);
 rg_stats_t rg_system_get_counters(void);
+bool rg_system_set_telemetry(bool enable);
+bool rg_system_get_telemetry(void);
+bool rg_system_save_telemetry(const char *filename);
 
 // RTC and time-related functions
 void rg_system_set_timezone(const char *TZ);
@@ -284,6 +300,25 @@ rg_emu_states_t *rg_emu_get_states(const char *romPath, size_t slots);
 uint8_t rg_emu_get_last_used_slot(const char *romPath);
 void rg_emu_set_speed(float speed);
 float rg_emu_get_speed(void);
+bool rg_emu_rewind(void);
+void rg_emu_set_rewind(bool enable);
+bool rg_emu_get_rewind(void);
+
+// Stdio-like stream for the cores' state code, backed by a file or by memory. The serialize/unserialize
+// handlers use the latter, fmemopen isn't available everywhere (MinGW).
+typedef struct
+{
+    FILE *fp;      // When set, the calls below go straight to stdio
+    uint8_t *data;
+    size_t size;   // Capacity of data when writing, its length when reading
+    size_t pos;
+    size_t used;   // Furthest position reached, ie the size of a serialized state
+    bool error;    // A call came up short (end of data, full buffer or I/O error)
+} rg_stream_t;
+size_t rg_stream_read(void *ptr, size_t size, size_t count, rg_stream_t *stream);
+size_t rg_stream_write(const void *ptr, size_t size, size_t count, rg_stream_t *stream);
+int rg_stream_seek(rg_stream_t *stream, long offset, int whence);
+long rg_stream_tell(rg_stream_t *stream);
 
 /* Utilities */
 
@@ -314,9 +349,28 @@ float rg_emu_get_speed(void);
 #ifdef RG_ENABLE_PROFILING
 void __cyg_profile_func_enter(void *this_fn, void *call_site);
 void __cyg_profile_func_exit(void *this_fn, void *call_site);
+void rg_profile_begin(const char *zone);
+void rg_profile_end(void);
+void rg_profile_end_scope(const char **zone);
+bool rg_profile_save_folded(const char *filename);
+bool rg_profile_trace_start(const char *filename);
+bool rg_profile_trace_stop(void);
+bool rg_profile_trace_active(void);
+void rg_system_dump_profile(void);
 #define NO_PROFILE __attribute((no_instrument_function))
+// Zone names must be string literals (or otherwise live forever), zones must be properly nested.
+// RG_PROFILE_ZONE covers the rest of the enclosing block, RG_PROFILE_BEGIN/END are for everything else.
+#define RG_PROFILE_ZONE(name) RG_PROFILE_SCOPE(name, __LINE__)
+#define RG_PROFILE_SCOPE(name, line) RG_PROFILE_SCOPE_(name, line)
+#define RG_PROFILE_SCOPE_(name, line) \
+    const char *rg_profile_zone_##line __attribute__((cleanup(rg_profile_end_scope), unused)) = (rg_profile_begin(name), name)
+#define RG_PROFILE_BEGIN(name) rg_profile_begin(name)
+#define RG_PROFILE_END() rg_profile_end()
 #else
 #define NO_PROFILE
+#define RG_PROFILE_ZONE(name)
+#define RG_PROFILE_BEGIN(name)
+#define RG_PROFILE_END()
 #endif
 
 #ifdef __cplusplus
@@ -292,6 +292,14 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Audio filter",
         [RG_LANG_FR] = "Filtre audio",
     },
+    {
+        [RG_LANG_EN] = "Threaded rendering",
+        [RG_LANG_FR] = "Rendu parallèle",
+    },
+    {
+        [RG_LANG_EN] = "Threaded audio",
+        [RG_LANG_FR] = "Audio parallèle",
+    },
 
 
     // rg_gui.c
@@ -463,6 +471,10 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Speed",
         [RG_LANG_FR] = "Vitesse",
     },
+    {
+        [RG_LANG_EN] = "Rewind",
+        [RG_LANG_FR] = "Retour arrière",
+    },
 
     // about menu
     {
@@ -676,6 +688,10 @@ static const char *translations[][RG_LANG_MAX] =
         [RG_LANG_EN] = "Build CRC cache",
         [RG_LANG_FR] = "Build CRC cache",
     },
+    {
+        [RG_LANG_EN] = "Rescan library",
+        [RG_LANG_FR] = "Rescanner la bibliothèque",
+    },
     {
         [RG_LANG_EN] = "Check for updates",
         [RG_LANG_FR] = "Verifier mise à jour",
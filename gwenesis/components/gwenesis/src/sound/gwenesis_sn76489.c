@@ -203,6 +203,40 @@ static inline void gwenesis_SN76489_Update(INT16 *buffer, int length)
         }
     }
 }
+/* Deferred synthesis, see YM2612Replay(). The PSG has nothing readable so the */
+/* emulation side only has to log the writes with their sample index.           */
+#define SN_LOG_LENGTH 1024 /* power of two */
+#define SN_LOG_END    0x100
+
+typedef struct
+{
+    UINT16 index;
+    UINT16 data;
+} SN_LOG_ENTRY;
+
+static struct
+{
+    UINT32 head, tail;
+    SN_LOG_ENTRY entries[SN_LOG_LENGTH];
+} *deferred_log;
+
+static void (*deferred_wakeup)(void);
+static int replay_index;
+
+static void deferred_log_push(int index, int data)
+{
+    UINT32 head = deferred_log->head;
+
+    while (head - __atomic_load_n(&deferred_log->tail, __ATOMIC_ACQUIRE) >= SN_LOG_LENGTH)
+        deferred_wakeup();
+
+    deferred_log->entries[head % SN_LOG_LENGTH] = (SN_LOG_ENTRY){index, data};
+    __atomic_store_n(&deferred_log->head, head + 1, __ATOMIC_RELEASE);
+
+    if (head + 1 - deferred_log->tail == SN_LOG_LENGTH / 2)
+        deferred_wakeup();
+}
+
 /* SN76589 execution */
 extern int scan_line;
 void gwenesis_SN76489_run(int target) {
@@ -212,17 +246,15 @@ if ( sn76489_clock >= target) return;
   int sn76489_prev_index = sn76489_index;
   sn76489_index += (target-sn76489_clock) / gwenesis_SN76489.divisor;
   if (sn76489_index > sn76489_prev_index) {
-    gwenesis_SN76489_Update(gwenesis_sn76489_buffer + sn76489_prev_index, sn76489_index-sn76489_prev_index);
+    if (!deferred_wakeup)
+      gwenesis_SN76489_Update(gwenesis_sn76489_buffer + sn76489_prev_index, sn76489_index-sn76489_prev_index);
     sn76489_clock = sn76489_index*gwenesis_SN76489.divisor;
   } else {
     sn76489_index = sn76489_prev_index;
   }
 }
-void gwenesis_SN76489_Write(int data, int target)
+static void gwenesis_SN76489_WriteReg(int data)
 {
-  if (GWENESIS_AUDIO_ACCURATE == 1)
-    gwenesis_SN76489_run(target);
-
   if (data & 0x80) {
     /* Latch/data byte  %1 cc t dddd */
     gwenesis_SN76489.LatchedRegister = ((data >> 4) & 0x07);
@@ -254,6 +286,63 @@ void gwenesis_SN76489_Write(int data, int target)
     }
 }
 
+void gwenesis_SN76489_Write(int data, int target)
+{
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    gwenesis_SN76489_run(target);
+
+  if (deferred_wakeup)
+    deferred_log_push(sn76489_index, data & 0xff);
+  else
+    gwenesis_SN76489_WriteReg(data);
+}
+
+/* Switching modes must be done between frames, with the log fully replayed */
+void gwenesis_SN76489_SetDeferred(void (*wakeup)(void))
+{
+  if (wakeup && !deferred_wakeup) {
+    if (!deferred_log && !(deferred_log = calloc(1, sizeof(*deferred_log))))
+      return;
+    deferred_log->head = deferred_log->tail = 0;
+    replay_index = 0;
+  }
+  deferred_wakeup = wakeup;
+}
+
+void gwenesis_SN76489_EndFrame(void)
+{
+  if (deferred_wakeup)
+    deferred_log_push(sn76489_index, SN_LOG_END);
+}
+
+int gwenesis_SN76489_Replay(int16 *buffer)
+{
+  UINT32 head = __atomic_load_n(&deferred_log->head, __ATOMIC_ACQUIRE);
+  UINT32 tail = deferred_log->tail;
+  int length = -1;
+
+  while (tail != head && length < 0)
+  {
+    SN_LOG_ENTRY entry = deferred_log->entries[tail % SN_LOG_LENGTH];
+
+    if (entry.index > replay_index) {
+      gwenesis_SN76489_Update(buffer + replay_index, entry.index - replay_index);
+      replay_index = entry.index;
+    }
+
+    if (entry.data == SN_LOG_END) {
+      length = replay_index;
+      replay_index = 0;
+    } else {
+      gwenesis_SN76489_WriteReg(entry.data);
+    }
+
+    __atomic_store_n(&deferred_log->tail, ++tail, __ATOMIC_RELEASE);
+  }
+
+  return length;
+}
+
 void gwenesis_sn76489_save_state() {
   SaveState* state;
   state = saveGwenesisStateOpenForWrite("sn76489");
@@ -66,6 +66,9 @@ uint8 *gwenesis_SN76489_GetContextPtr();
 int gwenesis_SN76489_GetContextSize(void);
 void gwenesis_SN76489_Write(int data, int target);
 void gwenesis_SN76489_run(int target);
+void gwenesis_SN76489_SetDeferred(void (*wakeup)(void));
+void gwenesis_SN76489_EndFrame(void);
+int gwenesis_SN76489_Replay(int16 *buffer);
 
 void gwenesis_sn76489_save_state();
 void gwenesis_sn76489_load_state();
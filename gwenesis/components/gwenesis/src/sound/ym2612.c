@@ -133,6 +133,7 @@
 #endif
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
@@ -2148,6 +2149,123 @@ static inline void YM2612Update(int16_t *buffer, int length)
   INTERNAL_TIMER_B(length);
 }
 
+/* Deferred synthesis: the emulation only keeps the timers and status up to date and logs */
+/* the writes with their sample index, YM2612Replay() later does the synthesis from the   */
+/* log, usually on another core. The log is single producer / single consumer.            */
+#define YM_LOG_LENGTH 2048 /* power of two */
+#define YM_LOG_END    0xff /* end of frame marker, index is the frame length */
+
+typedef struct
+{
+  UINT16 index;
+  UINT8  a;
+  UINT8  v;
+} YM_LOG_ENTRY;
+
+static struct
+{
+  UINT32 head, tail;
+  YM_LOG_ENTRY entries[YM_LOG_LENGTH];
+} *deferred_log;
+
+static void (*deferred_wakeup)(void);
+static int replay_index;
+
+/* timers as seen by the emulation side, ym2612.OPN.ST belongs to the synthesis side */
+static struct
+{
+  UINT16 address;
+  UINT8  status;
+  UINT32 mode;
+  INT32  TA, TAL, TAC;
+  INT32  TB, TBL, TBC;
+} deferred_timers;
+
+/* Same as INTERNAL_TIMER_A/B over a YM2612Update() call, minus the CSM key on */
+static void DEFERRED_TIMERS_run(int length)
+{
+  if (deferred_timers.mode & 0x01)
+  {
+    for (int i = 0; i < length; i++)
+    {
+      if (--deferred_timers.TAC <= 0)
+      {
+        if (deferred_timers.mode & 0x04)
+          deferred_timers.status |= 0x01;
+        deferred_timers.TAC = deferred_timers.TAL;
+      }
+    }
+  }
+
+  if (deferred_timers.mode & 0x02)
+  {
+    deferred_timers.TBC -= length;
+    if (deferred_timers.TBC <= 0)
+    {
+      if (deferred_timers.mode & 0x08)
+        deferred_timers.status |= 0x02;
+      if (deferred_timers.TBL)
+        deferred_timers.TBC += deferred_timers.TBL;
+      else
+        deferred_timers.TBC = deferred_timers.TBL;
+    }
+  }
+}
+
+/* Mirrors what OPNWriteMode()/set_timers() do to the timers */
+static void DEFERRED_TIMERS_write(unsigned int a, unsigned int v)
+{
+  switch (a)
+  {
+    case 0:
+      deferred_timers.address = v;
+      break;
+    case 2:
+      deferred_timers.address = v | 0x100;
+      break;
+    default:
+      switch (deferred_timers.address)
+      {
+        case 0x24:
+          deferred_timers.TA = (deferred_timers.TA & 0x03)|(((int)v)<<2);
+          deferred_timers.TAL = 1024 - deferred_timers.TA;
+          break;
+        case 0x25:
+          deferred_timers.TA = (deferred_timers.TA & 0x3fc)|(v&3);
+          deferred_timers.TAL = 1024 - deferred_timers.TA;
+          break;
+        case 0x26:
+          deferred_timers.TB = v;
+          deferred_timers.TBL = (256 - v) << 4;
+          break;
+        case 0x27:
+          if ((v&1) && !(deferred_timers.mode&1))
+            deferred_timers.TAC = deferred_timers.TAL;
+          if ((v&2) && !(deferred_timers.mode&2))
+            deferred_timers.TBC = deferred_timers.TBL;
+          deferred_timers.status &= (~v >> 4);
+          deferred_timers.mode = v;
+          break;
+      }
+  }
+}
+
+static void deferred_log_push(int index, unsigned int a, unsigned int v)
+{
+  UINT32 head = deferred_log->head;
+
+  /* full, the consumer is way behind */
+  while (head - __atomic_load_n(&deferred_log->tail, __ATOMIC_ACQUIRE) >= YM_LOG_LENGTH)
+    deferred_wakeup();
+
+  deferred_log->entries[head % YM_LOG_LENGTH] = (YM_LOG_ENTRY){index, a, v};
+  __atomic_store_n(&deferred_log->head, head + 1, __ATOMIC_RELEASE);
+
+  /* don't let the consumer start too late on write heavy frames (DAC streaming) */
+  if (head + 1 - deferred_log->tail == YM_LOG_LENGTH / 2)
+    deferred_wakeup();
+}
+
 void ym2612_run( int target) {
 
   if ( ym2612_clock >= target) {
@@ -2156,7 +2274,10 @@ void ym2612_run( int target) {
   int ym2612_prev_index = ym2612_index;
   ym2612_index += (target-ym2612_clock) / ym2612.divisor;
   if (ym2612_index > ym2612_prev_index) {
-    YM2612Update(gwenesis_ym2612_buffer + ym2612_prev_index, ym2612_index-ym2612_prev_index);
+    if (deferred_wakeup)
+      DEFERRED_TIMERS_run(ym2612_index-ym2612_prev_index);
+    else
+      YM2612Update(gwenesis_ym2612_buffer + ym2612_prev_index, ym2612_index-ym2612_prev_index);
     ym2612_clock = ym2612_index*ym2612.divisor;
 
   } else {
@@ -2168,16 +2289,8 @@ void ym2612_run( int target) {
 /* n = number  */
 /* a = address */
 /* v = value   */
-void YM2612Write(unsigned int a, unsigned int v,  int target)
+static void YM2612WriteReg(unsigned int a, unsigned int v)
 {
-  ym_log(__FUNCTION__," %06x : %02x",a,v);
-
-  //Sync
-  if (GWENESIS_AUDIO_ACCURATE == 1)
-    ym2612_run(target); 
-
-  v &= 0xff;  /* adjust to 8 bit bus */
-
   switch( a )
   {
     case 0:  /* address port 0 */
@@ -2220,15 +2333,104 @@ void YM2612Write(unsigned int a, unsigned int v,  int target)
   }
 }
 
+void YM2612Write(unsigned int a, unsigned int v,  int target)
+{
+  ym_log(__FUNCTION__," %06x : %02x",a,v);
+
+  //Sync
+  if (GWENESIS_AUDIO_ACCURATE == 1)
+    ym2612_run(target); 
+
+  v &= 0xff;  /* adjust to 8 bit bus */
+
+  if (deferred_wakeup) {
+    DEFERRED_TIMERS_write(a, v);
+    deferred_log_push(ym2612_index, a, v);
+  } else {
+    YM2612WriteReg(a, v);
+  }
+}
+
 unsigned int YM2612Read(int target)
 {
   // //Sync
   if (GWENESIS_AUDIO_ACCURATE == 1)
     ym2612_run(target);
+  if (deferred_wakeup)
+    return deferred_timers.status & 0xff;
   ym_log(__FUNCTION__, "%02x",ym2612.OPN.ST.status & 0xff);
   return ym2612.OPN.ST.status & 0xff;
 }
 
+/* Switching modes must be done between frames, with the log fully replayed */
+void YM2612SetDeferred(void (*wakeup)(void))
+{
+  if (wakeup && !deferred_wakeup) {
+    if (!deferred_log && !(deferred_log = calloc(1, sizeof(*deferred_log))))
+      return;
+    deferred_log->head = deferred_log->tail = 0;
+    replay_index = 0;
+    deferred_timers.address = ym2612.OPN.ST.address;
+    deferred_timers.status = ym2612.OPN.ST.status;
+    deferred_timers.mode = ym2612.OPN.ST.mode;
+    deferred_timers.TA = ym2612.OPN.ST.TA;
+    deferred_timers.TAL = ym2612.OPN.ST.TAL;
+    deferred_timers.TAC = ym2612.OPN.ST.TAC;
+    deferred_timers.TB = ym2612.OPN.ST.TB;
+    deferred_timers.TBL = ym2612.OPN.ST.TBL;
+    deferred_timers.TBC = ym2612.OPN.ST.TBC;
+  } else if (!wakeup && deferred_wakeup) {
+    /* the synthesis side ran its own copy of the timers, ours are the ones the game saw */
+    ym2612.OPN.ST.address = deferred_timers.address;
+    ym2612.OPN.ST.status = deferred_timers.status;
+    ym2612.OPN.ST.mode = deferred_timers.mode;
+    ym2612.OPN.ST.TA = deferred_timers.TA;
+    ym2612.OPN.ST.TAL = deferred_timers.TAL;
+    ym2612.OPN.ST.TAC = deferred_timers.TAC;
+    ym2612.OPN.ST.TB = deferred_timers.TB;
+    ym2612.OPN.ST.TBL = deferred_timers.TBL;
+    ym2612.OPN.ST.TBC = deferred_timers.TBC;
+  }
+  deferred_wakeup = wakeup;
+}
+
+/* Marks the end of the emulated frame, its length is the current ym2612_index */
+void YM2612EndFrame(void)
+{
+  if (deferred_wakeup)
+    deferred_log_push(ym2612_index, YM_LOG_END, 0);
+}
+
+/* Synthesizes what has been logged so far into buffer. Returns the frame length once */
+/* its end is reached (the next call starts a new frame), or -1 if it isn't there yet. */
+int YM2612Replay(int16_t *buffer)
+{
+  UINT32 head = __atomic_load_n(&deferred_log->head, __ATOMIC_ACQUIRE);
+  UINT32 tail = deferred_log->tail;
+  int length = -1;
+
+  while (tail != head && length < 0)
+  {
+    YM_LOG_ENTRY entry = deferred_log->entries[tail % YM_LOG_LENGTH];
+
+    if (entry.index > replay_index) {
+      YM2612Update(buffer + replay_index, entry.index - replay_index);
+      replay_index = entry.index;
+    }
+
+    if (entry.a == YM_LOG_END) {
+      length = replay_index;
+      replay_index = 0;
+    } else {
+      YM2612WriteReg(entry.a, entry.v);
+    }
+
+    __atomic_store_n(&deferred_log->tail, ++tail, __ATOMIC_RELEASE);
+  }
+
+  return length;
+}
+
 
 void YM2612Config(unsigned char dac_bits) //,unsigned int AUDIO_FREQ_DIVISOR)
 {
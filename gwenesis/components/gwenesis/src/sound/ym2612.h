@@ -28,6 +28,11 @@ extern void YM2612Write(unsigned int a, unsigned int v, int target);
 extern void ym2612_run(int target);
 extern unsigned int YM2612Read(int target);
 
+/* Deferred synthesis, wakeup is called when the log needs to be consumed (NULL disables) */
+extern void YM2612SetDeferred(void (*wakeup)(void));
+extern void YM2612EndFrame(void);
+extern int YM2612Replay(int16_t *buffer);
+
 #if 0
 extern int YM2612LoadContext(unsigned char *state);
 extern int YM2612SaveContext(unsigned char *state);
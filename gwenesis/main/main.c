@@ -25,6 +25,11 @@ static int savestate_errors = 0;
 static bool yfm_enabled = true;
 static bool z80_enabled = true;
 static bool sn76489_enabled = true;
+static bool threaded_audio = true;
+
+static rg_task_t *audio_task;
+static uint32_t audio_frames_queued;
+static uint32_t audio_frames_done;
 
 static rg_surface_t *updates[2];
 static rg_surface_t *currentUpdate;
@@ -33,6 +38,7 @@ static rg_app_t *app;
 static const char *SETTING_YFM_EMULATION = "yfm_enable";
 static const char *SETTING_Z80_EMULATION = "z80_enable";
 static const char *SETTING_SN76489_EMULATION = "sn_enable";
+static const char *SETTING_THREADED_AUDIO = "threaded_audio";
 // --- MAIN
 
 typedef struct {
@@ -108,6 +114,66 @@ void gwenesis_io_get_buttons()
 }
 
 
+static void audio_mix_submit(int ym2612_length, int sn76489_length)
+{
+    // Both chips share the sample clock, a disabled one simply doesn't advance its index
+    if (ym2612_length < sn76489_length)
+        memset(gwenesis_ym2612_buffer + ym2612_length, 0, (sn76489_length - ym2612_length) * sizeof(int16_t));
+    for (int i = 0; i < sn76489_length; i++)
+    {
+        int sample = gwenesis_ym2612_buffer[i] + gwenesis_sn76489_buffer[i];
+        gwenesis_ym2612_buffer[i] = RG_MIN(RG_MAX(sample, -32768), 32767);
+    }
+    rg_audio_submit((void *)gwenesis_ym2612_buffer, AUDIO_BUFFER_LENGTH >> 1);
+}
+
+static void audio_task_wakeup(void)
+{
+    if (!rg_task_messages_waiting(audio_task))
+        rg_task_send(audio_task, &(rg_task_msg_t){0});
+}
+
+static void audio_task_loop(void *arg)
+{
+    int ym2612_length = -1, sn76489_length = -1;
+    rg_task_msg_t msg;
+
+    while (true)
+    {
+        rg_task_receive(&msg);
+        if (msg.type == RG_TASK_MSG_STOP)
+            break;
+        // Synthesize everything logged so far, a frame goes out once both chips have reached its end
+        while (true)
+        {
+            if (ym2612_length < 0)
+                ym2612_length = YM2612Replay(gwenesis_ym2612_buffer);
+            if (sn76489_length < 0)
+                sn76489_length = gwenesis_SN76489_Replay(gwenesis_sn76489_buffer);
+            if (ym2612_length < 0 || sn76489_length < 0)
+                break;
+            if (yfm_enabled || z80_enabled || sn76489_enabled)
+                audio_mix_submit(ym2612_length, sn76489_length);
+            ym2612_length = sn76489_length = -1;
+            __atomic_store_n(&audio_frames_done, audio_frames_done + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static void audio_wait(uint32_t max_pending)
+{
+    while (audio_frames_queued - __atomic_load_n(&audio_frames_done, __ATOMIC_ACQUIRE) > max_pending)
+        rg_task_yield();
+}
+
+static void set_threaded_audio(bool enable)
+{
+    // The chips belong to the audio task until it has caught up
+    audio_wait(0);
+    YM2612SetDeferred(enable ? &audio_task_wakeup : NULL);
+    gwenesis_SN76489_SetDeferred(enable ? &audio_task_wakeup : NULL);
+}
+
 static rg_gui_event_t yfm_update_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -144,6 +210,19 @@ static rg_gui_event_t z80_update_cb(rg_gui_option_t *option, rg_gui_event_t even
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t threaded_audio_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        threaded_audio = !threaded_audio;
+        rg_settings_set_number(NS_APP, SETTING_THREADED_AUDIO, threaded_audio);
+        set_threaded_audio(threaded_audio);
+    }
+    strcpy(option->value, threaded_audio ? _("On") : _("Off"));
+
+    return RG_DIALOG_VOID;
+}
+
 static bool screenshot_handler(const char *filename, int width, int height)
 {
     return rg_surface_save_image_file(currentUpdate, filename, width, height);
@@ -151,33 +230,41 @@ static bool screenshot_handler(const char *filename, int width, int height)
 
 static bool save_state_handler(const char *filename)
 {
+    bool success = false;
+    set_threaded_audio(false);
     if ((savestate_fp = fopen(filename, "wb")))
     {
         savestate_errors = 0;
         gwenesis_save_state();
         fclose(savestate_fp);
-        return savestate_errors == 0;
+        success = savestate_errors == 0;
     }
-    return false;
+    set_threaded_audio(threaded_audio);
+    return success;
 }
 
 static bool load_state_handler(const char *filename)
 {
+    bool success = false;
+    set_threaded_audio(false);
     if ((savestate_fp = fopen(filename, "rb")))
     {
         savestate_errors = 0;
         gwenesis_load_state();
         fclose(savestate_fp);
-        if (savestate_errors == 0)
-            return true;
+        success = savestate_errors == 0;
     }
-    reset_emulation();
-    return false;
+    if (!success)
+        reset_emulation();
+    set_threaded_audio(threaded_audio);
+    return success;
 }
 
 static bool reset_handler(bool hard)
 {
+    set_threaded_audio(false);
     reset_emulation();
+    set_threaded_audio(threaded_audio);
     return true;
 }
 
@@ -194,6 +281,7 @@ static void options_handler(rg_gui_option_t *dest)
     *dest++ = (rg_gui_option_t){0, _("YM2612 audio "), "-", RG_DIALOG_FLAG_NORMAL, &yfm_update_cb};
     *dest++ = (rg_gui_option_t){0, _("SN76489 audio"), "-", RG_DIALOG_FLAG_NORMAL, &sn76489_update_cb};
     *dest++ = (rg_gui_option_t){0, _("Z80 emulation"), "-", RG_DIALOG_FLAG_NORMAL, &z80_update_cb};
+    *dest++ = (rg_gui_option_t){0, _("Threaded audio"), "-", RG_DIALOG_FLAG_NORMAL, &threaded_audio_cb};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
 
@@ -213,6 +301,7 @@ void app_main(void)
     yfm_enabled = rg_settings_get_number(NS_APP, SETTING_YFM_EMULATION, 1);
     sn76489_enabled = rg_settings_get_number(NS_APP, SETTING_SN76489_EMULATION, 0);
     z80_enabled = rg_settings_get_number(NS_APP, SETTING_Z80_EMULATION, 1);
+    threaded_audio = rg_settings_get_number(NS_APP, SETTING_THREADED_AUDIO, 1);
 
     updates[0] = rg_surface_create(320, 241, RG_PIXEL_PAL565_BE, MEM_FAST);
     // updates[1] = rg_surface_create(320, 241, RG_PIXEL_PAL565_BE, MEM_FAST);
@@ -251,6 +340,11 @@ void app_main(void)
     RG_LOGI("reset_emulation()\n");
     reset_emulation();
 
+    // In threaded mode the emulation only logs the YM2612/SN76489 writes (with their sample position),
+    // the synthesis of frame N happens on the other core while frame N+1 is being emulated.
+    audio_task = rg_task_create("gen_sound", &audio_task_loop, NULL, 3 * 1024, RG_TASK_PRIORITY_2, 1);
+    set_threaded_audio(threaded_audio);
+
     if (app->bootFlags & RG_BOOT_RESUME)
     {
         rg_emu_load_state(app->saveSlot);
@@ -398,9 +492,15 @@ void app_main(void)
 
         rg_system_tick(rg_system_timer() - startTime);
 
-        if (yfm_enabled || z80_enabled) {
-            // TODO: Mix in gwenesis_sn76489_buffer
-            rg_audio_submit((void *)gwenesis_ym2612_buffer, AUDIO_BUFFER_LENGTH >> 1);
+        if (threaded_audio) {
+            YM2612EndFrame();
+            gwenesis_SN76489_EndFrame();
+            audio_frames_queued++;
+            audio_task_wakeup();
+            // Don't get more than one frame ahead, the audio task's rg_audio_submit is what paces us
+            audio_wait(1);
+        } else if (yfm_enabled || z80_enabled || sn76489_enabled) {
+            audio_mix_submit(ym2612_index, sn76489_index);
         }
 
         if (skipFrames == 0)
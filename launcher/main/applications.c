@@ -10,44 +10,155 @@
 #include "gui.h"
 
 #define CRC_CACHE_MAGIC 0x21112223
-#define CRC_CACHE_MAX_ENTRIES 8192
-static struct __attribute__((__packed__))
+#define CRC_CACHE_PATH RG_BASE_PATH_CACHE "/crc32.bin"
+#define CRC_CACHE_MIN_CAPACITY 1024
+#define CRC_CACHE_SAVE_INTERVAL 16
+#define CRC_QUEUE_SIZE 32
+
+typedef struct __attribute__((__packed__))
 {
-    uint32_t magic;
-    uint32_t count;
-    struct {
+    uint32_t key;
+    uint32_t crc;
+} crc_entry_t;
+
+static struct
+{
+    crc_entry_t *entries; // Open addressing hash table, a key of 0 marks a free slot
+    size_t capacity;      // Always a power of two
+    size_t count;
+    size_t unsaved;
+    rg_mutex_t *lock;
+    rg_mutex_t *save_lock; // Serializes crc_cache_save, it's called from both the UI and the task
+    rg_task_t *task;
+    struct
+    {
         uint32_t key;
-        uint32_t crc;
-    } entries[CRC_CACHE_MAX_ENTRIES];
-} *crc_cache;
-static bool crc_cache_dirty = true;
+        uint32_t offset;
+        char *path;
+    } queue[CRC_QUEUE_SIZE];
+    size_t queue_count;
+} crc_cache;
 
 static retro_app_t *apps[24];
 static int apps_count = 0;
 
-static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
+#define LIBRARY_INDEX_MAGIC 0x21112224
+#define LIBRARY_INDEX_PATH RG_BASE_PATH_CACHE "/library_%s.bin"
+
+// On-disk library index, one per app: a header then for each folder its record, path and names
+typedef struct __attribute__((__packed__))
 {
-    retro_app_t *app = (retro_app_t *)arg;
-    uint8_t type = RETRO_TYPE_INVALID;
+    uint32_t magic;
+    uint32_t folders_count;
+} library_header_t;
 
-    // Skip hidden files
-    if (entry->basename[0] == '.')
-        return RG_SCANDIR_SKIP;
+typedef struct __attribute__((__packed__))
+{
+    int64_t mtime;
+    uint32_t files_count;
+    uint32_t names_size;
+    uint16_t path_len;
+} library_folder_t;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+} library_index_t;
+
+static const library_folder_t *library_index_find(const library_index_t *index, const char *path, const char **names)
+{
+    size_t path_len = strlen(path);
+    size_t pos = sizeof(library_header_t);
 
-    if (entry->is_file)
+    if (!index->data)
+        return NULL;
+
+    while (pos + sizeof(library_folder_t) <= index->size)
     {
-        if (rg_extension_match(entry->basename, app->extensions))
-            type = RETRO_TYPE_FILE;
+        const library_folder_t *folder = (library_folder_t *)(index->data + pos);
+        const char *folder_path = (char *)folder + sizeof(library_folder_t);
+        pos += sizeof(library_folder_t) + folder->path_len + folder->names_size;
+        if (pos > index->size)
+            break;
+        if (folder->path_len == path_len && memcmp(folder_path, path, path_len) == 0)
+        {
+            *names = folder_path + path_len;
+            return folder;
+        }
     }
-    else if (entry->is_dir)
+
+    return NULL;
+}
+
+static library_index_t library_index_load(retro_app_t *app)
+{
+    library_index_t index = {0};
+    char path[RG_PATH_MAX];
+
+    snprintf(path, sizeof(path), LIBRARY_INDEX_PATH, app->short_name);
+    if (app->force_rescan || !rg_storage_read_file(path, (void **)&index.data, &index.size, 0))
+        return index;
+
+    const library_header_t *header = (library_header_t *)index.data;
+    if (index.size < sizeof(library_header_t) || header->magic != LIBRARY_INDEX_MAGIC)
     {
-        RG_LOGI("Found subdirectory '%s'", entry->path);
-        type = RETRO_TYPE_FOLDER;
+        RG_LOGW("Library index '%s' is invalid, ignoring it.", path);
+        free(index.data);
+        return (library_index_t){0};
     }
 
-    if (type == RETRO_TYPE_INVALID)
-        return RG_SCANDIR_CONTINUE;
+    return index;
+}
+
+static void library_index_save(retro_app_t *app)
+{
+    char path[RG_PATH_MAX];
+    size_t size = sizeof(library_header_t);
 
+    for (size_t i = 0; i < app->folders_count; ++i)
+        size += sizeof(library_folder_t) + strlen(app->folders[i].path) + app->folders[i].names_size;
+
+    uint8_t *data = malloc(size);
+    if (!data)
+        return;
+
+    uint8_t *ptr = data + sizeof(library_header_t);
+    *(library_header_t *)data = (library_header_t){LIBRARY_INDEX_MAGIC, app->folders_count};
+
+    for (size_t i = 0; i < app->folders_count; ++i)
+    {
+        const retro_folder_t *folder = &app->folders[i];
+        library_folder_t *record = (library_folder_t *)ptr;
+        size_t path_len = strlen(folder->path);
+        char *names = (char *)ptr + sizeof(library_folder_t) + path_len;
+
+        memcpy(ptr + sizeof(library_folder_t), folder->path, path_len);
+
+        // Repack the names, some files might have been deleted since the scan
+        size_t names_size = 0, files_count = 0;
+        for (size_t j = folder->first; j < folder->first + folder->count; ++j)
+        {
+            const retro_file_t *file = &app->files[j];
+            if (file->type == RETRO_TYPE_INVALID)
+                continue;
+            names[names_size++] = file->type;
+            names_size += sprintf(names + names_size, "%s", file->name) + 1;
+            files_count++;
+        }
+
+        *record = (library_folder_t){folder->mtime, files_count, names_size, path_len};
+        ptr += sizeof(library_folder_t) + path_len + names_size;
+    }
+
+    snprintf(path, sizeof(path), LIBRARY_INDEX_PATH, app->short_name);
+    if (rg_storage_write_file(path, data, ptr - data, RG_FILE_ATOMIC_WRITE))
+        app->index_dirty = false;
+    free(data);
+}
+
+static bool add_file(retro_app_t *app, const char *name, const char *folder, uint8_t type)
+{
     if (app->files_count + 1 > app->files_capacity)
     {
         size_t new_capacity = (app->files_capacity * 1.5) + 1;
@@ -55,15 +166,15 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
         if (!new_buf)
         {
             RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...", app->files_count);
-            return RG_SCANDIR_STOP;
+            return false;
         }
         app->files = new_buf;
         app->files_capacity = new_capacity;
     }
 
     app->files[app->files_count++] = (retro_file_t) {
-        .name = strdup(entry->basename),
-        .folder = rg_unique_string(entry->dirname),
+        .name = name,
+        .folder = folder,
         .checksum = 0,
         .missing_cover = 0,
         .saves = 0,
@@ -71,6 +182,165 @@ static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
         .app = (void*)app,
     };
 
+    return true;
+}
+
+static uint8_t get_entry_type(retro_app_t *app, const rg_scandir_t *entry)
+{
+    // Skip hidden files
+    if (entry->basename[0] == '.')
+        return RETRO_TYPE_INVALID;
+
+    if (entry->is_file && rg_extension_match(entry->basename, app->extensions))
+        return RETRO_TYPE_FILE;
+
+    if (entry->is_dir)
+        return RETRO_TYPE_FOLDER;
+
+    return RETRO_TYPE_INVALID;
+}
+
+static int scan_folder_cb(const rg_scandir_t *entry, void *arg)
+{
+    retro_app_t *app = (retro_app_t *)arg;
+    retro_folder_t *folder = &app->folders[app->folders_count];
+    uint8_t type = get_entry_type(app, entry);
+
+    if (type == RETRO_TYPE_INVALID)
+        return RG_SCANDIR_CONTINUE;
+
+    if (type == RETRO_TYPE_FOLDER)
+        RG_LOGI("Found subdirectory '%s'", entry->path);
+
+    // The names are collected in a temporary list, they get packed once the folder is done
+    if (!add_file(app, strdup(entry->basename), folder->path, type))
+        return RG_SCANDIR_STOP;
+
+    folder->names_size += strlen(entry->basename) + 2;
+
+    return RG_SCANDIR_CONTINUE;
+}
+
+static void scan_folder(retro_app_t *app, const char *path, const library_index_t *index)
+{
+    // The record is reserved first because scan_folder_cb fills it in place
+    retro_folder_t *folders = realloc(app->folders, (app->folders_count + 1) * sizeof(retro_folder_t));
+    if (!folders)
+    {
+        RG_LOGE("Ran out of memory, folder '%s' can't be listed!", path);
+        return;
+    }
+    app->folders = folders;
+
+    retro_folder_t *folder = &app->folders[app->folders_count];
+    *folder = (retro_folder_t) {
+        .path = rg_unique_string(path),
+        .mtime = rg_storage_stat(path).mtime,
+        .first = app->files_count,
+    };
+
+    const char *names = NULL;
+    const library_folder_t *cached = library_index_find(index, path, &names);
+
+    if (cached && cached->mtime == folder->mtime && folder->mtime != 0)
+    {
+        // Unchanged since the last scan, no need to read the directory now. It is still verified once
+        // the list is shown (see verify_next_folder), a FAT directory's mtime can't be trusted.
+        if ((folder->names = malloc(RG_MAX(cached->names_size, 1))))
+        {
+            memcpy(folder->names, names, cached->names_size);
+            folder->names_size = cached->names_size;
+            folder->unverified = true;
+            for (size_t pos = 0; pos < folder->names_size; pos += strlen(folder->names + pos) + 1)
+            {
+                uint8_t type = folder->names[pos++];
+                if (!add_file(app, folder->names + pos, folder->path, type))
+                    break;
+            }
+        }
+    }
+    else
+    {
+        rg_storage_scandir(path, scan_folder_cb, app, 0);
+
+        // Pack the names found by scan_folder_cb in a single allocation
+        char *packed = malloc(RG_MAX(folder->names_size, 1));
+        size_t pos = 0;
+        for (size_t i = folder->first; i < app->files_count; ++i)
+        {
+            char *name = (char *)app->files[i].name;
+            if (packed)
+            {
+                packed[pos++] = app->files[i].type;
+                app->files[i].name = strcpy(packed + pos, name);
+                pos += strlen(name) + 1;
+            }
+            else
+            {
+                app->files[i].type = RETRO_TYPE_INVALID;
+                app->files[i].name = NULL;
+            }
+            free(name);
+        }
+        folder->names = packed;
+        app->index_dirty = true;
+    }
+
+    folder->count = app->files_count - folder->first;
+    app->folders_count++;
+
+    // Subfolders are scanned after so that the files of each folder remain contiguous
+    size_t first = folder->first, last = folder->first + folder->count;
+    const char *folder_path = folder->path;
+    for (size_t i = first; i < last; ++i)
+    {
+        if (app->files[i].type == RETRO_TYPE_FOLDER)
+        {
+            char subpath[RG_PATH_MAX + 1];
+            snprintf(subpath, sizeof(subpath), "%s/%s", folder_path, app->files[i].name);
+            scan_folder(app, subpath, index);
+        }
+    }
+}
+
+static retro_folder_t *find_folder(retro_app_t *app, const char *path)
+{
+    // path is expected to be a rg_unique_string
+    for (size_t i = 0; i < app->folders_count; ++i)
+    {
+        if (app->folders[i].path == path)
+            return &app->folders[i];
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    retro_app_t *app;
+    const char *names;
+    size_t names_size;
+    size_t pos;
+    bool changed;
+} verify_folder_t;
+
+static int verify_folder_cb(const rg_scandir_t *entry, void *arg)
+{
+    verify_folder_t *verify = (verify_folder_t *)arg;
+    uint8_t type = get_entry_type(verify->app, entry);
+
+    if (type == RETRO_TYPE_INVALID)
+        return RG_SCANDIR_CONTINUE;
+
+    // The entries must come in the same order as in the index, which is the order they were read in
+    size_t len = strlen(entry->basename);
+    if (verify->pos + len + 2 > verify->names_size || verify->names[verify->pos] != type
+        || strcmp(verify->names + verify->pos + 1, entry->basename) != 0)
+    {
+        verify->changed = true;
+        return RG_SCANDIR_STOP;
+    }
+    verify->pos += len + 2;
+
     return RG_SCANDIR_CONTINUE;
 }
 
@@ -105,7 +375,14 @@ static void application_init(retro_app_t *app)
     rg_storage_mkdir(app->paths.saves);
     rg_storage_mkdir(app->paths.roms);
 
-    rg_storage_scandir(app->paths.roms, scan_folder_cb, app, RG_SCANDIR_RECURSIVE);
+    library_index_t index = library_index_load(app);
+    scan_folder(app, app->paths.roms, &index);
+    free(index.data);
+
+    if (app->index_dirty)
+        library_index_save(app);
+    app->force_rescan = false;
+
     rg_storage_scandir(app->paths.saves, scan_saves_cb, app, RG_SCANDIR_RECURSIVE);
     // rg_storage_scandir(app->paths.covers, scan_folder_cb3, app, RG_SCANDIR_RECURSIVE);
 
@@ -115,6 +392,22 @@ static void application_init(retro_app_t *app)
     app->initialized = true;
 }
 
+static void application_deinit(retro_app_t *app)
+{
+    if (!app->initialized)
+        return;
+
+    for (size_t i = 0; i < app->folders_count; ++i)
+        free(app->folders[i].names);
+    free(app->folders);
+    app->folders = NULL;
+    app->folders_count = 0;
+    app->files_count = 0;
+    app->initialized = false;
+    // The files might have been changed from outside (webui), don't trust directory mtimes
+    app->force_rescan = true;
+}
+
 static const char *get_file_path(retro_file_t *file)
 {
     static char buffer[RG_PATH_MAX + 1];
@@ -139,7 +432,7 @@ static void application_start(retro_file_t *file, int load_state)
     rg_system_switch_app(part, name, path, flags);
 }
 
-static uint32_t crc_read_file(retro_file_t *file, bool interactive)
+static uint32_t crc_read_file(const char *path, size_t offset, bool interactive)
 {
     uint8_t buffer[0x800];
     uint32_t crc_tmp = 0;
@@ -147,12 +440,12 @@ static uint32_t crc_read_file(retro_file_t *file, bool interactive)
     int count = -1;
     FILE *fp;
 
-    if (file == NULL)
+    if (path == NULL)
         return 0;
 
-    if ((fp = fopen(get_file_path(file), "rb")))
+    if ((fp = fopen(path, "rb")))
     {
-        fseek(fp, file->app->crc_offset, SEEK_SET);
+        fseek(fp, offset, SEEK_SET);
 
         while (count != 0)
         {
@@ -172,105 +465,272 @@ static uint32_t crc_read_file(retro_file_t *file, bool interactive)
     return done ? crc_tmp : 0;
 }
 
-static void crc_cache_init(void)
+static uint32_t crc_cache_calc_key(retro_file_t *file)
 {
-    crc_cache = calloc(1, sizeof(*crc_cache));
-    if (!crc_cache)
-    {
-        RG_LOGE("Failed to allocate crc_cache!");
-        return;
-    }
+    // return ((uint64_t)rg_crc32(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
+    // This should be reasonably unique
+    const char *path = get_file_path(file);
+    uint32_t key = rg_crc32(0, (const uint8_t *)path, strlen(path));
+    return key ?: 1; // 0 is reserved for free slots
+}
+
+// The following crc_cache_*_locked functions must be called with crc_cache.lock held
+static crc_entry_t *crc_cache_find_locked(uint32_t key)
+{
+    if (!crc_cache.entries)
+        return NULL;
 
-    void *data_ptr = crc_cache;
-    size_t data_len = sizeof(*crc_cache);
-    rg_storage_read_file(RG_BASE_PATH_CACHE "/crc32.bin", &data_ptr, &data_len, RG_FILE_USER_BUFFER);
-    if (crc_cache->magic == CRC_CACHE_MAGIC && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
+    size_t mask = crc_cache.capacity - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask)
     {
-        RG_LOGI("Loaded CRC cache (entries: %d)", (int)crc_cache->count);
-        crc_cache_dirty = false;
+        if (crc_cache.entries[i].key == key || crc_cache.entries[i].key == 0)
+            return &crc_cache.entries[i];
     }
-    else
+}
+
+static bool crc_cache_insert_locked(uint32_t key, uint32_t crc)
+{
+    // Keep the load factor under 75%, otherwise probing gets slow
+    if ((crc_cache.count + 1) * 4 > crc_cache.capacity * 3)
     {
-        crc_cache->count = 0;
+        size_t new_capacity = RG_MAX(crc_cache.capacity * 2, CRC_CACHE_MIN_CAPACITY);
+        crc_entry_t *new_entries = calloc(new_capacity, sizeof(crc_entry_t));
+        if (!new_entries)
+        {
+            RG_LOGW("Ran out of memory, CRC cache can't grow past %d entries", (int)crc_cache.count);
+            return false;
+        }
+        crc_entry_t *old_entries = crc_cache.entries;
+        size_t old_capacity = crc_cache.capacity;
+        crc_cache.entries = new_entries;
+        crc_cache.capacity = new_capacity;
+        for (size_t i = 0; i < old_capacity; ++i)
+        {
+            if (old_entries[i].key)
+                *crc_cache_find_locked(old_entries[i].key) = old_entries[i];
+        }
+        free(old_entries);
     }
+
+    crc_entry_t *entry = crc_cache_find_locked(key);
+    if (entry->key == 0)
+        crc_cache.count++;
+    entry->key = key;
+    entry->crc = crc;
+    // A CRC of 0 is a failed read, it is kept in memory only (see crc_cache_save)
+    if (crc)
+        crc_cache.unsaved++;
+    return true;
 }
 
 static void crc_cache_save(void)
 {
-    if (!crc_cache || !crc_cache_dirty)
+    if (!crc_cache.lock)
+        return;
+
+    // Without this an older snapshot could be written last, or both writers could collide on the temp file
+    rg_mutex_take(crc_cache.save_lock, -1);
+
+    rg_mutex_take(crc_cache.lock, -1);
+    size_t data_len = 8;
+    uint32_t *data = crc_cache.unsaved ? malloc(data_len + crc_cache.count * sizeof(crc_entry_t)) : NULL;
+    if (data)
+    {
+        // Failed reads aren't saved, they might have been transient (card busy, file still being copied)
+        crc_entry_t *entries = (crc_entry_t *)&data[2];
+        size_t count = 0;
+        for (size_t i = 0; i < crc_cache.capacity; ++i)
+        {
+            if (crc_cache.entries[i].key && crc_cache.entries[i].crc)
+                entries[count++] = crc_cache.entries[i];
+        }
+        data[0] = CRC_CACHE_MAGIC;
+        data[1] = count;
+        data_len += count * sizeof(crc_entry_t);
+        crc_cache.unsaved = 0;
+    }
+    rg_mutex_give(crc_cache.lock);
+
+    if (!data)
+    {
+        rg_mutex_give(crc_cache.save_lock);
         return;
+    }
 
+    // The write is done without the lock so that lookups from the UI don't have to wait on the SD card
     RG_LOGI("Saving CRC cache...");
-    size_t data_len = RG_MIN(8 + (crc_cache->count * sizeof(crc_cache->entries[0])), sizeof(*crc_cache));
-    crc_cache_dirty = !rg_storage_write_file(RG_BASE_PATH_CACHE"/crc32.bin", crc_cache, data_len, 0);
+    if (!rg_storage_write_file(CRC_CACHE_PATH, data, data_len, RG_FILE_ATOMIC_WRITE))
+    {
+        rg_mutex_take(crc_cache.lock, -1);
+        crc_cache.unsaved++;
+        rg_mutex_give(crc_cache.lock);
+    }
+    free(data);
+
+    rg_mutex_give(crc_cache.save_lock);
 }
 
-static uint32_t crc_cache_calc_key(retro_file_t *file)
+static uint32_t crc_cache_lookup(retro_file_t *file)
 {
-    // return ((uint64_t)rg_crc32(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
-    // This should be reasonably unique
-    const char *path = get_file_path(file);
-    return rg_crc32(0, (const uint8_t *)path, strlen(path));
+    if (!crc_cache.lock)
+        return 0;
+
+    uint32_t key = crc_cache_calc_key(file);
+    rg_mutex_take(crc_cache.lock, -1);
+    crc_entry_t *entry = crc_cache_find_locked(key);
+    uint32_t crc = (entry && entry->key == key) ? entry->crc : 0;
+    rg_mutex_give(crc_cache.lock);
+    return crc;
 }
 
-static int crc_cache_find(retro_file_t *file)
+static void crc_cache_update(retro_file_t *file)
 {
-    if (!crc_cache)
-        return -1;
+    if (!crc_cache.lock)
+        return;
 
     uint32_t key = crc_cache_calc_key(file);
+    rg_mutex_take(crc_cache.lock, -1);
+    if (crc_cache_insert_locked(key, file->checksum))
+        RG_LOGI("Adding %08X => %08X to cache (new total: %d)", (int)key, (int)file->checksum, (int)crc_cache.count);
+    rg_mutex_give(crc_cache.lock);
+}
 
-    for (int i = 0; i < crc_cache->count; i++)
+static void crc_cache_task(void *arg)
+{
+    while (true)
     {
-        if (crc_cache->entries[i].key == key)
-            return i;
-    }
+        char *path = NULL;
+        uint32_t key = 0, offset = 0;
 
-    return -1;
-}
+        rg_mutex_take(crc_cache.lock, -1);
+        if (crc_cache.queue_count > 0)
+        {
+            key = crc_cache.queue[0].key;
+            offset = crc_cache.queue[0].offset;
+            path = crc_cache.queue[0].path;
+            memmove(&crc_cache.queue[0], &crc_cache.queue[1], (--crc_cache.queue_count) * sizeof(crc_cache.queue[0]));
+        }
+        size_t unsaved = crc_cache.unsaved;
+        rg_mutex_give(crc_cache.lock);
 
-static uint32_t crc_cache_lookup(retro_file_t *file)
-{
-    int index = crc_cache_find(file);
-    if (index != -1)
-        return crc_cache->entries[index].crc;
-    return 0;
+        if (!path)
+        {
+            // Persist the results once the queue runs dry, so that the SD card is left alone while browsing
+            if (unsaved > 0)
+                crc_cache_save();
+            rg_task_delay(100);
+            continue;
+        }
+
+        uint32_t crc = crc_read_file(path, offset, false);
+        free(path);
+
+        rg_mutex_take(crc_cache.lock, -1);
+        // A failed read is cached as 0 too, so that the file doesn't get queued over and over until reboot
+        crc_cache_insert_locked(key, crc);
+        unsaved = crc_cache.unsaved;
+        rg_mutex_give(crc_cache.lock);
+
+        if (unsaved >= CRC_CACHE_SAVE_INTERVAL)
+            crc_cache_save();
+    }
 }
 
-static void crc_cache_update(retro_file_t *file)
+static void crc_cache_request(retro_file_t *file, bool urgent)
 {
-    if (!crc_cache)
+    if (!crc_cache.task || !file || file->type != RETRO_TYPE_FILE || file->checksum)
         return;
 
     uint32_t key = crc_cache_calc_key(file);
-    int index = crc_cache_find(file);
-    if (index == -1)
-    {
-        if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-            index = crc_cache->count++;
-        else
-            index = rand() % CRC_CACHE_MAX_ENTRIES;
 
-        RG_LOGI("Adding %08X => %08X to cache (new total: %d)",
-            (int)key, (int)file->checksum, (int)crc_cache->count);
+    rg_mutex_take(crc_cache.lock, -1);
+    crc_entry_t *entry = crc_cache_find_locked(key);
+    size_t pos = crc_cache.queue_count;
+    for (size_t i = 0; i < crc_cache.queue_count; ++i)
+    {
+        if (crc_cache.queue[i].key == key)
+            pos = i;
     }
-    else
+    if (entry->key == key || (pos < crc_cache.queue_count && !urgent))
     {
-        RG_LOGI("Updating %08X => %08X to cache (total: %d)",
-            (int)key, (int)file->checksum, (int)crc_cache->count);
+        // Already computed or already queued
     }
+    else if (urgent)
+    {
+        // Move it to the front of the queue, dropping the last job if it's full
+        char *path = pos < crc_cache.queue_count ? crc_cache.queue[pos].path : strdup(get_file_path(file));
+        if (pos == crc_cache.queue_count && crc_cache.queue_count == CRC_QUEUE_SIZE)
+            free(crc_cache.queue[--pos].path);
+        else if (pos == crc_cache.queue_count)
+            crc_cache.queue_count++;
+        memmove(&crc_cache.queue[1], &crc_cache.queue[0], pos * sizeof(crc_cache.queue[0]));
+        crc_cache.queue[0].key = key;
+        crc_cache.queue[0].offset = file->app->crc_offset;
+        crc_cache.queue[0].path = path;
+    }
+    else if (crc_cache.queue_count < CRC_QUEUE_SIZE)
+    {
+        crc_cache.queue[pos].key = key;
+        crc_cache.queue[pos].offset = file->app->crc_offset;
+        crc_cache.queue[pos].path = strdup(get_file_path(file));
+        crc_cache.queue_count++;
+    }
+    rg_mutex_give(crc_cache.lock);
+}
+
+static void crc_cache_cancel_requests(void)
+{
+    if (!crc_cache.task)
+        return;
+
+    rg_mutex_take(crc_cache.lock, -1);
+    for (size_t i = 0; i < crc_cache.queue_count; ++i)
+        free(crc_cache.queue[i].path);
+    crc_cache.queue_count = 0;
+    rg_mutex_give(crc_cache.lock);
+}
+
+static void crc_cache_init(void)
+{
+    struct __attribute__((__packed__)) {
+        uint32_t magic;
+        uint32_t count;
+        crc_entry_t entries[];
+    } *data = NULL;
+    size_t data_len = 0;
+
+    if (!(crc_cache.entries = calloc(CRC_CACHE_MIN_CAPACITY, sizeof(crc_entry_t))))
+    {
+        RG_LOGE("Failed to allocate crc_cache!");
+        return;
+    }
+    crc_cache.capacity = CRC_CACHE_MIN_CAPACITY;
+    crc_cache.lock = rg_mutex_create();
+    crc_cache.save_lock = rg_mutex_create();
 
-    crc_cache->magic = CRC_CACHE_MAGIC;
-    crc_cache->entries[index].key = key;
-    crc_cache->entries[index].crc = file->checksum;
-    crc_cache_dirty = true;
+    rg_mutex_take(crc_cache.lock, -1);
+    if (rg_storage_read_file(CRC_CACHE_PATH, (void **)&data, &data_len, 0))
+    {
+        if (data_len >= 8 && data->magic == CRC_CACHE_MAGIC && data->count <= (data_len - 8) / sizeof(crc_entry_t))
+        {
+            for (size_t i = 0; i < data->count; ++i)
+            {
+                if (data->entries[i].key && data->entries[i].crc)
+                    crc_cache_insert_locked(data->entries[i].key, data->entries[i].crc);
+            }
+            RG_LOGI("Loaded CRC cache (entries: %d)", (int)crc_cache.count);
+        }
+        free(data);
+    }
+    crc_cache.unsaved = 0;
+    rg_mutex_give(crc_cache.lock);
 
-    // crc_cache_save();
+    crc_cache.task = rg_task_create("crc_cache", &crc_cache_task, NULL, 4 * 1024, RG_TASK_PRIORITY_1, -1);
 }
 
 void crc_cache_prebuild(void)
 {
-    if (!crc_cache)
+    if (!crc_cache.lock)
         return;
 
     for (int i = 0; i < apps_count; i++)
@@ -299,7 +759,7 @@ void crc_cache_prebuild(void)
             if ((file->checksum = crc_cache_lookup(file)))
                 continue;
 
-            if ((file->checksum = crc_read_file(file, true)))
+            if ((file->checksum = crc_read_file(get_file_path(file), app->crc_offset, true)))
                 crc_cache_update(file);
         }
 
@@ -313,6 +773,37 @@ void crc_cache_prebuild(void)
     crc_cache_save();
 }
 
+void applications_rescan(void)
+{
+    // The folders listed from the index are verified in the background (see verify_next_folder), but
+    // this drops it right away and every folder is read again when its tab is opened.
+    for (int i = 0; i < apps_count; i++)
+    {
+        application_deinit(apps[i]);
+        apps[i]->force_rescan = true;
+    }
+    gui_invalidate();
+}
+
+static void crc_cache_prefetch(tab_t *tab)
+{
+    retro_app_t *app = (retro_app_t *)tab->arg;
+
+    if (!crc_cache.task || !app->use_crc_covers)
+        return;
+
+    // Queue the files starting from the cursor, so that the covers the user is about to see come first
+    for (int i = 0; i < tab->listbox.length && crc_cache.queue_count < CRC_QUEUE_SIZE; i++)
+    {
+        retro_file_t *file = tab->listbox.items[(tab->listbox.cursor + i) % tab->listbox.length].arg;
+        if (!file || file->type != RETRO_TYPE_FILE || file->checksum)
+            continue;
+        if ((file->checksum = crc_cache_lookup(file)))
+            continue;
+        crc_cache_request(file, false);
+    }
+}
+
 static void tab_refresh(tab_t *tab, const char *selected)
 {
     retro_app_t *app = (retro_app_t *)tab->arg;
@@ -327,20 +818,18 @@ static void tab_refresh(tab_t *tab, const char *selected)
     if (folder == basepath)
         tab->navpath = NULL;
 
-    if (app->files_count > 0)
+    retro_folder_t *entries = find_folder(app, folder);
+    if (entries && entries->count > 0)
     {
-        gui_resize_list(tab, app->files_count);
+        gui_resize_list(tab, entries->count);
 
-        for (size_t i = 0; i < app->files_count; i++)
+        for (size_t i = entries->first; i < entries->first + entries->count; i++)
         {
             retro_file_t *file = &app->files[i];
 
             if (file->type == RETRO_TYPE_INVALID || !file->name)
                 continue;
 
-            if (file->folder != folder && strcmp(file->folder, folder) != 0)
-                continue;
-
             if (file->type == RETRO_TYPE_FOLDER)
             {
                 listbox_item_t *item = &tab->listbox.items[items_count++];
@@ -388,6 +877,45 @@ static void tab_refresh(tab_t *tab, const char *selected)
     }
 
     gui_scroll_list(tab, SCROLL_SET, tab->listbox.cursor);
+
+    // Jobs from the previous folder are no longer relevant
+    crc_cache_cancel_requests();
+    crc_cache_prefetch(tab);
+}
+
+static void verify_next_folder(tab_t *tab)
+{
+    retro_app_t *app = (retro_app_t *)tab->arg;
+
+    // Directory mtimes aren't reliable on FAT, FatFs (used on the device) doesn't update them when entries
+    // are added or removed. So the folders listed from the index are read again while the user is idle,
+    // one per call, and the tab is rescanned if one differs.
+    for (size_t i = 0; i < app->folders_count; ++i)
+    {
+        retro_folder_t *folder = &app->folders[i];
+        if (!folder->unverified)
+            continue;
+
+        verify_folder_t verify = {app, folder->names, folder->names_size, 0, false};
+        folder->unverified = false;
+        rg_storage_scandir(folder->path, verify_folder_cb, &verify, 0);
+        if (!verify.changed && verify.pos == verify.names_size)
+            return;
+
+        RG_LOGW("Folder '%s' changed since it was indexed, rescanning.", folder->path);
+
+        listbox_item_t *item = gui_get_selected_item(tab);
+        retro_file_t *file = (retro_file_t *)(item ? item->arg : NULL);
+        char selected[RG_PATH_MAX + 1] = {0};
+        if (file && file->name)
+            snprintf(selected, sizeof(selected), "%s", file->name);
+
+        // application_deinit sets force_rescan, the index can't be trusted for the other folders either
+        application_deinit(app);
+        application_init(app);
+        tab_refresh(tab, selected[0] ? selected : NULL);
+        return;
+    }
 }
 
 static void event_handler(gui_event_t event, tab_t *tab)
@@ -402,10 +930,11 @@ static void event_handler(gui_event_t event, tab_t *tab)
         tab->navpath = NULL;
 
         retro_file_t *selected = bookmark_find_by_app(BOOK_TYPE_RECENT, app);
-        if (selected) // && !rg_storage_exists(get_file_path(selected)))
+        retro_folder_t *folder = selected ? find_folder(app, selected->folder) : NULL;
+        if (folder) // && !rg_storage_exists(get_file_path(selected)))
         {
             // rg_storage_exists can take a long time on large folders (200ms), this is much faster
-            for (size_t i = 0; i < app->files_count; ++i)
+            for (size_t i = folder->first; i < folder->first + folder->count; ++i)
             {
                 retro_file_t *file = &app->files[i];
                 if (selected->folder == file->folder && strcmp(selected->name, file->name) == 0)
@@ -420,13 +949,8 @@ static void event_handler(gui_event_t event, tab_t *tab)
     }
     else if (event == TAB_DEINIT)
     {
-        if (app && app->initialized)
-        {
-            for (size_t i = 0; i < app->files_count; ++i)
-                free((char *)app->files[i].name);
-            app->files_count = 0;
-            app->initialized = false;
-        }
+        if (app)
+            application_deinit(app);
     }
     else if (event == TAB_REFRESH)
     {
@@ -441,6 +965,13 @@ static void event_handler(gui_event_t event, tab_t *tab)
     {
         if (file && !tab->preview && gui.idle_counter == 1)
             gui_load_preview(tab);
+        // Retry once the background task has computed the CRC we need for the cover
+        else if (file && !tab->preview && !file->checksum && app->use_crc_covers && (file->checksum = crc_cache_lookup(file)))
+            gui_load_preview(tab);
+        if (gui.idle_counter % 10 == 1)
+            crc_cache_prefetch(tab);
+        else if (gui.idle_counter > 1)
+            verify_next_folder(tab);
     }
     else if (event == TAB_ACTION)
     {
@@ -495,7 +1026,7 @@ bool application_path_to_file(const char *path, retro_file_t *file)
     return false;
 }
 
-bool application_get_file_crc32(retro_file_t *file)
+bool application_get_file_crc32(retro_file_t *file, bool wait)
 {
     uint32_t crc_tmp = 0;
 
@@ -509,13 +1040,18 @@ bool application_get_file_crc32(retro_file_t *file)
     {
         file->checksum = crc_tmp;
     }
+    else if (!wait && crc_cache.task)
+    {
+        // Let the background task do it, the caller will have to try again later
+        crc_cache_request(file, true);
+    }
     else
     {
         tab_t *tab = gui_get_current_tab();
         gui_set_status(tab, NULL, "CRC32...");
         gui_redraw(); // gui_draw_status(tab);
 
-        if ((crc_tmp = crc_read_file(file, true)))
+        if ((crc_tmp = crc_read_file(get_file_path(file), file->app->crc_offset, true)))
         {
             file->checksum = crc_tmp;
             crc_cache_update(file);
@@ -561,7 +1097,7 @@ static void show_file_info(retro_file_t *file)
         switch (rg_gui_dialog(_("File properties"), options, -1))
         {
         case 3:
-            application_get_file_crc32(file);
+            application_get_file_crc32(file, true);
             continue;
         case 5:
             if (rg_gui_confirm(_("Delete selected file?"), 0, 0))
@@ -571,6 +1107,7 @@ static void show_file_info(retro_file_t *file)
                     bookmark_remove(BOOK_TYPE_FAVORITE, file);
                     bookmark_remove(BOOK_TYPE_RECENT, file);
                     file->type = RETRO_TYPE_INVALID;
+                    library_index_save(file->app);
                     gui_event(TAB_REFRESH, gui_get_current_tab());
                     return;
                 }
@@ -25,6 +25,17 @@ typedef struct
     retro_app_t *app;
 } retro_file_t;
 
+typedef struct
+{
+    const char *path;   // rg_unique_string
+    time_t mtime;       // Of the directory when it was scanned
+    size_t first;       // Its files are contiguous in retro_app_t.files
+    size_t count;
+    char *names;        // Owns the names of its files, each prefixed by its type
+    size_t names_size;
+    bool unverified;    // Listed from the library index, not yet checked against the directory
+} retro_folder_t;
+
 typedef struct retro_app_s
 {
     char description[64];
@@ -40,7 +51,11 @@ typedef struct retro_app_s
     retro_file_t *files;
     size_t files_capacity;
     size_t files_count;
+    retro_folder_t *folders;
+    size_t folders_count;
     bool use_crc_covers;
+    bool index_dirty;
+    bool force_rescan;
     bool initialized;
     bool available;
 } retro_app_t;
@@ -49,6 +64,7 @@ typedef struct tab_s tab_t;
 
 void applications_init(void);
 void application_show_file_menu(retro_file_t *file, bool simplified);
-bool application_get_file_crc32(retro_file_t *file);
+bool application_get_file_crc32(retro_file_t *file, bool wait);
 bool application_path_to_file(const char *path, retro_file_t *out_file);
 void crc_cache_prebuild(void);
+void applications_rescan(void);
@@ -21,6 +21,56 @@ retro_gui_t gui;
 #define SETTING_SCROLL_MODE     "ScrollMode"
 #define SETTING_HIDE_TAB(name)  strcat((char[99]){"HideTab."}, (name))
 
+#define COVER_CACHE_MAGIC 0x21112225
+#define COVER_CACHE_PATH RG_BASE_PATH_CACHE "/covers.bin"
+#define COVER_CACHE_SLOTS 1024 // Must be a power of two
+#define COVER_CACHE_MAX_SIZE (32 * 1024 * 1024)
+#define COVER_MEMORY_ENTRIES 4
+
+typedef struct __attribute__((__packed__))
+{
+    uint32_t key;    // CRC32 of the source path, 0 marks a free slot
+    uint32_t mtime;  // Of the source file, to notice covers that were replaced
+    uint32_t size;
+    uint32_t offset; // Of the RGB565 pixels in the cache file
+    uint16_t width;
+    uint16_t height;
+} cover_slot_t;
+
+// Covers are kept decoded and already scaled to the preview size, both in a small in-memory LRU
+// and in a packed file on the SD card. Decoding a PNG takes far longer than reading its pixels back.
+static struct
+{
+    FILE *fp;
+    size_t file_size;
+    cover_slot_t *slots; // COVER_CACHE_SLOTS entries, mirrors the index at the start of the file
+    struct
+    {
+        uint32_t key;
+        uint32_t last_use;
+        rg_image_t *image;
+    } memory[COVER_MEMORY_ENTRIES];
+    uint32_t clock;
+    rg_mutex_t *lock;
+    rg_task_t *task;
+    retro_file_t prefetch[2]; // The entries above and below the cursor
+    uint32_t prefetch_order;
+    uint32_t generation;
+} covers;
+
+static void cover_prefetch_task(void *arg);
+
+// gui_save_config runs every time the user moves to another tab, don't hash the keys every time
+static struct
+{
+    rg_setting_t *selected_tab;
+    rg_setting_t *start_screen;
+    rg_setting_t *startup_mode;
+    rg_setting_t *color_theme;
+    rg_setting_t *show_preview;
+    rg_setting_t *scroll_mode;
+} settings;
+
 static int max_visible_lines(const tab_t *tab, int *_line_height)
 {
     int line_height = TEXT_RECT("ABC123", 0).height;
@@ -30,14 +80,20 @@ static int max_visible_lines(const tab_t *tab, int *_line_height)
 
 void gui_init(bool cold_boot)
 {
+    settings.selected_tab = rg_settings_find(NS_APP, SETTING_SELECTED_TAB);
+    settings.start_screen = rg_settings_find(NS_APP, SETTING_START_SCREEN);
+    settings.startup_mode = rg_settings_find(NS_APP, SETTING_STARTUP_MODE);
+    settings.color_theme = rg_settings_find(NS_APP, SETTING_COLOR_THEME);
+    settings.show_preview = rg_settings_find(NS_APP, SETTING_SHOW_PREVIEW);
+    settings.scroll_mode = rg_settings_find(NS_APP, SETTING_SCROLL_MODE);
     gui = (retro_gui_t){
-        .selected_tab = rg_settings_get_number(NS_APP, SETTING_SELECTED_TAB, 0),
-        .startup_mode = rg_settings_get_number(NS_APP, SETTING_STARTUP_MODE, 0),
+        .selected_tab = rg_setting_get_number(settings.selected_tab, 0),
+        .startup_mode = rg_setting_get_number(settings.startup_mode, 0),
         .language     = rg_settings_get_number(NS_APP, SETTING_LANGUAGE, 0),
-        .color_theme  = rg_settings_get_number(NS_APP, SETTING_COLOR_THEME, 0),
-        .start_screen = rg_settings_get_number(NS_APP, SETTING_START_SCREEN, START_SCREEN_AUTO),
-        .show_preview = rg_settings_get_number(NS_APP, SETTING_SHOW_PREVIEW, PREVIEW_MODE_SAVE_COVER),
-        .scroll_mode  = rg_settings_get_number(NS_APP, SETTING_SCROLL_MODE, SCROLL_MODE_CENTER),
+        .color_theme  = rg_setting_get_number(settings.color_theme, 0),
+        .start_screen = rg_setting_get_number(settings.start_screen, START_SCREEN_AUTO),
+        .show_preview = rg_setting_get_number(settings.show_preview, PREVIEW_MODE_SAVE_COVER),
+        .scroll_mode  = rg_setting_get_number(settings.scroll_mode, SCROLL_MODE_CENTER),
         .width        = rg_display_get_width(),
         .height       = rg_display_get_height(),
     };
@@ -47,6 +103,11 @@ void gui_init(bool cold_boot)
     gui.http_lock = false;
     gui.low_memory_mode = rg_system_get_app()->lowMemoryMode;
     gui.surface = rg_surface_create(gui.width, gui.height, RG_PIXEL_565_LE, MEM_SLOW);
+    if (!gui.low_memory_mode && (covers.slots = rg_alloc(COVER_CACHE_SLOTS * sizeof(cover_slot_t), MEM_SLOW)))
+    {
+        covers.lock = rg_mutex_create();
+        covers.task = rg_task_create("cover_prefetch", &cover_prefetch_task, NULL, 6 * 1024, RG_TASK_PRIORITY_1, -1);
+    }
     gui_update_theme();
 }
 
@@ -68,7 +129,8 @@ tab_t *gui_add_tab(const char *name, const char *desc, void *arg, void *event_ha
 
     tab->event_handler = event_handler;
     tab->initialized = false;
-    tab->enabled = !rg_settings_get_number(NS_APP, SETTING_HIDE_TAB(name), 0);
+    tab->hidden_setting = rg_settings_find(NS_APP, SETTING_HIDE_TAB(name));
+    tab->enabled = !rg_setting_get_number(tab->hidden_setting, 0);
     tab->arg = arg;
     tab->listbox = (listbox_t){
         .items = calloc(10, sizeof(listbox_item_t)),
@@ -238,14 +300,14 @@ void gui_update_theme(void)
 
 void gui_save_config(void)
 {
-    rg_settings_set_number(NS_APP, SETTING_SELECTED_TAB, gui.selected_tab);
-    rg_settings_set_number(NS_APP, SETTING_START_SCREEN, gui.start_screen);
-    rg_settings_set_number(NS_APP, SETTING_SHOW_PREVIEW, gui.show_preview);
-    rg_settings_set_number(NS_APP, SETTING_SCROLL_MODE, gui.scroll_mode);
-    rg_settings_set_number(NS_APP, SETTING_COLOR_THEME, gui.color_theme);
-    rg_settings_set_number(NS_APP, SETTING_STARTUP_MODE, gui.startup_mode);
+    rg_setting_set_number(settings.selected_tab, gui.selected_tab);
+    rg_setting_set_number(settings.start_screen, gui.start_screen);
+    rg_setting_set_number(settings.show_preview, gui.show_preview);
+    rg_setting_set_number(settings.scroll_mode, gui.scroll_mode);
+    rg_setting_set_number(settings.color_theme, gui.color_theme);
+    rg_setting_set_number(settings.startup_mode, gui.startup_mode);
     for (int i = 0; i < gui.tabs_count; i++)
-        rg_settings_set_number(NS_APP, SETTING_HIDE_TAB(gui.tabs[i]->name), !gui.tabs[i]->enabled);
+        rg_setting_set_number(gui.tabs[i]->hidden_setting, !gui.tabs[i]->enabled);
     rg_settings_commit();
 }
 
@@ -543,6 +605,297 @@ void gui_set_preview(tab_t *tab, rg_image_t *preview)
     tab->preview = preview;
 }
 
+static bool cover_cache_open(void)
+{
+    uint32_t header[2] = {0};
+
+    if (covers.fp)
+        return true;
+
+    if ((covers.fp = fopen(COVER_CACHE_PATH, "r+b")))
+    {
+        fseek(covers.fp, 0, SEEK_END);
+        covers.file_size = ftell(covers.fp);
+        fseek(covers.fp, 0, SEEK_SET);
+        if (fread(header, sizeof(header), 1, covers.fp) && header[0] == COVER_CACHE_MAGIC
+            && header[1] == COVER_CACHE_SLOTS && fread(covers.slots, COVER_CACHE_SLOTS * sizeof(cover_slot_t), 1, covers.fp)
+            && covers.file_size <= COVER_CACHE_MAX_SIZE)
+            return true;
+        fclose(covers.fp);
+    }
+
+    // Missing, invalid, or full: start over
+    RG_LOGI("Creating cover cache '%s'", COVER_CACHE_PATH);
+    memset(covers.slots, 0, COVER_CACHE_SLOTS * sizeof(cover_slot_t));
+    header[0] = COVER_CACHE_MAGIC;
+    header[1] = COVER_CACHE_SLOTS;
+    if ((covers.fp = fopen(COVER_CACHE_PATH, "w+b")))
+    {
+        fwrite(header, sizeof(header), 1, covers.fp);
+        fwrite(covers.slots, COVER_CACHE_SLOTS * sizeof(cover_slot_t), 1, covers.fp);
+        covers.file_size = ftell(covers.fp);
+        return true;
+    }
+    RG_LOGE("Failed to create cover cache!");
+    return false;
+}
+
+static cover_slot_t *cover_cache_find_slot(uint32_t key)
+{
+    for (size_t i = 0; i < COVER_CACHE_SLOTS; ++i)
+    {
+        cover_slot_t *slot = &covers.slots[(key + i) & (COVER_CACHE_SLOTS - 1)];
+        if (slot->key == key || slot->key == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static rg_image_t *cover_cache_read(uint32_t key, const rg_stat_t *info)
+{
+    cover_slot_t *slot = cover_cache_find_slot(key);
+    if (!slot || slot->key != key || slot->mtime != (uint32_t)info->mtime || slot->size != info->size)
+        return NULL;
+
+    rg_image_t *image = rg_surface_create(slot->width, slot->height, RG_PIXEL_565_LE, MEM_SLOW);
+    if (image && (fseek(covers.fp, slot->offset, SEEK_SET) != 0
+        || fread(image->data, image->stride * image->height, 1, covers.fp) != 1))
+    {
+        rg_surface_free(image);
+        image = NULL;
+    }
+    return image;
+}
+
+static void cover_cache_write(uint32_t key, const rg_stat_t *info, const rg_image_t *image)
+{
+    size_t data_size = image->width * image->height * 2;
+
+    if (covers.file_size + data_size > COVER_CACHE_MAX_SIZE)
+    {
+        fclose(covers.fp);
+        covers.fp = NULL;
+        remove(COVER_CACHE_PATH);
+        if (!cover_cache_open())
+            return;
+    }
+
+    cover_slot_t *slot = cover_cache_find_slot(key);
+    if (!slot)
+        return;
+
+    // The pixels are always appended, a replaced cover leaves a hole until the file gets reset
+    cover_slot_t new_slot = {key, info->mtime, info->size, covers.file_size, image->width, image->height};
+    fseek(covers.fp, covers.file_size, SEEK_SET);
+    for (int y = 0; y < image->height; ++y)
+        fwrite((uint8_t *)image->data + y * image->stride, image->width * 2, 1, covers.fp);
+    fseek(covers.fp, 8 + (slot - covers.slots) * sizeof(cover_slot_t), SEEK_SET);
+    if (fwrite(&new_slot, sizeof(new_slot), 1, covers.fp))
+    {
+        covers.file_size += data_size;
+        *slot = new_slot;
+    }
+    fflush(covers.fp);
+}
+
+static rg_image_t *cover_memory_get(uint32_t key)
+{
+    for (size_t i = 0; i < COVER_MEMORY_ENTRIES; ++i)
+    {
+        if (covers.memory[i].image && covers.memory[i].key == key)
+        {
+            covers.memory[i].last_use = ++covers.clock;
+            return covers.memory[i].image;
+        }
+    }
+    return NULL;
+}
+
+static void cover_memory_put(uint32_t key, rg_image_t *image)
+{
+    size_t lru = 0;
+    for (size_t i = 0; i < COVER_MEMORY_ENTRIES; ++i)
+    {
+        if (covers.memory[i].last_use < covers.memory[lru].last_use)
+            lru = i;
+    }
+    rg_surface_free(covers.memory[lru].image);
+    covers.memory[lru].key = key;
+    covers.memory[lru].last_use = ++covers.clock;
+    covers.memory[lru].image = image;
+}
+
+static rg_image_t *cover_copy(const rg_image_t *image)
+{
+    rg_image_t *copy = rg_surface_create(image->width, image->height, RG_PIXEL_565_LE, MEM_SLOW);
+    if (copy)
+        rg_surface_copy(image, NULL, copy, NULL, false);
+    return copy;
+}
+
+// Returns a new image that the caller must free
+static rg_image_t *cover_load(const char *path)
+{
+    uint32_t key = rg_crc32(0, (const uint8_t *)path, strlen(path));
+    rg_image_t *image = NULL;
+    rg_image_t *cached;
+
+    if (!covers.lock)
+        return rg_surface_load_image_file(path, 0);
+
+    rg_mutex_take(covers.lock, -1);
+    if ((cached = cover_memory_get(key)))
+        image = cover_copy(cached);
+    rg_mutex_give(covers.lock);
+
+    if (image)
+        return image;
+
+    rg_stat_t info = rg_storage_stat(path);
+    if (!info.exists || !info.is_file)
+        return NULL;
+
+    rg_mutex_take(covers.lock, -1);
+    if (cover_cache_open())
+        image = cover_cache_read(key, &info);
+    rg_mutex_give(covers.lock);
+
+    if (!image && (image = rg_surface_load_image_file(path, 0)))
+    {
+        // Scale the same way gui_draw_preview would, so it doesn't have to resize on every redraw
+        int width = RG_MIN(image->width, PREVIEW_WIDTH);
+        int height = RG_MIN(image->height, PREVIEW_HEIGHT);
+        if (width != image->width || height != image->height || image->format != RG_PIXEL_565_LE)
+        {
+            rg_image_t *resized = rg_surface_resize(image, width, height);
+            rg_surface_free(image);
+            image = resized;
+        }
+        if (image)
+        {
+            rg_mutex_take(covers.lock, -1);
+            if (cover_cache_open())
+                cover_cache_write(key, &info, image);
+            rg_mutex_give(covers.lock);
+        }
+    }
+
+    if (image && (cached = cover_copy(image)))
+    {
+        rg_mutex_take(covers.lock, -1);
+        cover_memory_put(key, cached);
+        rg_mutex_give(covers.lock);
+    }
+
+    return image;
+}
+
+static size_t get_preview_path(const retro_file_t *file, int type, char *path)
+{
+    retro_app_t *app = file->app;
+    size_t path_len = 0;
+
+    if (type == 0x1 && app->use_crc_covers && file->checksum) // Game cover (old format)
+        path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
+    else if (type == 0x2 && app->use_crc_covers && file->checksum) // Game cover (png)
+        path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
+    else if (type == 0x3) // Game cover (based on filename)
+    {
+        path_len = snprintf(path, RG_PATH_MAX, "%s/%s", app->paths.covers, file->name);
+        if (path_len < RG_PATH_MAX - 3) // Don't bother if we already have an overflow
+            strcpy(path + path_len - strlen(rg_extension(file->name) ?: ""), "png");
+    }
+    else if (type == 0x4 && file->saves > 0) // Save state screenshot (png)
+    {
+        snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
+        uint8_t last_used_slot = rg_emu_get_last_used_slot(path);
+        if (last_used_slot != 0xFF)
+        {
+            char *preview = rg_emu_get_path(RG_PATH_SCREENSHOT + last_used_slot, path);
+            path_len = snprintf(path, RG_PATH_MAX, "%s", preview);
+            free(preview);
+        }
+    }
+
+    return path_len < RG_PATH_MAX ? path_len : 0;
+}
+
+static void cover_prefetch_task(void *arg)
+{
+    uint32_t generation = 0;
+
+    while (true)
+    {
+        retro_file_t file = {0};
+        uint32_t order = 0;
+
+        rg_mutex_take(covers.lock, -1);
+        for (size_t i = 0; i < RG_COUNT(covers.prefetch); ++i)
+        {
+            if (covers.prefetch[i].name)
+            {
+                file = covers.prefetch[i];
+                covers.prefetch[i].name = NULL;
+                order = covers.prefetch_order;
+                break;
+            }
+        }
+        generation = covers.generation;
+        rg_mutex_give(covers.lock);
+
+        if (!file.name)
+        {
+            rg_task_delay(50);
+            continue;
+        }
+
+        // Stop at the first image found, that's the one gui_load_preview will want
+        while (order && generation == covers.generation)
+        {
+            char path[RG_PATH_MAX + 1];
+            int type = order & 0xF;
+            order >>= 4;
+            if (file.missing_cover & (1 << type))
+                continue;
+            if (get_preview_path(&file, type, path))
+            {
+                rg_image_t *image = cover_load(path);
+                rg_surface_free(image);
+                if (image)
+                    break;
+            }
+        }
+
+        free((char *)file.name);
+    }
+}
+
+static void cover_prefetch(tab_t *tab, uint32_t order)
+{
+    if (!covers.task)
+        return;
+
+    rg_mutex_take(covers.lock, -1);
+    covers.generation++;
+    covers.prefetch_order = order;
+    for (size_t i = 0; i < RG_COUNT(covers.prefetch); ++i)
+    {
+        int index = tab->listbox.cursor + (i ? 1 : -1);
+        retro_file_t *file = NULL;
+        if (index >= 0 && index < tab->listbox.length)
+            file = tab->listbox.items[index].arg;
+        free((char *)covers.prefetch[i].name);
+        covers.prefetch[i].name = NULL;
+        // The file list can be freed at any time, the task gets its own copy
+        if (file && file->type == RETRO_TYPE_FILE)
+        {
+            covers.prefetch[i] = *file;
+            covers.prefetch[i].name = strdup(file->name);
+        }
+    }
+    rg_mutex_give(covers.lock);
+}
+
 void gui_load_preview(tab_t *tab)
 {
     listbox_item_t *item = gui_get_selected_item(tab);
@@ -579,12 +932,12 @@ void gui_load_preview(tab_t *tab)
 
     retro_file_t *file = item->arg;
     retro_app_t *app = file->app;
+    uint32_t initial_order = order;
     uint32_t errors = 0;
 
     while (order && !tab->preview)
     {
         char path[RG_PATH_MAX + 1];
-        size_t path_len = 0;
         int type = order & 0xF;
 
         order >>= 4;
@@ -596,32 +949,14 @@ void gui_load_preview(tab_t *tab)
         if (file->missing_cover & (1 << type))
             continue;
 
-        if (type == 0x1 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (old format)
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.art", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
-        else if (type == 0x2 && app->use_crc_covers && application_get_file_crc32(file)) // Game cover (png)
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%X/%08X.png", app->paths.covers, (int)(file->checksum >> 28), (int)file->checksum);
-        else if (type == 0x3) // Game cover (based on filename)
-        {
-            path_len = snprintf(path, RG_PATH_MAX, "%s/%s", app->paths.covers, file->name);
-            if (path_len < RG_PATH_MAX - 3) // Don't bother if we already have an overflow
-                strcpy(path + path_len - strlen(rg_extension(file->name) ?: ""), "png");
-        }
-        else if (type == 0x4 && file->saves > 0) // Save state screenshot (png)
-        {
-            snprintf(path, RG_PATH_MAX, "%s/%s", file->folder, file->name);
-            uint8_t last_used_slot = rg_emu_get_last_used_slot(path);
-            if (last_used_slot != 0xFF)
-            {
-                char *preview = rg_emu_get_path(RG_PATH_SCREENSHOT + last_used_slot, path);
-                path_len = snprintf(path, RG_PATH_MAX, "%s", preview);
-                free(preview);
-            }
-        }
+        // The CRC might still be computing in the background, the cover will be retried once it's known
+        if ((type == 0x1 || type == 0x2) && app->use_crc_covers && !application_get_file_crc32(file, false))
+            continue;
 
-        if (path_len > 0 && path_len < RG_PATH_MAX)
+        if (get_preview_path(file, type, path))
         {
             RG_LOGD("Looking for %s", path);
-            gui_set_preview(tab, rg_surface_load_image_file(path, 0));
+            gui_set_preview(tab, cover_load(path));
             // if (!tab->preview && rg_storage_exists(path))
             //     errors++;
         }
@@ -629,6 +964,9 @@ void gui_load_preview(tab_t *tab)
         file->missing_cover |= (tab->preview ? 0 : 1) << type;
     }
 
+    // Get the neighbours ready, scrolling to them will then be instant
+    cover_prefetch(tab, initial_order);
+
     if (!tab->preview && file->checksum && (show_missing_cover || errors))
     {
         RG_LOGI("No image found for '%s'\n", file->name);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <rg_gui.h>
+#include <rg_settings.h>
 #include <stdbool.h>
 
 typedef enum {
@@ -105,6 +106,7 @@ typedef struct tab_s {
     } status[2];
     bool initialized;
     bool enabled;
+    rg_setting_t *hidden_setting;
     void *arg;
     const char *navpath;
     listbox_t listbox;
@@ -189,6 +189,16 @@ static rg_gui_event_t prebuild_cache_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t rescan_library_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_ENTER)
+    {
+        applications_rescan();
+        return RG_DIALOG_SELECT;
+    }
+    return RG_DIALOG_VOID;
+}
+
 static void retro_loop(void)
 {
     tab_t *tab = NULL;
@@ -432,6 +442,7 @@ static void options_handler(rg_gui_option_t *dest)
 static void about_handler(rg_gui_option_t *dest)
 {
     *dest++ = (rg_gui_option_t){0, _("Build CRC cache"), NULL, RG_DIALOG_FLAG_NORMAL, &prebuild_cache_cb};
+    *dest++ = (rg_gui_option_t){0, _("Rescan library"), NULL, RG_DIALOG_FLAG_NORMAL, &rescan_library_cb};
     #if defined(RG_ENABLE_NETWORKING) && RG_UPDATER_ENABLE
     *dest++ = (rg_gui_option_t){0, _("Check for updates"), NULL, RG_DIALOG_FLAG_NORMAL, &updater_cb};
     #endif
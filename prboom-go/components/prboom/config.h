@@ -28,6 +28,14 @@
 /* Set to the attribute to apply to struct definitions to make them packed */
 #define PACKEDATTR __attribute__((packed))
 
+/* Size in bytes of the zone memory arena (see z_zone.c). It is halved until it
+   can be allocated, blocks that don't fit even after purging the cache overflow
+   to the system allocator. 0 to only use the system allocator. */
+#define ZONE_ARENA_SIZE (2 * 1024 * 1024)
+
+/* retro-go memory caps of the zone arena, MEM_SLOW puts it in PSRAM */
+#define ZONE_ARENA_CAPS MEM_SLOW
+
 /* Define to enable internal range checking */
 /* #undef RANGECHECK */
 
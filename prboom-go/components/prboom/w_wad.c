@@ -56,6 +56,27 @@ size_t numwadfiles = 0;
 lumpinfo_t *lumpinfo;
 size_t      numlumps;
 
+// Read cache for the WADs that aren't loaded in memory. Level setup and
+// texture init do thousands of small reads of lumps that mostly sit next to each
+// other, so each miss fills a line with one aligned read, and that read doubles
+// in size for as long as the misses are sequential.
+#define CACHE_LINES     4
+#define CACHE_LINE_MIN  (4 * 1024)
+#define CACHE_LINE_MAX  (32 * 1024)
+
+typedef struct
+{
+  wadfile_info_t *wad;
+  size_t offset, length;
+  unsigned last_used;
+  byte *data;
+} cacheline_t;
+
+static cacheline_t cachelines[CACHE_LINES];
+static unsigned cache_clock;
+static wadfile_info_t *readahead_wad;
+static size_t readahead_end, readahead_size = CACHE_LINE_MIN;
+
 void ExtractFileBase (const char *path, char *dest)
 {
   const char *src = path + strlen(path) - 1;
@@ -133,6 +154,7 @@ static void W_AddFile(wadfile_info_t *wadfile)
 #endif
     if (wadfile->handle)
     {
+      setvbuf(wadfile->handle, NULL, _IONBF, 0); // W_Read does its own buffering
       fseek(wadfile->handle, 0, SEEK_END);
       wadfile->size = ftell(wadfile->handle);
     }
@@ -387,6 +409,72 @@ void W_Init(void)
   W_HashLumps();
 }
 
+static cacheline_t *W_FillCacheLine(wadfile_info_t *wad, size_t offset)
+{
+  cacheline_t *line = &cachelines[0];
+
+  for (int i = 1; i < CACHE_LINES; i++)
+    if (cachelines[i].last_used < line->last_used)
+      line = &cachelines[i];
+
+  if (!line->data && !(line->data = malloc(CACHE_LINE_MAX)))
+    return NULL;
+
+  // A miss right where the previous fill ended means we're reading sequentially
+  if (wad == readahead_wad && offset >= readahead_end && offset < readahead_end + CACHE_LINE_MIN)
+    readahead_size = MIN(readahead_size * 2, CACHE_LINE_MAX);
+  else
+    readahead_size = CACHE_LINE_MIN;
+
+  line->wad = wad;
+  line->last_used = ++cache_clock;
+  line->offset = offset & ~(CACHE_LINE_MIN - 1);
+  fseek(wad->handle, line->offset, SEEK_SET);
+  line->length = fread(line->data, 1, MIN(readahead_size, wad->size - line->offset), wad->handle);
+
+  readahead_wad = wad;
+  readahead_end = line->offset + line->length;
+
+  return line;
+}
+
+static void W_ReadCached(byte *dest, size_t size, size_t offset, wadfile_info_t *wad)
+{
+  while (size > 0)
+  {
+    cacheline_t *line = NULL;
+
+    for (int i = 0; i < CACHE_LINES && !line; i++)
+    {
+      cacheline_t *l = &cachelines[i];
+      if (l->wad == wad && offset >= l->offset && offset < l->offset + l->length)
+      {
+        l->last_used = ++cache_clock;
+        line = l;
+      }
+    }
+
+    if (!line)
+    {
+      line = W_FillCacheLine(wad, offset);
+      if (!line) // Out of memory, read the rest without the cache
+      {
+        fseek(wad->handle, offset, SEEK_SET);
+        fread(dest, size, 1, wad->handle);
+        return;
+      }
+      if (offset >= line->offset + line->length) // Read error or past EOF
+        return;
+    }
+
+    size_t count = MIN(size, line->offset + line->length - offset);
+    memcpy(dest, line->data + (offset - line->offset), count);
+    dest += count;
+    offset += count;
+    size -= count;
+  }
+}
+
 //
 // W_Read
 // Read arbitrary data from the WAD file
@@ -404,8 +492,16 @@ int W_Read(void *dest, size_t size, size_t offset, wadfile_info_t *wad)
   }
   else if (wad->handle)
   {
-    fseek(wad->handle, offset, SEEK_SET);
-    fread(dest, size, 1, wad->handle);
+    // Big lumps go straight to their destination, the cache would only add a copy
+    if (size >= CACHE_LINE_MAX)
+    {
+      fseek(wad->handle, offset, SEEK_SET);
+      fread(dest, size, 1, wad->handle);
+    }
+    else
+    {
+      W_ReadCached(dest, size, offset, wad);
+    }
     return size;
   }
   return -1;
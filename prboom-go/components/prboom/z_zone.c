@@ -37,6 +37,13 @@
  * memory allocation functions, including malloc() and similar functions.
  * Added line and file numbers, in case of error. Added performance
  * statistics and tunables.
+ *
+ * Blocks now come from a preallocated arena (first fit over power of two
+ * free lists, with coalescing) and small ones from size class slabs carved
+ * out of it, instead of one system malloc per block. When the arena is full
+ * the least recently used PU_CACHE blocks are purged until the request fits,
+ * but only up to a few times its size, past that we overflow to the system
+ * allocator.
  *-----------------------------------------------------------------------------
  */
 
@@ -46,6 +53,9 @@
 #include "config.h"
 #endif
 
+#ifdef RETRO_GO
+#include <rg_system.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -53,16 +63,37 @@
 #include "lprintf.h"
 #include "z_zone.h"
 
-#define CHUNK_SIZE 4        // Minimum chunk size at which blocks are allocated
+#define CHUNK_SIZE 8        // Minimum chunk size at which blocks are allocated
 #define ZONEID  0x931d4a11  // signature for block header
 
+#ifndef ZONE_ARENA_SIZE
+#define ZONE_ARENA_SIZE 0
+#endif
+#ifndef ZONE_ARENA_CAPS
+#define ZONE_ARENA_CAPS 0
+#endif
+#define ZONE_ARENA_MIN (256 * 1024) // Below this we don't bother and use the system allocator
+#define ZONE_PURGE_SCAN 32          // Oldest cache blocks checked for one that leaves a big enough hole
+#define ZONE_PURGE_FACTOR 4         // Bytes purged blindly for a request, in multiples of its size
+
+enum {
+  BLOCK_ARENA,  // carved out of the arena
+  BLOCK_SLAB,   // slot of a slab page (itself an arena block)
+  BLOCK_SYSTEM, // overflow, straight from the system allocator
+};
+
 typedef struct memblock
 {
   uint32_t zoneid;
-  uint32_t tag: 10;
-  uint32_t size:22;
-
-  struct memblock *next,*prev;
+  uint32_t tag: 4;
+  uint32_t kind: 2;
+  uint32_t size:26;
+
+  struct memblock *next,*prev; // tag list, or free list when tag is PU_FREE
+  union {
+    struct memblock *before;   // BLOCK_ARENA: physically preceding block, NULL if first
+    struct slab *slab;         // BLOCK_SLAB: page containing the slot
+  };
   void **user;
 
 #ifdef INSTRUMENTED
@@ -75,10 +106,38 @@ typedef struct memblock
 /* size of block header
  * cph - base on sizeof(memblock_t), which can be larger than CHUNK_SIZE on
  * 64bit architectures */
-static const size_t HEADER_SIZE = (sizeof(memblock_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);
+#define HEADER_SIZE ((sizeof(memblock_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1))
 
+// The PU_CACHE list is kept in least to most recently used order: blocks are
+// appended when they become purgable, which for lumps and patches is when their
+// last lock is released (W_UnlockLumpNum), and leave it while locked again
+// (W_CacheLumpNum). So the head is always the best candidate for purging.
 static memblock_t *blockbytag[PU_MAX];
 
+// Arena free blocks, binned by the power of two below their size
+#define NUM_BINS 26
+static memblock_t *freebins[NUM_BINS];
+static char *arena_start, *arena_end;
+
+#define NEXT_BLOCK(b) ((memblock_t *)((char *)(b) + HEADER_SIZE + (b)->size))
+
+// Slabs: pages of same sized slots for the very numerous small blocks
+// (thinkers, sector nodes, strings...) that would otherwise fragment the arena.
+#define SLAB_PAGE_SIZE 4096
+#define NUM_SLAB_CLASSES 8
+static const uint16_t slab_sizes[NUM_SLAB_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256};
+
+typedef struct slab
+{
+  struct slab *next,*prev;  // pages of the same class that have free slots
+  memblock_t *free;         // free slots
+  uint16_t used, class;
+} slab_t;
+
+#define SLAB_HEADER_SIZE ((sizeof(slab_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1))
+
+static slab_t *slabs[NUM_SLAB_CLASSES];
+
 #ifdef INSTRUMENTED
 
 // statistics for evaluating performance
@@ -158,6 +217,9 @@ void Z_DumpMemory(void)
       block=block->next;
     }
   }
+  for (tag = 0; tag < NUM_BINS; tag++)
+    for (memblock_t *block = freebins[tag]; block; block = block->next)
+      total_free += block->size;
   fprintf(fp, "malloc %d, cache %d, free %d, total %d\n",
     total_malloc, total_cache, total_free,
     total_malloc + total_cache + total_free);
@@ -166,6 +228,240 @@ void Z_DumpMemory(void)
 #endif
 #endif
 
+//
+// Arena
+//
+
+static int Z_BinForSize(size_t size)
+{
+  int bin = 31 - __builtin_clz(size | 1);
+  return bin < NUM_BINS ? bin : NUM_BINS - 1;
+}
+
+static void Z_LinkFree(memblock_t *block)
+{
+  int bin = Z_BinForSize(block->size);
+  block->tag = PU_FREE;
+  block->prev = NULL;
+  block->next = freebins[bin];
+  if (block->next)
+    block->next->prev = block;
+  freebins[bin] = block;
+}
+
+static void Z_UnlinkFree(memblock_t *block)
+{
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    freebins[Z_BinForSize(block->size)] = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+}
+
+static memblock_t *Z_ArenaAlloc(size_t size)
+{
+  int bin = Z_BinForSize(size);
+  memblock_t *block = freebins[bin];
+
+  // The first bin can hold smaller blocks, any block of the ones above fits
+  while (block && block->size < size)
+    block = block->next;
+  while (!block && ++bin < NUM_BINS)
+    block = freebins[bin];
+  if (!block)
+    return NULL;
+
+  Z_UnlinkFree(block);
+
+  // Split off the remainder, unless it would be too small to be of any use
+  if (block->size >= size + HEADER_SIZE + 64)
+  {
+    memblock_t *rest = (memblock_t *)((char *)block + HEADER_SIZE + size);
+    rest->kind = BLOCK_ARENA;
+    rest->size = block->size - size - HEADER_SIZE;
+    rest->before = block;
+    if ((char *)NEXT_BLOCK(rest) < arena_end)
+      NEXT_BLOCK(rest)->before = rest;
+    block->size = size;
+    Z_LinkFree(rest);
+  }
+
+  block->kind = BLOCK_ARENA;
+  return block;
+}
+
+// Returns the free block that now contains the released one
+static memblock_t *Z_ArenaFree(memblock_t *block)
+{
+  memblock_t *after = NEXT_BLOCK(block);
+
+  if ((char *)after < arena_end && after->tag == PU_FREE)
+  {
+    Z_UnlinkFree(after);
+    block->size += HEADER_SIZE + after->size;
+  }
+  if (block->before && block->before->tag == PU_FREE)
+  {
+    memblock_t *before = block->before;
+    Z_UnlinkFree(before);
+    before->size += HEADER_SIZE + block->size;
+    block = before;
+  }
+  if ((char *)(after = NEXT_BLOCK(block)) < arena_end)
+    after->before = block;
+
+  Z_LinkFree(block);
+  return block;
+}
+
+//
+// Slabs
+//
+
+static void Z_SlabFree(memblock_t *block)
+{
+  slab_t *slab = block->slab;
+  slab_t **list = &slabs[slab->class];
+
+  block->tag = PU_FREE;
+  block->next = slab->free;
+
+  if (!slab->free) // It was full, it has room again
+  {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (slab->next)
+      slab->next->prev = slab;
+    *list = slab;
+  }
+  slab->free = block;
+
+  if (--slab->used == 0) // Give the page back so that the arena can coalesce it
+  {
+    if (slab->prev)
+      slab->prev->next = slab->next;
+    else
+      *list = slab->next;
+    if (slab->next)
+      slab->next->prev = slab->prev;
+    Z_ArenaFree((memblock_t *)((char *)slab - HEADER_SIZE));
+  }
+}
+
+static memblock_t *Z_SlabAlloc(int class)
+{
+  slab_t *slab = slabs[class];
+
+  if (!slab)
+  {
+    memblock_t *page = Z_ArenaAlloc(SLAB_PAGE_SIZE);
+    if (!page)
+      return NULL;
+    page->zoneid = 0; // Not a user block
+    page->tag = PU_STATIC; // Keeps the arena from merging it, it is in no tag list
+    slab = (slab_t *)((char *)page + HEADER_SIZE);
+    slab->next = slab->prev = NULL;
+    slab->free = NULL;
+    slab->used = 0;
+    slab->class = class;
+
+    size_t stride = HEADER_SIZE + slab_sizes[class];
+    for (char *p = (char *)slab + SLAB_HEADER_SIZE; p + stride <= (char *)slab + page->size; p += stride)
+    {
+      memblock_t *slot = (memblock_t *)p;
+      slot->kind = BLOCK_SLAB;
+      slot->tag = PU_FREE;
+      slot->size = slab_sizes[class];
+      slot->slab = slab;
+      slot->next = slab->free;
+      slab->free = slot;
+    }
+    slabs[class] = slab;
+  }
+
+  memblock_t *block = slab->free;
+  slab->free = block->next;
+  slab->used++;
+
+  if (!slab->free) // Full, take it out of the list
+  {
+    slabs[class] = slab->next;
+    if (slab->next)
+      slab->next->prev = NULL;
+  }
+
+  return block;
+}
+
+// Space that freeing an arena block would leave, once merged with its free neighbours
+static size_t Z_HoleSize(memblock_t *block)
+{
+  memblock_t *after = NEXT_BLOCK(block);
+  size_t size = block->size;
+
+  if ((char *)after < arena_end && after->tag == PU_FREE)
+    size += HEADER_SIZE + after->size;
+  if (block->before && block->before->tag == PU_FREE)
+    size += HEADER_SIZE + block->before->size;
+  return size;
+}
+
+// Among the oldest purgable blocks, picks the first one whose eviction makes room
+// for size bytes. Otherwise returns the oldest one and clears *fits.
+static memblock_t *Z_PurgeVictim(size_t size, int *fits)
+{
+  memblock_t *block = blockbytag[PU_CACHE], *oldest = NULL;
+
+  for (int i = 0; block && i < ZONE_PURGE_SCAN; i++)
+  {
+    if (block->kind != BLOCK_SYSTEM)
+    {
+      if (!oldest)
+        oldest = block;
+      if (block->kind == BLOCK_ARENA && Z_HoleSize(block) >= size)
+        return *fits = 1, block;
+    }
+    if ((block = block->next) == blockbytag[PU_CACHE])
+      break;
+  }
+
+  *fits = 0;
+  return oldest;
+}
+
+// Allocates from the arena, purging least recently used cache blocks as needed
+static memblock_t *Z_ZoneAlloc(size_t size)
+{
+  size_t needed, purged = 0;
+  int class = 0, fits;
+
+  if (!arena_start)
+    return NULL;
+
+  while (class < NUM_SLAB_CLASSES && slab_sizes[class] < size)
+    class++;
+
+  // A slab allocation only fails when it needs a new page
+  needed = class < NUM_SLAB_CLASSES ? SLAB_PAGE_SIZE : size;
+
+  while (1)
+  {
+    memblock_t *block = class < NUM_SLAB_CLASSES ? Z_SlabAlloc(class) : Z_ArenaAlloc(size);
+    if (block)
+      return block;
+
+    // Evicting a block that leaves a big enough hole is always worth it. Otherwise the
+    // oldest ones go, hoping their space coalesces into one, but we don't empty the cache
+    // for a single request: past a few times its size the system allocator takes it.
+    memblock_t *victim = Z_PurgeVictim(needed, &fits);
+    if (!victim || (!fits && purged >= needed * ZONE_PURGE_FACTOR))
+      return NULL;
+    purged += victim->size;
+    (Z_Free)((char *)victim + HEADER_SIZE DA(__FILE__, __LINE__));
+  }
+}
+
 void Z_Close(void)
 {
 #ifdef INSTRUMENTED
@@ -173,11 +469,42 @@ void Z_Close(void)
 #endif
   // Release everything
   Z_FreeTags(PU_FREE, PU_MAX);
+
+  (free)(arena_start);
+  arena_start = arena_end = NULL;
+  memset(freebins, 0, sizeof(freebins));
+  memset(slabs, 0, sizeof(slabs));
 }
 
 void Z_Init(void)
 {
-  // Nothing to do
+  size_t size = ZONE_ARENA_SIZE & ~(CHUNK_SIZE-1);
+
+  // Take the biggest arena we can get, what doesn't fit will overflow to the system allocator
+  while (size >= ZONE_ARENA_MIN && !arena_start)
+  {
+#ifdef RETRO_GO
+    if (!(arena_start = rg_alloc(size, ZONE_ARENA_CAPS | MEM_NOPANIC)))
+#else
+    if (!(arena_start = (malloc)(size)))
+#endif
+      size /= 2;
+  }
+
+  if (!arena_start)
+  {
+    lprintf(LO_INFO, "Z_Init: Using the system allocator only\n");
+    return;
+  }
+
+  memblock_t *block = (memblock_t *)arena_start;
+  arena_end = arena_start + size;
+  block->kind = BLOCK_ARENA;
+  block->size = size - HEADER_SIZE;
+  block->before = NULL;
+  Z_LinkFree(block);
+
+  lprintf(LO_INFO, "Z_Init: Allocated zone arena of %u bytes\n", (unsigned)size);
 }
 
 void *(Z_Malloc)(size_t size, int tag, void **user DA(const char *file, int line))
@@ -202,7 +529,12 @@ void *(Z_Malloc)(size_t size, int tag, void **user DA(const char *file, int line
 
   size = (size+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);  // round to chunk size
 
-  while (!(block = (malloc)(size + HEADER_SIZE))) {
+  while (!(block = Z_ZoneAlloc(size))) {
+    if ((block = (malloc)(size + HEADER_SIZE))) {
+      block->kind = BLOCK_SYSTEM;
+      block->size = size;
+      break;
+    }
     if (!blockbytag[PU_CACHE])
       I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
 #ifdef INSTRUMENTED
@@ -230,8 +562,6 @@ void *(Z_Malloc)(size_t size, int tag, void **user DA(const char *file, int line
     blockbytag[tag]->prev = block;
   }
 
-  block->size = size;
-
 #ifdef INSTRUMENTED
   if (tag >= PU_PURGELEVEL)
     purgable_memory += block->size;
@@ -301,10 +631,20 @@ void (Z_Free)(void *p DA(const char *file, int line))
     active_memory -= block->size;
 
   /* scramble memory -- weed out any bugs */
-  memset(block, gametic & 0xff, block->size + HEADER_SIZE);
+  memset(p, gametic & 0xff, block->size);
 #endif
 
-  (free)(block);
+  switch (block->kind)
+  {
+    case BLOCK_ARENA:
+      Z_ArenaFree(block);
+      break;
+    case BLOCK_SLAB:
+      Z_SlabFree(block);
+      break;
+    default:
+      (free)(block);
+  }
 
 #ifdef INSTRUMENTED
       Z_DrawStats();           // print memory allocation stats
@@ -437,13 +777,13 @@ char *(Z_Strdup)(const char *s, int tag, void **user DA(const char *file, int li
 
 void (Z_CheckHeap)(DAC(const char *file, int line))
 {
-#if 0
-  memblock_t *block;   // Start at base of zone mem
-  if (block)
-  do {                        // Consistency check (last node treated special)
-    if ((block->next != zone &&
-         (memblock_t *)((char *) block+HEADER_SIZE+block->size) != block->next)
-        || block->next->prev != block || block->prev->next != block)
+  memblock_t *before = NULL;
+
+  // Walk the arena, every block must start where the previous one ends
+  for (char *p = arena_start; p && p < arena_end; p += HEADER_SIZE + ((memblock_t *)p)->size)
+  {
+    memblock_t *block = (memblock_t *)p;
+    if (block->kind != BLOCK_ARENA || block->before != before || (char *)NEXT_BLOCK(block) > arena_end)
       I_Error("Z_CheckHeap: Block size does not touch the next block\n"
 #ifdef INSTRUMENTED
               "Source: %s:%d"
@@ -451,13 +791,6 @@ void (Z_CheckHeap)(DAC(const char *file, int line))
               , file, line, block->file, block->line
 #endif
               );
-//#ifdef INSTRUMENTED
-// shouldn't be needed anymore, was just for testing
-#if 0
-    if (((int)block->file < 0x00001000) && (block->file != NULL) && (block->tag != 0)) {
-      block->file = NULL;
-    }
-#endif
-  } while ((block=block->next) != zone);
-#endif
+    before = block;
+  }
 }
@@ -49,6 +49,7 @@
 
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / TICRATE + 1)
 #define NUM_MIX_CHANNELS 8
+#define MIX_BLOCK_LENGTH 128
 
 static rg_surface_t *update;
 static rg_app_t *app;
@@ -70,14 +71,16 @@ typedef struct {
 
 typedef struct {
     const doom_sfx_t *sfx;
-    size_t pos;
-    float factor;
+    uint32_t pos;  // 16.16 position in sfx->samples
+    uint32_t step; // 16.16 increment per output sample
+    int32_t gain[2];
     int starttic;
 } channel_t;
 
 static channel_t channels[NUM_MIX_CHANNELS];
 static const doom_sfx_t *sfx[NUMSFX];
 static rg_audio_sample_t mixbuffer[AUDIO_BUFFER_LENGTH];
+static int32_t sfxbuffer[MIX_BLOCK_LENGTH * 2];
 static const music_player_t *music_player = &opl_synth_player;
 static bool musicPlaying = false;
 
@@ -207,8 +210,21 @@ const char *I_DoomExeDir(void)
     return RG_BASE_PATH_ROMS "/doom";
 }
 
+static void set_channel_params(channel_t *chan, int volume, int seperation)
+{
+    // Same x^2 stereo separation law as the original linux port, 128 is the center.
+    // volume is 0-127 and already includes snd_SfxVolume and the distance.
+    int sep = seperation + 1;
+    volume = RG_MIN(RG_MAX(volume, 0), 127);
+    chan->gain[0] = volume - ((volume * sep * sep) >> 16);
+    sep -= 257;
+    chan->gain[1] = volume - ((volume * sep * sep) >> 16);
+}
+
 void I_UpdateSoundParams(int handle, int volume, int seperation, int pitch)
 {
+    if (handle >= 0 && handle < NUM_MIX_CHANNELS)
+        set_channel_params(&channels[handle], volume, seperation);
 }
 
 int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priority)
@@ -247,9 +263,12 @@ int I_StartSound(int sfxid, int channel, int vol, int sep, int pitch, int priori
     }
 
     channel_t *chan = &channels[slot];
-    chan->sfx = sfx[sfxid];
-    chan->factor = (float)chan->sfx->samplerate / snd_samplerate;
+    __atomic_store_n(&chan->sfx, NULL, __ATOMIC_RELEASE); // The sound task skips the channel while we set it up
     chan->pos = 0;
+    chan->step = ((uint32_t)sfx[sfxid]->samplerate << 16) / snd_samplerate;
+    chan->starttic = gametic;
+    set_channel_params(chan, vol, sep);
+    __atomic_store_n(&chan->sfx, sfx[sfxid], __ATOMIC_RELEASE); // Publishes the parameters above
 
     return slot;
 }
@@ -274,6 +293,42 @@ bool I_AnySoundStillPlaying(void)
     return false;
 }
 
+// Adds all the playing channels to buffer (interleaved stereo, 32 bits to have headroom)
+static void mix_channels(int32_t *buffer, size_t length)
+{
+    memset(buffer, 0, length * 2 * sizeof(*buffer));
+
+    for (int i = 0; i < NUM_MIX_CHANNELS; i++)
+    {
+        channel_t *chan = &channels[i];
+        const doom_sfx_t *sfx = __atomic_load_n(&chan->sfx, __ATOMIC_ACQUIRE);
+        if (!sfx)
+            continue;
+
+        const byte *samples = sfx->samples;
+        const int32_t left = chan->gain[0], right = chan->gain[1];
+        uint32_t pos = chan->pos, step = chan->step;
+        uint32_t end = (uint32_t)sfx->length << 16;
+        size_t count = pos < end ? RG_MIN(length, (end - pos - 1) / step + 1) : 0;
+
+        for (size_t j = 0; j < count; j++)
+        {
+            int32_t sample = samples[pos >> 16] - 128;
+            buffer[j * 2 + 0] += sample * left;
+            buffer[j * 2 + 1] += sample * right;
+            pos += step;
+        }
+
+        if (__atomic_load_n(&chan->sfx, __ATOMIC_ACQUIRE) == sfx) // I_StartSound may have reused the channel meanwhile
+        {
+            if (count < length)
+                chan->sfx = NULL;
+            else
+                chan->pos = pos;
+        }
+    }
+}
+
 static void soundTask(void *arg)
 {
     while (1)
@@ -285,63 +340,29 @@ static void soundTask(void *arg)
         {
             music_player->render(mixbuffer, AUDIO_BUFFER_LENGTH);
         }
+        else
+        {
+            memset(mixbuffer, 0, sizeof(mixbuffer));
+        }
 
         if (haveSFX)
         {
             int16_t *audioBuffer = (int16_t *)mixbuffer;
-            int16_t *audioBufferEnd = audioBuffer + AUDIO_BUFFER_LENGTH * 2;
-            while (audioBuffer < audioBufferEnd)
+            for (size_t pos = 0; pos < AUDIO_BUFFER_LENGTH; pos += MIX_BLOCK_LENGTH)
             {
-                int totalSample = 0;
-                int totalSources = 0;
-                int sample;
-
-                for (int i = 0; i < NUM_MIX_CHANNELS; i++)
-                {
-                    channel_t *chan = &channels[i];
-                    if (!chan->sfx)
-                        continue;
-
-                    size_t pos = (size_t)(chan->pos++ * chan->factor);
-
-                    if (pos >= chan->sfx->length)
-                    {
-                        chan->sfx = NULL;
-                    }
-                    else if ((sample = chan->sfx->samples[pos]))
-                    {
-                        totalSample += sample - 127;
-                        totalSources++;
-                    }
-                }
-
-                totalSample <<= 7;
-                totalSample /= (16 - snd_SfxVolume);
-
-                if (haveMusic)
+                size_t length = RG_MIN(AUDIO_BUFFER_LENGTH - pos, MIX_BLOCK_LENGTH);
+                mix_channels(sfxbuffer, length);
+                // Saturating add over the music, kept branchless so it vectorizes
+                for (size_t i = 0; i < length * 2; i++)
                 {
-                    totalSample += *audioBuffer;
-                    totalSources += (totalSources == 0);
+                    int32_t sample = sfxbuffer[i] + *audioBuffer;
+                    sample = sample > 32767 ? 32767 : sample;
+                    sample = sample < -32768 ? -32768 : sample;
+                    *audioBuffer++ = sample;
                 }
-
-                if (totalSources > 0)
-                    totalSample /= totalSources;
-
-                if (totalSample > 32767)
-                    totalSample = 32767;
-                else if (totalSample < -32768)
-                    totalSample = -32768;
-
-                *audioBuffer++ = totalSample;
-                *audioBuffer++ = totalSample;
             }
         }
 
-        if (!haveMusic && !haveSFX)
-        {
-            memset(mixbuffer, 0, sizeof(mixbuffer));
-        }
-
         rg_audio_submit(mixbuffer, AUDIO_BUFFER_LENGTH);
     }
 }
@@ -52,6 +52,18 @@ void gnuboy_set_framebuffer(void *buffer)
 }
 
 
+/*
+ * When set, each line drawn to the framebuffer is compared against the
+ * same line of `reference` (NULL means everything changed) and the result
+ * stored in `dirty_lines`, one byte per line.
+ */
+void gnuboy_set_dirty_lines(uint8_t *dirty_lines, const void *reference)
+{
+	GB.video.dirty_lines = dirty_lines;
+	GB.video.reference = reference;
+}
+
+
 void gnuboy_set_soundbuffer(void *buffer, size_t length)
 {
 	GB.audio.buffer = buffer;
@@ -174,6 +186,32 @@ int gnuboy_load_bios_file(const char *file)
 }
 
 
+// Bank cache used when the ROM is streamed from cart.romFile because it doesn't fit in memory.
+static struct
+{
+	uint32_t *last_use; // Per bank, 0 means never used since loading
+	uint32_t clock;
+	int prefetch;       // Next likely bank, -1 if none
+	int hits, misses;
+} bank_cache;
+
+static int find_victim_bank(int bank)
+{
+	int current = cart.rombank & (cart.romsize - 1);
+	int victim = -1;
+
+	// Least recently used, bank 0 and the currently mapped bank are pinned
+	for (int i = 1; i < cart.romsize; i++)
+	{
+		if (!cart.rombanks[i] || i == current || i == bank)
+			continue;
+		if (victim < 0 || bank_cache.last_use[i] < bank_cache.last_use[victim])
+			victim = i;
+	}
+
+	return victim;
+}
+
 void gnuboy_load_bank(int bank)
 {
 	const size_t OFFSET = bank * BANK_SIZE;
@@ -185,16 +223,17 @@ void gnuboy_load_bank(int bank)
 		return;
 
 	MESSAGE_INFO("loading bank %d.\n", bank);
-	while (!cart.rombanks[bank])
+	if (!cart.rombanks[bank])
 	{
-		int i = rand() & 0xFF;
-		if (cart.rombanks[i])
+		int victim = bank_cache.last_use ? find_victim_bank(bank) : -1;
+		if (victim < 0)
 		{
-			MESSAGE_INFO("reclaiming bank %d.\n", i);
-			cart.rombanks[bank] = cart.rombanks[i];
-			cart.rombanks[i] = NULL;
-			break;
+			MESSAGE_ERROR("no bank to reclaim!\n");
+			abort();
 		}
+		MESSAGE_INFO("reclaiming bank %d.\n", victim);
+		cart.rombanks[bank] = cart.rombanks[victim];
+		cart.rombanks[victim] = NULL;
 	}
 
 	// Load the 16K page
@@ -208,6 +247,52 @@ void gnuboy_load_bank(int bank)
 }
 
 
+void gnuboy_use_bank(int bank)
+{
+	if (bank_cache.last_use)
+		bank_cache.last_use[bank] = ++bank_cache.clock;
+
+	if (cart.rombanks[bank])
+	{
+		bank_cache.hits++;
+		return;
+	}
+
+	bank_cache.misses++;
+	gnuboy_load_bank(bank);
+
+	// Large ROMs tend to stream data (audio, video) from consecutive banks
+	bank_cache.prefetch = bank + 1 < cart.romsize ? bank + 1 : -1;
+}
+
+
+bool gnuboy_prefetch_bank(void)
+{
+	int bank = bank_cache.prefetch;
+
+	if (!cart.romFile || bank < 0)
+		return false;
+
+	bank_cache.prefetch = -1;
+
+	if (cart.rombanks[bank])
+		return false;
+
+	gnuboy_load_bank(bank);
+	// Stamp it as recently used, otherwise it would be the first victim of the next miss
+	if (bank_cache.last_use)
+		bank_cache.last_use[bank] = ++bank_cache.clock;
+	return true;
+}
+
+
+void gnuboy_get_bank_stats(int *hits, int *misses)
+{
+	if (hits) *hits = bank_cache.hits;
+	if (misses) *misses = bank_cache.misses;
+}
+
+
 int gnuboy_load_rom(const byte *data, size_t size)
 {
 	// Memory Bank Controller names
@@ -444,6 +529,11 @@ int gnuboy_load_rom_file(const char *file)
 		preload = cart.romsize - 40;
 	}
 
+	free(bank_cache.last_use);
+	bank_cache.last_use = calloc(cart.romsize, sizeof(uint32_t));
+	bank_cache.clock = bank_cache.hits = bank_cache.misses = 0;
+	bank_cache.prefetch = -1;
+
 	MESSAGE_INFO("Preloading the first %d banks\n", preload);
 	for (int i = 0; i < preload; i++)
 	{
@@ -454,10 +544,64 @@ int gnuboy_load_rom_file(const char *file)
 }
 
 
+int gnuboy_load_rom_zip(const char *file)
+{
+	MESSAGE_INFO("Loading zip file: '%s'\n", file);
+
+	// Each bank is inflated straight into its own allocation, so we never need the whole ROM in one block
+	size_t size = 0;
+	rg_zip_t *zip = rg_storage_zip_open(file, "gb gbc cgb sgb", &size);
+	if (zip == NULL)
+	{
+		MESSAGE_ERROR("ROM zip open failed\n");
+		return -1;
+	}
+
+	byte *bank0 = malloc(BANK_SIZE);
+	if (bank0 == NULL || rg_storage_zip_read(zip, bank0, BANK_SIZE) != BANK_SIZE)
+	{
+		MESSAGE_ERROR("ROM header read failed\n");
+		rg_storage_zip_close(zip);
+		free(bank0);
+		return -1;
+	}
+
+	int ret = gnuboy_load_rom(bank0, BANK_SIZE);
+	if (ret != 0)
+	{
+		MESSAGE_ERROR("ROM setup failed\n");
+		rg_storage_zip_close(zip);
+		free(bank0);
+		return ret;
+	}
+
+	cart.rombanks_owned = true;
+
+	for (int i = 1; i < cart.romsize && i * BANK_SIZE < size; i++)
+	{
+		if ((cart.rombanks[i] = malloc(BANK_SIZE)) == NULL)
+		{
+			MESSAGE_ERROR("Not enough memory for bank %d\n", i);
+			ret = -3;
+			break;
+		}
+		if (rg_storage_zip_read(zip, cart.rombanks[i], BANK_SIZE) != BANK_SIZE)
+		{
+			MESSAGE_WARN("ROM bank %d is truncated\n", i);
+			break;
+		}
+	}
+
+	rg_storage_zip_close(zip);
+
+	return ret;
+}
+
+
 void gnuboy_free_rom(void)
 {
-	// If cart.romFile isn't NULL it indicates that we haven't allocated those buffers, don't free them.
-	if (cart.romFile && cart.rombanks)
+	// If neither flag is set the banks point into the caller's buffer, don't free them.
+	if ((cart.romFile || cart.rombanks_owned) && cart.rombanks)
 	{
 		for (int i = 0; i < cart.romsize; i++)
 			free(cart.rombanks[i]);
@@ -466,6 +610,9 @@ void gnuboy_free_rom(void)
 	free(cart.rombanks);
 	cart.rombanks = NULL;
 
+	free(bank_cache.last_use);
+	bank_cache.last_use = NULL;
+
 	free(cart.rambanks);
 	cart.rambanks = NULL;
 
@@ -700,7 +847,7 @@ typedef struct
 } sblock_t;
 
 
-static int do_save_load(const char *file, bool save)
+static int do_save_load(rg_stream_t *stream, bool save)
 {
 	uint32_t sav_ver = SAVE_VERSION;
 	const svar_t svars[] =
@@ -785,13 +932,8 @@ static int do_save_load(const char *file, bool save)
 		{NULL, 0},
 	};
 
-	FILE *fp = NULL;
-
 	if (save)
 	{
-		if (!(fp = fopen(file, "wb")))
-			goto _error;
-
 		for (int i = 0; svars[i].ptr; i++)
 		{
 			uint32_t d = 0;
@@ -820,7 +962,7 @@ static int do_save_load(const char *file, bool save)
 
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fwrite(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (rg_stream_write(blocks[i].ptr, 4096, blocks[i].len, stream) < blocks[i].len)
 			{
 				MESSAGE_ERROR("Write error in block %d\n", i);
 				goto _error;
@@ -829,12 +971,9 @@ static int do_save_load(const char *file, bool save)
 	}
 	else
 	{
-		if (!(fp = fopen(file, "rb")))
-			goto _error;
-
 		for (int i = 0; blocks[i].ptr != NULL; i++)
 		{
-			if (fread(blocks[i].ptr, 4096, blocks[i].len, fp) < 1)
+			if (rg_stream_read(blocks[i].ptr, 4096, blocks[i].len, stream) < blocks[i].len)
 			{
 				MESSAGE_ERROR("Read error in block %d\n", i);
 				goto _error;
@@ -887,14 +1026,12 @@ static int do_save_load(const char *file, bool save)
 		gb_hw_updatemap();
 	}
 
-	fclose(fp);
 	free(buf);
 
 	return 0;
 
 _error:
-	if (fp) fclose(fp);
-	if (buf) free(buf);
+	free(buf);
 
 	return -1;
 }
@@ -902,11 +1039,33 @@ _error:
 
 int gnuboy_save_state(const char *file)
 {
-	return do_save_load(file, true);
+	rg_stream_t stream = {.fp = fopen(file, "wb")};
+	if (!stream.fp)
+		return -1;
+	int ret = do_save_load(&stream, true);
+	fclose(stream.fp);
+	return ret;
 }
 
 
 int gnuboy_load_state(const char *file)
 {
-	return do_save_load(file, false);
+	rg_stream_t stream = {.fp = fopen(file, "rb")};
+	if (!stream.fp)
+		return -1;
+	int ret = do_save_load(&stream, false);
+	fclose(stream.fp);
+	return ret;
+}
+
+
+int gnuboy_save_state_stream(rg_stream_t *stream)
+{
+	return do_save_load(stream, true);
+}
+
+
+int gnuboy_load_state_stream(rg_stream_t *stream)
+{
+	return do_save_load(stream, false);
 }
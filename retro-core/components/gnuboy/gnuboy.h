@@ -106,14 +106,19 @@ int  gnuboy_load_bios_file(const char *file);
 void gnuboy_free_bios(void);
 int  gnuboy_load_rom(const byte *data, size_t size);
 int  gnuboy_load_rom_file(const char *file);
+int  gnuboy_load_rom_zip(const char *file);
 void gnuboy_free_rom(void);
 void gnuboy_reset(bool hard);
 void gnuboy_run(bool draw);
 bool gnuboy_sram_dirty(void);
 void gnuboy_load_bank(int);
+void gnuboy_use_bank(int);
+bool gnuboy_prefetch_bank(void);
+void gnuboy_get_bank_stats(int *hits, int *misses);
 void gnuboy_set_pad(int);
 
 void gnuboy_set_framebuffer(void *buffer);
+void gnuboy_set_dirty_lines(uint8_t *dirty_lines, const void *reference);
 void gnuboy_set_soundbuffer(void *buffer, size_t length);
 
 void gnuboy_get_time(int *day, int *hour, int *minute, int *second);
@@ -127,3 +132,5 @@ int gnuboy_load_sram(const char *file);
 int gnuboy_save_sram(const char *file, bool quick_save);
 int gnuboy_load_state(const char *file);
 int gnuboy_save_state(const char *file);
+int gnuboy_load_state_stream(rg_stream_t *stream);
+int gnuboy_save_state_stream(rg_stream_t *stream);
@@ -182,6 +182,7 @@ typedef struct
 
 	// Memory
 	byte **rombanks; // [512];
+	bool rombanks_owned; // Banks were allocated one by one, not pointing into a caller's buffer
 	byte (*rambanks)[8192];
 	unsigned sram_dirty;
 	unsigned sram_saved;
@@ -242,6 +243,8 @@ typedef struct
 			void *buffer;
 		};
 		uint16_t palette[64];
+		uint8_t *dirty_lines;
+		const void *reference;
 	} video;
 
 	struct {
@@ -702,6 +702,14 @@ static inline void lcd_renderline()
 		for (int i = 0; i < 160; ++i)
 			dst[i] = pal[BUF[i]];
 	}
+
+	// The line is still in cache, this is the cheapest time to tell if it changed
+	if (host.video.dirty_lines)
+	{
+		const size_t size = host.video.format == GB_PIXEL_PALETTED ? 160 : 320;
+		const byte *ref = host.video.reference;
+		host.video.dirty_lines[SL] = !ref || memcmp(host.video.buffer8 + SL * size, ref + SL * size, size) != 0;
+	}
 }
 
 void gb_lcd_emulate(int cycles)
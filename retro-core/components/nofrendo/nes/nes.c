@@ -42,6 +42,14 @@ void nes_emulate(bool draw)
 
         ppu_renderline(nes.vidbuf, nes.scanline, draw);
 
+        // Comparing the line now, while it's still in cache, is cheaper than a pass over the frame later
+        if (draw && nes.dirty_lines && nes.scanline < NES_SCREEN_HEIGHT)
+        {
+            const uint8 *line = NES_SCREEN_GETPTR(nes.vidbuf, 0, nes.scanline);
+            nes.dirty_lines[nes.scanline] = !nes.refbuf ||
+                memcmp(line, NES_SCREEN_GETPTR(nes.refbuf, 0, nes.scanline), NES_SCREEN_WIDTH) != 0;
+        }
+
         if (nes.scanline == 241)
         {
             elapsed_cycles += nes6502_execute(6);
@@ -85,6 +93,12 @@ uint8 *nes_setvidbuf(uint8 *vidbuf)
     return prevbuf;
 }
 
+void nes_setdirtylines(uint8 *dirty_lines, const uint8 *refbuf)
+{
+    nes.dirty_lines = dirty_lines;
+    nes.refbuf = refbuf;
+}
+
 /* This sets a timer to be fired every `period` cpu cycles. It is NOT accurate. */
 void nes_settimer(nes_timer_t *func, int period)
 {
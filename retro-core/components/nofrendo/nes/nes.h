@@ -88,6 +88,8 @@ typedef struct nes_s
 
     /* Video buffer */
     uint8 *vidbuf; // [NES_SCREEN_PITCH * NES_SCREEN_HEIGHT]
+    uint8 *dirty_lines; // [NES_SCREEN_HEIGHT], optional
+    const uint8 *refbuf; // What vidbuf's lines are compared against to fill dirty_lines
 
     /* Misc */
     nes_type_t system;
@@ -115,6 +117,7 @@ typedef struct nes_s
 nes_t *nes_getptr(void);
 nes_t *nes_init(nes_type_t system, int sample_rate, bool stereo, const char *fds_bios);
 uint8 *nes_setvidbuf(uint8 *vidbuf);
+void nes_setdirtylines(uint8 *dirty_lines, const uint8 *refbuf);
 void nes_shutdown(void);
 int nes_insertcart(rom_t *cart);
 int nes_loadfile(const char *filename);
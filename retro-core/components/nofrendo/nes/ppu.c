@@ -74,6 +74,28 @@ void ppu_getcontext(ppu_t *dest)
    MESSAGE_ERROR("%s: Not implemented!\n", __func__);
 }
 
+/* Forget the decoded tiles of CHR memory that was banked in */
+INLINE void invalidate_tiles(uint32 page)
+{
+   memset(ppu.tile_cached + (page << (PPU_PAGESHIFT - 4)), 0, PPU_PAGESIZE >> 4);
+}
+
+/* Forget the decoded tile of a CHR-RAM write, the same bank might be mapped in more than one page */
+static void invalidate_tile(uint32 addr)
+{
+   uint8 *location = ppu.page[addr >> PPU_PAGESHIFT] + (addr & ~PPU_PAGEMASK);
+   for (int page = 0; page < 8; page++)
+   {
+      if (ppu.page[page] + (page << PPU_PAGESHIFT) == location)
+         ppu.tile_cached[(page << (PPU_PAGESHIFT - 4)) | ((addr & PPU_PAGEMASK) >> 4)] = 0;
+   }
+}
+
+void ppu_flushtiles(void)
+{
+   memset(ppu.tile_cached, 0, sizeof(ppu.tile_cached));
+}
+
 void ppu_setpage(uint32 page, uint8 *location)
 {
    if (page >= PPU_PAGECOUNT || location == NULL)
@@ -81,6 +103,10 @@ void ppu_setpage(uint32 page, uint8 *location)
       MESSAGE_ERROR("Invalid PPU page #%d!\n", (int)page);
       return;
    }
+
+   if (page < 8 && ppu.page[page] != location - (page << PPU_PAGESHIFT))
+      invalidate_tiles(page);
+
    ppu.page[page] = location - (page << PPU_PAGESHIFT);
 
    /* Setup mirror if required (8-11 <=> 12-15) */
@@ -296,6 +322,8 @@ void ppu_write(uint32 address, uint8 value)
             MESSAGE_DEBUG("VRAM write to $%04X, scanline %d\n",
                            ppu.vaddr, nes_getptr()->scanline);
             PPU_MEM_WRITE(ppu.vaddr, 0xFF); /* corrupt */
+            if (ppu.vaddr < 0x2000)
+               invalidate_tile(ppu.vaddr);
          }
          else
          {
@@ -305,6 +333,8 @@ void ppu_write(uint32 address, uint8 value)
                ppu.vaddr -= 0x1000;
 
             PPU_MEM_WRITE(addr, value);
+            if (addr < 0x2000)
+               invalidate_tile(addr);
          }
       }
       else
@@ -357,46 +387,66 @@ void ppu_setvreadfunc(ppu_vreadfunc_t func)
 }
 
 /* rendering routines */
-INLINE uint32 get_patpix(uint32 tile_addr)
-{
-   uint32 pat1 = PPU_MEM_READ(tile_addr);
-   uint32 pat2 = PPU_MEM_READ(tile_addr + 8);
-   return ((pat2 & 0xAA) << 8) | ((pat2 & 0x55) << 1)
-        | ((pat1 & 0xAA) << 7) | ((pat1 & 0x55) << 0);
-}
+static uint16 spread_bits[2][256];
 
-INLINE void build_tile_colors(bool flip, uint32 pattern, uint8 *colors)
+static void build_spread_tables(void)
 {
-   /* swap pixels around if our tile is flipped */
-   if (flip)
+   /* Bit N of a bitplane byte goes to bit N*2 (normal) or (7-N)*2 (h-flipped) */
+   for (int value = 0; value < 256; value++)
    {
-      colors[7] = (pattern >> 14) & 3;
-      colors[6] = (pattern >> 6) & 3;
-      colors[5] = (pattern >> 12) & 3;
-      colors[4] = (pattern >> 4) & 3;
-      colors[3] = (pattern >> 10) & 3;
-      colors[2] = (pattern >> 2) & 3;
-      colors[1] = (pattern >> 8) & 3;
-      colors[0] = pattern & 3;
+      spread_bits[0][value] = spread_bits[1][value] = 0;
+      for (int bit = 0; bit < 8; bit++)
+      {
+         if (value & (1 << bit))
+         {
+            spread_bits[0][value] |= 1 << (bit * 2);
+            spread_bits[1][value] |= 1 << ((7 - bit) * 2);
+         }
+      }
    }
-   else
+}
+
+static void decode_tile(uint32 tile_addr)
+{
+   uint16 *rows = ppu.patterns + tile_addr;
+
+   /* Interleave both bitplanes into 2-bit pixels, leftmost pixel in the top bits */
+   for (int row = 0; row < 8; row++)
    {
-      colors[0] = (pattern >> 14) & 3;
-      colors[1] = (pattern >> 6) & 3;
-      colors[2] = (pattern >> 12) & 3;
-      colors[3] = (pattern >> 4) & 3;
-      colors[4] = (pattern >> 10) & 3;
-      colors[5] = (pattern >> 2) & 3;
-      colors[6] = (pattern >> 8) & 3;
-      colors[7] = pattern & 3;
+      uint32 pat1 = PPU_MEM_READ(tile_addr + row);
+      uint32 pat2 = PPU_MEM_READ(tile_addr + row + 8);
+      rows[row] = spread_bits[0][pat1] | (spread_bits[0][pat2] << 1);
+      rows[row + 8] = spread_bits[1][pat1] | (spread_bits[1][pat2] << 1);
    }
+
+   ppu.tile_cached[tile_addr >> 4] = 1;
+}
+
+INLINE uint32 get_pattern(uint32 tile_addr, bool flip)
+{
+   /* tile_addr is always in the first bitplane (bit 3 clear) */
+   if (!ppu.tile_cached[tile_addr >> 4])
+      decode_tile(tile_addr & ~0xF);
+   return ppu.patterns[tile_addr | (flip ? 8 : 0)];
+}
+
+INLINE void build_tile_colors(uint32 pattern, uint8 *colors)
+{
+   colors[0] = (pattern >> 14) & 3;
+   colors[1] = (pattern >> 12) & 3;
+   colors[2] = (pattern >> 10) & 3;
+   colors[3] = (pattern >> 8) & 3;
+   colors[4] = (pattern >> 6) & 3;
+   colors[5] = (pattern >> 4) & 3;
+   colors[6] = (pattern >> 2) & 3;
+   colors[7] = pattern & 3;
 }
 
 /* we render a scanline of graphics first so we know exactly
 ** where the sprite 0 strike is going to occur (in terms of
 ** cpu cycles), using the relation that 3 pixels == 1 cpu cycle
 */
-INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
+INLINE void check_strike(uint8 *surface, uint32 pattern)
 {
    uint8 colors[8];
 
@@ -408,7 +458,7 @@ INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
    if (0 == pattern)
       return;
 
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
+   build_tile_colors(pattern, colors);
 
    for (int i = 0; i < 8; i++)
    {
@@ -425,12 +475,12 @@ INLINE void check_strike(uint8 *surface, uint8 attrib, uint32 pattern)
 INLINE void draw_bgtile(uint8 *surface, uint32 pattern, const uint8 *colors)
 {
    *surface++ = colors[(pattern >> 14) & 3];
-   *surface++ = colors[(pattern >> 6) & 3];
    *surface++ = colors[(pattern >> 12) & 3];
-   *surface++ = colors[(pattern >> 4) & 3];
    *surface++ = colors[(pattern >> 10) & 3];
-   *surface++ = colors[(pattern >> 2) & 3];
    *surface++ = colors[(pattern >> 8) & 3];
+   *surface++ = colors[(pattern >> 6) & 3];
+   *surface++ = colors[(pattern >> 4) & 3];
+   *surface++ = colors[(pattern >> 2) & 3];
    *surface   = colors[pattern & 3];
 }
 
@@ -442,7 +492,7 @@ INLINE void draw_oamtile(uint8 *surface, uint8 attrib, uint32 pattern, const uin
    if (0 == pattern)
       return;
 
-   build_tile_colors(attrib & OAMF_HFLIP, pattern, colors);
+   build_tile_colors(pattern, colors);
 
    /* draw the character */
    if (attrib & OAMF_BEHIND)
@@ -499,7 +549,7 @@ INLINE void ppu_renderbg(uint8 *vidbuf)
          ppu.latchfunc(ppu.bg_base, tile_index);
 
       /* Fetch tile and draw it */
-      draw_bgtile(bmp_ptr, get_patpix(bg_offset + (tile_index << 4)), ppu.palette + col_high);
+      draw_bgtile(bmp_ptr, get_pattern(bg_offset + (tile_index << 4), false), ppu.palette + col_high);
       bmp_ptr += 8;
 
       x_tile++;
@@ -594,7 +644,7 @@ INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
       /* Check for a strike on sprite 0 if strike flag isn't set */
       if (sprite_num == 0 && !ppu.strikeflag)
       {
-         check_strike(draw ? vidbuf + sprite->x_loc : NULL, sprite->attr, get_patpix(tile_addr));
+         check_strike(draw ? vidbuf + sprite->x_loc : NULL, get_pattern(tile_addr, sprite->attr & OAMF_HFLIP));
       }
 
       /* If we don't draw to buffer then we're done after sprite 0 */
@@ -605,7 +655,7 @@ INLINE void ppu_renderoam(uint8 *vidbuf, int scanline, bool draw)
       draw_oamtile(
          vidbuf + sprite->x_loc,
          sprite->attr,
-         get_patpix(tile_addr),
+         get_pattern(tile_addr, sprite->attr & OAMF_HFLIP),
          ppu.palette + 16 + ((sprite->attr & 3) << 2));
 
       /* maximum of 8 sprites per scanline */
@@ -714,6 +764,7 @@ void ppu_reset(void)
    ppu.latch = 0;
    ppu.vram_accessible = true;
    ppu.scanlines = nes_getptr()->scanlines_per_frame;
+   ppu_flushtiles();
 }
 
 ppu_t *ppu_init(void)
@@ -721,9 +772,12 @@ ppu_t *ppu_init(void)
    memset(&ppu, 0, sizeof(ppu_t));
 
    ppu.nametab = malloc(0x400 * 4);
-   if (!ppu.nametab)
+   ppu.patterns = malloc(0x2000 * sizeof(uint16));
+   if (!ppu.nametab || !ppu.patterns)
       return NULL;
 
+   build_spread_tables();
+
    ppu_setopt(PPU_DRAW_BACKGROUND, true);
    ppu_setopt(PPU_DRAW_SPRITES, true);
    ppu_setopt(PPU_LIMIT_SPRITES, true);
@@ -735,6 +789,8 @@ void ppu_shutdown(void)
 {
    free(ppu.nametab);
    ppu.nametab = NULL;
+   free(ppu.patterns);
+   ppu.patterns = NULL;
 }
 
 
@@ -812,7 +868,7 @@ static void draw_sprite(uint8 *bmp, int x, int y, uint8 tile_num, uint8 attrib)
       if (line == 8)
          tile_addr += 8;
 
-      draw_bgtile(vid, get_patpix(tile_addr), ppu.palette + 16 + col_high);
+      draw_bgtile(vid, get_pattern(tile_addr, false), ppu.palette + 16 + col_high);
       //draw_oamtile(vid, attrib, data_ptr[0], data_ptr[8], ppu.palette + 16 + col_high);
 
       tile_addr++;
@@ -125,6 +125,10 @@ typedef struct
    /* VRAM (CHR RAM/ROM) paging */
    uint8 *page[PPU_PAGECOUNT];
 
+   /* Decoded pattern tables, indexed like CHR: row N of a tile is at N (normal) and N + 8 (h-flipped) */
+   uint16 *patterns; // [0x2000]
+   uint8 tile_cached[0x2000 / 16];
+
    /* Hardware registers */
    uint8 ctrl0, ctrl1, stat, oam_addr, nametab_base;
    uint8 latch, vdata_latch, tile_xofs, flipflop;
@@ -157,6 +161,7 @@ typedef struct
 
 /* Mirroring / Paging */
 void ppu_setpage(uint32 page_num, uint8 *location);
+void ppu_flushtiles(void);
 void ppu_setnametable(uint8 index, uint8 table);
 void ppu_setmirroring(ppu_mirror_t type);
 uint8 *ppu_getpage(uint32 page_num);
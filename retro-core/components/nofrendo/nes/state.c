@@ -43,6 +43,8 @@
  * - BASR: 6449 bytes
  * - INFO: 256 bytes
  * - SOUN: 22 bytes
+ * - APUS: APU_STATE_SIZE bytes (raw apu.c structs, in host byte order and layout)
+ * - MISC: 24 bytes
  * - SRAM: prg-ram + 1 bytes
  * - VRAM: chr-ram bytes
  * - MPRD: 152 bytes
@@ -62,8 +64,12 @@ typedef struct
    uint8  data[];
 } block_t;
 
+// Length of the APUS block, apu.c's runtime state that the SOUN registers can't restore
+#define APU_STATE_SIZE (2 * sizeof(rectangle_t) + sizeof(triangle_t) + sizeof(noise_t) + sizeof(dmc_t) \
+                        + sizeof(((apu_t *)0)->fc) + sizeof(int))
+
 #define _fread(buffer, size) {                       \
-   if (fread(buffer, size, 1, file) != 1)            \
+   if (rg_stream_read(buffer, size, 1, file) != 1)   \
    {                                                 \
       MESSAGE_ERROR("state_load: fread failed.\n");  \
       goto _error;                                   \
@@ -71,7 +77,7 @@ typedef struct
 }
 
 #define _fwrite(buffer, size) {                      \
-   if (fwrite(buffer, size, 1, file) != 1)           \
+   if (rg_stream_write(buffer, size, 1, file) != 1)  \
    {                                                 \
       MESSAGE_ERROR("state_save: fwrite failed.\n"); \
       goto _error;                                   \
@@ -116,20 +122,11 @@ static bool memory_zone_dirty(const void *ptr, size_t size)
 }
 
 
-int state_save(const char* fn)
+int state_save_stream(rg_stream_t *file)
 {
    uint32 numberOfBlocks = 0;
    uint8 buffer[600];
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "wb")))
-   {
-       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-   }
-
-   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
 
    _fwrite("SNSS\x00\x00\x00\x05", 8);
 
@@ -175,6 +172,8 @@ int state_save(const char* fn)
 
    MESSAGE_INFO("  - Saving info block\n");
 
+   // Nothing goes in there yet, but stale stack bytes would make identical states differ (netplay compares them)
+   memset(buffer, 0, 0x100);
    _fwrite("INFO\x00\x00\x00\x01\x00\x00\x01\x00", 12);
    _fwrite(&buffer, 0x100);
    numberOfBlocks++;
@@ -209,6 +208,45 @@ int state_save(const char* fn)
    numberOfBlocks++;
 
 
+   /****************************************************/
+
+   MESSAGE_INFO("  - Saving APU state block\n");
+
+   // SOUN only has the registers, replaying them loses the length counters, sweeps, envelopes, DMC
+   // progress and frame counter. That's audible at most for a save state, but netplay rollbacks use
+   // this too and they must resume exactly where they were. This block follows SOUN and overrides it.
+   uint32 apuStateSize = swap32(APU_STATE_SIZE);
+   _fwrite("APUS\x00\x00\x00\x01", 8);
+   _fwrite(&apuStateSize, 4);
+   _fwrite(&machine->apu->rectangle, sizeof(machine->apu->rectangle));
+   _fwrite(&machine->apu->triangle, sizeof(machine->apu->triangle));
+   _fwrite(&machine->apu->noise, sizeof(machine->apu->noise));
+   _fwrite(&machine->apu->dmc, sizeof(machine->apu->dmc));
+   _fwrite(&machine->apu->fc, sizeof(machine->apu->fc));
+   _fwrite(&machine->apu->prev_sample, sizeof(machine->apu->prev_sample));
+   numberOfBlocks++;
+
+
+   /****************************************************/
+
+   MESSAGE_INFO("  - Saving misc block\n");
+
+   // Cycle counters and PPU latches, without them a loaded state drifts from the one that was saved
+   *((uint32*)&buffer[0x00]) = swap32(machine->cycles);
+   *((uint32*)&buffer[0x04]) = swap32(machine->cpu->total_cycles);
+   *((uint32*)&buffer[0x08]) = swap32(machine->cpu->burn_cycles);
+   *((uint32*)&buffer[0x0C]) = swap32(machine->ppu->strike_cycle);
+   *((uint32*)&buffer[0x10]) = swap32(machine->ppu->vaddr_latch);
+   buffer[0x14] = machine->ppu->flipflop;
+   buffer[0x15] = machine->ppu->strikeflag;
+   buffer[0x16] = machine->cpu->int_pending;
+   buffer[0x17] = machine->cpu->jammed;
+
+   _fwrite("MISC\x00\x00\x00\x01\x00\x00\x00\x18", 12);
+   _fwrite(&buffer, 0x18);
+   numberOfBlocks++;
+
+
    /****************************************************/
 
    if (memory_zone_dirty(machine->cart->chr_ram, 0x2000 * machine->cart->chr_ram_banks))
@@ -272,12 +310,12 @@ int state_save(const char* fn)
 
    /****************************************************/
 
-   // Update number of blocks
-   fseek(file, 4, SEEK_SET);
+   // Update number of blocks, and leave the position at the end for in-memory streams
+   long fileSize = rg_stream_tell(file);
+   rg_stream_seek(file, 4, SEEK_SET);
    numberOfBlocks = swap32(numberOfBlocks);
    _fwrite(&numberOfBlocks, 4);
-
-   fclose(file);
+   rg_stream_seek(file, fileSize, SEEK_SET);
 
    MESSAGE_INFO("state_save: Game saved!\n");
 
@@ -285,40 +323,50 @@ int state_save(const char* fn)
 
 _error:
    MESSAGE_ERROR("state_save: Save failed!\n");
-   fclose(file);
    return -1;
 }
 
 
-int state_load(const char* fn)
+int state_save(const char* fn)
+{
+   rg_stream_t file = {0};
+
+   if (!(file.fp = fopen(fn, "wb")))
+   {
+       MESSAGE_ERROR("state_save: file '%s' could not be opened.\n", fn);
+       return -1;
+   }
+
+   MESSAGE_INFO("state_save: file '%s' opened.\n", fn);
+
+   int ret = state_save_stream(&file);
+   fclose(file.fp);
+   return ret;
+}
+
+
+int state_load_stream(rg_stream_t *file)
 {
    uint8 buffer[600];
 
    nes_t *machine = nes_getptr();
-   FILE *file;
-
-   if (!(file = fopen(fn, "rb")))
-   {
-       MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
-       return -1; //goto _error;
-  }
 
    _fread(buffer, 8);
 
    if (memcmp(buffer, "SNSS", 4) != 0)
    {
-      MESSAGE_ERROR("state_load: file '%s' is not a save file.\n", fn);
+      MESSAGE_ERROR("state_load: not a save file.\n");
       goto _error;
    }
 
    uint32 numberOfBlocks = swap32(*((uint32*)&buffer[4]));
    uint32 nextBlock = 8;
 
-   MESSAGE_INFO("state_load: file '%s' opened, blocks=%u.\n", fn, numberOfBlocks);
+   MESSAGE_INFO("state_load: blocks=%u.\n", numberOfBlocks);
 
    for (uint32 blk = 0; blk < numberOfBlocks; blk++)
    {
-      fseek(file, nextBlock, SEEK_SET);
+      rg_stream_seek(file, nextBlock, SEEK_SET);
       _fread(buffer, 12);
 
       uint32 blockVersion = swap32(*((uint32*)&buffer[4]));
@@ -389,6 +437,7 @@ int state_load(const char* fn)
          }
 
          _fread(machine->cart->chr_ram, blockLength);
+         ppu_flushtiles();
       }
 
 
@@ -451,6 +500,49 @@ int state_load(const char* fn)
       }
 
 
+      /****************************************************/
+
+      else if (memcmp(buffer, "APUS", 4) == 0)
+      {
+         MESSAGE_INFO("  - Found APU state block (%u bytes)\n", blockLength);
+
+         // Written by a build with different structs, the SOUN registers will have to do
+         if (blockLength != APU_STATE_SIZE)
+         {
+            MESSAGE_ERROR("APU state block has the wrong size, ignoring it.\n");
+            continue;
+         }
+
+         _fread(&machine->apu->rectangle, sizeof(machine->apu->rectangle));
+         _fread(&machine->apu->triangle, sizeof(machine->apu->triangle));
+         _fread(&machine->apu->noise, sizeof(machine->apu->noise));
+         _fread(&machine->apu->dmc, sizeof(machine->apu->dmc));
+         _fread(&machine->apu->fc, sizeof(machine->apu->fc));
+         _fread(&machine->apu->prev_sample, sizeof(machine->apu->prev_sample));
+      }
+
+
+      /****************************************************/
+
+      else if (memcmp(buffer, "MISC", 4) == 0)
+      {
+         MESSAGE_INFO("  - Found misc block (%u bytes)\n", blockLength);
+
+         _fread(buffer, 0x18);
+
+         // This overrides what the BASR block inferred, it must come after it
+         machine->cycles = swap32(*((uint32*)&buffer[0x00]));
+         machine->cpu->total_cycles = swap32(*((uint32*)&buffer[0x04]));
+         machine->cpu->burn_cycles = swap32(*((uint32*)&buffer[0x08]));
+         machine->ppu->strike_cycle = swap32(*((uint32*)&buffer[0x0C]));
+         machine->ppu->vaddr_latch = swap32(*((uint32*)&buffer[0x10]));
+         machine->ppu->flipflop = buffer[0x14];
+         machine->ppu->strikeflag = buffer[0x15];
+         machine->cpu->int_pending = buffer[0x16];
+         machine->cpu->jammed = buffer[0x17];
+      }
+
+
       /****************************************************/
 
       else if (memcmp(buffer, "INFO", 4) == 0)
@@ -471,15 +563,29 @@ int state_load(const char* fn)
       }
    }
 
-   /* close file, we're done */
-   fclose(file);
-
    MESSAGE_INFO("state_load: Game restored\n");
 
    return 0;
 
 _error:
    MESSAGE_ERROR("state_load: Load failed!\n");
-   fclose(file);
    return -1;
 }
+
+
+int state_load(const char* fn)
+{
+   rg_stream_t file = {0};
+
+   if (!(file.fp = fopen(fn, "rb")))
+   {
+       MESSAGE_ERROR("state_load: file '%s' could not be opened.\n", fn);
+       return -1;
+   }
+
+   MESSAGE_INFO("state_load: file '%s' opened.\n", fn);
+
+   int ret = state_load_stream(&file);
+   fclose(file.fp);
+   return ret;
+}
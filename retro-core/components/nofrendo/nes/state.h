@@ -23,5 +23,9 @@
 
 #pragma once
 
+#include <rg_system.h>
+
 int state_load(const char *fn);
 int state_save(const char *fn);
+int state_load_stream(rg_stream_t *file);
+int state_save_stream(rg_stream_t *file);
@@ -32,98 +32,98 @@ state: sizeof SN76489_Context=92
 state: sizeof coleco=8
 */
 
-int system_save_state(void *mem)
+int system_save_state(rg_stream_t *mem)
 {
   uint8 padding[16] = {0};
   int i;
 
   /*** Save SMS Context ***/
-  fwrite(sms.wram, 0x2000, 1, mem);
-  fwrite(&sms.paused, 1, 1, mem);
-  fwrite(&sms.save, 1, 1, mem);
-  fwrite(&sms.territory, 1, 1, mem);
-  fwrite(&sms.console, 1, 1, mem);
-  fwrite(&sms.display, 1, 1, mem);
-  fwrite(&sms.fm_detect, 1, 1, mem);
-  fwrite(&sms.glasses_3d, 1, 1, mem);
-  fwrite(&sms.hlatch, 1, 1, mem);
-  fwrite(&sms.use_fm, 1, 1, mem);
-  fwrite(&sms.memctrl, 1, 1, mem);
-  fwrite(&sms.ioctrl, 1, 1, mem);
-  fwrite(&padding, 1, 1, mem);
-  fwrite(&sms.sio, 8, 1, mem);
-  fwrite(&sms.device, 2, 1, mem);
-  fwrite(&sms.gun_offset, 1, 1, mem);
-  fwrite(&padding, 1, 1, mem);
+  rg_stream_write(sms.wram, 0x2000, 1, mem);
+  rg_stream_write(&sms.paused, 1, 1, mem);
+  rg_stream_write(&sms.save, 1, 1, mem);
+  rg_stream_write(&sms.territory, 1, 1, mem);
+  rg_stream_write(&sms.console, 1, 1, mem);
+  rg_stream_write(&sms.display, 1, 1, mem);
+  rg_stream_write(&sms.fm_detect, 1, 1, mem);
+  rg_stream_write(&sms.glasses_3d, 1, 1, mem);
+  rg_stream_write(&sms.hlatch, 1, 1, mem);
+  rg_stream_write(&sms.use_fm, 1, 1, mem);
+  rg_stream_write(&sms.memctrl, 1, 1, mem);
+  rg_stream_write(&sms.ioctrl, 1, 1, mem);
+  rg_stream_write(&padding, 1, 1, mem);
+  rg_stream_write(&sms.sio, 8, 1, mem);
+  rg_stream_write(&sms.device, 2, 1, mem);
+  rg_stream_write(&sms.gun_offset, 1, 1, mem);
+  rg_stream_write(&padding, 1, 1, mem);
 
   /*** Save VDP state ***/
-  fwrite(vdp.vram, 0x4000, 1, mem);
-  fwrite(vdp.cram, 0x40, 1, mem);
-  fwrite(vdp.reg, 0x10, 1, mem);
-  fwrite(&vdp.vscroll, 1, 1, mem);
-  fwrite(&vdp.status, 1, 1, mem);
-  fwrite(&vdp.latch, 1, 1, mem);
-  fwrite(&vdp.pending, 1, 1, mem);
-  fwrite(&vdp.addr, 2, 1, mem);
-  fwrite(&vdp.code, 1, 1, mem);
-  fwrite(&vdp.buffer, 1, 1, mem);
-  fwrite(&vdp.pn, 4, 1, mem);
-  fwrite(&vdp.ct, 4, 1, mem);
-  fwrite(&vdp.pg, 4, 1, mem);
-  fwrite(&vdp.sa, 4, 1, mem);
-  fwrite(&vdp.sg, 4, 1, mem);
-  fwrite(&vdp.ntab, 4, 1, mem);
-  fwrite(&vdp.satb, 4, 1, mem);
-  fwrite(&vdp.line, 4, 1, mem);
-  fwrite(&vdp.left, 4, 1, mem);
-  fwrite(&vdp.lpf, 2, 1, mem);
-  fwrite(&vdp.height, 1, 1, mem);
-  fwrite(&vdp.extended, 1, 1, mem);
-  fwrite(&vdp.mode, 1, 1, mem);
-  fwrite(&vdp.irq, 1, 1, mem);
-  fwrite(&vdp.vint_pending, 1, 1, mem);
-  fwrite(&vdp.hint_pending, 1, 1, mem);
-  fwrite(&vdp.cram_latch, 2, 1, mem);
-  fwrite(&vdp.spr_col, 2, 1, mem);
-  fwrite(&vdp.spr_ovr, 1, 1, mem);
-  fwrite(&vdp.bd, 1, 1, mem);
-  fwrite(&padding, 2, 1, mem);
+  rg_stream_write(vdp.vram, 0x4000, 1, mem);
+  rg_stream_write(vdp.cram, 0x40, 1, mem);
+  rg_stream_write(vdp.reg, 0x10, 1, mem);
+  rg_stream_write(&vdp.vscroll, 1, 1, mem);
+  rg_stream_write(&vdp.status, 1, 1, mem);
+  rg_stream_write(&vdp.latch, 1, 1, mem);
+  rg_stream_write(&vdp.pending, 1, 1, mem);
+  rg_stream_write(&vdp.addr, 2, 1, mem);
+  rg_stream_write(&vdp.code, 1, 1, mem);
+  rg_stream_write(&vdp.buffer, 1, 1, mem);
+  rg_stream_write(&vdp.pn, 4, 1, mem);
+  rg_stream_write(&vdp.ct, 4, 1, mem);
+  rg_stream_write(&vdp.pg, 4, 1, mem);
+  rg_stream_write(&vdp.sa, 4, 1, mem);
+  rg_stream_write(&vdp.sg, 4, 1, mem);
+  rg_stream_write(&vdp.ntab, 4, 1, mem);
+  rg_stream_write(&vdp.satb, 4, 1, mem);
+  rg_stream_write(&vdp.line, 4, 1, mem);
+  rg_stream_write(&vdp.left, 4, 1, mem);
+  rg_stream_write(&vdp.lpf, 2, 1, mem);
+  rg_stream_write(&vdp.height, 1, 1, mem);
+  rg_stream_write(&vdp.extended, 1, 1, mem);
+  rg_stream_write(&vdp.mode, 1, 1, mem);
+  rg_stream_write(&vdp.irq, 1, 1, mem);
+  rg_stream_write(&vdp.vint_pending, 1, 1, mem);
+  rg_stream_write(&vdp.hint_pending, 1, 1, mem);
+  rg_stream_write(&vdp.cram_latch, 2, 1, mem);
+  rg_stream_write(&vdp.spr_col, 2, 1, mem);
+  rg_stream_write(&vdp.spr_ovr, 1, 1, mem);
+  rg_stream_write(&vdp.bd, 1, 1, mem);
+  rg_stream_write(&padding, 2, 1, mem);
 
   /*** Save cart info ***/
   for (i = 0; i < 4; i++)
   {
-    fwrite(&cart.fcr[i], 1, 1, mem);
+    rg_stream_write(&cart.fcr[i], 1, 1, mem);
   }
 
   /*** Save SRAM ***/
-  fwrite(cart.sram, 0x8000, 1, mem);
+  rg_stream_write(cart.sram, 0x8000, 1, mem);
 
   /*** Save Z80 Context ***/
-  fwrite(&Z80.pc, 4, 1, mem);
-  fwrite(&Z80.sp, 4, 1, mem);
-  fwrite(&Z80.af, 4, 1, mem);
-  fwrite(&Z80.bc, 4, 1, mem);
-  fwrite(&Z80.de, 4, 1, mem);
-  fwrite(&Z80.hl, 4, 1, mem);
-  fwrite(&Z80.ix, 4, 1, mem);
-  fwrite(&Z80.iy, 4, 1, mem);
-  fwrite(&Z80.wz, 4, 1, mem);
-  fwrite(&Z80.af2, 4, 1, mem);
-  fwrite(&Z80.bc2, 4, 1, mem);
-  fwrite(&Z80.de2, 4, 1, mem);
-  fwrite(&Z80.hl2, 4, 1, mem);
-  fwrite(&Z80.r, 1, 1, mem);
-  fwrite(&Z80.r2, 1, 1, mem);
-  fwrite(&Z80.iff1, 1, 1, mem);
-  fwrite(&Z80.iff2, 1, 1, mem);
-  fwrite(&Z80.halt, 1, 1, mem);
-  fwrite(&Z80.im, 1, 1, mem);
-  fwrite(&Z80.i, 1, 1, mem);
-  fwrite(&Z80.nmi_state, 1, 1, mem);
-  fwrite(&Z80.nmi_pending, 1, 1, mem);
-  fwrite(&Z80.irq_state, 1, 1, mem);
-  fwrite(&Z80.after_ei, 1, 1, mem);
-  fwrite(&padding, 9, 1, mem);
+  rg_stream_write(&Z80.pc, 4, 1, mem);
+  rg_stream_write(&Z80.sp, 4, 1, mem);
+  rg_stream_write(&Z80.af, 4, 1, mem);
+  rg_stream_write(&Z80.bc, 4, 1, mem);
+  rg_stream_write(&Z80.de, 4, 1, mem);
+  rg_stream_write(&Z80.hl, 4, 1, mem);
+  rg_stream_write(&Z80.ix, 4, 1, mem);
+  rg_stream_write(&Z80.iy, 4, 1, mem);
+  rg_stream_write(&Z80.wz, 4, 1, mem);
+  rg_stream_write(&Z80.af2, 4, 1, mem);
+  rg_stream_write(&Z80.bc2, 4, 1, mem);
+  rg_stream_write(&Z80.de2, 4, 1, mem);
+  rg_stream_write(&Z80.hl2, 4, 1, mem);
+  rg_stream_write(&Z80.r, 1, 1, mem);
+  rg_stream_write(&Z80.r2, 1, 1, mem);
+  rg_stream_write(&Z80.iff1, 1, 1, mem);
+  rg_stream_write(&Z80.iff2, 1, 1, mem);
+  rg_stream_write(&Z80.halt, 1, 1, mem);
+  rg_stream_write(&Z80.im, 1, 1, mem);
+  rg_stream_write(&Z80.i, 1, 1, mem);
+  rg_stream_write(&Z80.nmi_state, 1, 1, mem);
+  rg_stream_write(&Z80.nmi_pending, 1, 1, mem);
+  rg_stream_write(&Z80.irq_state, 1, 1, mem);
+  rg_stream_write(&Z80.after_ei, 1, 1, mem);
+  rg_stream_write(&padding, 9, 1, mem);
 
 #if 0
   /*** Save YM2413 ***/
@@ -132,18 +132,18 @@ int system_save_state(void *mem)
 #endif
 
   /*** Save SN76489 ***/
-  fwrite(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
+  rg_stream_write(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
 
-  fwrite(&coleco.pio_mode, 1, 1, mem);
-  fwrite(&coleco.port53, 1, 1, mem);
-  fwrite(&coleco.port7F, 1, 1, mem);
-  fwrite(&padding, 5, 1, mem);
+  rg_stream_write(&coleco.pio_mode, 1, 1, mem);
+  rg_stream_write(&coleco.port53, 1, 1, mem);
+  rg_stream_write(&coleco.port7F, 1, 1, mem);
+  rg_stream_write(&padding, 5, 1, mem);
 
-  return 0;
+  return mem->error ? -1 : 0;
 }
 
 
-void system_load_state(void *mem)
+void system_load_state(rg_stream_t *mem)
 {
   uint8 padding[16] = {0};
   int i;
@@ -155,23 +155,23 @@ void system_load_state(void *mem)
   int current_console = sms.console;
   sms.console = 0xFF;
 
-  fread(sms.wram, 0x2000, 1, mem);
-  fread(&sms.paused, 1, 1, mem);
-  fread(&sms.save, 1, 1, mem);
-  fread(&sms.territory, 1, 1, mem);
-  fread(&sms.console, 1, 1, mem);
-  fread(&sms.display, 1, 1, mem);
-  fread(&sms.fm_detect, 1, 1, mem);
-  fread(&sms.glasses_3d, 1, 1, mem);
-  fread(&sms.hlatch, 1, 1, mem);
-  fread(&sms.use_fm, 1, 1, mem);
-  fread(&sms.memctrl, 1, 1, mem);
-  fread(&sms.ioctrl, 1, 1, mem);
-  fread(&padding, 1, 1, mem);
-  fread(&sms.sio, 8, 1, mem);
-  fread(&sms.device, 2, 1, mem);
-  fread(&sms.gun_offset, 1, 1, mem);
-  fread(&padding, 1, 1, mem);
+  rg_stream_read(sms.wram, 0x2000, 1, mem);
+  rg_stream_read(&sms.paused, 1, 1, mem);
+  rg_stream_read(&sms.save, 1, 1, mem);
+  rg_stream_read(&sms.territory, 1, 1, mem);
+  rg_stream_read(&sms.console, 1, 1, mem);
+  rg_stream_read(&sms.display, 1, 1, mem);
+  rg_stream_read(&sms.fm_detect, 1, 1, mem);
+  rg_stream_read(&sms.glasses_3d, 1, 1, mem);
+  rg_stream_read(&sms.hlatch, 1, 1, mem);
+  rg_stream_read(&sms.use_fm, 1, 1, mem);
+  rg_stream_read(&sms.memctrl, 1, 1, mem);
+  rg_stream_read(&sms.ioctrl, 1, 1, mem);
+  rg_stream_read(&padding, 1, 1, mem);
+  rg_stream_read(&sms.sio, 8, 1, mem);
+  rg_stream_read(&sms.device, 2, 1, mem);
+  rg_stream_read(&sms.gun_offset, 1, 1, mem);
+  rg_stream_read(&padding, 1, 1, mem);
 
   if(sms.console != current_console)
   {
@@ -182,37 +182,37 @@ void system_load_state(void *mem)
   }
 
   /*** Set vdp state ***/
-  fread(vdp.vram, 0x4000, 1, mem);
-  fread(vdp.cram, 0x40, 1, mem);
-  fread(vdp.reg, 0x10, 1, mem);
-  fread(&vdp.vscroll, 1, 1, mem);
-  fread(&vdp.status, 1, 1, mem);
-  fread(&vdp.latch, 1, 1, mem);
-  fread(&vdp.pending, 1, 1, mem);
-  fread(&vdp.addr, 2, 1, mem);
-  fread(&vdp.code, 1, 1, mem);
-  fread(&vdp.buffer, 1, 1, mem);
-  fread(&vdp.pn, 4, 1, mem);
-  fread(&vdp.ct, 4, 1, mem);
-  fread(&vdp.pg, 4, 1, mem);
-  fread(&vdp.sa, 4, 1, mem);
-  fread(&vdp.sg, 4, 1, mem);
-  fread(&vdp.ntab, 4, 1, mem);
-  fread(&vdp.satb, 4, 1, mem);
-  fread(&vdp.line, 4, 1, mem);
-  fread(&vdp.left, 4, 1, mem);
-  fread(&vdp.lpf, 2, 1, mem);
-  fread(&vdp.height, 1, 1, mem);
-  fread(&vdp.extended, 1, 1, mem);
-  fread(&vdp.mode, 1, 1, mem);
-  fread(&vdp.irq, 1, 1, mem);
-  fread(&vdp.vint_pending, 1, 1, mem);
-  fread(&vdp.hint_pending, 1, 1, mem);
-  fread(&vdp.cram_latch, 2, 1, mem);
-  fread(&vdp.spr_col, 2, 1, mem);
-  fread(&vdp.spr_ovr, 1, 1, mem);
-  fread(&vdp.bd, 1, 1, mem);
-  fread(&padding, 2, 1, mem);
+  rg_stream_read(vdp.vram, 0x4000, 1, mem);
+  rg_stream_read(vdp.cram, 0x40, 1, mem);
+  rg_stream_read(vdp.reg, 0x10, 1, mem);
+  rg_stream_read(&vdp.vscroll, 1, 1, mem);
+  rg_stream_read(&vdp.status, 1, 1, mem);
+  rg_stream_read(&vdp.latch, 1, 1, mem);
+  rg_stream_read(&vdp.pending, 1, 1, mem);
+  rg_stream_read(&vdp.addr, 2, 1, mem);
+  rg_stream_read(&vdp.code, 1, 1, mem);
+  rg_stream_read(&vdp.buffer, 1, 1, mem);
+  rg_stream_read(&vdp.pn, 4, 1, mem);
+  rg_stream_read(&vdp.ct, 4, 1, mem);
+  rg_stream_read(&vdp.pg, 4, 1, mem);
+  rg_stream_read(&vdp.sa, 4, 1, mem);
+  rg_stream_read(&vdp.sg, 4, 1, mem);
+  rg_stream_read(&vdp.ntab, 4, 1, mem);
+  rg_stream_read(&vdp.satb, 4, 1, mem);
+  rg_stream_read(&vdp.line, 4, 1, mem);
+  rg_stream_read(&vdp.left, 4, 1, mem);
+  rg_stream_read(&vdp.lpf, 2, 1, mem);
+  rg_stream_read(&vdp.height, 1, 1, mem);
+  rg_stream_read(&vdp.extended, 1, 1, mem);
+  rg_stream_read(&vdp.mode, 1, 1, mem);
+  rg_stream_read(&vdp.irq, 1, 1, mem);
+  rg_stream_read(&vdp.vint_pending, 1, 1, mem);
+  rg_stream_read(&vdp.hint_pending, 1, 1, mem);
+  rg_stream_read(&vdp.cram_latch, 2, 1, mem);
+  rg_stream_read(&vdp.spr_col, 2, 1, mem);
+  rg_stream_read(&vdp.spr_ovr, 1, 1, mem);
+  rg_stream_read(&vdp.bd, 1, 1, mem);
+  rg_stream_read(&padding, 2, 1, mem);
 
   /** restore video & audio settings (needed if timing changed) ***/
   vdp_init();
@@ -221,38 +221,38 @@ void system_load_state(void *mem)
   /*** Set cart info ***/
   for (i = 0; i < 4; i++)
   {
-    fread(&cart.fcr[i], 1, 1, mem);
+    rg_stream_read(&cart.fcr[i], 1, 1, mem);
   }
 
   /*** Set SRAM ***/
-  fread(cart.sram, 0x8000, 1, mem);
+  rg_stream_read(cart.sram, 0x8000, 1, mem);
 
   /*** Set Z80 Context ***/
-  fread(&Z80.pc, 4, 1, mem);
-  fread(&Z80.sp, 4, 1, mem);
-  fread(&Z80.af, 4, 1, mem);
-  fread(&Z80.bc, 4, 1, mem);
-  fread(&Z80.de, 4, 1, mem);
-  fread(&Z80.hl, 4, 1, mem);
-  fread(&Z80.ix, 4, 1, mem);
-  fread(&Z80.iy, 4, 1, mem);
-  fread(&Z80.wz, 4, 1, mem);
-  fread(&Z80.af2, 4, 1, mem);
-  fread(&Z80.bc2, 4, 1, mem);
-  fread(&Z80.de2, 4, 1, mem);
-  fread(&Z80.hl2, 4, 1, mem);
-  fread(&Z80.r, 1, 1, mem);
-  fread(&Z80.r2, 1, 1, mem);
-  fread(&Z80.iff1, 1, 1, mem);
-  fread(&Z80.iff2, 1, 1, mem);
-  fread(&Z80.halt, 1, 1, mem);
-  fread(&Z80.im, 1, 1, mem);
-  fread(&Z80.i, 1, 1, mem);
-  fread(&Z80.nmi_state, 1, 1, mem);
-  fread(&Z80.nmi_pending, 1, 1, mem);
-  fread(&Z80.irq_state, 1, 1, mem);
-  fread(&Z80.after_ei, 1, 1, mem);
-  fread(&padding, 9, 1, mem);
+  rg_stream_read(&Z80.pc, 4, 1, mem);
+  rg_stream_read(&Z80.sp, 4, 1, mem);
+  rg_stream_read(&Z80.af, 4, 1, mem);
+  rg_stream_read(&Z80.bc, 4, 1, mem);
+  rg_stream_read(&Z80.de, 4, 1, mem);
+  rg_stream_read(&Z80.hl, 4, 1, mem);
+  rg_stream_read(&Z80.ix, 4, 1, mem);
+  rg_stream_read(&Z80.iy, 4, 1, mem);
+  rg_stream_read(&Z80.wz, 4, 1, mem);
+  rg_stream_read(&Z80.af2, 4, 1, mem);
+  rg_stream_read(&Z80.bc2, 4, 1, mem);
+  rg_stream_read(&Z80.de2, 4, 1, mem);
+  rg_stream_read(&Z80.hl2, 4, 1, mem);
+  rg_stream_read(&Z80.r, 1, 1, mem);
+  rg_stream_read(&Z80.r2, 1, 1, mem);
+  rg_stream_read(&Z80.iff1, 1, 1, mem);
+  rg_stream_read(&Z80.iff2, 1, 1, mem);
+  rg_stream_read(&Z80.halt, 1, 1, mem);
+  rg_stream_read(&Z80.im, 1, 1, mem);
+  rg_stream_read(&Z80.i, 1, 1, mem);
+  rg_stream_read(&Z80.nmi_state, 1, 1, mem);
+  rg_stream_read(&Z80.nmi_pending, 1, 1, mem);
+  rg_stream_read(&Z80.irq_state, 1, 1, mem);
+  rg_stream_read(&Z80.after_ei, 1, 1, mem);
+  rg_stream_read(&padding, 9, 1, mem);
 
 #if 0
   /*** Set YM2413 ***/
@@ -269,16 +269,16 @@ void system_load_state(void *mem)
   float psg_dClock = psg->dClock;
 
   /*** Set SN76489 ***/
-  fread(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
+  rg_stream_read(SN76489_GetContextPtr(0), SN76489_GetContextSize(), 1, mem);
 
   // Restore clock rate
   psg->Clock = psg_Clock;
   psg->dClock = psg_dClock;
 
-  fread(&coleco.pio_mode, 1, 1, mem);
-  fread(&coleco.port53, 1, 1, mem);
-  fread(&coleco.port7F, 1, 1, mem);
-  fread(&padding, 5, 1, mem);
+  rg_stream_read(&coleco.pio_mode, 1, 1, mem);
+  rg_stream_read(&coleco.port53, 1, 1, mem);
+  rg_stream_read(&coleco.port7F, 1, 1, mem);
+  rg_stream_read(&padding, 5, 1, mem);
 
   if (sms.console == CONSOLE_COLECO)
   {
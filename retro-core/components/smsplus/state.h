@@ -30,7 +30,7 @@
 #define STATE_HEADER    "SST\0"     /* State file header */
 
 /* Function prototypes */
-extern int system_save_state(void *mem);
-extern void system_load_state(void *mem);
+extern int system_save_state(rg_stream_t *mem);
+extern void system_load_state(rg_stream_t *mem);
 
 #endif /* _STATE_H_ */
@@ -5,6 +5,12 @@
 #include "snes9x.h"
 #include "memmap.h"
 #include "ppu.h"
+#include "gfx.h"
+
+/* The renderer's view of the PPU, see gfx.c */
+#define PPU (*DrawPPU)
+#define IPPU (*DrawIPPU)
+#define Memory DrawMemory
 
 typedef struct
 {
@@ -1,5 +1,7 @@
 /* This file is part of Snes9x. See LICENSE file. */
 
+#include <stddef.h>
+
 #include "snes9x.h"
 
 #include "memmap.h"
@@ -72,14 +74,108 @@ static ClippedTileRenderer DrawHiResClippedTilePtr;
 static LargePixelRenderer  DrawLargePixelPtr;
 static uint8_t  Mode7Depths [2];
 
-static struct {
+typedef struct {
    SLineData LineData[240];
    SLineMatrixData LineMatrixData[240];
+} SLines;
+
+static struct {
+   SLines Lines[2];
    SOBJLines OBJLines[SNES_HEIGHT_EXTENDED];
 } *LocalState;
 
-#define LineData LocalState->LineData
-#define LineMatrixData LocalState->LineMatrixData
+/* RenderLine() latches into LiveLines, the renderer reads DrawLines. They only differ when
+ * rendering is threaded, in which case consecutive frames alternate between the two sets. */
+static SLines* LiveLines;
+static SLines* DrawLines;
+static uint8_t* NextScreen;
+
+SPPU*        DrawPPU;
+InternalPPU* DrawIPPU;
+SDrawMemory  DrawMemory;
+
+#define LineData LiveLines->LineData
+#define LineMatrixData LiveLines->LineMatrixData
+
+/* Threaded rendering. Each flush (S9xUpdateScreen) snapshots what the renderer needs into a
+ * command: the PPU registers minus CGRAM/OAM, plus the OBJ table and palette when they changed.
+ * VRAM goes through a journal of the 16 bytes blocks written since the previous command, using
+ * the live TileCached array as the dirty map (the renderer has its own). */
+#define DRAW_CMDS    16
+#define DRAW_JOURNAL MAX_2BIT_TILES /* A full VRAM rewrite must fit */
+
+enum
+{
+   DRAW_START,
+   DRAW_LINES,
+   DRAW_END,
+   DRAW_OBJ
+};
+
+#define PPU_STATE_SIZE (offsetof(SPPU, CGDATA) \
+                      + offsetof(SPPU, OBJ) - offsetof(SPPU, FirstSprite) \
+                      + offsetof(SPPU, OAMData) - offsetof(SPPU, OAMPriorityRotation) \
+                      + sizeof(SPPU) - offsetof(SPPU, VTimerEnabled))
+
+static const struct
+{
+   uint16_t Offset;
+   uint16_t Size;
+} PPUState[] =
+{
+   {0,                                   offsetof(SPPU, CGDATA)},
+   {offsetof(SPPU, FirstSprite),         offsetof(SPPU, OBJ) - offsetof(SPPU, FirstSprite)},
+   {offsetof(SPPU, OAMPriorityRotation), offsetof(SPPU, OAMData) - offsetof(SPPU, OAMPriorityRotation)},
+   {offsetof(SPPU, VTimerEnabled),       sizeof(SPPU) - offsetof(SPPU, VTimerEnabled)},
+};
+
+typedef struct
+{
+   uint8_t        Action;
+   bool           OBJChanged;
+   bool           ColorsChanged;
+   bool           Interlace;
+   int32_t        PreviousLine;
+   int32_t        CurrentLine;
+   const uint8_t* XB;
+   uint8_t*       Screen;
+   SLines*        Lines;
+   uint32_t       JournalEnd;
+   uint8_t        Regs[8]; /* $212c-$2133 */
+   uint8_t        State[PPU_STATE_SIZE];
+   SOBJ           OBJ[128];
+   uint16_t       Colors[256];
+} SDrawCmd;
+
+static struct
+{
+   SDrawCmd    Cmds[DRAW_CMDS];
+   uint32_t    CmdHead;      /* Written by the emulation */
+   uint32_t    CmdTail;      /* Written by the renderer */
+   uint16_t    JournalBlock[DRAW_JOURNAL];
+   uint8_t     JournalData[DRAW_JOURNAL][16];
+   uint32_t    JournalHead;
+   uint32_t    JournalTail;
+   uint32_t    FramesQueued;
+   uint32_t    FramesDrawn;
+   uint8_t     FrameRTO;
+   uint8_t     LastFrameRTO;
+   SPPU        PPU;
+   InternalPPU IPPU;
+   uint16_t    ScreenColors[256];
+   uint8_t     TileCached[MAX_2BIT_TILES];
+   uint8_t     VRAM[VRAM_SIZE];
+   uint8_t     FillRAM[0x2134]; /* Only $212c-$2133 are read by the renderer */
+} *Pipe;
+
+static bool Threaded;
+
+#ifdef RETRO_GO
+static rg_task_t* RenderTask;
+#define WAIT_FOR_RENDERER() rg_task_yield()
+#else
+#define WAIT_FOR_RENDERER()
+#endif
 
 #define CLIP_10_BIT_SIGNED(a) \
    ((a) & ((1 << 10) - 1)) + (((((a) & (1 << 13)) ^ (1 << 13)) - (1 << 13)) >> 3)
@@ -163,6 +259,12 @@ bool S9xInitGFX(void)
       return false;
 
    GFX.OBJLines = LocalState->OBJLines;
+   LiveLines = DrawLines = &LocalState->Lines[0];
+   NextScreen = GFX.Screen;
+   DrawPPU = &PPU;
+   DrawIPPU = &IPPU;
+   DrawMemory.VRAM = Memory.VRAM;
+   DrawMemory.FillRAM = Memory.FillRAM;
    GFX.RealPitch = GFX.Pitch2 = GFX.Pitch;
    GFX.ZPitch = GFX.Pitch;
    GFX.ZPitch >>= 1;
@@ -221,6 +323,20 @@ bool S9xInitGFX(void)
 
 void S9xDeinitGFX(void)
 {
+   S9xSetThreadedRendering(false);
+#ifdef RETRO_GO
+   if (RenderTask)
+   {
+      /* A stale wake-up might still have the task looking at Pipe, so it frees it on its way out */
+      rg_task_send(RenderTask, &(rg_task_msg_t){.type = RG_TASK_MSG_STOP});
+      RenderTask = NULL;
+   }
+   else
+   {
+      free(Pipe);
+      Pipe = NULL;
+   }
+#endif
    /* Free any memory allocated in S9xInitGFX */
    if (GFX.ZERO)
    {
@@ -234,6 +350,152 @@ void S9xDeinitGFX(void)
    }
 }
 
+static void DrawScreenStart(uint8_t* screen, SLines* lines);
+static void DrawScreen(void);
+static void DrawScreenEnd(void);
+static void ExecCmd(SDrawCmd* cmd);
+static void RenderTaskLoop(void* arg);
+
+static void JournalVRAM(void)
+{
+   uint32_t head = Pipe->JournalHead;
+   uint32_t block;
+
+   for (block = 0; block < MAX_2BIT_TILES; block++)
+   {
+      if (IPPU.TileCached[block])
+         continue;
+      while (head - __atomic_load_n(&Pipe->JournalTail, __ATOMIC_ACQUIRE) >= DRAW_JOURNAL)
+         WAIT_FOR_RENDERER();
+      Pipe->JournalBlock[head % DRAW_JOURNAL] = block;
+      memcpy(Pipe->JournalData[head % DRAW_JOURNAL], &Memory.VRAM[block << 4], 16);
+      IPPU.TileCached[block] = true;
+      head++;
+   }
+
+   Pipe->JournalHead = head;
+   IPPU.VRAMChanged = false;
+}
+
+static void CaptureCmd(SDrawCmd* cmd, uint8_t action)
+{
+   uint8_t* state = cmd->State;
+   uint32_t i;
+
+   for (i = 0; i < sizeof(PPUState) / sizeof(PPUState[0]); i++)
+   {
+      memcpy(state, (uint8_t*) &PPU + PPUState[i].Offset, PPUState[i].Size);
+      state += PPUState[i].Size;
+   }
+
+   if ((cmd->OBJChanged = IPPU.OBJChanged))
+      memcpy(cmd->OBJ, PPU.OBJ, sizeof(cmd->OBJ));
+   if ((cmd->ColorsChanged = IPPU.ColorsChanged))
+      memcpy(cmd->Colors, IPPU.ScreenColors, sizeof(cmd->Colors));
+   if (IPPU.VRAMChanged)
+      JournalVRAM();
+
+   memcpy(cmd->Regs, &Memory.FillRAM[0x212c], sizeof(cmd->Regs));
+   cmd->Action = action;
+   cmd->Interlace = IPPU.Interlace;
+   cmd->PreviousLine = IPPU.PreviousLine;
+   cmd->CurrentLine = IPPU.CurrentLine;
+   cmd->XB = IPPU.XB;
+   cmd->Screen = NextScreen;
+   cmd->Lines = LiveLines;
+   cmd->JournalEnd = Pipe->JournalHead;
+
+   /* The renderer keeps these pending on its side until it acts on them */
+   IPPU.OBJChanged = false;
+   IPPU.ColorsChanged = false;
+   PPU.RecomputeClipWindows = false;
+}
+
+static void QueueCmd(uint8_t action)
+{
+   uint32_t head = Pipe->CmdHead;
+
+   while (head - __atomic_load_n(&Pipe->CmdTail, __ATOMIC_ACQUIRE) >= DRAW_CMDS)
+      WAIT_FOR_RENDERER();
+
+   CaptureCmd(&Pipe->Cmds[head % DRAW_CMDS], action);
+   __atomic_store_n(&Pipe->CmdHead, head + 1, __ATOMIC_RELEASE);
+
+#ifdef RETRO_GO
+   if (!rg_task_messages_waiting(RenderTask))
+      rg_task_send(RenderTask, &(rg_task_msg_t){.type = 0});
+#endif
+}
+
+static void WaitForRenderer(void)
+{
+   while (Threaded && Pipe->CmdHead != __atomic_load_n(&Pipe->CmdTail, __ATOMIC_ACQUIRE))
+      WAIT_FOR_RENDERER();
+}
+
+void S9xSetThreadedRendering(bool enable)
+{
+   if (enable == Threaded)
+      return;
+
+   WaitForRenderer();
+
+   if (enable)
+   {
+#ifdef RETRO_GO
+      if (!Pipe && !(Pipe = calloc(1, sizeof(*Pipe))))
+         return;
+      if (!RenderTask && !(RenderTask = rg_task_create("snes9x_gfx", &RenderTaskLoop, NULL, 4 * 1024, RG_TASK_PRIORITY_2, 1)))
+         return;
+#else
+      return;
+#endif
+      Pipe->PPU = PPU;
+      Pipe->IPPU = IPPU;
+      Pipe->IPPU.ScreenColors = Pipe->ScreenColors;
+      Pipe->IPPU.TileCached = Pipe->TileCached;
+      memcpy(Pipe->ScreenColors, IPPU.ScreenColors, sizeof(Pipe->ScreenColors));
+      memcpy(Pipe->VRAM, Memory.VRAM, VRAM_SIZE);
+      memcpy(&Pipe->FillRAM[0x212c], &Memory.FillRAM[0x212c], 8);
+      memset(Pipe->TileCached, 0, MAX_2BIT_TILES);
+      /* From now on the live array only tracks what the renderer's VRAM copy is missing */
+      memset(IPPU.TileCached, true, MAX_2BIT_TILES);
+      IPPU.VRAMChanged = false;
+      DrawPPU = &Pipe->PPU;
+      DrawIPPU = &Pipe->IPPU;
+      DrawMemory.VRAM = Pipe->VRAM;
+      DrawMemory.FillRAM = Pipe->FillRAM;
+   }
+   else
+   {
+      memset(IPPU.TileCached, 0, MAX_2BIT_TILES);
+      IPPU.OBJChanged = true;
+      LiveLines = &LocalState->Lines[0];
+      DrawPPU = &PPU;
+      DrawIPPU = &IPPU;
+      DrawMemory.VRAM = Memory.VRAM;
+      DrawMemory.FillRAM = Memory.FillRAM;
+   }
+
+   Threaded = enable;
+}
+
+void S9xSetScreen(uint8_t* screen)
+{
+   NextScreen = screen;
+}
+
+uint32_t S9xSyncScreen(uint32_t frames)
+{
+   if (!Threaded)
+      return 0;
+
+   while (Pipe->FramesQueued - __atomic_load_n(&Pipe->FramesDrawn, __ATOMIC_ACQUIRE) > frames)
+      WAIT_FOR_RENDERER();
+
+   return Pipe->FramesQueued - __atomic_load_n(&Pipe->FramesDrawn, __ATOMIC_ACQUIRE);
+}
+
 void S9xStartScreenRefresh(void)
 {
    if (IPPU.RenderThisFrame)
@@ -242,47 +504,16 @@ void S9xStartScreenRefresh(void)
 
       if (PPU.BGMode == 5 || PPU.BGMode == 6)
          IPPU.Interlace = (Memory.FillRAM[0x2133] & 1);
-      if (PPU.BGMode == 5 || PPU.BGMode == 6 || IPPU.Interlace)
-      {
-         IPPU.RenderedScreenWidth = 512;
-         IPPU.DoubleWidthPixels = true;
-         IPPU.HalfWidthPixels = false;
 
-         if (IPPU.Interlace)
-         {
-            IPPU.RenderedScreenHeight = PPU.ScreenHeight << 1;
-            IPPU.DoubleHeightPixels = true;
-            GFX.Pitch2 = GFX.RealPitch;
-            GFX.Pitch = GFX.RealPitch * 2;
-            GFX.PPL = GFX.PPLx2 = GFX.RealPitch;
-         }
-         else
-         {
-            IPPU.RenderedScreenHeight = PPU.ScreenHeight;
-            GFX.Pitch2 = GFX.Pitch = GFX.RealPitch;
-            IPPU.DoubleHeightPixels = false;
-            GFX.PPL = GFX.Pitch >> 1;
-            GFX.PPLx2 = GFX.PPL << 1;
-         }
-      }
-      else
+      if (Threaded)
       {
-         IPPU.RenderedScreenWidth = 256;
-         IPPU.RenderedScreenHeight = PPU.ScreenHeight;
-         IPPU.DoubleWidthPixels = false;
-         IPPU.HalfWidthPixels = false;
-         IPPU.DoubleHeightPixels = false;
-         {
-            GFX.Pitch2 = GFX.Pitch = GFX.RealPitch;
-            GFX.PPL = GFX.PPLx2 >> 1;
-            GFX.ZPitch = GFX.RealPitch;
-            GFX.ZPitch >>= 1;
-         }
+         /* The line latches alternate, the frame before the previous one must be done with this set */
+         S9xSyncScreen(1);
+         LiveLines = &LocalState->Lines[Pipe->FramesQueued & 1];
+         QueueCmd(DRAW_START);
       }
-
-      PPU.RecomputeClipWindows = true;
-      GFX.DepthDelta = GFX.SubZBuffer - GFX.ZBuffer;
-      GFX.Delta = (GFX.SubScreen - GFX.Screen) >> 1;
+      else
+         DrawScreenStart(NextScreen, LiveLines);
    }
 
    if (++IPPU.FrameCount == (uint32_t)Memory.ROMFramesPerSecond)
@@ -329,7 +560,19 @@ void RenderLine(uint8_t C)
    {
       /* if we're not rendering this frame, we still need to update this */
       /* XXX: Check ForceBlank? Or anything else? */
-      if (IPPU.OBJChanged)
+      if (Threaded)
+      {
+         /* GFX.OBJLines belongs to the renderer, leave it alone until it has caught up */
+         if (Pipe->CmdHead != __atomic_load_n(&Pipe->CmdTail, __ATOMIC_ACQUIRE))
+            return;
+         if (IPPU.OBJChanged)
+         {
+            SDrawCmd* cmd = &Pipe->Cmds[Pipe->CmdHead % DRAW_CMDS];
+            CaptureCmd(cmd, DRAW_OBJ);
+            ExecCmd(cmd);
+         }
+      }
+      else if (IPPU.OBJChanged)
          S9xSetupOBJ();
       PPU.RangeTimeOver |= GFX.OBJLines[C].RTOFlags;
    }
@@ -340,21 +583,183 @@ void S9xEndScreenRefresh(void)
    if (IPPU.RenderThisFrame)
    {
       FLUSH_REDRAW();
-      if (IPPU.ColorsChanged)
+      if (Threaded)
       {
-         uint32_t saved = PPU.CGDATA[0];
-         IPPU.ColorsChanged = false;
-         PPU.CGDATA[0] = saved;
+         QueueCmd(DRAW_END);
+         Pipe->FramesQueued++;
+         /* The renderer only knows once it has drawn the frame, so this is the previous one's */
+         PPU.RangeTimeOver |= __atomic_load_n(&Pipe->LastFrameRTO, __ATOMIC_RELAXED);
       }
-
-      GFX.Pitch = GFX.Pitch2 = GFX.RealPitch;
-      GFX.PPL = GFX.PPLx2 >> 1;
+      else
+         DrawScreenEnd();
    }
 
    if (CPU.SRAMModified)
       CPU.SRAMModified = false;
 }
 
+void S9xUpdateScreen(void)
+{
+   if (Threaded)
+      QueueCmd(DRAW_LINES);
+   else
+      DrawScreen();
+
+   IPPU.PreviousLine = IPPU.CurrentLine;
+}
+
+/* Everything below is the renderer. When rendering is threaded it runs on its own task and
+ * PPU, IPPU and Memory refer to the copies the commands are applied to, see ApplyCmd(). */
+#undef LineData
+#undef LineMatrixData
+#define LineData DrawLines->LineData
+#define LineMatrixData DrawLines->LineMatrixData
+#define PPU (*DrawPPU)
+#define IPPU (*DrawIPPU)
+#define Memory DrawMemory
+
+static void DrawScreenStart(uint8_t* screen, SLines* lines)
+{
+   GFX.Screen = screen;
+   DrawLines = lines;
+
+   if (PPU.BGMode == 5 || PPU.BGMode == 6 || IPPU.Interlace)
+   {
+      IPPU.RenderedScreenWidth = 512;
+      IPPU.DoubleWidthPixels = true;
+      IPPU.HalfWidthPixels = false;
+
+      if (IPPU.Interlace)
+      {
+         IPPU.RenderedScreenHeight = PPU.ScreenHeight << 1;
+         IPPU.DoubleHeightPixels = true;
+         GFX.Pitch2 = GFX.RealPitch;
+         GFX.Pitch = GFX.RealPitch * 2;
+         GFX.PPL = GFX.PPLx2 = GFX.RealPitch;
+      }
+      else
+      {
+         IPPU.RenderedScreenHeight = PPU.ScreenHeight;
+         GFX.Pitch2 = GFX.Pitch = GFX.RealPitch;
+         IPPU.DoubleHeightPixels = false;
+         GFX.PPL = GFX.Pitch >> 1;
+         GFX.PPLx2 = GFX.PPL << 1;
+      }
+   }
+   else
+   {
+      IPPU.RenderedScreenWidth = 256;
+      IPPU.RenderedScreenHeight = PPU.ScreenHeight;
+      IPPU.DoubleWidthPixels = false;
+      IPPU.HalfWidthPixels = false;
+      IPPU.DoubleHeightPixels = false;
+      {
+         GFX.Pitch2 = GFX.Pitch = GFX.RealPitch;
+         GFX.PPL = GFX.PPLx2 >> 1;
+         GFX.ZPitch = GFX.RealPitch;
+         GFX.ZPitch >>= 1;
+      }
+   }
+
+   PPU.RecomputeClipWindows = true;
+   GFX.DepthDelta = GFX.SubZBuffer - GFX.ZBuffer;
+   GFX.Delta = (GFX.SubScreen - GFX.Screen) >> 1;
+}
+
+static void DrawScreenEnd(void)
+{
+   GFX.Pitch = GFX.Pitch2 = GFX.RealPitch;
+   GFX.PPL = GFX.PPLx2 >> 1;
+}
+
+static void ApplyCmd(const SDrawCmd* cmd)
+{
+   const uint8_t* state = cmd->State;
+   bool recompute = PPU.RecomputeClipWindows;
+   uint32_t i;
+
+   for (i = 0; i < sizeof(PPUState) / sizeof(PPUState[0]); i++)
+   {
+      memcpy((uint8_t*) &PPU + PPUState[i].Offset, state, PPUState[i].Size);
+      state += PPUState[i].Size;
+   }
+   PPU.RecomputeClipWindows |= recompute;
+
+   if (cmd->OBJChanged)
+   {
+      memcpy(PPU.OBJ, cmd->OBJ, sizeof(PPU.OBJ));
+      IPPU.OBJChanged = true;
+   }
+   if (cmd->ColorsChanged)
+      memcpy(IPPU.ScreenColors, cmd->Colors, sizeof(cmd->Colors));
+
+   for (i = Pipe->JournalTail; i != cmd->JournalEnd; i++)
+   {
+      uint32_t block = Pipe->JournalBlock[i % DRAW_JOURNAL];
+      memcpy(&Memory.VRAM[block << 4], Pipe->JournalData[i % DRAW_JOURNAL], 16);
+      IPPU.TileCached[block] = IPPU.TileCached[block >> 1] = IPPU.TileCached[block >> 2] = false;
+   }
+   __atomic_store_n(&Pipe->JournalTail, i, __ATOMIC_RELEASE);
+
+   memcpy(&Memory.FillRAM[0x212c], cmd->Regs, sizeof(cmd->Regs));
+   IPPU.Interlace = cmd->Interlace;
+   IPPU.PreviousLine = cmd->PreviousLine;
+   IPPU.CurrentLine = cmd->CurrentLine;
+   IPPU.XB = cmd->XB;
+}
+
+static void ExecCmd(SDrawCmd* cmd)
+{
+   ApplyCmd(cmd);
+
+   switch (cmd->Action)
+   {
+      case DRAW_START:
+         DrawScreenStart(cmd->Screen, cmd->Lines);
+         Pipe->FrameRTO = 0;
+         break;
+      case DRAW_LINES:
+         DrawScreen();
+         Pipe->FrameRTO |= PPU.RangeTimeOver;
+         break;
+      case DRAW_END:
+         DrawScreenEnd();
+         __atomic_store_n(&Pipe->LastFrameRTO, Pipe->FrameRTO, __ATOMIC_RELAXED);
+         __atomic_store_n(&Pipe->FramesDrawn, Pipe->FramesDrawn + 1, __ATOMIC_RELEASE);
+         break;
+      case DRAW_OBJ:
+         if (IPPU.OBJChanged)
+            S9xSetupOBJ();
+         break;
+   }
+}
+
+static void RenderTaskLoop(void* arg)
+{
+#ifdef RETRO_GO
+   rg_task_msg_t msg;
+
+   while (true)
+   {
+      uint32_t tail;
+
+      rg_task_receive(&msg);
+      if (msg.type == RG_TASK_MSG_STOP)
+         break;
+
+      tail = Pipe->CmdTail;
+      while (tail != __atomic_load_n(&Pipe->CmdHead, __ATOMIC_ACQUIRE))
+      {
+         ExecCmd(&Pipe->Cmds[tail % DRAW_CMDS]);
+         __atomic_store_n(&Pipe->CmdTail, ++tail, __ATOMIC_RELEASE);
+      }
+   }
+
+   free(Pipe);
+   Pipe = NULL;
+#endif
+}
+
 static INLINE void SelectTileRenderer(bool normal)
 {
    if (normal)
@@ -2582,7 +2987,7 @@ static void RenderScreen(uint8_t* Screen, bool sub, bool force_no_add, uint8_t D
    }
 }
 
-void S9xUpdateScreen(void)
+static void DrawScreen(void)
 {
    int32_t x2 = 1;
    uint32_t starty, endy, black;
@@ -3094,6 +3499,4 @@ void S9xUpdateScreen(void)
 
    /* Double the height of the pixels just drawn */
    FIX_INTERLACE(GFX.Screen, false, GFX.ZBuffer);
-
-   IPPU.PreviousLine = IPPU.CurrentLine;
 }
@@ -18,6 +18,13 @@ void RenderLine(uint8_t line);
 bool S9xInitGFX(void);
 void S9xDeinitGFX(void);
 
+/* Threaded rendering: the frame is latched at each flush and drawn by a separate task while
+ * the next one is emulated. S9xSetScreen() selects the buffer the next frame will be drawn to,
+ * S9xSyncScreen() waits until at most `frames` frames are still being drawn and returns that count. */
+void S9xSetThreadedRendering(bool enable);
+void S9xSetScreen(uint8_t* screen);
+uint32_t S9xSyncScreen(uint32_t frames);
+
 typedef struct
 {
    uint8_t RTOFlags;
@@ -111,6 +118,18 @@ typedef struct
 
 extern SBG BG;
 
+typedef struct
+{
+   uint8_t* VRAM;
+   uint8_t* FillRAM;
+} SDrawMemory;
+
+/* The state the renderer reads, which is the live state unless rendering is threaded.
+ * The drawing code refers to them through PPU/IPPU/Memory defines, see gfx.c. */
+extern SPPU*        DrawPPU;
+extern InternalPPU* DrawIPPU;
+extern SDrawMemory  DrawMemory;
+
 /* Could use BSWAP instruction on Intel port... */
 #define SWAP_DWORD(dword) dword = ((((dword) & 0x000000ff) << 24) \
                                 |  (((dword) & 0x0000ff00) <<  8) \
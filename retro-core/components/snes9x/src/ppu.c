@@ -1652,6 +1652,7 @@ static void CommonPPUReset()
    IPPU.RenderThisFrame = true;
    IPPU.FrameCount = 0;
    memset(IPPU.TileCached, 0, MAX_2BIT_TILES);
+   IPPU.VRAMChanged = true;
    IPPU.FirstVRAMRead = false;
    IPPU.Interlace = false;
    IPPU.DoubleWidthPixels = false;
@@ -39,6 +39,7 @@ typedef struct
    uint32_t FrameCount;
    uint8_t* TileCache;
    uint8_t* TileCached;
+   bool     VRAMChanged;  /* Some TileCached entries were cleared since the renderer last looked */
    bool     FirstVRAMRead;
    bool     DoubleHeightPixels;
    bool     Interlace;
@@ -356,6 +357,7 @@ static INLINE void REGISTER_2118(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (!PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
@@ -369,6 +371,7 @@ static INLINE void REGISTER_2118_tile(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (!PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
@@ -380,6 +383,7 @@ static INLINE void REGISTER_2118_linear(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (!PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
@@ -398,6 +402,7 @@ static INLINE void REGISTER_2119(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
@@ -410,6 +415,7 @@ static INLINE void REGISTER_2119_tile(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
@@ -421,6 +427,7 @@ static INLINE void REGISTER_2119_linear(uint8_t Byte)
    IPPU.TileCached[address >> 4] = false;
    IPPU.TileCached[address >> 5] = false;
    IPPU.TileCached[address >> 6] = false;
+   IPPU.VRAMChanged = true;
    if (PPU.VMA.High)
       PPU.VMA.Address += PPU.VMA.Increment;
 }
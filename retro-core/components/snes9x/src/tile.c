@@ -8,6 +8,10 @@
 #include "gfx.h"
 #include "tile.h"
 
+/* The renderer's view of the PPU, see gfx.c */
+#define IPPU (*DrawIPPU)
+#define Memory DrawMemory
+
 static const uint32_t HeadMask[4] =
 {
 #ifdef MSB_FIRST
@@ -16,8 +16,8 @@ static bool useSystemTime = true;
 static bool loadBIOSFile = false;
 
 static rg_app_t *app;
-static rg_surface_t *updates[2];
-static rg_surface_t *currentUpdate;
+static rg_display_frame_t *frames;
+static rg_display_frame_t *currentFrame;
 
 static const char *SETTING_SAVESRAM = "SaveSRAM";
 static const char *SETTING_PALETTE  = "Palette";
@@ -39,13 +39,13 @@ static void event_handler(int event, void *arg)
 {
     if (event == RG_EVENT_REDRAW)
     {
-        rg_display_submit(currentUpdate, 0);
+        rg_display_submit(rg_display_get_last_frame(), 0);
     }
 }
 
 static bool screenshot_handler(const char *filename, int width, int height)
 {
-    return rg_surface_save_image_file(currentUpdate, filename, width, height);
+    return rg_surface_save_image_file(rg_display_get_last_frame(), filename, width, height);
 }
 
 static bool save_state_handler(const char *filename)
@@ -53,6 +53,27 @@ static bool save_state_handler(const char *filename)
     return gnuboy_save_state(filename) == 0;
 }
 
+static size_t serialize_handler(void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = buffer, .size = size};
+    if (gnuboy_save_state_stream(&stream) != 0)
+        return stream.error ? size : 0;
+    return stream.used;
+}
+
+static bool unserialize_handler(const void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = (void *)buffer, .size = size};
+    bool success = gnuboy_load_state_stream(&stream) == 0;
+    if (!success)
+    {
+        gnuboy_reset(true);
+        gnuboy_load_sram(sramFile);
+    }
+    update_rtc_time();
+    return success;
+}
+
 static bool load_state_handler(const char *filename)
 {
     if (gnuboy_load_state(filename) != 0)
@@ -216,11 +237,20 @@ static rg_gui_event_t rtc_update_cb(rg_gui_option_t *option, rg_gui_event_t even
     return RG_DIALOG_VOID;
 }
 
+static void acquire_frame(void)
+{
+    currentFrame = rg_display_acquire_frame();
+    currentFrame->rows_marked = true;
+    gnuboy_set_framebuffer(currentFrame->surface->data);
+    gnuboy_set_dirty_lines(currentFrame->surface->dirty_rows,
+                           currentFrame->reference ? currentFrame->reference->data : NULL);
+}
+
 static void video_callback(void *buffer)
 {
     int64_t startTime = rg_system_timer();
     slowFrame = !rg_display_sync(false);
-    rg_display_submit(currentUpdate, 0);
+    rg_display_present_frame(currentFrame, 0);
     video_time += rg_system_timer() - startTime;
 }
 
@@ -246,6 +276,8 @@ void gbc_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .serialize = &serialize_handler,
+        .unserialize = &unserialize_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -254,9 +286,7 @@ void gbc_main(void)
 
     app = rg_system_reinit(AUDIO_SAMPLE_RATE, &handlers, NULL);
 
-    updates[0] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
-    updates[1] = rg_surface_create(GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
-    currentUpdate = updates[0];
+    frames = rg_display_create_frames(DISPLAY_FRAMES, GB_WIDTH, GB_HEIGHT, RG_PIXEL_565_BE, MEM_ANY);
 
     useSystemTime = (bool)rg_settings_get_number(NS_APP, SETTING_SYSTIME, 1);
     loadBIOSFile = (bool)rg_settings_get_number(NS_APP, SETTING_LOADBIOS, 0);
@@ -270,17 +300,13 @@ void gbc_main(void)
     if (gnuboy_init(app->sampleRate, GB_AUDIO_STEREO_S16, GB_PIXEL_565_BE, &video_callback, &audio_callback) < 0)
         RG_PANIC("Emulator init failed!");
 
-    gnuboy_set_framebuffer(currentUpdate->data);
+    acquire_frame();
     gnuboy_set_soundbuffer(malloc(AUDIO_BUFFER_LENGTH * 4), AUDIO_BUFFER_LENGTH);
 
     // Load ROM
     if (rg_extension_match(app->romPath, "zip"))
     {
-        void *data;
-        size_t size;
-        if (!rg_storage_unzip_file(app->romPath, NULL, &data, &size, RG_FILE_ALIGN_16KB))
-            RG_PANIC("ROM file unzipping failed!");
-        if (gnuboy_load_rom(data, size) < 0)
+        if (gnuboy_load_rom_zip(app->romPath) < 0)
             RG_PANIC("ROM Loading failed!");
     }
     else if (gnuboy_load_rom_file(app->romPath) < 0)
@@ -351,10 +377,7 @@ void gbc_main(void)
         video_time = audio_time = 0;
 
         if (drawFrame)
-        {
-            currentUpdate = updates[currentUpdate == updates[0]];
-            gnuboy_set_framebuffer(currentUpdate->data);
-        }
+            acquire_frame();
         gnuboy_run(drawFrame);
 
         if (autoSaveSRAM > 0)
@@ -389,5 +412,9 @@ void gbc_main(void)
         {
             skipFrames--;
         }
+
+        // Use the spare time to read ahead the next likely ROM bank, if the ROM is streamed
+        if (rg_system_timer() - startTime - audio_time < app->frameTime / 2)
+            gnuboy_prefetch_bank();
     }
 }
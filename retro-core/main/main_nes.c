@@ -10,8 +10,8 @@ static bool nsfPlayer = false;
 static nes_t *nes;
 
 static rg_app_t *app;
-static rg_surface_t *updates[2];
-static rg_surface_t *currentUpdate;
+static rg_display_frame_t *frames;
+static rg_display_frame_t *currentFrame;
 
 static const char *SETTING_AUTOCROP = "autocrop";
 static const char *SETTING_OVERSCAN = "overscan";
@@ -33,7 +33,7 @@ static void event_handler(int event, void *arg)
 
 static bool screenshot_handler(const char *filename, int width, int height)
 {
-	return rg_surface_save_image_file(currentUpdate, filename, width, height);
+	return rg_surface_save_image_file(rg_display_get_last_frame(), filename, width, height);
 }
 
 static bool save_state_handler(const char *filename)
@@ -51,6 +51,23 @@ static bool load_state_handler(const char *filename)
     return true;
 }
 
+static size_t serialize_handler(void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = buffer, .size = size};
+    if (state_save_stream(&stream) != 0)
+        return stream.error ? size : 0;
+    return stream.used;
+}
+
+static bool unserialize_handler(const void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = (void *)buffer, .size = size};
+    bool success = state_load_stream(&stream) == 0;
+    if (!success)
+        nes_reset(true);
+    return success;
+}
+
 static bool reset_handler(bool hard)
 {
     nes_reset(hard);
@@ -63,8 +80,8 @@ static void build_palette(int n)
     for (int i = 0; i < 256; i++)
     {
         uint16_t color = (pal[i] >> 8) | ((pal[i]) << 8);
-        updates[0]->palette[i] = color;
-        updates[1]->palette[i] = color;
+        for (int j = 0; j < DISPLAY_FRAMES; j++)
+            frames[j].surface->palette[i] = color;
     }
     free(pal);
 }
@@ -156,10 +173,19 @@ static void blit_screen(uint8 *bmp)
     int crop_v = (overscan) ? nes->overscan : 0;
     int crop_h = (autocrop) ? 8 : 0;
     // crop_h = (autocrop == 2) || (autocrop == 1 && nes->ppu->left_bg_counter > 210) ? 8 : 0;
-    currentUpdate->width = NES_SCREEN_WIDTH - crop_h * 2;
-    currentUpdate->height = NES_SCREEN_HEIGHT - crop_v * 2;
-    currentUpdate->offset = crop_v * currentUpdate->stride + crop_h + 8;
-    rg_display_submit(currentUpdate, 0);
+    rg_surface_t *update = bmp ? currentFrame->surface : rg_display_get_last_frame();
+    if (!update)
+        return;
+    update->width = NES_SCREEN_WIDTH - crop_h * 2;
+    update->height = NES_SCREEN_HEIGHT - crop_v * 2;
+    update->offset = crop_v * update->stride + crop_h + 8;
+    // The emulator flagged scanlines, the surface's rows start at the crop
+    if (bmp && update->dirty_rows && crop_v)
+        memmove(update->dirty_rows, update->dirty_rows + crop_v, update->height);
+    if (bmp)
+        rg_display_present_frame(currentFrame, 0);
+    else
+        rg_display_submit(update, 0);
 }
 
 static void nsf_draw_overlay(void)
@@ -179,6 +205,15 @@ static void nsf_draw_overlay(void)
 }
 
 
+#ifdef RG_ENABLE_NETPLAY
+static void netplay_replay(const uint32_t *inputs)
+{
+    input_update(0, inputs[0]);
+    input_update(1, inputs[1]);
+    nes_emulate(false);
+}
+#endif
+
 static void options_handler(rg_gui_option_t *dest)
 {
     *dest++ = (rg_gui_option_t){0, _("Palette"),      "-", RG_DIALOG_FLAG_NORMAL, &palette_update_cb};
@@ -193,6 +228,8 @@ void nes_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .serialize = &serialize_handler,
+        .unserialize = &unserialize_handler,
         .reset = &reset_handler,
         .event = &event_handler,
         .screenshot = &screenshot_handler,
@@ -205,9 +242,7 @@ void nes_main(void)
     autocrop = rg_settings_get_number(NS_APP, SETTING_AUTOCROP, 0);
     palette = rg_settings_get_number(NS_APP, SETTING_PALETTE, NES_PALETTE_PVM);
 
-    updates[0] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
-    updates[1] = rg_surface_create(NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
-    currentUpdate = updates[0];
+    frames = rg_display_create_frames(DISPLAY_FRAMES, NES_SCREEN_PITCH, NES_SCREEN_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
 
     nes = nes_init(SYS_DETECT, app->sampleRate, true, RG_BASE_PATH_BIOS "/fds_bios.bin");
     if (!nes)
@@ -286,12 +321,24 @@ void nes_main(void)
 
         if (drawFrame)
         {
-            currentUpdate = updates[currentUpdate == updates[0]];
-            nes_setvidbuf(currentUpdate->data);
+            currentFrame = rg_display_acquire_frame();
+            currentFrame->rows_marked = true;
+            nes_setvidbuf(currentFrame->surface->data);
+            nes_setdirtylines(currentFrame->surface->dirty_rows,
+                              currentFrame->reference ? currentFrame->reference->data : NULL);
         }
 
+    #ifdef RG_ENABLE_NETPLAY
+        uint32_t inputs[NETPLAY_MAX_PLAYERS];
+        rg_netplay_sync(buttons, inputs, &netplay_replay);
+        input_update(0, inputs[0]);
+        input_update(1, inputs[1]);
+    #else
         input_update(0, buttons);
+    #endif
+        RG_PROFILE_BEGIN("nes_emulate");
         nes_emulate(drawFrame);
+        RG_PROFILE_END();
 
         // Tick before submitting audio/syncing
         rg_system_tick(rg_system_timer() - startTime);
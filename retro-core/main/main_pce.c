@@ -76,7 +76,11 @@ void osd_vsync(void)
 
     int64_t curtime = rg_system_timer();
     int frameTime = app->frameTime;
+#ifdef RG_ENABLE_BENCHMARK
+    int sleep = 0; // Benchmarks run unthrottled
+#else
     int sleep = frameTime - (curtime - lasttime);
+#endif
 
     if (sleep > frameTime)
     {
@@ -3,8 +3,8 @@
 #include <smsplus.h>
 
 static rg_app_t *app;
-static rg_surface_t *updates[2];
-static rg_surface_t *currentUpdate;
+static rg_display_frame_t *frames;
+static rg_display_frame_t *currentFrame;
 
 const rg_keyboard_map_t coleco_keyboard = {
     .columns = 3,
@@ -25,34 +25,48 @@ static void event_handler(int event, void *arg)
 {
     if (event == RG_EVENT_REDRAW)
     {
-        rg_display_submit(currentUpdate, 0);
+        rg_display_submit(rg_display_get_last_frame(), 0);
     }
 }
 
 static bool screenshot_handler(const char *filename, int width, int height)
 {
-	return rg_surface_save_image_file(currentUpdate, filename, width, height);
+	return rg_surface_save_image_file(rg_display_get_last_frame(), filename, width, height);
 }
 
 static bool save_state_handler(const char *filename)
 {
-    FILE* f = fopen(filename, "w");
-    if (f)
+    rg_stream_t stream = {.fp = fopen(filename, "w")};
+    if (stream.fp)
     {
-        system_save_state(f);
-        fclose(f);
-        return true;
+        bool success = system_save_state(&stream) == 0;
+        fclose(stream.fp);
+        return success;
     }
     return false;
 }
 
+static size_t serialize_handler(void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = buffer, .size = size};
+    system_save_state(&stream);
+    return stream.error ? size : stream.used;
+}
+
+static bool unserialize_handler(const void *buffer, size_t size)
+{
+    rg_stream_t stream = {.data = (void *)buffer, .size = size};
+    system_load_state(&stream);
+    return !stream.error;
+}
+
 static bool load_state_handler(const char *filename)
 {
-    FILE* f = fopen(filename, "r");
-    if (f)
+    rg_stream_t stream = {.fp = fopen(filename, "r")};
+    if (stream.fp)
     {
-        system_load_state(f);
-        fclose(f);
+        system_load_state(&stream);
+        fclose(stream.fp);
         return true;
     }
     system_reset();
@@ -82,8 +96,11 @@ static rg_gui_event_t palette_update_cb(rg_gui_option_t *opt, rg_gui_event_t eve
             option.tms_pal = pal;
             for (int i = 0; i < PALETTE_SIZE; i++)
                 palette_sync(i);
-            if (render_copy_palette(currentUpdate->palette))
-                memcpy(updates[currentUpdate == updates[0]]->palette, currentUpdate->palette, 512);
+            if (render_copy_palette(frames[0].surface->palette))
+            {
+                for (int i = 1; i < DISPLAY_FRAMES; i++)
+                    memcpy(frames[i].surface->palette, frames[0].surface->palette, 512);
+            }
             rg_settings_set_number(NS_APP, SETTING_PALETTE, pal);
         }
         return RG_DIALOG_REDRAW;
@@ -104,6 +121,8 @@ void sms_main(void)
     const rg_handlers_t handlers = {
         .loadState = &load_state_handler,
         .saveState = &save_state_handler,
+        .serialize = &serialize_handler,
+        .unserialize = &unserialize_handler,
         .reset = &reset_handler,
         .screenshot = &screenshot_handler,
         .event = &event_handler,
@@ -112,9 +131,8 @@ void sms_main(void)
 
     app = rg_system_reinit(AUDIO_SAMPLE_RATE, &handlers, NULL);
 
-    updates[0] = rg_surface_create(SMS_WIDTH, SMS_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
-    updates[1] = rg_surface_create(SMS_WIDTH, SMS_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
-    currentUpdate = updates[0];
+    frames = rg_display_create_frames(DISPLAY_FRAMES, SMS_WIDTH, SMS_HEIGHT, RG_PIXEL_PAL565_BE, MEM_FAST);
+    currentFrame = rg_display_acquire_frame();
 
     system_reset_config();
     option.sndrate = AUDIO_SAMPLE_RATE;
@@ -146,16 +164,16 @@ void sms_main(void)
     bitmap.width = SMS_WIDTH;
     bitmap.height = SMS_HEIGHT;
     bitmap.pitch = bitmap.width;
-    bitmap.data = currentUpdate->data;
+    bitmap.data = currentFrame->surface->data;
 
     system_poweron();
 
-    updates[0]->offset = bitmap.viewport.x;
-    updates[0]->width = bitmap.viewport.w;
-    updates[0]->height = bitmap.viewport.h;
-    updates[1]->offset = bitmap.viewport.x;
-    updates[1]->width = bitmap.viewport.w;
-    updates[1]->height = bitmap.viewport.h;
+    for (int i = 0; i < DISPLAY_FRAMES; i++)
+    {
+        frames[i].surface->offset = bitmap.viewport.x;
+        frames[i].surface->width = bitmap.viewport.w;
+        frames[i].surface->height = bitmap.viewport.h;
+    }
 
     if (app->bootFlags & RG_BOOT_RESUME)
     {
@@ -245,12 +263,15 @@ void sms_main(void)
 
         if (drawFrame)
         {
-            if (render_copy_palette(currentUpdate->palette))
-                memcpy(updates[currentUpdate == updates[0]]->palette, currentUpdate->palette, 512);
+            rg_surface_t *update = currentFrame->surface;
+            rg_surface_t *previous = rg_display_get_last_frame();
+            // The frame may have been sitting in the queue for a while, its palette can be stale
+            if (!render_copy_palette(update->palette) && previous && previous != update)
+                memcpy(update->palette, previous->palette, 512);
             slowFrame = !rg_display_sync(false);
-            rg_display_submit(currentUpdate, 0);
-            currentUpdate = updates[currentUpdate == updates[0]]; // Swap
-            bitmap.data = currentUpdate->data;
+            rg_display_present_frame(currentFrame, 0);
+            currentFrame = rg_display_acquire_frame();
+            bitmap.data = currentFrame->surface->data;
         }
 
         // The emulator's sound buffer isn't in a very convenient format, we must remix it.
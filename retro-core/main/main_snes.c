@@ -67,18 +67,21 @@ static const char *SNES_BUTTONS[] = {
 #define AUDIO_LOW_PASS_RANGE ((60 * 65536) / 100)
 
 static rg_app_t *app;
-static rg_surface_t *updates[2];
+static rg_surface_t *updates[3];
 static rg_surface_t *currentUpdate;
+static rg_surface_t *pendingUpdate;
 static rg_audio_sample_t *audioBuffer;
 
 static bool apu_enabled = true;
 static bool lowpass_filter = false;
+static bool threaded_rendering = true;
 
 static int keymap_id = 0;
 static keymap_t keymap;
 
 static const char *SETTING_KEYMAP = "keymap";
 static const char *SETTING_APU_EMULATION = "apu";
+static const char *SETTING_THREADED_RENDERING = "threaded";
 // --- MAIN
 
 static void update_keymap(int id)
@@ -139,6 +142,20 @@ static rg_gui_event_t lowpass_filter_cb(rg_gui_option_t *option, rg_gui_event_t
     return RG_DIALOG_VOID;
 }
 
+static rg_gui_event_t threaded_rendering_cb(rg_gui_option_t *option, rg_gui_event_t event)
+{
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
+    {
+        threaded_rendering = !threaded_rendering;
+        rg_settings_set_number(NS_APP, SETTING_THREADED_RENDERING, threaded_rendering);
+        S9xSetThreadedRendering(threaded_rendering);
+    }
+
+    strcpy(option->value, threaded_rendering ? _("On") : _("Off"));
+
+    return RG_DIALOG_VOID;
+}
+
 static rg_gui_event_t change_keymap_cb(rg_gui_option_t *option, rg_gui_event_t event)
 {
     if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT)
@@ -288,6 +305,7 @@ static void options_handler(rg_gui_option_t *dest)
 {
     *dest++ = (rg_gui_option_t){0, _("Audio enable"), "-", RG_DIALOG_FLAG_NORMAL, &apu_toggle_cb};
     *dest++ = (rg_gui_option_t){0, _("Audio filter"), "-", RG_DIALOG_FLAG_NORMAL, &lowpass_filter_cb};
+    *dest++ = (rg_gui_option_t){0, _("Threaded rendering"), "-", RG_DIALOG_FLAG_NORMAL, &threaded_rendering_cb};
     *dest++ = (rg_gui_option_t){0, _("Controls"),     "-", RG_DIALOG_FLAG_NORMAL, &menu_keymap_cb};
     *dest++ = (rg_gui_option_t)RG_DIALOG_END;
 }
@@ -305,9 +323,14 @@ void snes_main(void)
     app = rg_system_reinit(AUDIO_SAMPLE_RATE, &handlers, NULL);
 
     apu_enabled = rg_settings_get_number(NS_APP, SETTING_APU_EMULATION, 1);
+    threaded_rendering = rg_settings_get_number(NS_APP, SETTING_THREADED_RENDERING, 1);
 
-    updates[0] = rg_surface_create(SNES_WIDTH, SNES_HEIGHT_EXTENDED, RG_PIXEL_565_LE, 0);
-    updates[0]->height = SNES_HEIGHT;
+    // One on screen, one still being drawn by the render thread, and one for the next frame
+    for (int i = 0; i < 3; ++i)
+    {
+        updates[i] = rg_surface_create(SNES_WIDTH, SNES_HEIGHT_EXTENDED, RG_PIXEL_565_LE, 0);
+        updates[i]->height = SNES_HEIGHT;
+    }
     currentUpdate = updates[0];
 
     audioBuffer = (rg_audio_sample_t *)malloc(AUDIO_BUFFER_LENGTH * 4);
@@ -340,6 +363,8 @@ void snes_main(void)
     if (!S9xInitGFX())
         RG_PANIC("Graphics init failed!");
 
+    S9xSetThreadedRendering(threaded_rendering);
+
     const char *filename = app->romPath;
 
     if (rg_extension_match(filename, "zip"))
@@ -400,14 +425,40 @@ void snes_main(void)
         bool slowFrame = false;
 
         IPPU.RenderThisFrame = drawFrame;
-        GFX.Screen = currentUpdate->data;
+
+        // With threaded rendering the frame is still being drawn when S9xMainLoop returns, in
+        // which case it becomes pending and we present the one before it. The display task may
+        // still be reading currentUpdate, so we never draw into it either.
+        rg_surface_t *drawUpdate = updates[0];
+        for (int i = 0; drawUpdate == currentUpdate || drawUpdate == pendingUpdate; ++i)
+            drawUpdate = updates[i + 1];
+        rg_surface_t *completedUpdate = NULL;
+        S9xSetScreen(drawUpdate->data);
 
         S9xMainLoop();
 
-        if (drawFrame)
+        if (drawFrame && S9xSyncScreen(1) == 0)
+        {
+            completedUpdate = drawUpdate;
+            pendingUpdate = NULL;
+        }
+        else if (drawFrame)
+        {
+            completedUpdate = pendingUpdate;
+            pendingUpdate = drawUpdate;
+        }
+        else if (pendingUpdate)
+        {
+            S9xSyncScreen(0);
+            completedUpdate = pendingUpdate;
+            pendingUpdate = NULL;
+        }
+
+        if (completedUpdate)
         {
             slowFrame = !rg_display_sync(false);
-            rg_display_submit(currentUpdate, 0);
+            rg_display_submit(completedUpdate, 0);
+            currentUpdate = completedUpdate;
         }
 
     #ifndef USE_BLARGG_APU
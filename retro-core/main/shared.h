@@ -7,6 +7,12 @@
 #define AUDIO_SAMPLE_RATE   (32000)
 #define AUDIO_BUFFER_LENGTH (AUDIO_SAMPLE_RATE / 50 + 1)
 
+// Surfaces in the display frame queue. 3 lets emulation run a full frame ahead
+// of the display at the cost of one more framebuffer in internal RAM.
+#ifndef DISPLAY_FRAMES
+#define DISPLAY_FRAMES      (2)
+#endif
+
 extern uint8_t shared_memory_block_64K[0x10000];
 
 void launcher_main();
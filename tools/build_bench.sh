@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Headless benchmark build of retro-core, see RG_ENABLE_BENCHMARK in rg_system.c
+# Required: SDL2 (only for threads and timers, no display or audio device is needed)
+#
+# Usage: tools/build_bench.sh [app:rom[:input] ...]
+#   Each argument runs one benchmark, for example: tools/build_bench.sh nes:roms/smb.nes gbc:roms/zelda.gbc:zelda.inp
+#   Input movies can be recorded with a regular SDL2 build: RG_INPUT_RECORD=zelda.inp ./retro-core.exe
+#   RG_BENCH_FRAMES sets the number of frames to run (default: 3600)
+
+CC="gcc"
+CFLAGS="-O2 -no-pie -DRG_TARGET_SDL2 -DRG_ENABLE_BENCHMARK -DRETRO_GO -DCJSON_HIDE_SYMBOLS -DSDL_MAIN_HANDLED=1 -DRG_BUILD_INFO=\"SDL2-bench\" -Dapp_main=SDL_Main $(sdl2-config --cflags)"
+INCLUDES="-Icomponents/retro-go -Icomponents/retro-go/libs/cJSON -Icomponents/retro-go/libs/lodepng -Icomponents/retro-go/libs/miniz"
+SRCFILES="components/retro-go/*.c components/retro-go/drivers/audio/*.c components/retro-go/fonts/*.c
+		  components/retro-go/libs/cJSON/*.c components/retro-go/libs/lodepng/*.c components/retro-go/libs/miniz/*.c"
+LIBS="$(sdl2-config --libs) -lstdc++"
+
+echo "Building retro-core (benchmark)..."
+$CC $CFLAGS $INCLUDES \
+	-Iretro-core/components/gnuboy \
+	-Iretro-core/components/gw-emulator/src \
+	-Iretro-core/components/gw-emulator/src/cpus \
+	-Iretro-core/components/gw-emulator/src/gw_sys \
+	-Iretro-core/components/handy \
+	-Iretro-core/components/nofrendo \
+	-Iretro-core/components/pce-go \
+	-Iretro-core/components/snes9x \
+	-Iretro-core/components/snes9x/src \
+	-Iretro-core/components/smsplus \
+	-Iretro-core/main \
+	$SRCFILES \
+	retro-core/components/gnuboy/*.c \
+	retro-core/components/gw-emulator/src/*.c \
+	retro-core/components/gw-emulator/src/cpus/*.c \
+	retro-core/components/gw-emulator/src/gw_sys/*.c \
+	retro-core/components/handy/*.cpp \
+	retro-core/components/nofrendo/mappers/*.c \
+	retro-core/components/nofrendo/nes/*.c \
+	retro-core/components/nofrendo/*.c \
+	retro-core/components/pce-go/*.c \
+	retro-core/components/snes9x/src/*.c \
+	retro-core/components/smsplus/*.c \
+	retro-core/components/smsplus/cpu/*.c \
+	retro-core/components/smsplus/sound/*.c \
+	retro-core/main/*.c \
+	retro-core/main/*.cpp \
+	$LIBS \
+	-o retro-core-bench.exe || exit 1
+
+for bench in "$@"; do
+	IFS=: read -r app rom input <<< "$bench"
+	RG_BENCH_APP="$app" RG_BENCH_ROM="$rom" RG_BENCH_INPUT="$input" ./retro-core-bench.exe | grep "^BENCHMARK"
+done
@@ -2,15 +2,27 @@
 
 # Supported systems: Linux / MINGW32 / MINGW64
 # Required: SDL2
+#
+# Display options (environment): RG_SDL_SCALE=3 RG_SDL_INTEGER_SCALE=1 RG_SDL_VSYNC=1 ./retro-core.exe
+#   See components/retro-go/drivers/display/sdl2.h
+# Netplay (Linux only, it needs BSD sockets): RG_NETPLAY=1 tools/build_sdl2.sh
+#   See components/retro-go/libs/netplay/NETPLAY.md
 
 CC="gcc"
 # BUILD_INFO="RG:$(git describe) / SDL:$(sdl2-config --version)"
 CFLAGS="-no-pie -DRG_TARGET_SDL2 -DRETRO_GO -DCJSON_HIDE_SYMBOLS -DSDL_MAIN_HANDLED=1 -DRG_BUILD_INFO=\"SDL2\" -Dapp_main=SDL_Main $(sdl2-config --cflags)"
-INCLUDES="-Icomponents/retro-go -Icomponents/retro-go/libs/cJSON -Icomponents/retro-go/libs/lodepng -Icomponents/retro-go/libs/miniz"
+INCLUDES="-Icomponents/retro-go -Icomponents/retro-go/libs/cJSON -Icomponents/retro-go/libs/lodepng -Icomponents/retro-go/libs/miniz
+		  -Icomponents/retro-go/libs/netplay"
 SRCFILES="components/retro-go/*.c components/retro-go/drivers/audio/*.c components/retro-go/fonts/*.c
-		  components/retro-go/libs/cJSON/*.c components/retro-go/libs/lodepng/*.c components/retro-go/libs/miniz/*.c"
+		  components/retro-go/libs/cJSON/*.c components/retro-go/libs/lodepng/*.c components/retro-go/libs/miniz/*.c
+		  components/retro-go/libs/netplay/*.c"
 LIBS="$(sdl2-config --libs) -lstdc++"
 
+# RG_ENABLE_NETWORKING is not defined, it's the ESP32 Wi-Fi stack. Netplay uses plain sockets on SDL2.
+if [ "$RG_NETPLAY" = "1" ]; then
+	CFLAGS="$CFLAGS -DRG_ENABLE_NETPLAY"
+fi
+
 echo "Cleaning..."
 rm -f launcher.exe retro-core.exe gmon.out
 